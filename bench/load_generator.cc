@@ -0,0 +1,460 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <json/json.h>
+#include <sockpp/tcp_connector.h>
+#include <unistd.h>
+
+#include "load_generator.h"
+#include "proto/proto_interpreter.h"
+
+namespace {
+
+// Files of the benchmark on the server
+const std::string retr_file_name = "simple-ftp-bench-retr.bin";
+std::string stor_file_name(size_t session) {
+  return "simple-ftp-bench-stor-" + std::to_string(session) + ".bin";
+}
+
+// Directory of the pipeline workload, in the remote directory
+const std::string pipeline_directory = "simple-ftp-bench-pipeline";
+
+// Commands of one operation of the pipeline workload, then QUIT: 64 cd
+// into the directory, each through it and back 600 times (about 16 KiB),
+// so that the batch (about 1.1 MiB) is more than the server takes in one
+// read and lines are split across reads
+std::vector<std::string> pipeline_commands(const ftp::bench_options &options) {
+  std::string path = options.remote_directory;
+  while (!path.empty() && path.back() == '/') {
+    path.pop_back();
+  }
+  for (size_t i = 0; i < 600; ++i) {
+    path += "/" + pipeline_directory + "/..";
+  }
+  path += "/" + pipeline_directory;
+  return std::vector<std::string>(64, "cd " + path);
+}
+
+// A logged in session
+struct bench_session {
+  sockpp::tcp_connector connector;
+  std::unique_ptr<ftp::protocol_interpreter_client> interpreter;
+};
+
+// Responses of the server start with 2 on success
+bool positive(const std::string &response) {
+  return !response.empty() && response[0] == '2';
+}
+
+// Connect and log in, returns nullptr on failure
+std::unique_ptr<bench_session> open_session(const sockpp::inet_address &server,
+                                            const ftp::bench_options &options) {
+  auto s = std::make_unique<bench_session>();
+  if (!s->connector.connect(server)) {
+    return nullptr;
+  }
+  s->interpreter = std::make_unique<ftp::protocol_interpreter_client>(
+      &s->connector);
+  s->interpreter->set_quiet(true);
+  if (!s->interpreter->login(options.username, options.password)) {
+    return nullptr;
+  }
+  return s;
+}
+
+// Change to the directory of the benchmark and set up data connections
+bool prepare_session(bench_session &s, const ftp::bench_options &options,
+                     size_t index, bool passive) {
+  if (!positive(s.interpreter->execute("CWD " + options.remote_directory))) {
+    return false;
+  }
+  if (passive) {
+    return s.interpreter->enter_passive_mode();
+  }
+  return s.interpreter->enter_active_mode(
+      uint16_t(options.active_port_base + index));
+}
+
+// End a session, the server closes it on QUIT
+void close_session(bench_session &s) {
+  s.interpreter->stop();
+  s.connector.close();
+}
+
+// Write a file of pseudo-random bytes
+bool write_payload(const std::filesystem::path &path, uint64_t size) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    return false;
+  }
+  std::vector<char> chunk(1024 * 1024);
+  std::mt19937_64 random(size);
+  for (auto &c : chunk) {
+    c = char(random());
+  }
+  bool successful = true;
+  for (uint64_t left = size; successful && left > 0;) {
+    const size_t n = size_t(std::min<uint64_t>(left, chunk.size()));
+    successful = write(fd, chunk.data(), n) == ssize_t(n);
+    left -= n;
+  }
+  return close(fd) == 0 && successful;
+}
+
+// Counters of one session
+struct session_stats {
+  uint64_t operations = 0;
+  uint64_t errors = 0;
+  uint64_t reconnects = 0;
+  uint64_t bytes = 0;
+  std::vector<uint64_t> latencies;
+};
+
+// Run the operations of one session until the run is over
+void run_session(const sockpp::inet_address &server,
+                 const ftp::bench_options &options, uint64_t file_size,
+                 const std::filesystem::path &payload, size_t index,
+                 std::chrono::steady_clock::time_point deadline,
+                 session_stats &stats) {
+  using clock = std::chrono::steady_clock;
+  const auto workload = options.workload;
+  auto over = [&](uint64_t attempts) {
+    return options.operations != 0 ? attempts >= options.operations
+                                   : clock::now() >= deadline;
+  };
+
+  const auto commands = workload == ftp::bench_workload::pipeline
+                            ? pipeline_commands(options)
+                            : std::vector<std::string>();
+  std::unique_ptr<bench_session> session;
+  bool opened_before = false;
+  for (uint64_t attempts = 0; !over(attempts); ++attempts) {
+    // Every operation of a login storm (or of a batch, which quits) is a
+    // new session
+    if (workload != ftp::bench_workload::login &&
+        workload != ftp::bench_workload::pipeline && session == nullptr) {
+      session = open_session(server, options);
+      if (session != nullptr &&
+          !prepare_session(*session, options, index, options.passive)) {
+        session.reset();
+      }
+      if (session == nullptr) {
+        stats.errors++;
+        // Do not spin while the server refuses sessions
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        continue;
+      }
+      stats.reconnects += opened_before ? 1 : 0;
+      opened_before = true;
+    }
+
+    const auto start = clock::now();
+    bool successful = false;
+    switch (workload) {
+    case ftp::bench_workload::login:
+      if (auto s = open_session(server, options)) {
+        close_session(*s);
+        successful = true;
+      }
+      break;
+    case ftp::bench_workload::list:
+      successful = positive(session->interpreter->execute("LIST"));
+      break;
+    case ftp::bench_workload::retr:
+      successful = session->interpreter->retrieve(retr_file_name, "/dev/null");
+      break;
+    case ftp::bench_workload::stor:
+      successful =
+          session->interpreter->store(stor_file_name(index), payload);
+      break;
+    case ftp::bench_workload::pipeline:
+      if (auto s = open_session(server, options)) {
+        successful = s->interpreter->run_batch(commands) == 0;
+        s->connector.close();
+      }
+      break;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock::now() - start);
+
+    if (!successful) {
+      // The state of the session is unknown, start over with a new one
+      stats.errors++;
+      if (session != nullptr) {
+        close_session(*session);
+        session.reset();
+      }
+      continue;
+    }
+    stats.operations++;
+    stats.bytes += file_size;
+    stats.latencies.push_back(uint64_t(elapsed.count()));
+  }
+
+  if (session != nullptr) {
+    close_session(*session);
+  }
+}
+
+// Remove the files of the benchmark from the server
+void remove_files(const sockpp::inet_address &server,
+                  const ftp::bench_options &options) {
+  auto s = open_session(server, options);
+  if (s == nullptr ||
+      !positive(s->interpreter->execute("CWD " + options.remote_directory))) {
+    return;
+  }
+  if (options.workload == ftp::bench_workload::retr) {
+    s->interpreter->execute("DELE " + retr_file_name);
+  }
+  if (options.workload == ftp::bench_workload::stor) {
+    for (size_t i = 0; i < options.sessions; ++i) {
+      s->interpreter->execute("DELE " + stor_file_name(i));
+    }
+  }
+  if (options.workload == ftp::bench_workload::pipeline) {
+    s->interpreter->execute("RMD " + pipeline_directory);
+  }
+  close_session(*s);
+}
+
+// Duration in milliseconds, for reports
+std::string milliseconds(uint64_t nanoseconds) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.3f ms", double(nanoseconds) / 1e6);
+  return text;
+}
+
+} // namespace
+
+// Parse a workload name, returns false if it is unknown
+bool ftp::parse_workload(const std::string &name, bench_workload &workload) {
+  for (const auto w : {bench_workload::login, bench_workload::list,
+                       bench_workload::retr, bench_workload::stor,
+                       bench_workload::pipeline}) {
+    if (name == workload_name(w)) {
+      workload = w;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *ftp::workload_name(bench_workload workload) {
+  switch (workload) {
+  case bench_workload::login:
+    return "login";
+  case bench_workload::list:
+    return "list";
+  case bench_workload::retr:
+    return "retr";
+  case bench_workload::stor:
+    return "stor";
+  case bench_workload::pipeline:
+    return "pipeline";
+  }
+  return "unknown";
+}
+
+// Default file size of a workload (0 if it transfers no file)
+uint64_t ftp::default_file_size(bench_workload workload) {
+  switch (workload) {
+  case bench_workload::retr:
+    return 4 * 1024;
+  case bench_workload::stor:
+    return 64 * 1024 * 1024;
+  default:
+    return 0;
+  }
+}
+
+// Latency of the q-th quantile (0 < q <= 1), 0 without operations
+uint64_t ftp::bench_result::percentile(double q) const {
+  if (latencies.empty()) {
+    return 0;
+  }
+  const auto rank = size_t(std::ceil(q * double(latencies.size())));
+  return latencies[std::clamp<size_t>(rank, 1, latencies.size()) - 1];
+}
+
+double ftp::bench_result::operations_per_second() const {
+  return seconds > 0 ? double(operations) / seconds : 0;
+}
+
+double ftp::bench_result::bytes_per_second() const {
+  return seconds > 0 ? double(bytes) / seconds : 0;
+}
+
+// Run a workload against a server
+bool ftp::run_bench(const bench_options &options, bench_result &result,
+                    std::string &error) {
+  using clock = std::chrono::steady_clock;
+
+  sockpp::inet_address server;
+  try {
+    server = sockpp::inet_address(options.host, options.port);
+  } catch (const std::exception &e) {
+    error = "Cannot resolve " + options.host + ": " + e.what();
+    return false;
+  }
+
+  result = bench_result();
+  result.workload = options.workload;
+  result.sessions = options.sessions;
+  result.passive = options.passive;
+  const bool transfers = options.workload == bench_workload::retr ||
+                         options.workload == bench_workload::stor;
+  if (transfers) {
+    result.file_size = options.file_size != 0
+                           ? options.file_size
+                           : default_file_size(options.workload);
+  }
+
+  // The local file uploaded by stor, and once by retr to have one to
+  // download
+  std::filesystem::path payload;
+  std::error_code ec;
+  if (transfers) {
+    payload = std::filesystem::temp_directory_path(ec) /
+              ("simple-ftp-bench-" + std::to_string(getpid()) + ".bin");
+    if (ec || !write_payload(payload, result.file_size)) {
+      error = "Cannot write " + payload.string();
+      return false;
+    }
+  }
+
+  bool ready = true;
+  if (options.workload == bench_workload::pipeline) {
+    auto s = open_session(server, options);
+    ready = s != nullptr &&
+            positive(s->interpreter->execute("CWD " +
+                                             options.remote_directory));
+    if (ready) {
+      // Left over by an interrupted run, or made now
+      s->interpreter->execute("MKD " + pipeline_directory);
+      ready = positive(s->interpreter->execute("CWD " + pipeline_directory));
+    }
+    if (s != nullptr) {
+      close_session(*s);
+    }
+    if (!ready) {
+      error = "Cannot make " + pipeline_directory + " in " +
+              options.remote_directory;
+    }
+  }
+  if (options.workload == bench_workload::retr) {
+    auto s = open_session(server, options);
+    ready = s != nullptr && prepare_session(*s, options, 0, true) &&
+            s->interpreter->store(retr_file_name, payload);
+    if (s != nullptr) {
+      close_session(*s);
+    }
+    if (!ready) {
+      error = "Cannot upload " + retr_file_name + " into " +
+              options.remote_directory;
+    }
+  }
+
+  if (ready) {
+    std::vector<session_stats> stats(options.sessions);
+    std::vector<std::thread> sessions;
+    const auto start = clock::now();
+    const auto deadline =
+        start + std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>(options.duration_seconds));
+    for (size_t i = 0; i < options.sessions; ++i) {
+      sessions.emplace_back(run_session, std::cref(server), std::cref(options),
+                            result.file_size, std::cref(payload), i, deadline,
+                            std::ref(stats[i]));
+    }
+    for (auto &t : sessions) {
+      t.join();
+    }
+    result.seconds =
+        std::chrono::duration<double>(clock::now() - start).count();
+
+    for (auto &s : stats) {
+      result.operations += s.operations;
+      result.errors += s.errors;
+      result.reconnects += s.reconnects;
+      result.bytes += s.bytes;
+      result.latencies.insert(result.latencies.end(), s.latencies.begin(),
+                              s.latencies.end());
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+  }
+
+  if (transfers) {
+    remove_files(server, options);
+    std::filesystem::remove(payload, ec);
+  }
+  return ready;
+}
+
+// Report of a run, for people
+std::string ftp::format_text(const bench_result &result) {
+  char line[160];
+  std::string out;
+
+  snprintf(line, sizeof(line), "workload    %s, %zu sessions, %s mode",
+           workload_name(result.workload), result.sessions,
+           result.passive ? "passive" : "active");
+  out += line;
+  if (result.file_size != 0) {
+    out += ", " + std::to_string(result.file_size) + " byte file";
+  }
+  snprintf(line, sizeof(line),
+           "\nduration    %.2f s\n"
+           "operations  %llu (%.1f/s)\n",
+           result.seconds, (unsigned long long)result.operations,
+           result.operations_per_second());
+  out += line;
+  if (result.file_size != 0) {
+    snprintf(line, sizeof(line), "throughput  %.1f MiB/s\n",
+             result.bytes_per_second() / (1024 * 1024));
+    out += line;
+  }
+  snprintf(line, sizeof(line), "errors      %llu (%llu reconnects)\n",
+           (unsigned long long)result.errors,
+           (unsigned long long)result.reconnects);
+  out += line;
+  out += "latency     p50 " + milliseconds(result.percentile(0.5)) +
+         "  p99 " + milliseconds(result.percentile(0.99)) + "  p999 " +
+         milliseconds(result.percentile(0.999)) + "  max " +
+         milliseconds(result.percentile(1)) + "\n";
+  return out;
+}
+
+// Report of a run, for scripts
+std::string ftp::format_json(const bench_result &result) {
+  Json::Value report;
+  report["workload"] = workload_name(result.workload);
+  report["sessions"] = Json::UInt64(result.sessions);
+  report["mode"] = result.passive ? "passive" : "active";
+  report["fileSize"] = Json::UInt64(result.file_size);
+  report["seconds"] = result.seconds;
+  report["operations"] = Json::UInt64(result.operations);
+  report["operationsPerSecond"] = result.operations_per_second();
+  report["bytes"] = Json::UInt64(result.bytes);
+  report["bytesPerSecond"] = result.bytes_per_second();
+  report["errors"] = Json::UInt64(result.errors);
+  report["reconnects"] = Json::UInt64(result.reconnects);
+
+  Json::Value latency;
+  latency["p50"] = Json::UInt64(result.percentile(0.5));
+  latency["p99"] = Json::UInt64(result.percentile(0.99));
+  latency["p999"] = Json::UInt64(result.percentile(0.999));
+  latency["max"] = Json::UInt64(result.percentile(1));
+  report["latencyNanoseconds"] = latency;
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "  ";
+  return Json::writeString(builder, report) + "\n";
+}
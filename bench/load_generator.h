@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ftp {
+
+// Scripted workloads of simple-ftp-bench
+enum class bench_workload {
+  login, // Connect, log in and disconnect (login storm)
+  list,  // LIST the directory (listing flood)
+  retr,  // Download the same small file
+  stor,  // Upload a large file
+  // Pipeline cd commands with long arguments (paths of about 16 KiB), in
+  // batches larger than what the server reads at once
+  pipeline,
+};
+
+// Parse a workload name, returns false if it is unknown
+bool parse_workload(const std::string &name, bench_workload &workload);
+const char *workload_name(bench_workload workload);
+
+// Default file size of a workload (0 if it transfers no file)
+uint64_t default_file_size(bench_workload workload);
+
+struct bench_options {
+  std::string host = "localhost";
+  uint16_t port = 21;
+  std::string username;
+  std::string password;
+
+  bench_workload workload = bench_workload::list;
+  size_t sessions = 8;
+  // Run for this long, or until every session did this many operations
+  // (when not 0)
+  double duration_seconds = 10;
+  uint64_t operations = 0;
+  // Size of the file of retr and stor
+  uint64_t file_size = 0;
+
+  // Data connections: passive (PASV) or active (PORT), where session i
+  // listens on active_port_base + i (below the ephemeral ports of Linux, so
+  // that the sessions of a login storm do not hold them)
+  bool passive = true;
+  uint16_t active_port_base = 30000;
+
+  // Directory on the server for the files of the benchmark, which are
+  // removed afterwards
+  std::string remote_directory = "/";
+};
+
+// Outcome of a run
+struct bench_result {
+  bench_workload workload = bench_workload::list;
+  size_t sessions = 0;
+  bool passive = true;
+  uint64_t file_size = 0;
+
+  double seconds = 0;
+  uint64_t operations = 0; // Successful ones
+  uint64_t errors = 0;     // Failed operations
+  uint64_t reconnects = 0; // Sessions opened again after a failure
+  uint64_t bytes = 0;      // File data transferred
+  // Latency of every successful operation, sorted, in nanoseconds
+  std::vector<uint64_t> latencies;
+
+  // Latency of the q-th quantile (0 < q <= 1), 0 without operations
+  uint64_t percentile(double q) const;
+  double operations_per_second() const;
+  double bytes_per_second() const;
+};
+
+// Run a workload against a server
+// Sessions are opened and the files needed are uploaded first; returns
+// false (with the reason in error) if that fails
+bool run_bench(const bench_options &options, bench_result &result,
+               std::string &error);
+
+// Report of a run, for people or for scripts
+std::string format_text(const bench_result &result);
+std::string format_json(const bench_result &result);
+
+} // namespace ftp
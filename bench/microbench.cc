@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <json/json.h>
+
+#include "microbench.h"
+
+namespace {
+
+std::atomic<uint64_t> allocation_count = 0;
+std::atomic<uint64_t> allocated_bytes = 0;
+
+void *allocate(size_t size, size_t alignment = 0) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  void *p = nullptr;
+  if (alignment > alignof(std::max_align_t)) {
+    // aligned_alloc() wants a multiple of the alignment
+    p = aligned_alloc(alignment, (size + alignment - 1) / alignment *
+                                     alignment);
+  } else {
+    p = malloc(size == 0 ? 1 : size);
+  }
+  return p;
+}
+
+// Run the operation iterations times, returns the elapsed nanoseconds
+double time_iterations(const ftp::microbench &bench, uint64_t iterations) {
+  const auto start = std::chrono::steady_clock::now();
+  bench.body(iterations);
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+// Every allocation of the program goes through these
+void *operator new(size_t size) {
+  if (void *p = allocate(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+void *operator new(size_t size, std::align_val_t alignment) {
+  if (void *p = allocate(size, size_t(alignment))) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  free(p);
+}
+
+// Heap allocations made by the program so far
+ftp::allocation_counts ftp::allocations() {
+  return {allocation_count.load(std::memory_order_relaxed),
+          allocated_bytes.load(std::memory_order_relaxed)};
+}
+
+// Run a microbenchmark
+ftp::microbench_result
+ftp::run_microbench(const microbench &bench,
+                    const microbench_options &options) {
+  microbench_result result;
+  result.name = bench.name;
+  result.allocation_budget = bench.allocation_budget;
+
+  // Warm up (caches, lazily built tables) and double the iterations until
+  // a run lasts long enough
+  const double min_nanoseconds = options.min_seconds * 1e9;
+  uint64_t iterations = 1;
+  double elapsed = time_iterations(bench, iterations);
+  while (elapsed < min_nanoseconds / 2 && iterations < (1ull << 40)) {
+    iterations *= 2;
+    elapsed = time_iterations(bench, iterations);
+  }
+  if (elapsed < min_nanoseconds) {
+    iterations = uint64_t(double(iterations) * min_nanoseconds /
+                          std::max(elapsed, 1.0)) +
+                 1;
+  }
+  result.iterations = iterations;
+
+  std::vector<double> per_operation;
+  const auto before = allocations();
+  for (size_t i = 0; i < std::max<size_t>(options.repetitions, 1); ++i) {
+    per_operation.push_back(time_iterations(bench, iterations) /
+                            double(iterations));
+  }
+  const auto after = allocations();
+
+  std::sort(per_operation.begin(), per_operation.end());
+  result.nanoseconds = per_operation[per_operation.size() / 2];
+  result.min_nanoseconds = per_operation.front();
+  const double operations = double(iterations * per_operation.size());
+  result.allocations = double(after.count - before.count) / operations;
+  result.allocated_bytes = double(after.bytes - before.bytes) / operations;
+  return result;
+}
+
+// Report of a run, for people
+std::string
+ftp::format_text(const std::vector<microbench_result> &results) {
+  char line[160];
+  snprintf(line, sizeof(line), "%-36s %12s %12s %10s %12s\n", "benchmark",
+           "ns/op", "min ns/op", "allocs/op", "bytes/op");
+  std::string out = line;
+  for (const auto &r : results) {
+    snprintf(line, sizeof(line), "%-36s %12.1f %12.1f %10.2f %12.1f%s\n",
+             r.name.c_str(), r.nanoseconds, r.min_nanoseconds, r.allocations,
+             r.allocated_bytes,
+             r.over_budget() ? "  over budget" : "");
+    out += line;
+  }
+  return out;
+}
+
+// Report of a run, for scripts
+std::string
+ftp::format_json(const std::vector<microbench_result> &results) {
+  Json::Value report(Json::arrayValue);
+  for (const auto &r : results) {
+    Json::Value entry;
+    entry["name"] = r.name;
+    entry["iterations"] = Json::UInt64(r.iterations);
+    entry["nanosecondsPerOperation"] = r.nanoseconds;
+    entry["minNanosecondsPerOperation"] = r.min_nanoseconds;
+    entry["allocationsPerOperation"] = r.allocations;
+    entry["allocatedBytesPerOperation"] = r.allocated_bytes;
+    entry["allocationBudget"] = r.allocation_budget;
+    entry["overBudget"] = r.over_budget();
+    report.append(entry);
+  }
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "  ";
+  return Json::writeString(builder, report) + "\n";
+}
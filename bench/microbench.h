@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ftp {
+
+// Heap allocations (operator new) made by the program so far
+// The microbenchmark binary replaces the global operator new to count them
+struct allocation_counts {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+};
+allocation_counts allocations();
+
+// Keep the compiler from optimizing a result away
+template <typename T> inline void do_not_optimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// A microbenchmark: body runs the measured operation iterations times
+struct microbench {
+  std::string name;
+  // Allocations per operation above which the run fails, so that a change
+  // adding allocations (a std::regex or a std::istringstream built on every
+  // call...) is caught even when the timings are noisy
+  double allocation_budget = 0;
+  std::function<void(uint64_t iterations)> body;
+};
+
+struct microbench_options {
+  // Iterations are calibrated for every repetition to last this long
+  double min_seconds = 0.1;
+  size_t repetitions = 5;
+  // Only run the microbenchmarks whose name contains it
+  std::string filter;
+};
+
+struct microbench_result {
+  std::string name;
+  uint64_t iterations = 0;     // Of every repetition
+  double nanoseconds = 0;      // Per operation, median of the repetitions
+  double min_nanoseconds = 0;  // Per operation, fastest repetition
+  double allocations = 0;      // Per operation
+  double allocated_bytes = 0;  // Per operation
+  double allocation_budget = 0;
+
+  bool over_budget() const { return allocations > allocation_budget; }
+};
+
+// Run a microbenchmark
+microbench_result run_microbench(const microbench &bench,
+                                 const microbench_options &options);
+
+// Microbenchmarks of trim, split, parse_command, send/receive_message and
+// message_framer
+// commands replaces the built-in command corpus when not empty
+std::vector<microbench>
+utility_microbenches(const std::vector<std::string> &commands);
+
+// Report of a run, for people or for scripts
+std::string format_text(const std::vector<microbench_result> &results);
+std::string format_json(const std::vector<microbench_result> &results);
+
+} // namespace ftp
@@ -0,0 +1,417 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <json/json.h>
+#include <sockpp/tcp_acceptor.h>
+#include <sockpp/tcp_connector.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "regression.h"
+#include "utils/metrics.h"
+
+namespace {
+
+// A port nobody listens on, for the server to take
+uint16_t free_port() {
+  sockpp::tcp_acceptor probe(sockpp::inet_address("127.0.0.1", 0));
+  return probe ? probe.address().port() : 0;
+}
+
+// Size for case names: 4KiB, 1MiB...
+std::string size_name(uint64_t bytes) {
+  if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0) {
+    return std::to_string(bytes / (1024 * 1024)) + "MiB";
+  }
+  if (bytes >= 1024 && bytes % 1024 == 0) {
+    return std::to_string(bytes / 1024) + "KiB";
+  }
+  return std::to_string(bytes) + "B";
+}
+
+// Relative change, for reports
+std::string change(double value, double baseline) {
+  if (baseline <= 0) {
+    return "";
+  }
+  char text[32];
+  snprintf(text, sizeof(text), "%+.1f%%", (value / baseline - 1) * 100);
+  return text;
+}
+
+// Read a JSON file, returns false if it cannot be read or parsed
+bool read_json(const std::filesystem::path &path, Json::Value &root) {
+  std::ifstream file(path, std::ifstream::binary);
+  Json::CharReaderBuilder builder;
+  std::string errors;
+  return file && Json::parseFromStream(builder, file, &root, &errors);
+}
+
+// What tells the host the suite runs on: its name, processors and kernel
+// Numbers recorded on one host say nothing about another
+Json::Value host_fingerprint() {
+  Json::Value host;
+  char name[256] = "";
+  gethostname(name, sizeof(name) - 1);
+  host["name"] = name;
+  host["cpus"] = Json::Int(std::thread::hardware_concurrency());
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      host["cpu"] = line.substr(line.find(':') + 2);
+      break;
+    }
+  }
+  struct utsname system;
+  if (uname(&system) == 0) {
+    host["kernel"] = system.release;
+  }
+  return host;
+}
+
+// Case of the same workload in the other mode ("retr/active/4KiB" for
+// "retr/passive/4KiB"), "" if there is no such name
+std::string other_mode(const std::string &name) {
+  for (const auto &[mode, other] : {std::pair{"/passive", "/active"},
+                                    std::pair{"/active", "/passive"}}) {
+    const auto position = name.find(mode);
+    if (position != std::string::npos) {
+      return name.substr(0, position) + other +
+             name.substr(position + strlen(mode));
+    }
+  }
+  return "";
+}
+
+// Keys in a listing page of the S3 stand-in, few so that listings of the
+// "s3" storage go through several pages
+constexpr size_t s3_page_keys = 2;
+
+} // namespace
+
+// Move to a temporary directory and write the config.json of the server
+ftp::loopback_server::loopback_server(const std::string &storage) {
+  if (storage == "s3") {
+    store_ = std::make_unique<s3_stand_in>(s3_page_keys);
+    std::string error;
+    if (!store_->start(error)) {
+      std::cerr << "[Bench] " << error << std::endl;
+      return;
+    }
+  }
+  previous_directory_ = std::filesystem::current_path();
+  std::string directory = (std::filesystem::temp_directory_path() /
+                           "simple-ftp-regression-XXXXXX")
+                              .string();
+  if (mkdtemp(directory.data()) == nullptr) {
+    return;
+  }
+  directory_ = directory;
+  std::filesystem::create_directory(directory_ / "root");
+
+  Json::Value user;
+  user["username"] = username_;
+  user["password"] = password_;
+  Json::Value config;
+  config["workingDirectory"] = (directory_ / "root").string();
+  config["storage"]["backend"] = storage;
+  if (store_ != nullptr) {
+    const auto settings = store_->settings();
+    config["storage"]["objectStore"]["endpoint"] = settings.endpoint;
+    config["storage"]["objectStore"]["bucket"] = settings.bucket;
+    config["storage"]["objectStore"]["accessKey"] = settings.access_key;
+    config["storage"]["objectStore"]["secretKey"] = settings.secret_key;
+  }
+  config["users"].append(user);
+  std::ofstream(directory_ / "config.json")
+      << Json::writeString(Json::StreamWriterBuilder(), config);
+
+  // Settings are read from config.json in the current directory
+  std::filesystem::current_path(directory_);
+}
+
+// Stop the server, move back and remove the temporary directory
+ftp::loopback_server::~loopback_server() {
+  stop();
+  std::error_code ec;
+  std::filesystem::current_path(previous_directory_, ec);
+  if (!directory_.empty()) {
+    std::filesystem::remove_all(directory_, ec);
+  }
+}
+
+// Start serving
+bool ftp::loopback_server::start(std::string &error) {
+  port_ = free_port();
+  if (directory_.empty() || port_ == 0) {
+    error = "Cannot set up a temporary directory and a port for the server";
+    return false;
+  }
+  server_ = std::make_unique<server>(port_);
+  thread_ = std::thread([this]() { server_->start(); });
+
+  // Wait for the server to accept connections
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < deadline) {
+    sockpp::tcp_connector probe;
+    if (probe.connect(sockpp::inet_address("127.0.0.1", port_))) {
+      probe.write(std::string("QUIT"));
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  error = "The server did not start on port " + std::to_string(port_);
+  return false;
+}
+
+// Wait for the sessions to end and stop serving
+void ftp::loopback_server::stop() {
+  if (server_ == nullptr) {
+    return;
+  }
+  // Sessions end on their own threads once their client quit
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (ftp::metrics::instance().active_sessions() > 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  server_->stop();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  server_.reset();
+}
+
+// RETR, STOR and LIST in passive and active mode, over a range of sizes,
+// and pipelined long commands
+std::vector<ftp::regression_case> ftp::regression_cases() {
+  std::vector<regression_case> cases;
+  for (const bool passive : {true, false}) {
+    const std::string mode = passive ? "passive" : "active";
+    auto add = [&](bench_workload workload, uint64_t size, size_t sessions,
+                   uint64_t operations) {
+      regression_case c;
+      c.name = std::string(workload_name(workload)) + "/" + mode;
+      if (size != 0) {
+        c.name += "/" + size_name(size);
+      }
+      c.options.workload = workload;
+      c.options.file_size = size;
+      c.options.sessions = sessions;
+      c.options.operations = operations;
+      c.options.passive = passive;
+      cases.push_back(c);
+    };
+
+    add(bench_workload::list, 0, 4, 5000);
+    if (passive) {
+      // No data connection: one mode is enough
+      add(bench_workload::pipeline, 0, 4, 25);
+    }
+    for (const uint64_t size : {uint64_t(4 * 1024), uint64_t(1024 * 1024),
+                                uint64_t(64 * 1024 * 1024)}) {
+      const bool large = size > 1024 * 1024;
+      add(bench_workload::retr, size, 4, large ? 4 : 500);
+      add(bench_workload::stor, size, 4, large ? 4 : 500);
+    }
+  }
+  return cases;
+}
+
+// Run the suite against a loopback server and compare it with (or write)
+// the baseline
+bool ftp::run_regression(const regression_options &options,
+                         std::vector<regression_result> &results,
+                         std::string &error) {
+  // Before moving to the directory of the server
+  const auto baseline_path = std::filesystem::absolute(options.baseline);
+  Json::Value baseline;
+  const bool has_baseline_file = read_json(baseline_path, baseline);
+  const auto host = host_fingerprint();
+  const bool same_host = has_baseline_file && baseline["host"] == host;
+  if (!options.update_baseline && !same_host) {
+    std::cerr << "[Bench] "
+              << (has_baseline_file ? "The baseline was recorded on another "
+                                      "host, "
+                                    : "No baseline, ")
+              << "only the checks within the run apply (record one here "
+              << "with --update-baseline)" << std::endl;
+  }
+
+  {
+    loopback_server server(options.storage);
+    if (!server.start(error)) {
+      return false;
+    }
+    const std::string prefix =
+        options.storage == "local" ? "" : options.storage + "/";
+    for (const auto &c : regression_cases()) {
+      const std::string name = prefix + c.name;
+      if (name.find(options.filter) == std::string::npos) {
+        continue;
+      }
+      auto bench = c.options;
+      bench.host = "127.0.0.1";
+      bench.port = server.port();
+      bench.username = server.username();
+      bench.password = server.password();
+
+      regression_result r;
+      r.name = name;
+      if (!run_bench(bench, r.result, error)) {
+        error = name + ": " + error;
+        return false;
+      }
+      results.push_back(std::move(r));
+    }
+  }
+
+  if (options.update_baseline) {
+    // Cases of another host are not kept along
+    if (!same_host) {
+      baseline = Json::Value();
+    }
+    baseline["note"] = "Written by simple-ftp-bench --regression "
+                       "--update-baseline on the host below, and only "
+                       "compared with there; do not edit";
+    baseline["host"] = host;
+    // Cases left out by the filter keep their baseline
+    for (const auto &r : results) {
+      Json::Value entry;
+      entry["operationsPerSecond"] = r.result.operations_per_second();
+      entry["bytesPerSecond"] = r.result.bytes_per_second();
+      entry["p50"] = Json::UInt64(r.result.percentile(0.5));
+      entry["p99"] = Json::UInt64(r.result.percentile(0.99));
+      baseline["cases"][r.name] = entry;
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "  ";
+    std::error_code ignored;
+    std::filesystem::create_directories(baseline_path.parent_path(), ignored);
+    std::ofstream file(baseline_path);
+    if (!(file << Json::writeString(builder, baseline) << "\n")) {
+      error = "Cannot write " + baseline_path.string();
+      return false;
+    }
+    return true;
+  }
+
+  for (auto &r : results) {
+    if (r.result.errors > 0) {
+      r.regressed = true;
+      r.reason = std::to_string(r.result.errors) + " errors";
+    }
+    const auto &entry = baseline["cases"][r.name];
+    if (!entry.isObject()) {
+      continue;
+    }
+    if (!same_host) {
+      r.other_host = true;
+      continue;
+    }
+    r.has_baseline = true;
+    r.baseline_operations_per_second =
+        entry.get("operationsPerSecond", 0).asDouble();
+    r.baseline_p50 = entry.get("p50", 0).asUInt64();
+
+    const double operations_per_second = r.result.operations_per_second();
+    const uint64_t p50 = r.result.percentile(0.5);
+    if (operations_per_second <
+        r.baseline_operations_per_second * (1 - options.tolerance)) {
+      r.regressed = true;
+      r.reason += (r.reason.empty() ? "" : ", ") + std::string("throughput ") +
+                  change(operations_per_second,
+                         r.baseline_operations_per_second);
+    }
+    if (double(p50) > double(r.baseline_p50) * (1 + options.tolerance)) {
+      r.regressed = true;
+      r.reason += (r.reason.empty() ? "" : ", ") + std::string("p50 ") +
+                  change(double(p50), double(r.baseline_p50));
+    }
+  }
+
+  // Within the run: a workload much slower in one mode than in the other
+  // (a wait in active mode, say) shows on any host
+  for (auto &r : results) {
+    const auto other_name = other_mode(r.name);
+    const auto other = std::find_if(
+        results.begin(), results.end(),
+        [&](const regression_result &o) { return o.name == other_name; });
+    if (other == results.end()) {
+      continue;
+    }
+    const double operations_per_second = r.result.operations_per_second();
+    const double other_operations_per_second =
+        other->result.operations_per_second();
+    if (operations_per_second <
+        other_operations_per_second * (1 - options.relative_tolerance)) {
+      r.regressed = true;
+      r.reason += (r.reason.empty() ? "" : ", ") + std::string("throughput ") +
+                  change(operations_per_second, other_operations_per_second) +
+                  " of " + other_name;
+    }
+  }
+  return true;
+}
+
+// Report of a run, for people
+std::string
+ftp::format_text(const std::vector<regression_result> &results) {
+  char line[200];
+  snprintf(line, sizeof(line), "%-29s %11s %9s %11s %9s %6s  %s\n", "case",
+           "ops/s", "change", "p50 ms", "change", "errors", "verdict");
+  std::string out = line;
+  for (const auto &r : results) {
+    const double p50 = double(r.result.percentile(0.5));
+    const std::string verdict = r.regressed      ? "REGRESSED: " + r.reason
+                                : r.other_host   ? "ok (other host)"
+                                : r.has_baseline ? "ok"
+                                                 : "no baseline";
+    snprintf(line, sizeof(line), "%-29s %11.1f %9s %11.3f %9s %6llu  %s\n",
+             r.name.c_str(), r.result.operations_per_second(),
+             change(r.result.operations_per_second(),
+                    r.baseline_operations_per_second)
+                 .c_str(),
+             p50 / 1e6, change(p50, double(r.baseline_p50)).c_str(),
+             (unsigned long long)r.result.errors, verdict.c_str());
+    out += line;
+  }
+  return out;
+}
+
+// Report of a run, for scripts
+std::string
+ftp::format_json(const std::vector<regression_result> &results) {
+  Json::Value report(Json::arrayValue);
+  for (const auto &r : results) {
+    Json::Value entry;
+    entry["name"] = r.name;
+    entry["operationsPerSecond"] = r.result.operations_per_second();
+    entry["bytesPerSecond"] = r.result.bytes_per_second();
+    entry["p50"] = Json::UInt64(r.result.percentile(0.5));
+    entry["p99"] = Json::UInt64(r.result.percentile(0.99));
+    entry["errors"] = Json::UInt64(r.result.errors);
+    entry["otherHost"] = r.other_host;
+    if (r.has_baseline) {
+      entry["baselineOperationsPerSecond"] =
+          r.baseline_operations_per_second;
+      entry["baselineP50"] = Json::UInt64(r.baseline_p50);
+    }
+    entry["regressed"] = r.regressed;
+    if (r.regressed) {
+      entry["reason"] = r.reason;
+    }
+    report.append(entry);
+  }
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "  ";
+  return Json::writeString(builder, report) + "\n";
+}
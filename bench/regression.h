@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ftp_server.h"
+#include "load_generator.h"
+#include "s3_stand_in.h"
+
+namespace ftp {
+
+// A server of this process, on loopback, sharing a temporary directory
+// The process moves to a temporary directory holding the config.json of
+// the server, and back when the server is destroyed
+// storage is the backend of the server (see utils/vfs.h), "s3" storing the
+// files in an S3 stand-in of this process; as the storage is created once
+// per process, so is a loopback server
+class loopback_server {
+public:
+  explicit loopback_server(const std::string &storage = "local");
+  ~loopback_server();
+  loopback_server(const loopback_server &) = delete;
+  loopback_server &operator=(const loopback_server &) = delete;
+
+  // Start serving, returns false (with the reason in error) on failure
+  bool start(std::string &error);
+  // Wait for the sessions to end and stop serving
+  void stop();
+
+  uint16_t port() const { return port_; }
+  const std::string &username() const { return username_; }
+  const std::string &password() const { return password_; }
+
+private:
+  std::filesystem::path previous_directory_;
+  std::filesystem::path directory_; // config.json and the shared root/
+  uint16_t port_ = 0;
+  std::string username_ = "bench";
+  std::string password_ = "bench";
+
+  std::unique_ptr<s3_stand_in> store_; // Of the "s3" storage
+  std::unique_ptr<server> server_;
+  std::thread thread_;
+};
+
+// A workload of the regression suite
+struct regression_case {
+  std::string name; // <workload>/<mode>/<file size>
+  bench_options options;
+};
+
+// RETR, STOR and LIST in passive and active mode, over a range of sizes
+std::vector<regression_case> regression_cases();
+
+struct regression_options {
+  // Baseline results, JSON, recorded on this host with update_baseline;
+  // those of another host (or none) are not compared with
+  std::filesystem::path baseline = "bench/baselines/loopback.json";
+  // Relative slowdown of throughput or median latency failing a case
+  double tolerance = 0.25;
+  // Checks within a run, which hold on any host: the throughput of a case
+  // in one mode may be that much lower than in the other at most
+  double relative_tolerance = 0.5;
+  // Write the results as the new baseline instead of comparing
+  bool update_baseline = false;
+  // Only run the cases whose name contains it
+  std::string filter;
+  // Storage backend of the server, "local", "memory" or "s3" (an S3
+  // stand-in of this process); cases of other backends than local are named
+  // "<backend>/<case>"
+  std::string storage = "local";
+};
+
+// Outcome of a case compared with its baseline
+struct regression_result {
+  std::string name;
+  bench_result result;
+  bool has_baseline = false;
+  bool other_host = false; // The baseline was recorded elsewhere
+  double baseline_operations_per_second = 0;
+  uint64_t baseline_p50 = 0; // Nanoseconds
+  bool regressed = false;
+  std::string reason; // Why the case failed
+};
+
+// Run the suite against a loopback server and compare it with (or write)
+// the baseline; returns false (with the reason in error) if it could not
+// be run
+bool run_regression(const regression_options &options,
+                    std::vector<regression_result> &results,
+                    std::string &error);
+
+// Report of a run, for people or for scripts
+std::string format_text(const std::vector<regression_result> &results);
+std::string format_json(const std::vector<regression_result> &results);
+
+} // namespace ftp
@@ -0,0 +1,652 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+#include <utility>
+
+#include <sys/socket.h>
+
+#include "s3_stand_in.h"
+#include "utils/sha256.h"
+
+namespace {
+
+// Heads of requests are a request line and a few headers
+constexpr size_t max_head_size = 64 * 1024;
+// Bytes read from a connection at a time
+constexpr size_t read_size = 64 * 1024;
+
+// Append what the connection has to pending, false once closed or failed
+bool fill(sockpp::tcp_socket &sock, std::string &pending) {
+  const size_t size = pending.size();
+  pending.resize(size + read_size);
+  const ssize_t n = sock.read(pending.data() + size, read_size);
+  pending.resize(size + size_t(std::max<ssize_t>(n, 0)));
+  return n > 0;
+}
+
+// Copy without leading and trailing spaces
+std::string trim_spaces(const std::string &text) {
+  const auto start = text.find_first_not_of(" \t");
+  if (start == std::string::npos) {
+    return "";
+  }
+  return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+// Text with its %XX escapes decoded
+std::string uri_decode(const std::string &text) {
+  std::string decoded;
+  decoded.reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '%' && i + 2 < text.size() &&
+        std::isxdigit((unsigned char)text[i + 1]) &&
+        std::isxdigit((unsigned char)text[i + 2])) {
+      decoded += char(std::strtoul(text.substr(i + 1, 2).c_str(), nullptr,
+                                   16));
+      i += 2;
+      continue;
+    }
+    decoded += text[i];
+  }
+  return decoded;
+}
+
+// Text with the XML special characters escaped
+std::string xml_encode(const std::string &text) {
+  std::string encoded;
+  encoded.reserve(text.size());
+  for (const char c : text) {
+    switch (c) {
+    case '&':
+      encoded += "&amp;";
+      break;
+    case '<':
+      encoded += "&lt;";
+      break;
+    case '>':
+      encoded += "&gt;";
+      break;
+    case '"':
+      encoded += "&quot;";
+      break;
+    default:
+      encoded += c;
+    }
+  }
+  return encoded;
+}
+
+// Contents of every <tag> element of a document, in order
+std::vector<std::string> elements(const std::string &xml,
+                                  const std::string &tag) {
+  std::vector<std::string> found;
+  const std::string open = "<" + tag + ">";
+  const std::string close = "</" + tag + ">";
+  size_t position = 0;
+  while ((position = xml.find(open, position)) != std::string::npos) {
+    position += open.size();
+    const auto end = xml.find(close, position);
+    if (end == std::string::npos) {
+      break;
+    }
+    found.push_back(xml.substr(position, end - position));
+    position = end + close.size();
+  }
+  return found;
+}
+
+// Value of a field of the Authorization header: Name=value, up to a comma
+std::string auth_field(const std::string &header, const std::string &name) {
+  const auto start = header.find(name + "=");
+  if (start == std::string::npos) {
+    return "";
+  }
+  const auto value = start + name.size() + 1;
+  return header.substr(value, header.find(',', value) - value);
+}
+
+// Parts of a text separated by a character
+std::vector<std::string> split_on(const std::string &text, char separator) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (true) {
+    const auto end = text.find(separator, start);
+    parts.push_back(text.substr(start, end - start));
+    if (end == std::string::npos) {
+      return parts;
+    }
+    start = end + 1;
+  }
+}
+
+// A time formatted in UTC with strftime()
+std::string utc_time(int64_t seconds, const char *format) {
+  const std::time_t time = std::time_t(seconds);
+  std::tm utc;
+  gmtime_r(&time, &utc);
+  char text[64];
+  std::strftime(text, sizeof(text), format, &utc);
+  return text;
+}
+
+// ETag of an object, version being its modification time (or the number
+// of a part)
+std::string etag_of(const std::string &data, int64_t version) {
+  return "\"" + std::to_string(data.size()) + "-" + std::to_string(version) +
+         "\"";
+}
+
+const char *reason(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 204:
+    return "No Content";
+  case 206:
+    return "Partial Content";
+  case 403:
+    return "Forbidden";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 416:
+    return "Range Not Satisfiable";
+  default:
+    return "Bad Request";
+  }
+}
+
+} // namespace
+
+// Constructor
+ftp::s3_stand_in::s3_stand_in(size_t page_keys)
+    : page_keys_(std::max<size_t>(page_keys, 1)) {}
+
+// Destructor
+ftp::s3_stand_in::~s3_stand_in() { stop(); }
+
+// Start serving
+bool ftp::s3_stand_in::start(std::string &error) {
+  if (!acceptor_.open(sockpp::inet_address("127.0.0.1", 0))) {
+    error = "Cannot open the S3 stand-in: " + acceptor_.last_error_str();
+    return false;
+  }
+  running_ = true;
+  thread_ = std::thread([this]() { serve(); });
+  return true;
+}
+
+// Close the connections and stop serving
+void ftp::s3_stand_in::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  // Wakes up accept()
+  acceptor_.shutdown();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  // Wakes up the connections waiting for their next request
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const int fd : connections_) {
+      ::shutdown(fd, SHUT_RDWR);
+    }
+  }
+  for (auto &connection : threads_) {
+    connection.join();
+  }
+  threads_.clear();
+  acceptor_.close();
+}
+
+// Endpoint, bucket and keys of the store
+ftp::object_store_settings ftp::s3_stand_in::settings() const {
+  object_store_settings settings;
+  settings.endpoint = "127.0.0.1:" + std::to_string(acceptor_.address().port());
+  settings.bucket = bucket_;
+  settings.access_key = access_key_;
+  settings.secret_key = secret_key_;
+  return settings;
+}
+
+// Keys of the objects stored
+std::vector<std::string> ftp::s3_stand_in::keys() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> keys;
+  for (const auto &[key, object] : objects_) {
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+// Accept connections until stopped
+void ftp::s3_stand_in::serve() {
+  while (running_) {
+    sockpp::tcp_socket sock = acceptor_.accept();
+    if (!sock) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.push_back(sock.handle());
+    threads_.emplace_back(
+        [this, sock = std::move(sock)]() mutable { answer(std::move(sock)); });
+  }
+}
+
+// Answer the requests of a connection until it is closed
+void ftp::s3_stand_in::answer(sockpp::tcp_socket sock) {
+  std::string pending;
+  while (running_) {
+    size_t head_end;
+    while ((head_end = pending.find("\r\n\r\n")) == std::string::npos) {
+      if (pending.size() > max_head_size || !fill(sock, pending)) {
+        break;
+      }
+    }
+    if (head_end == std::string::npos) {
+      break;
+    }
+
+    // Request line: PUT /bucket/key?query HTTP/1.1
+    request r;
+    size_t line_end = pending.find("\r\n");
+    const auto line = split_on(pending.substr(0, line_end), ' ');
+    if (line.size() != 3) {
+      break;
+    }
+    r.method = line[0];
+    r.target = line[1];
+    while (line_end < head_end) {
+      const size_t start = line_end + 2;
+      line_end = pending.find("\r\n", start);
+      const auto colon = pending.find(':', start);
+      if (colon < line_end) {
+        auto name = pending.substr(start, colon - start);
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        r.headers[name] =
+            trim_spaces(pending.substr(colon + 1, line_end - colon - 1));
+      }
+    }
+    pending.erase(0, head_end + 4);
+
+    const size_t body_size = std::strtoull(
+        r.headers["content-length"].c_str(), nullptr, 10);
+    while (pending.size() < body_size) {
+      if (!fill(sock, pending)) {
+        break;
+      }
+    }
+    if (pending.size() < body_size) {
+      break;
+    }
+    r.body = pending.substr(0, body_size);
+    pending.erase(0, body_size);
+
+    ++requests_;
+    auto result = authorized(r) ? handle(r) : response{403, {}, ""};
+    if (result.status == 403 && result.body.empty()) {
+      result.body = "<Error><Code>SignatureDoesNotMatch</Code></Error>";
+    }
+    std::string head = "HTTP/1.1 " + std::to_string(result.status) + " " +
+                       reason(result.status) + "\r\n";
+    bool has_length = false;
+    for (const auto &[name, value] : result.headers) {
+      head += name + ": " + value + "\r\n";
+      has_length = has_length || name == "Content-Length";
+    }
+    if (!has_length && result.status != 204) {
+      head += "Content-Length: " + std::to_string(result.body.size()) + "\r\n";
+    }
+    head += "\r\n";
+    if (r.method != "HEAD") {
+      head += result.body;
+    }
+    if (sock.write(head) != ssize_t(head.size())) {
+      break;
+    }
+  }
+
+  // Closed here, so that stop() never shuts down a number reused since
+  std::lock_guard<std::mutex> lock(mutex_);
+  connections_.erase(
+      std::find(connections_.begin(), connections_.end(), sock.handle()));
+  sock.close();
+}
+
+// Is the request signed with the keys of the store?
+// The signature is computed again from the request as received
+bool ftp::s3_stand_in::authorized(const request &r) const {
+  const auto auth = r.headers.find("authorization");
+  const auto date = r.headers.find("x-amz-date");
+  const auto payload = r.headers.find("x-amz-content-sha256");
+  if (auth == r.headers.end() || date == r.headers.end() ||
+      payload == r.headers.end() ||
+      auth->second.rfind("AWS4-HMAC-SHA256 ", 0) != 0) {
+    return false;
+  }
+
+  // Credential=<access key>/<date>/<region>/s3/aws4_request
+  const auto credential = split_on(auth_field(auth->second, "Credential"), '/');
+  const object_store_settings defaults;
+  if (credential.size() != 5 || credential[0] != access_key_ ||
+      credential[1] != date->second.substr(0, 8) ||
+      credential[2] != defaults.region || credential[3] != "s3" ||
+      credential[4] != "aws4_request") {
+    return false;
+  }
+
+  // The path and the query, encoded again and sorted
+  const auto question = r.target.find('?');
+  const std::string uri =
+      uri_encode(uri_decode(r.target.substr(0, question)), false);
+  std::vector<std::string> parameters;
+  if (question != std::string::npos) {
+    for (const auto &parameter :
+         split_on(r.target.substr(question + 1), '&')) {
+      const auto equals = parameter.find('=');
+      parameters.push_back(
+          uri_encode(uri_decode(parameter.substr(0, equals))) + "=" +
+          (equals == std::string::npos
+               ? ""
+               : uri_encode(uri_decode(parameter.substr(equals + 1)))));
+    }
+  }
+  std::sort(parameters.begin(), parameters.end());
+  std::string query;
+  for (const auto &parameter : parameters) {
+    query += (query.empty() ? "" : "&") + parameter;
+  }
+
+  // The headers signed, which must cover the host and the date
+  const auto signed_headers = auth_field(auth->second, "SignedHeaders");
+  std::string canonical_headers;
+  bool has_host = false;
+  bool has_date = false;
+  for (const auto &name : split_on(signed_headers, ';')) {
+    const auto header = r.headers.find(name);
+    if (header == r.headers.end()) {
+      return false;
+    }
+    canonical_headers += name + ":" + header->second + "\n";
+    has_host = has_host || name == "host";
+    has_date = has_date || name == "x-amz-date";
+  }
+  if (!has_host || !has_date) {
+    return false;
+  }
+
+  const std::string canonical_request =
+      r.method + "\n" + uri + "\n" + query + "\n" + canonical_headers +
+      "\n" + signed_headers + "\n" + payload->second;
+  const std::string scope = credential[1] + "/" + credential[2] +
+                            "/s3/aws4_request";
+  const std::string string_to_sign =
+      "AWS4-HMAC-SHA256\n" + date->second + "\n" + scope + "\n" +
+      to_hex(sha256::of(canonical_request));
+  auto key = hmac_sha256("AWS4" + secret_key_, credential[1]);
+  for (const auto &part : {credential[2], std::string("s3"),
+                           std::string("aws4_request")}) {
+    key = hmac_sha256(std::string(key.begin(), key.end()), part);
+  }
+  return auth_field(auth->second, "Signature") ==
+         to_hex(hmac_sha256(std::string(key.begin(), key.end()),
+                            string_to_sign));
+}
+
+// Answer a signed request
+ftp::s3_stand_in::response ftp::s3_stand_in::handle(const request &r) {
+  const auto error = [](int status, const std::string &code) {
+    return response{status, {},
+                    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                    "<Error><Code>" +
+                        code + "</Code></Error>"};
+  };
+
+  // Path-style: /bucket/key
+  const auto question = r.target.find('?');
+  const auto path = uri_decode(r.target.substr(0, question));
+  std::map<std::string, std::string> query;
+  if (question != std::string::npos) {
+    for (const auto &parameter :
+         split_on(r.target.substr(question + 1), '&')) {
+      const auto equals = parameter.find('=');
+      query[uri_decode(parameter.substr(0, equals))] =
+          equals == std::string::npos
+              ? ""
+              : uri_decode(parameter.substr(equals + 1));
+    }
+  }
+  const std::string bucket_path = "/" + bucket_;
+  if (path.rfind(bucket_path, 0) != 0 ||
+      (path.size() > bucket_path.size() && path[bucket_path.size()] != '/')) {
+    return error(404, "NoSuchBucket");
+  }
+  const std::string key = path.substr(std::min(path.size(),
+                                               bucket_path.size() + 1));
+
+  if (key.empty()) {
+    if (r.method == "GET" && query["list-type"] == "2") {
+      return list(query);
+    }
+    return error(405, "MethodNotAllowed");
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int64_t now = int64_t(std::time(nullptr));
+
+  // Multipart uploads: start, parts, completion and abort
+  if (r.method == "POST" && query.count("uploads") != 0) {
+    const auto id = std::to_string(next_upload_++);
+    uploads_[id];
+    return response{200, {},
+                    "<InitiateMultipartUploadResult><Bucket>" + bucket_ +
+                        "</Bucket><Key>" + xml_encode(key) +
+                        "</Key><UploadId>" + id +
+                        "</UploadId></InitiateMultipartUploadResult>"};
+  }
+  if (query.count("uploadId") != 0) {
+    const auto upload = uploads_.find(query["uploadId"]);
+    if (upload == uploads_.end()) {
+      return error(404, "NoSuchUpload");
+    }
+    if (r.method == "PUT") {
+      const int number = std::atoi(query["partNumber"].c_str());
+      if (number < 1) {
+        return error(400, "InvalidArgument");
+      }
+      upload->second[number] = r.body;
+      return response{200, {{"ETag", etag_of(r.body, number)}}, ""};
+    }
+    if (r.method == "DELETE") {
+      uploads_.erase(upload);
+      return response{204, {}, ""};
+    }
+    if (r.method != "POST") {
+      return error(405, "MethodNotAllowed");
+    }
+    // The parts listed, in order, with the ETags they were given
+    stored_object object;
+    int previous = 0;
+    for (const auto &part : elements(r.body, "Part")) {
+      const auto numbers = elements(part, "PartNumber");
+      const auto etags = elements(part, "ETag");
+      const int number = numbers.empty() ? 0 : std::atoi(numbers[0].c_str());
+      const auto data = upload->second.find(number);
+      if (number <= previous || data == upload->second.end() ||
+          etags.empty() || etags[0] != etag_of(data->second, number)) {
+        return error(400, "InvalidPart");
+      }
+      object.data += data->second;
+      previous = number;
+    }
+    if (previous == 0) {
+      return error(400, "MalformedXML");
+    }
+    uploads_.erase(upload);
+    object.modified = now;
+    const auto etag = etag_of(object.data, now);
+    objects_[key] = std::move(object);
+    return response{200, {},
+                    "<CompleteMultipartUploadResult><Key>" + xml_encode(key) +
+                        "</Key><ETag>" + xml_encode(etag) +
+                        "</ETag></CompleteMultipartUploadResult>"};
+  }
+
+  if (r.method == "PUT") {
+    // Copy: x-amz-copy-source is /bucket/key
+    const auto source = r.headers.find("x-amz-copy-source");
+    if (source != r.headers.end()) {
+      const auto from = uri_decode(source->second);
+      const auto found = from.rfind(bucket_path + "/", 0) == 0
+                             ? objects_.find(from.substr(bucket_path.size() +
+                                                         1))
+                             : objects_.end();
+      if (found == objects_.end()) {
+        return error(404, "NoSuchKey");
+      }
+      stored_object copy{found->second.data, now};
+      const auto etag = etag_of(copy.data, now);
+      objects_[key] = std::move(copy);
+      return response{200, {},
+                      "<CopyObjectResult><ETag>" + xml_encode(etag) +
+                          "</ETag></CopyObjectResult>"};
+    }
+    const auto etag = etag_of(r.body, now);
+    objects_[key] = stored_object{r.body, now};
+    return response{200, {{"ETag", etag}}, ""};
+  }
+
+  if (r.method == "DELETE") {
+    objects_.erase(key);
+    return response{204, {}, ""};
+  }
+
+  if (r.method != "GET" && r.method != "HEAD") {
+    return error(405, "MethodNotAllowed");
+  }
+  const auto found = objects_.find(key);
+  if (found == objects_.end()) {
+    return r.method == "HEAD" ? response{404, {}, ""}
+                              : error(404, "NoSuchKey");
+  }
+  const auto &object = found->second;
+  response result;
+  result.headers = {
+      {"ETag", etag_of(object.data, object.modified)},
+      {"Last-Modified",
+       utc_time(object.modified, "%a, %d %b %Y %H:%M:%S GMT")}};
+  if (r.method == "HEAD") {
+    result.headers.emplace_back("Content-Length",
+                                std::to_string(object.data.size()));
+    return result;
+  }
+
+  // Range: bytes=<first>-<last>
+  const auto range = r.headers.find("range");
+  if (range == r.headers.end() || ignore_ranges_) {
+    result.body = object.data;
+    return result;
+  }
+  if (range->second.rfind("bytes=", 0) != 0) {
+    return error(400, "InvalidArgument");
+  }
+  const uint64_t first = std::strtoull(range->second.c_str() + 6, nullptr, 10);
+  const auto dash = range->second.find('-');
+  uint64_t last = object.data.size() - 1;
+  if (dash != std::string::npos && dash + 1 < range->second.size()) {
+    last = std::min<uint64_t>(
+        last, std::strtoull(range->second.c_str() + dash + 1, nullptr, 10));
+  }
+  if (first >= object.data.size() || first > last) {
+    return error(416, "InvalidRange");
+  }
+  result.status = 206;
+  result.headers.emplace_back(
+      "Content-Range", "bytes " + std::to_string(first) + "-" +
+                           std::to_string(last) + "/" +
+                           std::to_string(object.data.size()));
+  result.body = object.data.substr(first, last - first + 1);
+  return result;
+}
+
+// ListObjectsV2, one page
+// The continuation token is the last key or prefix of the page before
+ftp::s3_stand_in::response
+ftp::s3_stand_in::list(const std::map<std::string, std::string> &query) {
+  const auto parameter = [&](const std::string &name) {
+    const auto found = query.find(name);
+    return found == query.end() ? std::string() : found->second;
+  };
+  const auto prefix = parameter("prefix");
+  const auto delimiter = parameter("delimiter");
+  const auto token = parameter("continuation-token");
+  const auto requested = parameter("max-keys");
+  const size_t max_keys = std::min<size_t>(
+      page_keys_,
+      requested.empty() ? 1000 : std::strtoull(requested.c_str(), nullptr, 10));
+  // After a prefix, the keys below it were already rolled up in it
+  const bool after_prefix = !token.empty() && !delimiter.empty() &&
+                            token.find(delimiter, prefix.size()) !=
+                                std::string::npos;
+
+  std::string contents;
+  std::string prefixes;
+  std::string last;
+  size_t count = 0;
+  bool truncated = false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = token.empty() ? objects_.lower_bound(prefix)
+                               : objects_.upper_bound(token);
+       it != objects_.end() && it->first.rfind(prefix, 0) == 0; ++it) {
+    const auto &key = it->first;
+    if (after_prefix && key.rfind(token, 0) == 0) {
+      continue;
+    }
+    std::string common;
+    if (!delimiter.empty()) {
+      const auto end = key.find(delimiter, prefix.size());
+      if (end != std::string::npos) {
+        common = key.substr(0, end + delimiter.size());
+      }
+    }
+    if (!common.empty() && common == last) {
+      continue;
+    }
+    if (count == max_keys) {
+      truncated = true;
+      break;
+    }
+    ++count;
+    if (!common.empty()) {
+      last = common;
+      prefixes += "<CommonPrefixes><Prefix>" + xml_encode(common) +
+                  "</Prefix></CommonPrefixes>";
+      continue;
+    }
+    last = key;
+    contents += "<Contents><Key>" + xml_encode(key) + "</Key><LastModified>" +
+                utc_time(it->second.modified, "%Y-%m-%dT%H:%M:%S.000Z") +
+                "</LastModified><ETag>" +
+                xml_encode(etag_of(it->second.data, it->second.modified)) +
+                "</ETag><Size>" + std::to_string(it->second.data.size()) +
+                "</Size></Contents>";
+  }
+
+  std::string body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                     "<ListBucketResult><Name>" +
+                     bucket_ + "</Name><Prefix>" + xml_encode(prefix) +
+                     "</Prefix><KeyCount>" + std::to_string(count) +
+                     "</KeyCount><MaxKeys>" + std::to_string(max_keys) +
+                     "</MaxKeys><IsTruncated>" +
+                     (truncated ? "true" : "false") + "</IsTruncated>";
+  if (truncated) {
+    body += "<NextContinuationToken>" + xml_encode(last) +
+            "</NextContinuationToken>";
+  }
+  body += contents + prefixes + "</ListBucketResult>";
+  return response{200, {{"Content-Type", "application/xml"}}, body};
+}
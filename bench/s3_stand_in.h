@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sockpp/tcp_acceptor.h>
+
+#include "utils/s3_client.h"
+
+namespace ftp {
+
+// An S3 compatible object store of this process, on loopback, keeping its
+// objects in memory, for the object storage to be tested without AWS or
+// MinIO
+// It answers what object_store_vfs sends: HEAD, ranged GET, PUT, copies,
+// multipart uploads, DELETE and ListObjectsV2, path-style and for one
+// bucket, each connection on a thread of its own. Requests not signed with
+// the keys of settings() (Signature Version 4) are refused, and listings
+// hold at most page_keys keys and prefixes, so that callers have to follow
+// the continuation tokens
+class s3_stand_in {
+public:
+  explicit s3_stand_in(size_t page_keys = 1000);
+  ~s3_stand_in();
+  s3_stand_in(const s3_stand_in &) = delete;
+  s3_stand_in &operator=(const s3_stand_in &) = delete;
+
+  // Start serving, returns false (with the reason in error) on failure
+  bool start(std::string &error);
+  // Close the connections and stop serving
+  void stop();
+
+  // Endpoint, bucket and keys of the store
+  object_store_settings settings() const;
+  // Keys of the objects stored, sorted
+  std::vector<std::string> keys();
+  // Requests answered so far
+  uint64_t requests() const { return requests_; }
+  // Answer ranged GETs with the whole object (200), as some stores do
+  void ignore_ranges(bool ignore) { ignore_ranges_ = ignore; }
+
+private:
+  struct request {
+    std::string method;
+    std::string target; // As sent: /bucket/key?query
+    std::map<std::string, std::string> headers; // Names in lowercase
+    std::string body;
+  };
+
+  struct response {
+    int status = 200;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+  };
+
+  struct stored_object {
+    std::string data;
+    int64_t modified = 0; // Seconds since epoch
+  };
+
+  // An upload in parts, by part number
+  using multipart_upload = std::map<int, std::string>;
+
+  // Accept connections until stopped
+  void serve();
+  // Answer the requests of a connection until it is closed
+  void answer(sockpp::tcp_socket sock);
+  // Is the request signed with the keys of the store?
+  bool authorized(const request &r) const;
+  response handle(const request &r);
+  // ListObjectsV2, one page
+  response list(const std::map<std::string, std::string> &query);
+
+  size_t page_keys_;
+  std::string bucket_ = "simple-ftp";
+  std::string access_key_ = "stand-in";
+  std::string secret_key_ = "stand-in-secret";
+
+  sockpp::tcp_acceptor acceptor_;
+  std::atomic<bool> running_ = false;
+  std::thread thread_;
+  std::atomic<uint64_t> requests_ = 0;
+  std::atomic<bool> ignore_ranges_ = false;
+
+  std::mutex mutex_;
+  std::map<std::string, stored_object> objects_; // Sorted, for listings
+  std::map<std::string, multipart_upload> uploads_;
+  uint64_t next_upload_ = 1;
+  std::vector<int> connections_; // Sockets open, shut down by stop()
+  std::vector<std::thread> threads_;
+};
+
+} // namespace ftp
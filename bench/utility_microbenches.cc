@@ -0,0 +1,201 @@
+#include <memory>
+#include <stdexcept>
+
+#include <sys/socket.h>
+
+#include "microbench.h"
+#include "utils/ftp.h"
+#include "utils/io.h"
+
+namespace {
+
+// Commands as typed in the client and received by the server
+const std::vector<std::string> default_commands = {
+    "USER alice",
+    "PASS correct-horse-battery-staple",
+    "PASV",
+    "PORT 40123",
+    "LIST",
+    "ls",
+    "CWD /projects/simple-ftp/build",
+    "cd ..",
+    "PWD",
+    "RETR reports/2024/quarterly-results-final.pdf",
+    "get photos/IMG_20240101_120000.jpg",
+    "STOR backup-2024-06-30.tar.gz",
+    "put notes.txt",
+    "SIZE datasets/measurements.csv",
+    "MDTM datasets/measurements.csv",
+    "MLSD /datasets",
+    "MKD incoming",
+    "DELE incoming/partial.bin",
+    "RNFR draft.md",
+    "RNTO final.md",
+    "mput a.txt b.txt c.txt d.txt e.txt f.txt g.txt h.txt",
+    "mget -r -j 8 photos documents music",
+    "DONE",
+    "QUIT",
+    "  RETR   padded.txt  ",
+    "",
+    "   ",
+    "FEAT",
+    "retr too many arguments here",
+    "STOR /very/deep/directory/tree/with/many/levels/and/a/rather/long/"
+    "file-name-that-keeps-going-for-a-while.dat",
+};
+
+// Replies the server sends back, with their CRLF
+const std::vector<std::string> replies = {
+    "331 User name okay, need password.\r\n",
+    "230 User logged in, proceed.\r\n",
+    "200 Port set to 40123\r\n",
+    "200 File status okay; about to open data connection\r\n",
+    "226 File sent successfully\r\n",
+    "550 File not found\r\n",
+};
+
+// A listing as split into entries by the client
+std::string listing(size_t entries) {
+  std::string text = "200 Listing:\r\n";
+  for (size_t i = 0; i < entries; ++i) {
+    text += "    file-" + std::to_string(i) + ".txt\r\n";
+  }
+  return text;
+}
+
+// Strings padded with spaces, the way trim() sees them
+std::vector<std::string> padded(const std::vector<std::string> &commands) {
+  std::vector<std::string> out;
+  for (const auto &c : commands) {
+    out.push_back("   " + c + "  ");
+  }
+  return out;
+}
+
+// A connected pair of stream sockets, without a network
+struct socket_pair {
+  socket_pair() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+      throw std::runtime_error("socketpair() failed");
+    }
+    sender = sockpp::tcp_socket(fds[0]);
+    receiver = sockpp::tcp_socket(fds[1]);
+  }
+  sockpp::tcp_socket sender;
+  sockpp::tcp_socket receiver;
+};
+
+// A benchmark cycling through the strings of a corpus
+template <typename Operation>
+ftp::microbench over_corpus(std::string name, double allocation_budget,
+                            std::vector<std::string> corpus,
+                            Operation operation) {
+  return {std::move(name), allocation_budget,
+          [corpus = std::move(corpus), operation](uint64_t iterations) {
+            size_t next = 0;
+            for (uint64_t i = 0; i < iterations; ++i) {
+              operation(corpus[next]);
+              next = next + 1 == corpus.size() ? 0 : next + 1;
+            }
+          }};
+}
+
+} // namespace
+
+// Microbenchmarks of trim, split, parse_command, send/receive_message and
+// message_framer
+std::vector<ftp::microbench>
+ftp::utility_microbenches(const std::vector<std::string> &corpus) {
+  const auto &commands = corpus.empty() ? default_commands : corpus;
+  std::vector<microbench> benches;
+
+  // Allocation budgets are those of the built-in corpus, with a little
+  // headroom: lower them along with the allocations
+
+  // String utilities
+  benches.push_back(over_corpus("trim/padded", 30, padded(commands),
+                                [](const std::string &s) {
+                                  do_not_optimize(ftp::trim(s));
+                                }));
+  benches.push_back(over_corpus("trim/clean", 26, commands,
+                                [](const std::string &s) {
+                                  do_not_optimize(ftp::trim(s));
+                                }));
+  benches.push_back(over_corpus("split/command", 4, commands,
+                                [](const std::string &s) {
+                                  std::vector<std::string> tokens;
+                                  do_not_optimize(ftp::split(s, tokens, ' '));
+                                }));
+  benches.push_back(over_corpus("split/listing-200", 202, {listing(200)},
+                                [](const std::string &s) {
+                                  std::vector<std::string> lines;
+                                  do_not_optimize(ftp::split(s, lines, '\n'));
+                                }));
+
+  // Parser, logging included
+  benches.push_back(over_corpus("parse_command/corpus", 30, commands,
+                                [](const std::string &s) {
+                                  do_not_optimize(ftp::parse_command(s));
+                                }));
+
+  // Control messages over a socket pair: a command sent and received, then
+  // its reply, as on the control connection
+  std::vector<std::string> messages;
+  for (const auto &c : commands) {
+    if (!c.empty()) {
+      messages.push_back(c);
+    }
+  }
+  auto round_trip = [&messages](std::string name, bool growable) {
+    return microbench{
+        std::move(name), 6, [messages, growable](uint64_t iterations) {
+          socket_pair sockets;
+          auto shared = std::shared_ptr<char>(new char[ftp::buffer_size],
+                                              std::default_delete<char[]>());
+          ftp::message_buffer buffer;
+          for (uint64_t i = 0; i < iterations; ++i) {
+            const auto &command = messages[i % messages.size()];
+            const auto &reply = replies[i % replies.size()];
+            ftp::send_message(&sockets.sender, command);
+            do_not_optimize(
+                growable ? ftp::receive_message(&sockets.receiver, buffer)
+                         : ftp::receive_message(&sockets.receiver, shared,
+                                                ftp::buffer_size));
+            ftp::send_message(&sockets.receiver, reply);
+            do_not_optimize(
+                growable ? ftp::receive_message(&sockets.sender, buffer)
+                         : ftp::receive_message(&sockets.sender, shared,
+                                                ftp::buffer_size));
+          }
+        }};
+  };
+  benches.push_back(round_trip("message/round-trip", false));
+  benches.push_back(round_trip("message/round-trip-growable", true));
+
+  // A pipelined batch read in pieces of a fixed size: the first read ends
+  // on a line end, the next ones in the middle of a line, which the framer
+  // keeps until its end comes (tests/io_tests.cc checks the commands)
+  benches.push_back(microbench{
+      "message/framer-split", 8, [](uint64_t iterations) {
+        const std::vector<std::string> batch = {
+            "MKD incoming", "DELE incoming/partial.bin",
+            "RNTO reports/2024/quarterly-results-final.pdf"};
+        std::string message;
+        for (const auto &command : batch) {
+          message += command + "\r\n";
+        }
+        socket_pair sockets;
+        // Reads never take more than the first line
+        ftp::message_buffer buffer(batch[0].size() + 2, batch[0].size() + 2);
+        ftp::message_framer framer;
+        for (uint64_t i = 0; i < iterations; ++i) {
+          ftp::send_message(&sockets.sender, message);
+          for (size_t j = 0; j < batch.size(); ++j) {
+            do_not_optimize(framer.next(&sockets.receiver, buffer));
+          }
+        }
+      }});
+
+  return benches;
+}
@@ -3,6 +3,7 @@
 #include <atomic>
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #include <sockpp/tcp_connector.h>
 #include <sockpp/tcp_socket.h>
@@ -19,6 +20,10 @@ public:
   void connect();
   void disconnect();
 
+  // Connect, run commands without a prompt and disconnect
+  // Returns false if the connection or any command failed
+  bool run_batch(const std::vector<std::string> &commands);
+
 private:
   std::string server_host_;     // Server host
   uint16_t server_command_port_; // Server command port
@@ -30,7 +35,7 @@ private:
   void run_echo_from_stdin();
 
   // Protocol interpreter (single instance)
-  protocol_interpreter_client *protocol_interpreter_;
+  protocol_interpreter_client *protocol_interpreter_ = nullptr;
 };
 
 } // namespace ftp
\ No newline at end of file
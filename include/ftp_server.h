@@ -1,11 +1,19 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <sockpp/tcp_acceptor.h>
 
 #include "proto/proto_interpreter.h"
+#include "utils/admin_socket.h"
+#include "utils/http_listener.h"
 
 namespace ftp {
 
@@ -20,13 +28,36 @@ public:
 private:
   void run_echo(sockpp::tcp_socket sock);
 
+  // Commands of the admin socket
+  void start_admin_socket();
+  // Table of the live sessions
+  std::string describe_sessions();
+  // Kill or limit the sessions matching target (an id, or "all"), returns
+  // how many matched
+  size_t for_sessions(const std::string &target,
+                      const std::function<void(protocol_interpreter_server &)>
+                          &action);
+  // Wait for the sessions to end, returns false at the deadline
+  bool wait_for_sessions(std::chrono::steady_clock::time_point deadline);
+
   uint16_t command_port_; // Command port (always be used)
 
   sockpp::tcp_acceptor acceptor_;
   std::atomic<bool> running_;
 
-  // Instances of protocol interpreter
+  // Instances of protocol interpreter, each removes itself when its session
+  // ends
+  std::mutex interpreters_mutex_;
   std::vector<protocol_interpreter_server *> interpreters_;
+
+  // Serves the metrics over HTTP, when enabled in config.json
+  std::unique_ptr<http_listener> metrics_listener_;
+
+  // Local administration, when enabled in config.json
+  std::unique_ptr<admin_socket> admin_socket_;
+  // Set by the drain command: no new sessions, the live ones have until
+  // then (nanoseconds on the steady clock) to finish
+  std::atomic<int64_t> drain_deadline_ = 0;
 };
 
 } // namespace ftp
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/event_loop.h"
+#include "utils/mlsd.h"
+
+namespace ftp {
+
+// Outcome of an operation of an asynchronous client
+struct async_result {
+  bool successful = false;
+  // Last reply of the server, or what went wrong on this side
+  std::string message;
+};
+
+// Client for programs embedding simple-ftp: operations return at once and
+// complete on the thread running the event loop, which drives any number
+// of clients (one process can run hundreds of transfers)
+// Operations of a client run one after the other, in the order they were
+// called, and complete with their callback and their future; they may be
+// called from any thread. Callbacks run on the loop thread, where waiting
+// on a future of the same loop never ends
+// Transfers use passive mode, entered by login(); nothing is printed
+class async_client {
+public:
+  using completion = std::function<void(const async_result &)>;
+  // Bytes moved so far, and the size of the file (0 while unknown)
+  using progress = std::function<void(uint64_t transferred, uint64_t total)>;
+
+  // The loop outlives its clients
+  explicit async_client(event_loop &loop);
+  // Fails the operations not completed yet and closes the connections
+  ~async_client();
+  async_client(const async_client &) = delete;
+  async_client &operator=(const async_client &) = delete;
+
+  // Connect to the server; host names are resolved on a thread of their
+  // own, so that a slow resolver does not hold up the loop
+  std::future<async_result> connect(const std::string &host, uint16_t port,
+                                    completion done = nullptr);
+  // Log in and enter passive mode
+  std::future<async_result> login(const std::string &username,
+                                  const std::string &password,
+                                  completion done = nullptr);
+
+  // A command answered by one reply: CWD, PWD, MKD, RMD, DELE, SIZE...
+  // (not PASV and PORT, transfers need the passive mode of login())
+  std::future<async_result> execute(const std::string &command,
+                                    completion done = nullptr);
+
+  // Entries of a directory (the current one if empty), into entries,
+  // which is kept alive until completion
+  std::future<async_result> list(const std::string &directory,
+                                 std::vector<remote_entry> &entries,
+                                 completion done = nullptr);
+
+  // Download a file into a descriptor (written at its offset) or at the
+  // end of a buffer kept alive until completion
+  // A directory arrives as a tar archive, like in the client
+  std::future<async_result> get(const std::string &remote, int fd,
+                                completion done = nullptr,
+                                progress on_progress = nullptr);
+  std::future<async_result> get(const std::string &remote,
+                                std::string &buffer,
+                                completion done = nullptr,
+                                progress on_progress = nullptr);
+
+  // Upload a regular file, from its start, kept open until completion, or
+  // the contents of a buffer
+  std::future<async_result> put(const std::string &remote, int fd,
+                                completion done = nullptr,
+                                progress on_progress = nullptr);
+  std::future<async_result> put(const std::string &remote, std::string data,
+                                completion done = nullptr,
+                                progress on_progress = nullptr);
+
+  // End the session and close the connection
+  std::future<async_result> quit(completion done = nullptr);
+
+  // Fail the session when the server has not been heard from for that
+  // long during an operation (0: wait forever), 30 seconds by default
+  void set_timeout(std::chrono::milliseconds timeout);
+
+private:
+  struct operation;
+  struct session;
+
+  // Queue an operation on the loop thread
+  std::future<async_result> submit(std::shared_ptr<operation> op);
+
+  event_loop &loop_;
+  std::shared_ptr<session> session_;
+};
+
+} // namespace ftp
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "proto/parallel_transfer.h"
+
+namespace ftp {
+
+// Options of mirror:
+//   [-n] [-j <sessions>] [--delete] [--hash] up|down <local> <remote>
+struct mirror_options {
+  bool upload = false;         // up: local to remote, down: remote to local
+  bool dry_run = false;        // -n: print the plan, change nothing
+  bool remove_extra = false;   // --delete: delete what the source lacks
+  bool compare_hashes = false; // --hash: CRC-32 rather than mtime
+  size_t concurrency = default_transfer_concurrency;
+  std::string local;  // Local directory
+  std::string remote; // Remote directory, relative to the current one
+};
+
+// Parse the arguments of mirror, returns false on invalid options
+bool parse_mirror_options(const std::string &arguments,
+                          mirror_options &options);
+
+// A file or a directory of a tree
+struct tree_entry {
+  bool is_directory = false;
+  uint64_t size = 0;
+  std::string modify; // YYYYMMDDHHMMSS, UTC
+};
+// Entries by path relative to the root of the tree, parents come first
+using tree = std::map<std::string, tree_entry>;
+
+// What makes the target tree match the source tree (relative paths)
+struct mirror_plan {
+  bool create_root = false; // The target root does not exist yet
+  std::vector<std::string> directories; // To create, parents first
+  std::vector<std::pair<std::string, tree_entry>> transfers; // Source files
+  std::vector<std::string> removals;            // Target files (--delete)
+  std::vector<std::string> removed_directories; // Children first
+  // A file on one side and a directory on the other, left alone with
+  // everything beneath them
+  std::vector<std::string> conflicts;
+  uint64_t bytes = 0;     // Estimated transfer volume
+  uint64_t unchanged = 0; // Files found identical
+  uint64_t extra = 0;     // Target entries kept without --delete
+};
+
+// Result of running a plan
+struct mirror_summary {
+  uint64_t files_transferred = 0;
+  uint64_t bytes = 0;
+  uint64_t directories_created = 0;
+  uint64_t entries_removed = 0;
+  double seconds = 0;
+  // Path and reason of every failed operation
+  std::vector<std::pair<std::string, std::string>> failures;
+};
+
+// Keeps a remote tree and a local one in sync, in either direction
+// Both trees are walked (the remote one with MLSD) and their files compared
+// by size, then by modification time (copied when the source is newer) or
+// by CRC-32 (XCRC); the plan is then run over a pool of sessions
+// Downloads get the modification time of their remote file, uploads are
+// newer than their local file, so that nothing is copied twice
+class mirror {
+public:
+  // remote_root is absolute
+  mirror(sockpp::inet_address server, std::string username,
+         std::string password, mirror_options options,
+         std::string remote_root);
+
+  // Walk and compare both trees, returns false (see error()) if the
+  // source cannot be read
+  bool plan(mirror_plan &plan);
+  // Create the directories, transfer the files over the pool, then delete
+  mirror_summary run(const mirror_plan &plan);
+
+  // Why plan() failed
+  const std::string &error() const { return error_; }
+
+private:
+  // Read the trees, false if the root does not exist
+  bool walk_local(tree &entries);
+  bool walk_remote(tree &entries);
+  // Same CRC-32 on both sides?
+  bool same_contents(const std::string &relative);
+
+  // Session of the walk and of the directory operations
+  bool open_control();
+
+  std::filesystem::path local_root() const;
+  std::string remote_path(const std::string &relative) const;
+
+  mirror_options options_;
+  std::string remote_root_;
+  parallel_transfer pool_;
+  std::unique_ptr<parallel_transfer::session> control_;
+  // Reads local files to hash them, allocated on first use
+  std::unique_ptr<char[]> buffer_;
+  std::string error_;
+};
+
+// Print a plan, one line per operation, and the transfer volume
+void print_mirror_plan(const mirror_plan &plan,
+                       const mirror_options &options, std::ostream &out);
+
+} // namespace ftp
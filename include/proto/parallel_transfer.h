@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sockpp/tcp_connector.h>
+
+#include "proto/proto_interpreter.h"
+#include "utils/work_queue.h"
+
+namespace ftp {
+
+// Default number of parallel sessions of mget/mput
+constexpr size_t default_transfer_concurrency = 4;
+
+// Options of mget/mput: [-r] [-j <sessions>] <path>...
+struct transfer_options {
+  bool recursive = false;
+  bool parallel = false; // -r or -j given
+  size_t concurrency = default_transfer_concurrency;
+  std::vector<std::string> paths;
+};
+
+// Parse the arguments of mget/mput, returns false on invalid options
+bool parse_transfer_options(const std::string &arguments,
+                            transfer_options &options);
+
+// Join a remote directory and a relative path
+std::string remote_join(const std::string &directory,
+                        const std::string &relative);
+
+// Result of a parallel transfer
+struct transfer_summary {
+  uint64_t files_ok = 0;
+  uint64_t bytes = 0;
+  double seconds = 0;
+  // Path and reason of every failed file
+  std::vector<std::pair<std::string, std::string>> failures;
+};
+
+// Transfers files and directory trees over a pool of independent sessions,
+// each with its own control and data connections
+// One extra session walks the trees and feeds a work-stealing queue, so that
+// transfers start while the walk is still in progress
+class parallel_transfer {
+public:
+  parallel_transfer(sockpp::inet_address server, std::string username,
+                    std::string password, size_t concurrency);
+
+  // Download remote paths (relative to remote_directory) into the current
+  // local directory
+  transfer_summary download(const std::string &remote_directory,
+                            const std::vector<std::string> &paths,
+                            bool recursive);
+  // Upload local paths into remote_directory
+  transfer_summary upload(const std::string &remote_directory,
+                          const std::vector<std::string> &paths,
+                          bool recursive);
+
+  // A file to transfer
+  struct job {
+    std::string remote_directory; // Absolute directory on the server
+    std::string remote_name;      // File name within remote_directory
+    std::filesystem::path local_path; // Empty for remote deletions
+    // Modification time given to a downloaded file (YYYYMMDDHHMMSS, UTC),
+    // empty to leave the time of the download
+    std::string modify;
+  };
+
+  // Transfer files listed beforehand (by mirror), without walking
+  transfer_summary download(const std::vector<job> &jobs);
+  transfer_summary upload(const std::vector<job> &jobs);
+  // Delete remote files
+  transfer_summary remove(const std::vector<job> &jobs);
+
+  // A logged in session in passive mode
+  struct session {
+    sockpp::tcp_connector connector;
+    std::unique_ptr<protocol_interpreter_client> interpreter;
+    std::string remote_directory; // Current directory on the server
+  };
+
+  // Connect, log in and enter passive mode, returns nullptr on failure
+  std::unique_ptr<session> open_session();
+
+private:
+  // Change the remote directory of a session if needed
+  bool change_directory(session &s, const std::string &remote_directory);
+
+  // Run the workers while walk() feeds the queue
+  template <typename Walk, typename Transfer>
+  transfer_summary run(Walk walk, Transfer transfer);
+
+  // Record a failed file
+  void fail(const std::string &path, const std::string &reason);
+
+  // Walkers
+  void walk_remote(session &walker, const std::string &remote_directory,
+                   const std::vector<std::string> &paths, bool recursive);
+  void walk_local(session &walker, const std::string &remote_directory,
+                  const std::vector<std::string> &paths, bool recursive);
+
+  sockpp::inet_address server_;
+  std::string username_;
+  std::string password_;
+  size_t concurrency_;
+
+  std::unique_ptr<work_stealing_queue<job>> queue_;
+
+  // Results, shared by the workers
+  std::mutex summary_mutex_;
+  transfer_summary summary_;
+};
+
+} // namespace ftp
@@ -1,19 +1,36 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <filesystem>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <sockpp/tcp_acceptor.h>
 #include <sockpp/tcp_connector.h>
 #include <sockpp/tcp_socket.h>
 
+#include "utils/io.h"
+#include "utils/metrics.h"
+#include "utils/session_fs.h"
+#include "utils/session_status.h"
+#include "utils/stat_cache.h"
+#include "utils/vfs.h"
+
 namespace ftp {
 
+// Options of mget/mput, see proto/parallel_transfer.h
+struct transfer_options;
+// Entry of an MLSD listing, see utils/mlsd.h
+struct remote_entry;
+
 class protocol_interpreter_client {
 public:
   protocol_interpreter_client(sockpp::tcp_connector *const connector);
@@ -25,12 +42,56 @@ public:
   // Is protocol interpreter running?
   bool is_running() const;
 
+  // Run commands without a prompt, as typed in it; runs of commands that
+  // only query or change metadata (cd, mkdir, rmdir, rm, size, mdtm,
+  // xcrc, pwd) are pipelined, their replies matched in order
+  // Returns the number of commands that failed
+  size_t run_batch(const std::vector<std::string> &commands);
+
+  // Non-interactive use (parallel transfers)
+  // Log in with USER (and PASS if the server asks for it)
+  bool login(const std::string &username, const std::string &password);
+  // Send PASV and remember the announced data port
+  bool enter_passive_mode();
+  // Send PORT and listen on port for data connections
+  bool enter_active_mode(uint16_t port);
+  // Send a command and wait for the response
+  std::string execute(const std::string &command);
+  // Retrieve a file from the server into local_path
+  bool retrieve(const std::string &filename,
+                const std::filesystem::path &local_path);
+  // Retrieve a file from the server into a descriptor (a file, or a pipe
+  // filled with splice())
+  bool retrieve(const std::string &filename, int fd);
+  // Store a local file into the server's current directory
+  bool store(const std::string &filename);
+  // Store local_path as filename in the server's current directory
+  bool store(const std::string &filename,
+             const std::filesystem::path &local_path);
+  // Receive the machine readable listing (MLSD) of a directory into
+  // entries
+  bool list(const std::string &directory, std::vector<remote_entry> &entries);
+  // Do not print responses or progress bars
+  void set_quiet(bool quiet);
+
 private:
   sockpp::tcp_connector *connector_;
   std::atomic<bool> running_;
 
-  // Buffer for reading data from the server
-  std::shared_ptr<char> buf_;
+  // Credentials of the logged in user, used to open more sessions
+  std::string username_;
+  std::string password_;
+
+  // Suppress output meant for the interactive user
+  bool quiet_;
+
+  // Error replies (4xx and 5xx), failed transfers and invalid commands
+  size_t failures_ = 0;
+  // Replies received past those of pipelined commands
+  std::string pending_replies_;
+
+  // Buffer for reading replies from the server
+  ftp::message_buffer buf_;
 
   // States of the protocol interpreter
   // 0: Not logged in
@@ -47,6 +108,23 @@ private:
 
   // Client listening port in active mode
   uint16_t client_data_port_;
+  // Listening on client_data_port_ from PORT on, so that the server can
+  // connect as soon as it reads the command of a transfer
+  sockpp::tcp_acceptor data_acceptor_;
+  // Server data port announced by PASV (0: the port next to command port)
+  uint16_t server_data_port_;
+
+  // Run a command as typed in the prompt
+  void dispatch(const std::string &input);
+  // Send a command, ended with CRLF so that the server can tell it from
+  // the next one
+  void send_command(const std::string &command);
+  // Wait for the response of the server, counting errors as failures
+  // Returns at least one whole reply (all the lines of a reply of several)
+  std::string receive_reply();
+  // Send commands in one write, then print their replies
+  void run_pipelined(
+      const std::vector<std::pair<ftp::operation, std::string>> &commands);
 
   // Send username to the server, wait for response
   void do_user(std::string username);
@@ -60,14 +138,23 @@ private:
   void do_pasv();
 
   // implement the FTP commands
-  // Retrieve file from the server, save it to the local file system
+  // Retrieve file from the server, save it to the local file system (or
+  // stream it to standard output)
   // And wait for response
-  void do_retr(std::string filename);
+  void do_retr(std::string argument);
   // Store file to the server, read it from the local file system
   // And wait for response
   void do_stor(std::string filename);
   // List files in the current directory, wait for response
   void do_list();
+  // Print the machine readable listing of a directory, wait for response
+  void do_mlsd(std::string directory);
+  // Ask for the size of a file, wait for response
+  void do_size(std::string filename);
+  // Ask for the modification time of a file, wait for response
+  void do_mdtm(std::string filename);
+  // Ask for the CRC-32 of a file, wait for response
+  void do_xcrc(std::string filename);
   // Change working directory, wait for response
   void do_cwd(std::string directory);
   // Change to parent directory, wait for response
@@ -84,6 +171,19 @@ private:
   void do_rnfr(std::string oldname);
   // Rename to, wait for response
   void do_rnto(std::string newname);
+  // Upload many files over one data connection, wait for response
+  // With -r, upload directory trees using parallel sessions
+  void do_mput(std::string arguments);
+  // Download files or (with -r) directory trees using parallel sessions
+  void do_mget(std::string arguments);
+  // Current directory on the server, empty (and the reply printed) on
+  // failure
+  std::string remote_working_directory();
+  // Run mget/mput over a pool of sessions and print the summary
+  void run_parallel_transfer(bool download,
+                             const transfer_options &options);
+  // Synchronize a local and a remote tree over a pool of sessions
+  void do_mirror(std::string arguments);
 
   // Help command, runs locally without server
   void do_help();
@@ -92,22 +192,46 @@ private:
   // socket.
   // These functions will establish a data connection with the client
   // based on the mode (active or passive)
-  void send_file(std::string filename);
-  void receive_file(std::string filename);
+  // They return false if the transfer failed
+  bool send_file(std::string filename);
+  bool receive_file(std::string filename, int local_fd);
 
   // Implementation of file() and receive_file() in active mode and
   // passive mode
-  void send_file_active(std::string filename);
-  void send_file_passive(std::string filename);
-
-  void receive_file_active(std::string filename);
-  void receive_file_passive(std::string filename);
+  bool send_file_active(std::string filename);
+  bool send_file_passive(std::string filename);
+
+  bool receive_file_active(std::string filename, int local_fd);
+  bool receive_file_passive(std::string filename, int local_fd);
+  // Receive the size and the contents of a file over an established data
+  // connection, into local_fd
+  bool receive_file_data(sockpp::tcp_socket &data_sock, int local_fd);
+
+  // Establish a data connection with the server based on the mode
+  // Returns a closed socket on failure
+  sockpp::tcp_socket open_data_connection();
+  // Listen on client_data_port_ for the data connections of active mode,
+  // returns false if the port cannot be opened
+  bool listen_for_data();
+  // Accept the data connection of the server in active mode
+  // Returns a closed socket on failure
+  sockpp::tcp_socket accept_data_connection();
+  // Stream files as one batch over a data connection
+  // Returns the number of bytes sent
+  uint64_t send_batch(const std::vector<std::string> &filenames);
+  // Extract a directory sent as a tar stream into the current directory
+  void receive_archive(std::string directory);
+  // Copy a directory sent as a tar stream to a descriptor, unextracted
+  bool receive_archive(int fd);
+  // Copy a listing sent over a data connection to standard output, or
+  // into listing
+  bool receive_listing(std::string *listing);
 };
 
 class protocol_interpreter_server {
 public:
   protocol_interpreter_server(sockpp::tcp_socket sock);
-  ~protocol_interpreter_server() = default;
+  ~protocol_interpreter_server();
 
   void run();
   void stop();
@@ -115,12 +239,30 @@ public:
   // Is protocol interpreter running?
   bool is_running() const;
 
+  // What the session is doing, read and tuned by the admin socket
+  session_status &status() { return status_; }
+  // End the session from another thread: its control connection is shut
+  // down and its transfer stops at the next chunk
+  void kill();
+
 private:
   sockpp::tcp_socket sock_;
   std::atomic<bool> running_ = false;
-
-  // Buffer for reading data from the client
-  std::shared_ptr<char> buf_;
+  // Keeps kill() from shutting down a socket closed by stop()
+  std::mutex socket_mutex_;
+
+  session_status status_;
+  // Transfer pacing of the current command, see transfer_progress()
+  std::chrono::steady_clock::time_point pace_started_;
+  uint64_t pace_bytes_ = 0;
+  uint64_t pace_limit_ = 0;
+
+  // Buffer for reading control messages from the client, starts at a few KB
+  // (file data goes through leases from ftp::buffer_pool instead)
+  ftp::message_buffer buf_;
+  // Splits pipelined commands, every read of the control connection goes
+  // through it
+  ftp::message_framer framer_;
 
   // States of the protocol interpreter
   // 0: Not logged in
@@ -133,8 +275,9 @@ private:
   //    or : do commands that not require data connection
   //    loop until the user quits
 
-  // Current working directory
-  std::filesystem::path current_working_directory_;
+  // Current working directory in the storage, every path of the client is
+  // resolved from it
+  ftp::session_fs fs_;
 
   // Bool variables to check the state of the server
   bool is_username_valid_;
@@ -148,10 +291,32 @@ private:
   bool is_passive_mode_;
   // Client listening port in active mode
   uint16_t client_data_port_;
+  // Listener on an ephemeral data port, opened by PASV
+  // Without it, passive transfers use the port next to the command port
+  sockpp::tcp_acceptor pasv_acceptor_;
 
-  // A string for renaming files
+  // A string for renaming files (absolute client path)
   std::string rename_oldname_path_;
 
+  // Upload being received by the storage
+  // It replaces its destination only after the size and DONE check out
+  struct staged_upload {
+    std::unique_ptr<ftp::vfs_upload> file;
+    std::filesystem::path final_path; // For logs and caches
+    std::string path;                 // In the storage, for the quota
+    bool complete = false;
+    // Room reserved in the quota of the user, from the declared size
+    uint64_t quota_reserved = 0;
+    // The declared size did not fit the quota, nothing was staged
+    bool over_quota = false;
+    // For the transfer log: when the data started and stopped coming, and
+    // how much of it came
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point finished;
+    uint64_t received = 0;
+  };
+  staged_upload staged_upload_;
+
   // Check username and password
   void do_user(std::string username);
   void do_pass(std::string password);
@@ -167,6 +332,14 @@ private:
   void do_stor(std::string filename);
   // List files in the current working directory and send it to the client
   void do_list();
+  // Stream a machine readable listing of a directory over a data connection
+  void do_mlsd(std::string directory);
+  // Send the size of a file to the client
+  void do_size(std::string filename);
+  // Send the modification time of a file to the client
+  void do_mdtm(std::string filename);
+  // Send the CRC-32 of a whole file to the client
+  void do_xcrc(std::string filename);
   // Change current working directory, send response to the client
   void do_cwd(std::string directory);
   // Change to parent directory, send response to the client
@@ -183,21 +356,68 @@ private:
   void do_rnfr(std::string oldname);
   // Rename to, send response to the client
   void do_rnto(std::string newname);
+  // Receive many files over one data connection, send per-file results
+  void do_mput(std::string count);
 
   // send_file() and recv_file() are used to send and receive files over a
   // socket.
   // These functions will establish a data connection with the client
   // based on the mode (active or passive)
-  void send_file(std::string filename);
+  // send_file() sends the file opened by do_retr()
+  void send_file(std::string filename, std::unique_ptr<ftp::vfs_file> file);
   void receive_file(std::string filename);
 
   // Implementation of file() and receive_file() in active mode and
   // passive mode
-  void send_file_active(std::string filename);
-  void send_file_passive(std::string filename);
+  void send_file_active(std::string filename,
+                        std::unique_ptr<ftp::vfs_file> file);
+  void send_file_passive(std::string filename,
+                         std::unique_ptr<ftp::vfs_file> file);
 
   void receive_file_active(std::string filename);
   void receive_file_passive(std::string filename);
+
+  // Establish a data connection with the client based on the mode
+  // Returns a closed socket on failure
+  sockpp::tcp_socket open_data_connection();
+  // Wait for the next message of the client, "" once disconnected
+  std::string receive_command();
+  // Wait for what the client sends after a transfer ("DONE")
+  std::string receive_acknowledge();
+  // Receive a batch stream and store every file in it
+  // Returns the name and outcome of every file
+  std::vector<std::pair<std::string, bool>> receive_batch();
+  // Stream a directory tree as a tar archive, generated while walking it
+  void send_archive(const std::string &directory);
+  // Stream the MLSD lines of a directory, generated while reading it
+  void send_listing(const std::string &directory);
+
+  // Account for bytes of file data moved by the current command, and sleep
+  // as long as the rate limit of the session asks for
+  // Returns false once the session is killed, to stop the transfer
+  bool transfer_progress(ftp::transfer_direction direction, uint64_t bytes);
+  // Bytes to send between two calls to transfer_progress()
+  size_t transfer_chunk() const;
+
+  // Status of a file in the current working directory, from the stat cache
+  // Sends a 550 response and returns false unless it is a regular file
+  bool regular_file_status(const std::string &filename,
+                           ftp::file_status &status);
+
+  // Queue a record of a finished transfer for the transfer log
+  void log_transfer(const std::filesystem::path &path,
+                    ftp::transfer_direction direction, uint64_t bytes,
+                    uint64_t duration_nanoseconds, bool complete);
+  // Queue the record of the staged upload
+  void log_upload(bool complete);
+
+  // Start an upload of size bytes in the current working directory
+  // Fails without taking any data if it does not fit the quota of the user
+  bool stage_upload(std::string filename, uint64_t size);
+  // Commit the staged upload, replacing its destination
+  bool commit_upload();
+  // Discard the staged upload
+  void abort_upload();
 };
 
 } // namespace ftp
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ftp {
+
+// Settings of the admin socket, configured by "admin" in config.json
+struct admin_settings {
+  bool enabled = false;
+  // Unix domain socket, only its owner may connect
+  std::string path = "simple-ftp.sock";
+
+  static const admin_settings &instance();
+};
+
+// Local administration socket, for operators
+// Clients send command lines ("sessions", "kill 3"...) and get a reply to
+// each, whose first line starts with "ok" or "error"; they may send several
+// commands before closing the connection:
+//
+//   echo sessions | nc -U simple-ftp.sock
+//
+// Connections are served one at a time on a thread of its own
+class admin_socket {
+public:
+  // Reply to a command, given the words after its name
+  using handler =
+      std::function<std::string(const std::vector<std::string> &arguments)>;
+
+  explicit admin_socket(std::string path);
+  ~admin_socket();
+  admin_socket(const admin_socket &) = delete;
+  admin_socket &operator=(const admin_socket &) = delete;
+
+  // Answer a command, before start(); usage is shown by "help"
+  void command(const std::string &name, const std::string &usage,
+               handler reply);
+
+  // Start listening, returns false if the socket cannot be created
+  bool start();
+  // Stop listening, wait for the thread and remove the socket
+  void stop();
+
+private:
+  struct command_entry {
+    std::string usage;
+    handler reply;
+  };
+
+  // Accept connections until stopped
+  void serve();
+  // Answer the commands of one connection until it is closed
+  void answer(int fd);
+  // Reply to one command line
+  std::string reply(const std::string &line);
+  // Wait for fd to be readable, returns false once stopped
+  bool wait_readable(int fd);
+
+  std::string path_;
+  std::map<std::string, command_entry> commands_;
+
+  int listen_fd_ = -1;
+  int wake_fds_[2] = {-1, -1}; // Written to by stop()
+  std::atomic<bool> running_ = false;
+  std::thread thread_;
+};
+
+} // namespace ftp
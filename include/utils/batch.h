@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace ftp {
+
+// Framing of a batched upload (MPUT) over one data connection:
+//   "FILE <size> <name>\n" followed by <size> bytes, for every file
+//   "END\n" after the last file
+const std::string batch_end_marker = "END\n";
+
+// Longest header line accepted by the receiver
+constexpr size_t batch_max_header_size = 4096;
+
+// Build the header of a file in the batch stream
+std::string batch_file_header(const std::string &name, uint64_t size);
+
+// Parse a header line (without the trailing newline)
+// Returns false if the line is malformed, sets end on the END marker
+bool parse_batch_header(const std::string &line, std::string &name,
+                        uint64_t &size, bool &end);
+
+} // namespace ftp
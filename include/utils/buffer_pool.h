@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ftp {
+
+// How the slabs of the buffer pool are backed
+enum class huge_page_mode {
+  none,        // Regular pages
+  transparent, // madvise(MADV_HUGEPAGE), the kernel promotes when it can
+  reserved,    // MAP_HUGETLB from the reserved pool, regular pages if empty
+};
+
+// Parse "none", "transparent" or "reserved" (defaults to none)
+huge_page_mode parse_huge_page_mode(const std::string &name);
+
+class buffer_pool;
+
+// A buffer leased from the pool, returned to it when the lease is destroyed
+class buffer_lease {
+public:
+  buffer_lease() = default;
+  buffer_lease(buffer_lease &&other) noexcept;
+  buffer_lease &operator=(buffer_lease &&other) noexcept;
+  buffer_lease(const buffer_lease &) = delete;
+  buffer_lease &operator=(const buffer_lease &) = delete;
+  ~buffer_lease();
+
+  char *data() const { return data_; }
+  size_t size() const { return size_; }
+  explicit operator bool() const { return data_ != nullptr; }
+
+private:
+  friend class buffer_pool;
+  buffer_lease(buffer_pool *pool, char *data, size_t size);
+
+  buffer_pool *pool_ = nullptr;
+  char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Server-wide pool of equally sized data buffers
+// Memory is mapped in slabs of several buffers when needed, up to a maximum
+// number of buffers; leases wait while the pool is exhausted, up to a
+// timeout. Past a number of idle buffers, the pages of those returned the
+// longest ago go back to the kernel, so that a burst of transfers does not
+// leave its memory resident
+class buffer_pool {
+public:
+  buffer_pool(size_t buffer_size, size_t buffers_per_slab, size_t max_buffers,
+              huge_page_mode mode, size_t idle_buffers,
+              std::chrono::milliseconds lease_timeout);
+  ~buffer_pool();
+
+  // Server-wide instance, configured by "bufferPool" in config.json
+  static buffer_pool &instance();
+
+  size_t buffer_size() const;
+
+  // Lease one buffer, an empty lease if none was returned in time
+  buffer_lease lease();
+  // Lease up to count buffers at once, as many as are free but at least
+  // one; none if none was returned in time
+  // Waiting only for the first one, so that transfers wanting many neither
+  // starve behind those wanting one nor block each other with a part of
+  // what they want
+  std::vector<buffer_lease> lease(size_t count);
+
+  // Occupancy
+  size_t leased() const;      // Buffers in use
+  size_t high_water() const;  // Most buffers in use at once
+  size_t allocated() const;   // Buffers backed by memory
+  size_t resident() const;    // Of those, the ones whose pages are in use
+  size_t max_buffers() const; // Upper bound of allocated()
+  size_t slabs() const;       // Mapped slabs
+
+private:
+  friend class buffer_lease;
+
+  // Return a buffer to the free list
+  void release(char *data);
+  // Map a new slab, mutex_ must be held
+  bool grow();
+
+  size_t buffer_size_;
+  size_t buffers_per_slab_;
+  size_t max_buffers_;
+  huge_page_mode huge_pages_;
+  size_t idle_buffers_;
+  std::chrono::milliseconds lease_timeout_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable available_cv_;
+  // Leased from the back; the first trimmed_ have no pages
+  std::vector<char *> free_;
+  size_t trimmed_ = 0;
+  std::vector<std::pair<void *, size_t>> slabs_; // Address and length
+  size_t allocated_ = 0;
+  size_t leased_ = 0;
+  size_t high_water_ = 0;
+};
+
+} // namespace ftp
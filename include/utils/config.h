@@ -0,0 +1,11 @@
+#pragma once
+
+#include <json/json.h>
+
+namespace ftp {
+
+// Read and parse config.json from the current directory
+// Throws std::runtime_error if the file cannot be parsed
+Json::Value read_config();
+
+} // namespace ftp
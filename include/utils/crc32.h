@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ftp {
+
+// CRC-32 (IEEE 802.3, as zlib and XCRC) of size bytes, continuing from the
+// CRC of the bytes before them (0 for the first ones)
+uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+
+// CRC-32 of the whole file open at fd, read from its start into buffer
+// Returns false if the file cannot be read
+bool crc32_file(int fd, char *buffer, size_t buffer_size, uint32_t &crc);
+
+} // namespace ftp
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ftp {
+
+// How uploaded files are made durable before they are renamed into place
+enum class durability_policy {
+  none,         // Rely on the page cache (atomic rename only)
+  fsync,        // fdatasync() every file and its directory
+  group_commit, // Batch the syncs of concurrent uploads into one syncfs()
+};
+
+// Parse "none", "fsync" or "group" (defaults to none)
+durability_policy parse_durability_policy(const std::string &name);
+
+// Syncs files according to the configured durability policy
+// With group commit, one thread collects the sync requests of concurrent
+// sessions for a short window and flushes them together
+class durability_manager {
+public:
+  durability_manager(durability_policy policy,
+                     std::chrono::microseconds group_commit_window);
+  ~durability_manager();
+
+  // Server-wide instance, configured by "uploadDurability" in config.json
+  static durability_manager &instance();
+
+  durability_policy policy() const;
+
+  // Make the data of fd durable, blocks until done
+  // Returns false if the sync failed
+  bool sync(int fd);
+
+private:
+  // A sync request waiting for the next group commit
+  struct request {
+    int fd;
+    bool done = false;
+    bool successful = false;
+  };
+
+  // Group commit thread
+  void run_group_commit();
+
+  durability_policy policy_;
+  std::chrono::microseconds group_commit_window_;
+
+  std::mutex mutex_;
+  std::condition_variable pending_cv_;
+  std::condition_variable done_cv_;
+  std::vector<request *> pending_;
+  bool stopping_ = false;
+  std::thread group_commit_thread_;
+};
+
+} // namespace ftp
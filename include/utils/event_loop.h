@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ftp {
+
+// Readiness of file descriptors (epoll, level triggered) and timers, so
+// that one thread drives many non-blocking connections
+// Handlers, tasks and timers run on the thread calling run(); watch(),
+// unwatch(), post() and stop() may be called from any thread
+class event_loop {
+public:
+  // Called with the epoll events of the descriptor (EPOLLIN, EPOLLOUT...)
+  // A descriptor number reused after unwatch() may see a stale event, so
+  // handlers must expect spurious wake-ups (EAGAIN)
+  using handler = std::function<void(uint32_t events)>;
+  using task = std::function<void()>;
+  using clock = std::chrono::steady_clock;
+
+  event_loop();
+  ~event_loop();
+  event_loop(const event_loop &) = delete;
+  event_loop &operator=(const event_loop &) = delete;
+
+  // Could epoll and the wake-up descriptor be set up?
+  bool is_open() const { return epoll_fd_ != -1 && wake_fd_ != -1; }
+
+  // Call h whenever fd is ready for events; the events and the handler of
+  // a descriptor already watched are replaced
+  bool watch(int fd, uint32_t events, handler h);
+  // Stop watching fd, before closing it
+  void unwatch(int fd);
+
+  // Run t on the loop thread, in the order posted
+  void post(task t);
+  // Run t on the loop thread once delay has passed
+  void post_after(clock::duration delay, task t);
+
+  // Dispatch events, tasks and timers until stop()
+  void run();
+  // Make run() return, or the next run() if it has not started yet
+  void stop();
+
+  // Is the caller the thread in run()?
+  bool in_loop_thread() const {
+    return thread_.load() == std::this_thread::get_id();
+  }
+
+private:
+  // Interrupt epoll_wait()
+  void wake();
+  // Milliseconds epoll_wait() may sleep until the next task or timer
+  int wait_timeout();
+  // Run the posted tasks and the timers due
+  void run_due();
+
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1; // eventfd
+  std::atomic<bool> stopped_ = false;
+  std::atomic<std::thread::id> thread_;
+
+  std::mutex mutex_;
+  // Shared, so that a handler unwatched while it runs lives until it returns
+  std::unordered_map<int, std::shared_ptr<handler>> handlers_;
+  std::vector<task> tasks_;
+  std::multimap<clock::time_point, task> timers_;
+};
+
+} // namespace ftp
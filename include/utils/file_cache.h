@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "utils/sharded_lru.h"
+
+namespace ftp {
+
+// In-memory cache of small, frequently downloaded files
+// Entries are keyed by path and validated against the inode, size and
+// timestamps of the file, so a changed file is never served from memory
+class file_cache {
+public:
+  file_cache(size_t capacity_bytes, size_t max_file_bytes, size_t shard_count,
+             bool zero_copy, size_t zero_copy_min_bytes);
+  ~file_cache() = default;
+
+  // Server-wide instance, configured by "fileCache" in config.json
+  static file_cache &instance();
+
+  // Is the cache enabled (capacity > 0)?
+  bool enabled() const;
+  // Files larger than this are never cached
+  size_t max_file_bytes() const;
+
+  // Look up the contents of a file, nullptr on miss or stale entry
+  std::shared_ptr<const std::string> lookup(const std::string &path,
+                                            const struct stat &file_stat);
+  // Read the whole file from fd and insert it into the cache
+  // Returns nullptr if the file is too large or cannot be read
+  std::shared_ptr<const std::string> load(const std::string &path, int fd,
+                                          const struct stat &file_stat);
+  // Drop the entry of a path (after STOR, DELE, RNTO...)
+  void invalidate(const std::string &path);
+
+  // Send count bytes of cached contents from offset to a socket, using
+  // MSG_ZEROCOPY if enabled and they are large enough for pinning pages to
+  // pay off; they stay referenced until the kernel is done with them (see
+  // finish()). Returns the number of bytes sent
+  size_t send(int socket_fd, const std::shared_ptr<const std::string> &data,
+              size_t offset, size_t count);
+  // Before a socket that send() used is closed: wait a little for the
+  // completions of its zerocopy sends, then leave the rest to a duplicate
+  // of it that is closed once they all arrived
+  void finish(int socket_fd);
+
+  // Hit and miss counters
+  uint64_t hits() const;
+  uint64_t misses() const;
+  // Bytes currently held by the cache
+  size_t size_bytes() const;
+
+private:
+  struct entry {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    std::shared_ptr<const std::string> data;
+  };
+
+  // Zerocopy sends on one socket, numbered by the kernel from 0; each one
+  // keeps the contents it sent until its completion is reported
+  struct zero_copy_send {
+    uint32_t id;
+    bool done;
+    std::shared_ptr<const std::string> data;
+  };
+  struct zero_copy_socket {
+    bool enabled = false; // SO_ZEROCOPY could be set
+    uint32_t next_id = 0;
+    std::deque<zero_copy_send> in_flight;
+  };
+
+  // State of a socket, SO_ZEROCOPY being set on its first send
+  zero_copy_socket &zero_copy_state(int socket_fd);
+  // Drop the sends of a socket whose completions are queued, without waiting
+  static void reap(int socket_fd, zero_copy_socket &state);
+
+  size_t max_file_bytes_;
+  bool zero_copy_;
+  size_t zero_copy_min_bytes_;
+  sharded_lru<entry> entries_;
+
+  std::mutex zero_copy_mutex_;
+  std::unordered_map<int, zero_copy_socket> zero_copy_sockets_;
+  // Duplicates of closed sockets still waiting for completions
+  std::vector<std::pair<int, zero_copy_socket>> parked_sockets_;
+
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+};
+
+} // namespace ftp
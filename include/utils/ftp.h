@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 #include <utility>
 #include <vector>
@@ -31,7 +32,19 @@ enum operation {
   RNTO,     // Rename to (rnto <new>)
   HELP,     // Help (Print all commands and their description)
   NOOP,     // No operation
+  // Operations added later go last, so that the numbers above stay put
+  MPUT,     // Batched upload of many files (mput <file>...)
+  MGET,     // Parallel download (mget [-r] [-j <sessions>] <path>...)
+  MLSD,     // Machine readable listing (mlsd [<dir>])
+  SIZE,     // Size of a file (size <filename>)
+  MDTM,     // Modification time of a file (mdtm <filename>)
+  XCRC,     // CRC-32 of a file (xcrc <filename>)
+  MIRROR,   // Synchronize trees (mirror [<options>] up|down <local> <remote>)
 };
+constexpr size_t operation_count = MIRROR + 1;
+
+// Upper case name of an operation ("RETR"), for logs and metrics
+const char *operation_name(operation op);
 
 // Trim the leading and trailing whitespace from a string
 std::string trim(const std::string &str);
@@ -43,4 +56,15 @@ std::vector<std::string> split(const std::string &str,
 
 // Parse the command and return the operation
 std::pair<operation, std::string> parse_command(std::string command);
+
+// Does a reply carry an error code, 4xx or 5xx ("550 File not found")?
+bool is_error_reply(const std::string &reply);
+// Is a reply to RETR that of a directory, sent as a tar archive? Those
+// start with archive_reply_code, files with "200"
+constexpr const char *archive_reply_code = "150";
+bool is_archive_reply(const std::string &reply);
+// Size of the first complete reply at the start of received, with its line
+// ends, or 0 if more is needed: a line, or the lines from "226-..." up to
+// the one starting with "226 "
+size_t reply_size(const std::string &received);
 } // namespace ftp
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+
+#include <sockpp/tcp_acceptor.h>
+
+namespace ftp {
+
+// Minimal HTTP/1.0 listener for local tooling (metrics scrapers)
+// Answers GET requests for a few fixed paths, one connection at a time, on
+// a thread of its own
+class http_listener {
+public:
+  // Body of a response, produced for every request
+  using handler = std::function<std::string()>;
+
+  http_listener(std::string address, uint16_t port);
+  ~http_listener();
+  http_listener(const http_listener &) = delete;
+  http_listener &operator=(const http_listener &) = delete;
+
+  // Serve GET requests for path, before start()
+  void route(const std::string &path, const std::string &content_type,
+             handler body);
+
+  // Start listening, returns false if the port cannot be opened
+  bool start();
+  // Stop listening and wait for the thread
+  void stop();
+
+private:
+  struct route_entry {
+    std::string content_type;
+    handler body;
+  };
+
+  // Accept connections until stopped
+  void serve();
+  // Read one request and answer it
+  void answer(sockpp::tcp_socket &sock);
+
+  std::string address_;
+  uint16_t port_;
+  std::map<std::string, route_entry> routes_;
+
+  sockpp::tcp_acceptor acceptor_;
+  std::atomic<bool> running_ = false;
+  std::thread thread_;
+};
+
+} // namespace ftp
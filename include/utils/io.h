@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <sockpp/tcp_connector.h>
 #include <sockpp/tcp_socket.h>
@@ -14,11 +15,55 @@ void send_message(sockpp::tcp_connector *connector, const std::string &data);
 // Send (using socket)
 void send_message(sockpp::tcp_socket *socket, const std::string &data);
 
-// Receive (using connector)
-std::string receive_message(sockpp::tcp_connector *connector,
-                            std::shared_ptr<char> buffer, size_t buffer_size);
-
 // Receive (using socket)
 std::string receive_message(sockpp::tcp_socket *socket,
                             std::shared_ptr<char> buffer, size_t buffer_size);
+
+// Buffer for control messages, small at first, grown when a message does
+// not fit and shrunk back once they fit again
+class message_buffer {
+public:
+  explicit message_buffer(size_t initial_size = 4096,
+                          size_t max_size = 1024 * 1024);
+
+  char *data() { return data_.data(); }
+  size_t size() const { return data_.size(); }
+
+  // Double the size (up to the maximum), returns false if already at it
+  bool grow();
+  // Back to the initial size, releasing the memory grown
+  void shrink();
+  size_t initial_size() const { return initial_size_; }
+
+private:
+  std::vector<char> data_;
+  size_t initial_size_;
+  size_t max_size_;
+};
+
+// Receive (using socket and a growable buffer)
+std::string receive_message(sockpp::tcp_socket *socket,
+                            message_buffer &buffer);
+
+// Splits what a peer sends on the control connection into messages
+// Peers end their messages with CRLF (or LF) and may send many at once
+// (pipelining): they are returned one at a time, and reads are buffered up
+// to the next line end, as a pipelined batch may be split anywhere
+class message_framer {
+public:
+  // Next message without its line end, empty lines are skipped
+  // Returns "" once the connection is closed, or when a line grew past
+  // max_line_size (see overflowed()); the rest of that line is skipped
+  std::string next(sockpp::tcp_socket *socket, message_buffer &buffer);
+  // Did the last next() give up on a line too long?
+  bool overflowed() const { return overflowed_; }
+
+  // Longest line waited for, as large as a control message
+  static constexpr size_t max_line_size = 1024 * 1024;
+
+private:
+  std::string pending_;   // Start of a message, and the messages after it
+  bool skipping_ = false; // Dropping a line too long, up to its end
+  bool overflowed_ = false;
+};
 } // namespace ftp
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "utils/vfs.h"
+
+namespace ftp {
+
+// Render the LIST response of a directory of the storage: directories
+// first, then files, each group sorted by name, directories in bold blue
+std::string render_listing(vfs &storage, const std::string &directory);
+
+// Server-wide cache of rendered directory listings, shared by all sessions
+// Entries are keyed by the location of the directory in the storage, and
+// invalidated by inotify events on it, so changes made outside of the
+// server are seen too. If inotify is not available (or out of watches, or
+// the directory is not on a local disk), entries are validated against the
+// directory's mtime; directories without one are never cached
+class listing_cache {
+public:
+  listing_cache(bool enabled, size_t max_directories, bool use_inotify);
+  ~listing_cache();
+
+  // Server-wide instance, configured by "listingCache" in config.json
+  static listing_cache &instance();
+
+  // Rendered listing of a directory (an absolute client path), from the
+  // cache or rebuilt
+  std::shared_ptr<const std::string> listing(vfs &storage,
+                                             const std::string &directory);
+
+  // Drop the entry of a directory whose contents the server just changed
+  // (inotify events arrive asynchronously, so a session could otherwise
+  // list a directory right after changing it and see the old contents)
+  void invalidate(const std::filesystem::path &directory);
+
+  // Statistics
+  uint64_t hits() const;
+  uint64_t misses() const;
+  uint64_t rebuild_micros_total() const;
+  uint64_t rebuild_micros_max() const;
+  size_t size() const;
+
+private:
+  struct entry {
+    std::shared_ptr<const std::string> listing;
+    // Bumped on every invalidation, so that a listing rendered while the
+    // directory changed is not stored
+    uint64_t generation = 0;
+    int watch = -1;       // inotify watch descriptor, -1 if none
+    int64_t mtime_ns = 0; // Fallback validation without a watch
+    std::list<std::string>::iterator lru; // Position in lru_
+  };
+
+  // Watch a directory, returns -1 on failure
+  int add_watch(const std::string &directory);
+  // Drop least recently used entries while the cache is full, mutex_ held
+  void evict();
+  // inotify thread
+  void run_watcher();
+
+  bool enabled_;
+  size_t max_directories_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, entry> entries_;
+  std::unordered_map<int, std::string> watches_; // Watch descriptor -> key
+  std::list<std::string> lru_; // Keys, most recently used first
+
+  int inotify_fd_ = -1;
+  int wakeup_fd_ = -1; // eventfd used to stop the watcher
+  std::thread watcher_;
+
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+  std::atomic<uint64_t> rebuild_micros_total_ = 0;
+  std::atomic<uint64_t> rebuild_micros_max_ = 0;
+};
+
+} // namespace ftp
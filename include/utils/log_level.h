@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+namespace ftp {
+
+// How much the server logs
+// Errors go to std::cerr and are always shown; everything else goes to
+// std::clog and is shown at the info level only
+enum class log_level {
+  error,
+  info,
+};
+
+// Parse "error" or "info", returns false if the name is unknown
+bool parse_log_level(const std::string &name, log_level &level);
+const char *log_level_name(log_level level);
+
+// Put a filter in front of std::clog, which drops its output below the
+// info level; call it once, before any thread logs
+void install_log_filter();
+
+// Change the level at any time, from any thread: the filter checks it with
+// a relaxed load on every write, and never locks
+void set_log_level(log_level level);
+log_level current_log_level();
+
+} // namespace ftp
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils/ftp.h"
+
+namespace ftp {
+
+// Direction of file data, as seen from the server
+enum class transfer_direction {
+  download, // Sent to clients (RETR, archives)
+  upload,   // Received from clients (STOR, MPUT)
+};
+
+// Latency histogram with HDR-style buckets: every power of two is split
+// into 4 linear sub-buckets, so that a value is known within 25% from 1 ns
+// up to 2^40 ns (about 18 minutes, larger values go to the last bucket)
+// A histogram is written by a single thread, with relaxed loads and stores
+// instead of locked instructions, and read by the exporter
+struct latency_histogram {
+  static constexpr unsigned sub_bucket_bits = 2;
+  static constexpr unsigned sub_buckets = 1u << sub_bucket_bits;
+  static constexpr unsigned max_bits = 40;
+  static constexpr size_t bucket_count =
+      (max_bits - sub_bucket_bits + 1) * sub_buckets;
+
+  // Bucket of a value
+  static size_t bucket_of(uint64_t nanoseconds) {
+    if (nanoseconds < sub_buckets) {
+      return size_t(nanoseconds);
+    }
+    const unsigned top_bit = 63 - unsigned(__builtin_clzll(nanoseconds));
+    if (top_bit >= max_bits) {
+      return bucket_count - 1;
+    }
+    const unsigned shift = top_bit - sub_bucket_bits;
+    return (shift + 1) * sub_buckets +
+           ((nanoseconds >> shift) & (sub_buckets - 1));
+  }
+  // Smallest value above a bucket
+  static uint64_t bucket_end(size_t bucket);
+
+  // Record a value, only from the thread owning the histogram
+  void record(uint64_t nanoseconds) {
+    auto bump = [](std::atomic<uint64_t> &cell, uint64_t value) {
+      cell.store(cell.load(std::memory_order_relaxed) + value,
+                 std::memory_order_relaxed);
+    };
+    bump(buckets[bucket_of(nanoseconds)], 1);
+    bump(count, 1);
+    bump(sum, nanoseconds);
+  }
+
+  std::atomic<uint64_t> buckets[bucket_count] = {};
+  std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> sum = 0; // Nanoseconds
+};
+
+// Histograms of all threads added together
+struct histogram_snapshot {
+  std::array<uint64_t, latency_histogram::bucket_count> buckets = {};
+  uint64_t count = 0;
+  uint64_t sum = 0; // Nanoseconds
+
+  void add(const latency_histogram &histogram);
+  // Upper bound of the bucket holding the q-th quantile (0 < q <= 1)
+  uint64_t quantile(double q) const;
+  // Number of values below a bound, for cumulative buckets
+  uint64_t count_below(uint64_t nanoseconds) const;
+};
+
+// Settings of the metrics endpoint, configured by "metrics" in config.json
+struct metrics_settings {
+  // Serve the metrics over HTTP (they are recorded in any case)
+  bool enabled = false;
+  // Keep the endpoint local by default, it is not authenticated
+  std::string address = "127.0.0.1";
+  uint16_t port = 9464;
+
+  static const metrics_settings &instance();
+};
+
+// Server metrics: latency of every command, data connection setup time,
+// bytes of file data per direction and sessions
+// Every thread records into a block of its own, so that recording is a few
+// uncontended relaxed stores; the exporter adds the blocks together. Blocks
+// of exited threads are handed to new threads, their counts are kept
+class metrics {
+public:
+  metrics() = default;
+  ~metrics() = default;
+  metrics(const metrics &) = delete;
+  metrics &operator=(const metrics &) = delete;
+
+  // Server-wide instance
+  static metrics &instance();
+
+  // Hot path, recorded by the calling thread
+  static void record_command(operation op, uint64_t nanoseconds);
+  static void record_data_connection(uint64_t nanoseconds);
+  static void add_bytes(transfer_direction direction, uint64_t bytes);
+
+  // A session started or ended
+  void session_started();
+  void session_ended();
+
+  // Totals over all threads
+  histogram_snapshot command_latency(operation op) const;
+  histogram_snapshot data_connection_latency() const;
+  uint64_t bytes(transfer_direction direction) const;
+  uint64_t active_sessions() const;
+  uint64_t total_sessions() const;
+
+  // All metrics, including the server caches and the buffer pool, in the
+  // Prometheus text exposition format
+  std::string render_prometheus() const;
+
+private:
+  struct thread_block {
+    latency_histogram commands[operation_count];
+    latency_histogram data_connection;
+    std::atomic<uint64_t> bytes[2] = {};
+    std::atomic<bool> in_use = false;
+  };
+
+  // Block of the calling thread, attached on first use
+  static thread_block &local();
+  thread_block *attach();
+  static void detach(thread_block *block);
+
+  mutable std::mutex mutex_; // Guards blocks_
+  std::vector<std::unique_ptr<thread_block>> blocks_;
+
+  std::atomic<uint64_t> active_sessions_ = 0;
+  std::atomic<uint64_t> total_sessions_ = 0;
+};
+
+// Nanoseconds elapsed since a point in time
+inline uint64_t nanoseconds_since(std::chrono::steady_clock::time_point since) {
+  return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - since)
+                      .count());
+}
+
+// Records the time between its construction and its destruction as the
+// latency of a command
+class command_timer {
+public:
+  explicit command_timer(operation op)
+      : op_(op), started_(std::chrono::steady_clock::now()) {}
+  ~command_timer() {
+    metrics::record_command(op_, nanoseconds_since(started_));
+  }
+  command_timer(const command_timer &) = delete;
+  command_timer &operator=(const command_timer &) = delete;
+
+private:
+  operation op_;
+  std::chrono::steady_clock::time_point started_;
+};
+
+} // namespace ftp
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils/vfs.h"
+
+namespace ftp {
+
+// Entry of a remote directory, from MLSD
+struct remote_entry {
+  std::string name;
+  bool is_directory = false;
+  uint64_t size = 0;
+  std::string modify; // YYYYMMDDHHMMSS, UTC
+};
+
+// Append the entries of a listing received by a client to entries
+void parse_listing(const std::string &listing,
+                   std::vector<remote_entry> &entries);
+
+// Append the line of an entry to a machine readable listing (MLSD, RFC
+// 3659):
+//   type=file;size=1024;modify=20240101120000; name\r\n
+void append_mlsd_line(const vfs_entry &entry, std::string &out);
+
+} // namespace ftp
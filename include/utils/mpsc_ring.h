@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+
+namespace ftp {
+
+// Bounded lock-free ring between any number of producers and one consumer
+// Unlike spsc_ring, neither side ever blocks: try_push() fails while the
+// ring is full and try_pop() while it is empty, so producers on a hot path
+// are never held up by the consumer
+// Every slot carries a sequence number telling whose turn it is (D. Vyukov's
+// bounded queue): producers claim a position with one compare-and-swap
+template <typename T> class mpsc_ring {
+public:
+  // The capacity is rounded up to a power of two
+  explicit mpsc_ring(size_t capacity)
+      : capacity_(std::bit_ceil(std::max<size_t>(capacity, 2))),
+        mask_(capacity_ - 1), slots_(new slot[capacity_]) {
+    for (size_t i = 0; i < capacity_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  // Producer side, returns false (and leaves item alone) if the ring is full
+  bool try_push(T &item) {
+    size_t position = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      slot &s = slots_[position & mask_];
+      const size_t sequence = s.sequence.load(std::memory_order_acquire);
+      if (sequence == position) {
+        // The slot is free: claim the position
+        if (tail_.compare_exchange_weak(position, position + 1,
+                                        std::memory_order_relaxed)) {
+          s.item = std::move(item);
+          s.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (sequence < position) {
+        return false; // Not popped yet since the last lap: full
+      } else {
+        position = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer side, returns false if the ring is empty
+  bool try_pop(T &item) {
+    slot &s = slots_[head_ & mask_];
+    if (s.sequence.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    item = std::move(s.item);
+    s.sequence.store(head_ + capacity_, std::memory_order_release);
+    head_++;
+    return true;
+  }
+
+private:
+  struct slot {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<slot[]> slots_;
+
+  // The consumer's index is its own; the producers share the tail, on a
+  // cache line of its own
+  alignas(64) size_t head_ = 0;            // Next slot to pop
+  alignas(64) std::atomic<size_t> tail_{0}; // Next slot to push
+};
+
+} // namespace ftp
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "utils/vfs.h"
+
+namespace ftp {
+
+// Storage a user may hold, 0 for no limit
+struct quota_limits {
+  uint64_t bytes = 0;
+  uint64_t files = 0; // Directories count as files
+};
+
+// Storage a user holds
+struct quota_usage {
+  uint64_t bytes = 0;
+  uint64_t files = 0;
+};
+
+struct quota_settings {
+  bool enabled = false;
+  // Journal of who owns what, replayed at startup
+  std::string journal = "quota.journal";
+  // Limits of the users without "quotaBytes" or "quotaFiles"
+  quota_limits defaults;
+  // Per-user limits, from the "users" list
+  std::unordered_map<std::string, quota_limits> users;
+  // The journal is rewritten as a snapshot past this many records (or the
+  // number of paths owned, if larger)
+  uint64_t compact_records = 4096;
+};
+
+// Per-user storage quotas, kept up to date as files come and go instead of
+// walking the storage on every upload
+// Every path stored, renamed or created by a user is owned by them, and the
+// owner of every path is kept in memory with its size, so that usage is
+// known at once. Each change appends a record to a journal, which is
+// replayed at startup; a background scan then checks the journal against
+// the storage, dropping the paths removed and fixing the sizes changed
+// behind the back of the server. Files no user stored are owned by nobody
+// and count against no quota
+// Uploads reserve their declared size before any data comes, so that
+// concurrent uploads cannot exceed a quota together
+class quota_ledger {
+public:
+  explicit quota_ledger(const quota_settings &settings);
+  ~quota_ledger();
+  quota_ledger(const quota_ledger &) = delete;
+  quota_ledger &operator=(const quota_ledger &) = delete;
+
+  // Server-wide instance, configured by "quota" in config.json
+  static quota_ledger &instance();
+
+  bool enabled() const;
+
+  // Can the user store one more file?
+  bool has_room(const std::string &user);
+  // Reserve room for an upload of size bytes to path (a storage path)
+  // Returns false if the upload would take the user past a limit
+  bool reserve(const std::string &user, const std::string &path,
+               uint64_t size);
+  // Release the room of an upload that is not committed
+  void release(const std::string &user, uint64_t reserved);
+  // Account for a committed upload, releasing its reservation
+  void commit_file(const std::string &user, const std::string &path,
+                   uint64_t reserved, uint64_t size);
+  // Account for a directory made by the user
+  void add_directory(const std::string &user, const std::string &path);
+  // Forget a file or an (empty) directory removed
+  void remove(const std::string &path);
+  // Move a path, and everything below it, keeping their owners
+  void rename(const std::string &from, const std::string &to);
+
+  quota_usage usage(const std::string &user);
+  quota_limits limits(const std::string &user) const;
+  // Usage of every user owning something, sorted by name
+  std::map<std::string, quota_usage> all_usage();
+
+  // Check the journal against the storage on a thread of its own
+  void start_scan(vfs &storage);
+  bool scanning() const;
+
+private:
+  // A path owned by a user
+  struct owned_path {
+    std::string owner;
+    uint64_t bytes = 0;
+    bool is_directory = false;
+    uint64_t changed = 0; // Sequence number of the last change
+  };
+
+  using path_map = std::map<std::string, owned_path>;
+
+  // Changes of the paths, mutex_ held; they update usage_, the journal
+  // record is up to the caller
+  void put(const std::string &path, owned_path entry);
+  path_map::iterator erase(path_map::iterator it);
+  // Returns false if nothing is owned at or below from
+  bool move(const std::string &from, const std::string &to);
+
+  // Replay the journal into paths_
+  void replay();
+  // Queue a record for the journal, mutex_ held
+  void append(const std::string &record);
+  // Write the queued records to the journal and sync it, or replace it by a
+  // snapshot once it grew too long; mutex_ not held
+  void flush_journal();
+  // One record per path owned, mutex_ held
+  std::string snapshot() const;
+  // Replace the journal by a snapshot, journal_mutex_ held
+  bool write_snapshot(const std::string &snapshot);
+
+  // Walk the storage and reconcile paths_ with it
+  void scan(vfs &storage);
+
+  quota_settings settings_;
+
+  std::mutex mutex_;
+  path_map paths_; // Sorted, for renames of directories
+  std::unordered_map<std::string, quota_usage> usage_;
+  std::unordered_map<std::string, quota_usage> reserved_;
+  uint64_t sequence_ = 0;
+
+  std::string pending_; // Records not written yet, under mutex_
+  uint64_t records_ = 0; // Queued since the last compaction, under mutex_
+
+  // Taken before mutex_, never while holding it
+  std::mutex journal_mutex_;
+  int fd_ = -1; // Under journal_mutex_
+
+  std::thread scan_thread_;
+  std::atomic<bool> scanning_ = false;
+  std::atomic<bool> stopping_ = false;
+};
+
+} // namespace ftp
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sockpp/tcp_connector.h>
+
+namespace ftp {
+
+// Where the objects are, see "storage" in config.json
+struct object_store_settings {
+  std::string endpoint = "127.0.0.1:9000"; // host:port, plain HTTP
+  std::string bucket = "simple-ftp";
+  std::string region = "us-east-1";
+  // Credentials, requests are not signed without them
+  std::string access_key;
+  std::string secret_key;
+  // Uploads larger than this are sent as a multipart upload, in parts of
+  // this size (at least 5 MiB, the minimum of S3)
+  uint64_t part_bytes = 8 * 1024 * 1024;
+  // Idle connections kept open for the next requests
+  size_t connections = 16;
+};
+
+// A request for an object of the bucket (or for the bucket itself)
+struct s3_request {
+  std::string method = "GET";
+  std::string key; // Object key, "" for the bucket
+  // Query parameters and extra headers, not encoded
+  std::vector<std::pair<std::string, std::string>> query;
+  std::vector<std::pair<std::string, std::string>> headers;
+  const char *body = nullptr;
+  size_t body_size = 0;
+};
+
+struct s3_response {
+  int status = 0; // HTTP status, 0 if the store could not be reached
+  std::map<std::string, std::string> headers; // Names in lowercase
+  std::string body;
+};
+
+// Blocking client of an S3 compatible object store (AWS S3, MinIO...)
+// Requests use path-style URLs over HTTP/1.1 and are signed with AWS
+// Signature Version 4 (payloads are not hashed: UNSIGNED-PAYLOAD). Idle
+// connections are kept alive in a pool shared by all threads, a request
+// failing on a reused connection is retried once on a new one
+class s3_client {
+public:
+  explicit s3_client(object_store_settings settings);
+
+  // Send a request and read the whole response
+  s3_response send(const s3_request &request);
+  // Send a GET request and pass the body of a successful response on to
+  // socket_fd, spliced from the connection of the store without copying it
+  // through user space. With a Range header, only the bytes of the range
+  // are passed on, also from a store ignoring it (200 with the whole
+  // object). Returns the number of bytes passed on, or -1 with errno set
+  // if none could be
+  ssize_t forward(const s3_request &request, int socket_fd);
+
+  const object_store_settings &settings() const { return settings_; }
+
+private:
+  using connection = std::unique_ptr<sockpp::tcp_connector>;
+
+  // An idle connection, or a new one (nullptr if the store is unreachable)
+  connection acquire(bool &reused);
+  // Keep a connection for the next request
+  void release(connection conn);
+
+  // Write a signed request, then read the status line and the headers of
+  // its response; pending receives the start of the body
+  bool exchange(sockpp::tcp_connector &conn, const s3_request &request,
+                s3_response &response, std::string &pending);
+  // Read the rest of the body, false if the connection cannot be reused
+  bool read_body(sockpp::tcp_connector &conn, const s3_request &request,
+                 s3_response &response, std::string &pending);
+  // Head of a signed request
+  std::string request_head(const s3_request &request) const;
+
+  object_store_settings settings_;
+  std::string host_; // As sent in the Host header and signed
+  std::string address_;
+  uint16_t port_ = 80;
+
+  std::mutex mutex_;
+  std::vector<connection> idle_;
+};
+
+// Percent-encoding of URIs as signed by Signature Version 4: all but
+// letters, digits and "-._~", and "/" unless encode_slash is false
+std::string uri_encode(const std::string &text, bool encode_slash = true);
+
+} // namespace ftp
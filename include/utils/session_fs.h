@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "utils/vfs.h"
+
+namespace ftp {
+
+// A session's view of the storage (see utils/vfs.h)
+// Client paths are resolved against the working directory into absolute
+// client paths, which is all the storage is ever given, so that the
+// session can never leave the root. Client paths starting with "/" are
+// relative to the root, and ".." stops at the root. The working directory
+// is held open (see vfs_directory), so relative paths follow it when it is
+// renamed
+class session_fs {
+public:
+  explicit session_fs(vfs &storage);
+
+  // Storage the paths are resolved for
+  vfs &storage() const;
+
+  // Working directory as the client sees it, "/" being the root; where it
+  // last was once removed
+  const std::string &pwd() const;
+  // Is the working directory still there (it may have been removed)?
+  bool cwd_exists() const;
+
+  // Absolute client path of a client path, without "." or ".."
+  std::string resolve(const std::string &path) const;
+  // Where a client path is stored, for logs and server-wide caches
+  std::filesystem::path host_path(const std::string &path) const;
+
+  // Change the working directory, returns false with errno set on failure
+  bool change_directory(const std::string &path);
+
+private:
+  vfs *storage_;
+  std::unique_ptr<vfs_directory> cwd_;
+  mutable std::string pwd_ = "/";
+};
+
+} // namespace ftp
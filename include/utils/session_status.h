@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace ftp {
+
+// Settings of transfer rate limits, configured by "rateLimit" in
+// config.json; the admin socket changes them at runtime
+struct rate_limit_settings {
+  // Limit of every new session, bytes per second (0: unlimited)
+  std::atomic<uint64_t> bytes_per_second = 0;
+
+  static rate_limit_settings &instance();
+};
+
+// What a session is doing, for the admin socket
+// The session thread updates it with relaxed loads and stores; the admin
+// thread reads it while the server holds the session alive, so that the
+// data path never waits for a reader
+struct session_status {
+  explicit session_status(std::string peer);
+
+  // Set on creation
+  const uint64_t id;        // Unique in the process, from 1
+  const std::string peer;   // Address of the client
+  const std::chrono::steady_clock::time_point connected;
+
+  // Command being run (an ftp::operation), -1 while waiting for one
+  std::atomic<int> command = -1;
+  // When it started, nanoseconds on the steady clock
+  std::atomic<int64_t> command_started = 0;
+  // File data moved by the command and by the whole session
+  std::atomic<uint64_t> command_bytes = 0;
+  std::atomic<uint64_t> total_bytes = 0;
+
+  // Transfer rate limit, bytes per second (0: unlimited)
+  std::atomic<uint64_t> rate_limit = 0;
+  // Set by kill(): the session stops at its next read or data chunk
+  std::atomic<bool> killed = false;
+
+  // Logged in user, written once per login
+  void set_user(const std::string &user);
+  std::string user() const;
+
+private:
+  mutable std::mutex user_mutex_;
+  std::string user_;
+};
+
+// Nanoseconds on the steady clock, as stored in session_status
+inline int64_t steady_nanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace ftp
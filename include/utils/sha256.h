@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ftp {
+
+using sha256_digest = std::array<uint8_t, 32>;
+
+// SHA-256 (FIPS 180-4), fed in pieces
+class sha256 {
+public:
+  sha256();
+
+  // Hash size more bytes
+  void update(const void *data, size_t size);
+  // Digest of all the bytes so far, the hash cannot be updated any more
+  sha256_digest finish();
+
+  // Digest of a string
+  static sha256_digest of(const std::string &data);
+
+private:
+  // Hash one 64 byte block into state_
+  void compress(const uint8_t *block);
+
+  uint32_t state_[8];
+  uint8_t block_[64];
+  size_t block_size_ = 0;
+  uint64_t total_size_ = 0;
+};
+
+// HMAC-SHA-256 (RFC 2104) of a message
+sha256_digest hmac_sha256(const std::string &key, const std::string &message);
+
+// Lowercase hexadecimal digits of bytes
+std::string to_hex(const uint8_t *data, size_t size);
+std::string to_hex(const sha256_digest &digest);
+
+} // namespace ftp
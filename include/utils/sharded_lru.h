@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ftp {
+
+// Bounded map from paths to values, split into shards with a lock and an
+// LRU list each, so that sessions looking up different paths rarely
+// contend
+// Each shard holds values up to a total weight, as given by the weigher
+// (1 per value without one); the least recently used go first
+template <typename Value> class sharded_lru {
+public:
+  using weigher = std::function<size_t(const Value &)>;
+
+  sharded_lru(size_t shard_count, size_t shard_capacity,
+              weigher weigh = nullptr)
+      : shard_capacity_(shard_capacity), weigh_(std::move(weigh)) {
+    for (size_t i = 0; i < std::max<size_t>(shard_count, 1); ++i) {
+      shards_.push_back(std::make_unique<shard>());
+    }
+  }
+
+  // Value of a key if fresh() accepts it, making it the most recently used;
+  // a value it rejects is dropped
+  // The generation of the shard is stored in *generation, for insert()
+  std::optional<Value> find(const std::string &key,
+                            const std::function<bool(const Value &)> &fresh,
+                            uint64_t *generation = nullptr) {
+    auto &s = shard_for(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (generation != nullptr) {
+      *generation = s.generation;
+    }
+    const auto it = s.index.find(key);
+    if (it == s.index.end()) {
+      return std::nullopt;
+    }
+    if (!fresh(it->second->value)) {
+      remove(s, it->second);
+      return std::nullopt;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    return it->second->value;
+  }
+
+  // Store the value of a key, replacing any previous one, then evict the
+  // least recently used values until the shard fits its capacity
+  // With a generation from find(), nothing is stored if a key of the shard
+  // was invalidated since; returns whether the value was stored
+  bool insert(const std::string &key, Value value,
+              const uint64_t *generation = nullptr) {
+    auto &s = shard_for(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (generation != nullptr && *generation != s.generation) {
+      return false;
+    }
+    const auto it = s.index.find(key);
+    if (it != s.index.end()) {
+      remove(s, it->second);
+    }
+    const size_t value_weight = weight_of(value);
+    s.lru.push_front(node{key, std::move(value), value_weight});
+    s.index[key] = s.lru.begin();
+    s.weight += value_weight;
+    weight_ += value_weight;
+    size_++;
+    while (s.weight > shard_capacity_ && !s.lru.empty()) {
+      remove(s, std::prev(s.lru.end()));
+    }
+    return true;
+  }
+
+  // Drop the value of a key
+  void erase(const std::string &key) {
+    auto &s = shard_for(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.generation++;
+    const auto it = s.index.find(key);
+    if (it != s.index.end()) {
+      remove(s, it->second);
+    }
+  }
+
+  // Drop the values of a directory and of every path below it
+  // Those are spread over all shards, so this walks every entry: for the
+  // rare renames and removals of directories only
+  void erase_tree(const std::string &directory) {
+    std::string prefix = directory;
+    if (prefix.empty() || prefix.back() != '/') {
+      prefix += '/';
+    }
+    for (const auto &s : shards_) {
+      std::lock_guard<std::mutex> lock(s->mutex);
+      s->generation++;
+      for (auto it = s->lru.begin(); it != s->lru.end();) {
+        const auto next = std::next(it);
+        if (it->key == directory || it->key.starts_with(prefix)) {
+          remove(*s, it);
+        }
+        it = next;
+      }
+    }
+  }
+
+  // Number of values, and their total weight
+  size_t size() const { return size_; }
+  size_t weight() const { return weight_; }
+
+private:
+  struct node {
+    std::string key;
+    Value value;
+    size_t weight;
+  };
+
+  // One shard: LRU list (most recent first) and index into it
+  struct shard {
+    std::mutex mutex;
+    std::list<node> lru;
+    std::unordered_map<std::string, typename std::list<node>::iterator>
+        index;
+    size_t weight = 0;
+    // Bumped by every invalidation, so that a value read while the server
+    // changed a path of the shard is not stored
+    uint64_t generation = 0;
+  };
+
+  shard &shard_for(const std::string &key) {
+    return *shards_[std::hash<std::string>{}(key) % shards_.size()];
+  }
+
+  size_t weight_of(const Value &value) const {
+    return weigh_ ? weigh_(value) : 1;
+  }
+
+  // Drop a node, shard lock held
+  void remove(shard &s, typename std::list<node>::iterator it) {
+    s.weight -= it->weight;
+    weight_ -= it->weight;
+    size_--;
+    s.index.erase(it->key);
+    s.lru.erase(it);
+  }
+
+  size_t shard_capacity_;
+  weigher weigh_;
+  std::vector<std::unique_ptr<shard>> shards_;
+
+  std::atomic<size_t> size_ = 0;
+  std::atomic<size_t> weight_ = 0;
+};
+
+} // namespace ftp
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+namespace ftp {
+
+// Bounded lock-free ring between exactly one producer and one consumer
+// push() blocks while the ring is full and pop() while it is empty, which
+// gives the producer backpressure from a slow consumer
+template <typename T> class spsc_ring {
+public:
+  // The capacity is rounded up to a power of two
+  explicit spsc_ring(size_t capacity)
+      : slots_(std::bit_ceil(std::max<size_t>(capacity, 1))),
+        mask_(slots_.size() - 1) {}
+
+  size_t capacity() const { return slots_.size(); }
+
+  // Producer side, blocks while the ring is full
+  void push(T item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    while (tail - head == slots_.size()) {
+      head_.wait(head, std::memory_order_acquire);
+      head = head_.load(std::memory_order_acquire);
+    }
+    slots_[tail & mask_] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    tail_.notify_one();
+  }
+
+  // Consumer side, blocks while the ring is empty
+  T pop() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    while (tail == head) {
+      tail_.wait(tail, std::memory_order_acquire);
+      tail = tail_.load(std::memory_order_acquire);
+    }
+    T item = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    head_.notify_one();
+    return item;
+  }
+
+private:
+  std::vector<T> slots_;
+  const size_t mask_;
+
+  // Indices only grow; each one lives on its own cache line so that the
+  // producer and the consumer do not invalidate each other's line
+  alignas(64) std::atomic<size_t> head_{0}; // Next slot to pop
+  alignas(64) std::atomic<size_t> tail_{0}; // Next slot to push
+};
+
+} // namespace ftp
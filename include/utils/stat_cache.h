@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "utils/sharded_lru.h"
+
+namespace ftp {
+
+// Timestamp as YYYYMMDDHHMMSS (UTC), as used by MDTM and MLSD
+std::string format_timestamp(int64_t seconds);
+// Seconds since epoch of such a timestamp, -1 if it is not one
+int64_t parse_timestamp(const std::string &timestamp);
+
+// What SIZE and MDTM report about a path
+struct file_status {
+  bool exists = false;
+  bool is_regular = false;
+  uint64_t size = 0;
+  int64_t mtime = 0; // Seconds since epoch
+};
+
+// Status of the file open at fd (exists is false if fd is -1)
+file_status read_file_status(int fd);
+
+// Bounded cache of file metadata, so that clients polling SIZE and MDTM do
+// not cost a stat() each
+// The server drops entries of paths it changes (STOR, DELE, RNTO...);
+// changes made outside of the server are seen once an entry expires
+class stat_cache {
+public:
+  stat_cache(size_t max_entries, std::chrono::milliseconds ttl,
+             size_t shard_count);
+  ~stat_cache() = default;
+
+  // Server-wide instance, configured by "statCache" in config.json
+  static stat_cache &instance();
+
+  // Status of a path, from the cache or from load() on a miss
+  file_status status(const std::string &path,
+                     const std::function<file_status()> &load);
+  // Drop the entry of a path (after STOR, DELE, RNTO...)
+  void invalidate(const std::string &path);
+  // Drop the entries of a directory and of every path below it (after RMD
+  // or RNTO of a directory)
+  void invalidate_tree(const std::string &directory);
+
+  // Hit and miss counters
+  uint64_t hits() const;
+  uint64_t misses() const;
+  // Number of cached paths
+  size_t size() const;
+
+private:
+  struct entry {
+    file_status status;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  bool enabled_;
+  std::chrono::milliseconds ttl_;
+  sharded_lru<entry> entries_;
+
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+};
+
+} // namespace ftp
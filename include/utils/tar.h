@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <string>
+
+#include <sys/types.h>
+
+namespace ftp {
+
+// Streaming tar (ustar) support used to transfer whole directories
+constexpr size_t tar_block_size = 512;
+
+// Tar entry types
+constexpr char tar_type_file = '0';
+constexpr char tar_type_directory = '5';
+constexpr char tar_type_long_name = 'L'; // GNU extension for long names
+
+// Build the header block(s) of an entry
+// Names longer than 100 bytes are preceded by a GNU long name entry
+std::string tar_header(const std::string &name, char type, uint64_t size,
+                       mode_t mode, time_t mtime);
+
+// Number of zero bytes needed after size bytes of contents
+size_t tar_padding(uint64_t size);
+
+// Two zero blocks mark the end of the archive
+std::string tar_end_of_archive();
+
+// Extracts a tar stream into a directory while it arrives
+// Entries with absolute paths or ".." components are skipped, and entries
+// are opened beneath the destination like the files of a local_vfs (see
+// open_beneath()): no symbolic link met on the way leads out of it. Files
+// are created with O_EXCL | O_NOFOLLOW, what was there (even a link) being
+// removed first rather than written through
+class tar_extractor {
+public:
+  tar_extractor(std::filesystem::path destination);
+  ~tar_extractor();
+
+  // Feed the next chunk of the stream, returns false on a corrupt archive
+  bool feed(const char *data, size_t size);
+
+  // Has the end of archive marker (two zero blocks) been seen?
+  bool finished() const;
+
+  // Number of files and directories extracted so far
+  uint64_t files() const;
+  uint64_t directories() const;
+
+private:
+  enum class state { header, long_name, body, padding };
+
+  // Handle a complete header block
+  bool parse_header();
+  // Close the file being extracted and restore its mode and mtime
+  void finish_file();
+  // Make a directory and those above it, existing ones being fine
+  bool make_directories(const std::filesystem::path &relative);
+  // Open the directory containing a relative path, making it if needed, -1
+  // on failure
+  int open_parent(const std::filesystem::path &relative);
+
+  int root_fd_ = -1; // The destination
+  state state_ = state::header;
+  size_t zero_blocks_ = 0; // In a row
+
+  std::string header_;
+  std::string long_name_;
+  bool has_long_name_ = false;
+
+  // Current entry, relative to the destination
+  std::filesystem::path path_;
+  int fd_ = -1;
+  mode_t mode_ = 0;
+  time_t mtime_ = 0;
+  uint64_t remaining_ = 0;
+  size_t padding_ = 0;
+
+  bool finished_ = false;
+  uint64_t files_ = 0;
+  uint64_t directories_ = 0;
+};
+
+} // namespace ftp
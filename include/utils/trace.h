@@ -0,0 +1,62 @@
+#pragma once
+
+// Scoped tracing of the phases of a command (path resolution, data
+// connection, sendfile, DONE handshake...), for finding where a slow
+// transfer spends its time
+//
+//   FTP_TRACE_SCOPE("sendfile");
+//
+// records a span from this line to the end of the enclosing block. Spans
+// are kept in a ring per thread (the most recent ones) and rendered as
+// Chrome trace events (chrome://tracing, ui.perfetto.dev) on demand
+//
+// Tracing exists only in builds with FTP_ENABLE_TRACING (xmake f
+// --tracing=y); otherwise FTP_TRACE_SCOPE expands to nothing
+
+#ifdef FTP_ENABLE_TRACING
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace ftp {
+
+// Clock of the spans, in nanoseconds
+inline uint64_t trace_clock() {
+  return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+}
+
+// Record a finished span in the ring of the calling thread
+// name must outlive the trace (a string literal)
+void record_span(const char *name, uint64_t start, uint64_t end);
+
+// Spans of all threads, as Chrome trace-event JSON
+std::string render_trace();
+
+// A span from construction to destruction
+class trace_span {
+public:
+  explicit trace_span(const char *name) : name_(name), start_(trace_clock()) {}
+  ~trace_span() { record_span(name_, start_, trace_clock()); }
+  trace_span(const trace_span &) = delete;
+  trace_span &operator=(const trace_span &) = delete;
+
+private:
+  const char *name_;
+  uint64_t start_;
+};
+
+} // namespace ftp
+
+#define FTP_TRACE_CONCAT_(a, b) a##b
+#define FTP_TRACE_CONCAT(a, b) FTP_TRACE_CONCAT_(a, b)
+#define FTP_TRACE_SCOPE(name)                                                 \
+  const ftp::trace_span FTP_TRACE_CONCAT(ftp_trace_span_, __LINE__)(name)
+
+#else
+
+#define FTP_TRACE_SCOPE(name) static_cast<void>(0)
+
+#endif
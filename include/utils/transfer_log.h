@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "utils/metrics.h"
+#include "utils/mpsc_ring.h"
+
+namespace ftp {
+
+// One completed (or failed) transfer
+struct transfer_record {
+  std::chrono::system_clock::time_point finished;
+  uint64_t duration_nanoseconds = 0;
+  std::string remote_host;
+  std::string user;
+  std::string path; // On the server
+  uint64_t bytes = 0;
+  transfer_direction direction = transfer_direction::download;
+  bool passive = true;
+  bool complete = false;
+};
+
+// Format of the transfer log
+enum class transfer_log_format {
+  xferlog, // wu-ftpd compatible, one line of space separated fields
+  json,    // One JSON object per line, with mode and throughput
+};
+
+struct transfer_log_settings {
+  bool enabled = false;
+  std::string path = "xferlog";
+  transfer_log_format format = transfer_log_format::xferlog;
+  // The log is rotated to <path>.1 ... <path>.<keep> past this size
+  uint64_t max_bytes = 64 * 1024 * 1024;
+  size_t keep = 5;
+  // Records waiting for the writer, more are dropped (and counted)
+  size_t queue_size = 4096;
+  // The writer wakes up this often to write the waiting records at once
+  std::chrono::milliseconds flush_interval{200};
+};
+
+// Transfer log, one record per transfer
+// Sessions push records into a lock-free ring and return at once; a writer
+// thread writes them in batches, so that a slow disk never holds up a
+// transfer. When the ring is full, records are dropped rather than waited
+// for, and the number of dropped records is reported
+class transfer_log {
+public:
+  explicit transfer_log(const transfer_log_settings &settings);
+  ~transfer_log();
+  transfer_log(const transfer_log &) = delete;
+  transfer_log &operator=(const transfer_log &) = delete;
+
+  // Server-wide instance, configured by "transferLog" in config.json
+  static transfer_log &instance();
+
+  bool enabled() const;
+
+  // Queue a record, never blocks
+  void record(transfer_record record);
+
+  // Write what is queued and stop the writer
+  void stop();
+
+  // Records written and dropped
+  uint64_t written() const;
+  uint64_t dropped() const;
+
+private:
+  // Writer thread
+  void run();
+  // Write the queued records, rotating the log when it grows too large
+  void drain();
+  // Line of a record, in the configured format
+  std::string format(const transfer_record &record) const;
+  // Open the log for appending
+  bool open_log();
+  // Move the log to <path>.1, shifting older ones, and start a new one
+  void rotate();
+
+  transfer_log_settings settings_;
+  mpsc_ring<transfer_record> ring_;
+
+  int fd_ = -1;
+  uint64_t log_size_ = 0;
+
+  std::mutex mutex_; // For the writer to sleep on
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::thread writer_;
+
+  std::atomic<uint64_t> written_ = 0;
+  std::atomic<uint64_t> dropped_ = 0;
+};
+
+} // namespace ftp
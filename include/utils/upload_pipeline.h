@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <sockpp/tcp_socket.h>
+
+#include "utils/vfs.h"
+
+namespace ftp {
+
+// Settings of the upload pipeline
+struct upload_pipeline_settings {
+  // Run the network and disk stages on separate threads
+  bool enabled = true;
+  // Number of blocks travelling between the stages, each one a buffer
+  // leased from ftp::buffer_pool
+  size_t blocks = 16;
+  // Slow disk emulation, for benchmarks: write at most this many bytes per
+  // second (0: full speed) and stall for a while every so many bytes, like
+  // a disk flushing its write back cache
+  uint64_t emulated_disk_rate = 0;
+  uint64_t emulated_stall_millis = 0;
+  uint64_t emulated_stall_every_bytes = 16 * 1024 * 1024;
+
+  // Server-wide settings, configured by "uploadPipeline" in config.json
+  static const upload_pipeline_settings &instance();
+};
+
+// Receive size bytes from sock and write them to fd, starting at offset 0
+// When enabled, the network stage fills blocks leased from the buffer pool
+// and passes them through a lock-free ring to a disk writer thread, which
+// writes them with pwrite() and hands them back. A full ring stalls the
+// network stage, so memory stays bounded by the leased blocks
+// progress(received) is called by the network stage after each read, and
+// stops the transfer by returning false
+// Returns false if the connection or the disk failed, or progress stopped
+bool receive_to_file(sockpp::tcp_socket &sock, int fd, uint64_t size,
+                     const upload_pipeline_settings &settings,
+                     const std::function<bool(uint64_t)> &progress);
+
+// Receive size bytes from sock into an upload of the storage, through the
+// same pipeline: with receive_to_file() for a local file, otherwise with
+// vfs_upload::write() on the writer stage (an object store sends a part
+// while the next one arrives)
+bool receive_to_upload(sockpp::tcp_socket &sock, vfs_upload &upload,
+                       uint64_t size, const upload_pipeline_settings &settings,
+                       const std::function<bool(uint64_t)> &progress);
+
+} // namespace ftp
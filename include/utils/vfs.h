@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <sys/types.h>
+
+namespace ftp {
+
+// What a storage backend knows about a path
+struct vfs_status {
+  bool exists = false;
+  bool is_directory = false;
+  bool is_regular = false;
+  uint64_t size = 0;
+  int64_t mtime = 0; // Seconds since epoch
+  // Nanoseconds since epoch, -1 when the backend cannot tell when a
+  // directory changed (object stores), so that its listing is not cached
+  int64_t mtime_ns = -1;
+  mode_t mode = 0644; // Permission bits, for archives
+};
+
+// Entry of a directory
+struct vfs_entry {
+  std::string name;
+  vfs_status status; // Of the target of a symbolic link
+  bool is_link = false;
+};
+
+// A regular file open for reading
+class vfs_file {
+public:
+  virtual ~vfs_file() = default;
+
+  // Status of the file when it was opened
+  virtual const vfs_status &status() const = 0;
+  // Copy up to count bytes at offset into buffer
+  // Returns the number of bytes copied (0 at the end of the file), or -1
+  // with errno set
+  virtual ssize_t read(char *buffer, size_t count, uint64_t offset) = 0;
+  // Send up to count bytes at offset to a socket, without copying them
+  // through user space when the backend can (sendfile() for local files)
+  // Returns the number of bytes sent, or -1 with errno set
+  virtual ssize_t send(int socket_fd, uint64_t offset, size_t count);
+  // Descriptor of a local file, for the file cache; -1 for other backends
+  virtual int fd() const { return -1; }
+};
+
+// A file being written, which replaces its destination once committed
+// Destroying it before commit() discards it
+class vfs_upload {
+public:
+  virtual ~vfs_upload() = default;
+
+  // Append size bytes, returns false with errno set on failure
+  virtual bool write(const char *data, size_t size) = 0;
+  // Descriptor of a local file, written at increasing offsets by the upload
+  // pipeline instead of write(); -1 for other backends
+  virtual int fd() const { return -1; }
+  // Make the contents durable and replace the destination with them
+  virtual bool commit() = 0;
+};
+
+// A directory held open as a session's working directory, so that the
+// session stays in it when it is renamed and it cannot be swapped for
+// another one between a check and a use
+class vfs_directory {
+public:
+  virtual ~vfs_directory() = default;
+
+  // Absolute client path of the directory now, empty once it was removed
+  virtual std::string path() const = 0;
+};
+
+// Storage behind the sessions: local disk, memory or an object store
+// Paths are absolute client paths ("/" being the root) without "." or ".."
+// components, as given by session_fs::resolve(). Failures return false (or
+// nullptr) with errno set, like the system calls they replace
+class vfs {
+public:
+  virtual ~vfs() = default;
+
+  // Server-wide instance, configured by "storage" in config.json
+  static vfs &instance();
+
+  // Where a path is stored, for logs and the server-wide caches
+  virtual std::string location(const std::string &path) const = 0;
+
+  // Status of a path, following symbolic links; exists is false (with
+  // errno set) if it cannot be found
+  virtual vfs_status stat(const std::string &path) = 0;
+  // Call visit for the files and directories of a directory, as it is read;
+  // visit returns false to stop. With types_only, only is_directory and
+  // is_regular of the entries are needed (LIST), which saves backends a
+  // stat() per entry
+  virtual bool list(const std::string &path, bool types_only,
+                    const std::function<bool(const vfs_entry &)> &visit) = 0;
+  // Open a regular file for reading (EISDIR for a directory)
+  virtual std::unique_ptr<vfs_file> open_read(const std::string &path) = 0;
+  // Start writing a file in an existing directory
+  virtual std::unique_ptr<vfs_upload> open_write(const std::string &path) = 0;
+  // Rename a file or a directory (EEXIST if the destination exists)
+  virtual bool rename(const std::string &from, const std::string &to) = 0;
+  // Remove a file (EISDIR for a directory)
+  virtual bool remove(const std::string &path) = 0;
+  // Remove an empty directory (ENOTEMPTY otherwise)
+  virtual bool remove_directory(const std::string &path) = 0;
+  // Create a directory in an existing one (EEXIST if the path exists)
+  virtual bool make_directory(const std::string &path) = 0;
+  // Hold a directory open (ENOTDIR for a file); backends without
+  // descriptors only remember its path
+  virtual std::unique_ptr<vfs_directory>
+  open_directory(const std::string &path);
+};
+
+// Parent and last component of an absolute client path:
+// "/a/b" gives {"/a", "b"}, "/a" gives {"/", "a"}, "/" gives {"/", ""}
+std::pair<std::string, std::string> split_path(const std::string &path);
+// Client path of an entry of a directory
+std::string join_path(const std::string &directory, const std::string &name);
+
+} // namespace ftp
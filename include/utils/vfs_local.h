@@ -0,0 +1,66 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+#include <sys/types.h>
+
+#include "utils/vfs.h"
+
+namespace ftp {
+
+// Open relative (which must not start with "/") beneath dir_fd with
+// openat2(RESOLVE_BENEATH): neither ".." nor symbolic links may lead out of
+// dir_fd. Without openat2(), the path is walked with O_NOFOLLOW instead and
+// symbolic links are refused. Returns -1 with errno set on failure
+int open_beneath(int dir_fd, const std::string &relative, int flags,
+                 mode_t mode = 0);
+
+// Is name that of the temporary file of an upload in progress,
+// ".<name>.<pid>-<counter>.part"?
+bool is_upload_name(const std::string &name);
+
+// Files under a root directory of the local file system
+// The root is held open and every path is opened beneath it with a single
+// path walk, so that nothing outside of it can be reached. Files are sent
+// with sendfile(), uploads are written to a hidden temporary file next to
+// their destination and renamed into place once synced (see
+// utils/durability.h)
+class local_vfs : public vfs {
+public:
+  explicit local_vfs(const std::filesystem::path &root);
+  ~local_vfs() override;
+  local_vfs(const local_vfs &) = delete;
+  local_vfs &operator=(const local_vfs &) = delete;
+
+  // Could the root be opened?
+  bool is_open() const;
+
+  std::string location(const std::string &path) const override;
+  vfs_status stat(const std::string &path) override;
+  bool list(const std::string &path, bool types_only,
+            const std::function<bool(const vfs_entry &)> &visit) override;
+  std::unique_ptr<vfs_file> open_read(const std::string &path) override;
+  std::unique_ptr<vfs_upload> open_write(const std::string &path) override;
+  bool rename(const std::string &from, const std::string &to) override;
+  bool remove(const std::string &path) override;
+  bool remove_directory(const std::string &path) override;
+  bool make_directory(const std::string &path) override;
+  std::unique_ptr<vfs_directory>
+  open_directory(const std::string &path) override;
+
+private:
+  // Open a client path, returns -1 with errno set on failure
+  int open(const std::string &path, int flags, mode_t mode = 0) const;
+  // Open the directory containing a client path and set name to its last
+  // component, for the *at() calls that create, remove or rename entries
+  // Fails with EINVAL for the root itself
+  int open_parent(const std::string &path, std::string &name) const;
+
+  std::filesystem::path root_path_;
+  int root_fd_ = -1;
+  // Where the root really is, without symbolic links, "" for "/"
+  std::string root_real_;
+};
+
+} // namespace ftp
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "utils/vfs.h"
+
+namespace ftp {
+
+// Files held in memory, shared by all sessions and lost when the server
+// stops: the protocol path without a disk in the way, for benchmarks and
+// tests
+// Committed contents never change: a download keeps the version it opened
+// and is sent straight from it, an upload builds a new version and swaps it
+// in. At most capacity_bytes are held, uploads beyond fail with ENOSPC
+class memory_vfs : public vfs {
+public:
+  explicit memory_vfs(uint64_t capacity_bytes);
+
+  std::string location(const std::string &path) const override;
+  vfs_status stat(const std::string &path) override;
+  bool list(const std::string &path, bool types_only,
+            const std::function<bool(const vfs_entry &)> &visit) override;
+  std::unique_ptr<vfs_file> open_read(const std::string &path) override;
+  std::unique_ptr<vfs_upload> open_write(const std::string &path) override;
+  bool rename(const std::string &from, const std::string &to) override;
+  bool remove(const std::string &path) override;
+  bool remove_directory(const std::string &path) override;
+  bool make_directory(const std::string &path) override;
+
+  // Bytes of file contents held, including uploads in progress
+  uint64_t used_bytes() const;
+
+private:
+  class upload;
+
+  struct node {
+    bool is_directory = false;
+    std::shared_ptr<const std::string> contents; // Files
+    std::map<std::string, std::shared_ptr<node>> children; // Directories
+    int64_t mtime_ns = 0;
+  };
+
+  // Node of a path, nullptr with errno set if there is none; mutex_ held
+  std::shared_ptr<node> find(const std::string &path) const;
+  // Directory containing a path and the last component of the path,
+  // nullptr with errno set if there is none; mutex_ held
+  std::shared_ptr<node> find_parent(const std::string &path,
+                                    std::string &name) const;
+  // Replace the file at path with a committed upload
+  bool install(const std::string &path,
+               std::shared_ptr<const std::string> contents);
+
+  // Account for bytes held, false (ENOSPC) beyond the capacity
+  bool reserve(uint64_t bytes);
+  void release(uint64_t bytes);
+
+  mutable std::mutex mutex_;
+  std::shared_ptr<node> root_;
+  uint64_t capacity_;
+  std::atomic<uint64_t> used_ = 0;
+};
+
+} // namespace ftp
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+
+#include "utils/s3_client.h"
+#include "utils/vfs.h"
+
+namespace ftp {
+
+// Files as objects of an S3 compatible bucket (AWS S3, MinIO...)
+// A path is the key of its object without the leading "/"; directories are
+// the prefixes of the keys, created empty as a "<path>/" marker object.
+// Downloads are ranged GETs spliced to the data connection, uploads are
+// sent as one PUT, or as a multipart upload in parts of part_bytes once
+// larger. The object is only created when the upload is committed
+// Object stores have no rename: files are copied then deleted, directories
+// one object at a time (not atomically), and objects larger than 5 GiB
+// cannot be renamed. Directories have no modification time, so their
+// listings are never cached
+class object_store_vfs : public vfs {
+public:
+  explicit object_store_vfs(object_store_settings settings);
+
+  std::string location(const std::string &path) const override;
+  vfs_status stat(const std::string &path) override;
+  bool list(const std::string &path, bool types_only,
+            const std::function<bool(const vfs_entry &)> &visit) override;
+  std::unique_ptr<vfs_file> open_read(const std::string &path) override;
+  std::unique_ptr<vfs_upload> open_write(const std::string &path) override;
+  bool rename(const std::string &from, const std::string &to) override;
+  bool remove(const std::string &path) override;
+  bool remove_directory(const std::string &path) override;
+  bool make_directory(const std::string &path) override;
+
+private:
+  // Status of the object of a file, exists is false if there is none
+  vfs_status stat_object(const std::string &key);
+  // Is there a marker or any object below a prefix ending with "/"?
+  bool has_prefix(const std::string &prefix);
+  // Call visit for the keys below a prefix, one page of ListObjectsV2 at a
+  // time; delimited lists only the first level, where deeper keys show up
+  // as their common prefix (a directory, ending with "/")
+  // visit returns false to stop
+  bool list_keys(
+      const std::string &prefix, bool delimited,
+      const std::function<bool(const std::string &, const vfs_status &)>
+          &visit);
+  // Server-side copy of an object
+  bool copy_object(const std::string &from, const std::string &to);
+
+  s3_client client_;
+};
+
+} // namespace ftp
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "utils/vfs.h"
+#include "utils/vfs_local.h"
+
+namespace ftp {
+
+// Files spread over several root directories, one per disk, so that the
+// bandwidth of the disks adds up
+// A file is placed on the root owning its first path component on a
+// consistent hash ring, where each root holds virtual_nodes points: every
+// top-level directory, with everything below it, lies on one root. Adding a
+// root only moves the top-level entries it now owns, about one in (number
+// of roots). A directory is made on its owner, and on another root when a
+// file lying there needs it
+// Lookups try the owning root first, then the others, so that files not yet
+// moved by rebalance(), and files moved to another top-level directory
+// (which stay on their root, renames being atomic there), are still found.
+// A directory lying on several roots is not renamed (EXDEV) until rebalance
+// gathers it on its owner. Listings merge the directory of every root, and
+// the modification time of a directory is the latest of its copies, which
+// keeps the listing cache valid
+class sharded_vfs : public vfs {
+public:
+  sharded_vfs(const std::vector<std::filesystem::path> &roots,
+              size_t virtual_nodes);
+  ~sharded_vfs() override;
+  sharded_vfs(const sharded_vfs &) = delete;
+  sharded_vfs &operator=(const sharded_vfs &) = delete;
+
+  // Could every root be opened?
+  bool is_open() const;
+  size_t shard_count() const;
+  // Index of the root owning a path (that of its first component)
+  size_t owner(const std::string &path) const;
+
+  // Move the files lying on another root than the owner of their path to
+  // it, on a thread of its own; returns false if a rebalance is running
+  bool start_rebalance();
+  bool rebalancing() const;
+  // Files moved, and files that could not be, by the last rebalance
+  uint64_t moved_files() const;
+  uint64_t failed_files() const;
+
+  std::string location(const std::string &path) const override;
+  vfs_status stat(const std::string &path) override;
+  bool list(const std::string &path, bool types_only,
+            const std::function<bool(const vfs_entry &)> &visit) override;
+  std::unique_ptr<vfs_file> open_read(const std::string &path) override;
+  std::unique_ptr<vfs_upload> open_write(const std::string &path) override;
+  bool rename(const std::string &from, const std::string &to) override;
+  bool remove(const std::string &path) override;
+  bool remove_directory(const std::string &path) override;
+  bool make_directory(const std::string &path) override;
+
+private:
+  class upload;
+
+  // Create a directory and its parents on a root, if missing
+  bool make_directories(size_t shard, const std::string &directory);
+  // Remove the copies of a file from the roots other than shard
+  void remove_copies(size_t shard, const std::string &path);
+
+  // Walk a directory of a root, moving the misplaced files below it and
+  // removing the copies of directories it empties
+  void rebalance(size_t shard, const std::string &directory);
+  // Move a file from a root to another, keeping its modification time
+  bool move_file(size_t from, size_t to, const std::string &path);
+
+  std::vector<std::unique_ptr<local_vfs>> shards_;
+  // Points of the roots on the hash ring, sorted
+  std::vector<std::pair<uint64_t, size_t>> ring_;
+
+  std::thread rebalance_thread_;
+  std::atomic<bool> rebalancing_ = false;
+  std::atomic<bool> stopping_ = false;
+  std::atomic<uint64_t> moved_ = 0;
+  std::atomic<uint64_t> failed_ = 0;
+};
+
+} // namespace ftp
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace ftp {
+
+// Work-stealing queue shared by a fixed number of workers
+// Items are spread over per-worker deques; a worker takes from the front of
+// its own deque and steals from the back of the others when it runs dry
+template <typename T> class work_stealing_queue {
+public:
+  explicit work_stealing_queue(size_t workers) {
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); ++i) {
+      queues_.push_back(std::make_unique<worker_queue>());
+    }
+  }
+
+  // Add an item, spreading items round robin over the workers
+  void push(T item) {
+    auto &queue = *queues_[next_++ % queues_.size()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.items.push_back(std::move(item));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      size_++;
+    }
+    available_cv_.notify_one();
+  }
+
+  // No more items will be pushed, wake up the waiting workers
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    available_cv_.notify_all();
+  }
+
+  // Take the next item for a worker, blocks until an item is available
+  // Returns nothing once the queue is closed and empty
+  std::optional<T> pop(size_t worker) {
+    while (true) {
+      if (auto item = try_pop(worker)) {
+        return item;
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      available_cv_.wait(lock, [this]() { return closed_ || size_ > 0; });
+      if (closed_ && size_ == 0) {
+        return std::nullopt;
+      }
+    }
+  }
+
+private:
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<T> items;
+  };
+
+  // Own deque first, then steal from the others
+  std::optional<T> try_pop(size_t worker) {
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      auto &queue = *queues_[(worker + i) % queues_.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.items.empty()) {
+        continue;
+      }
+      std::optional<T> item;
+      if (i == 0) {
+        item = std::move(queue.items.front());
+        queue.items.pop_front();
+      } else {
+        item = std::move(queue.items.back());
+        queue.items.pop_back();
+      }
+      std::lock_guard<std::mutex> size_lock(mutex_);
+      size_--;
+      return item;
+    }
+    return std::nullopt;
+  }
+
+  std::vector<std::unique_ptr<worker_queue>> queues_;
+  std::atomic<size_t> next_{0};
+
+  // Number of queued items, guarded by mutex_ so that no wakeup is lost
+  std::mutex mutex_;
+  std::condition_variable available_cv_;
+  size_t size_ = 0;
+  bool closed_ = false;
+};
+
+} // namespace ftp
@@ -44,6 +44,27 @@ void ftp::client::connect() {
   disconnect();
 }
 
+// Connect, run commands without a prompt and disconnect
+bool ftp::client::run_batch(const std::vector<std::string> &commands) {
+  if (!connector_.connect(
+          sockpp::inet_address(server_host_, server_command_port_))) {
+    std::cerr << "[Client] " << "Error: " << connector_.last_error_str()
+              << std::endl;
+    return false;
+  }
+  connected_ = true;
+  std::clog << "[Client] " << "Connected to "
+            << connector_.peer_address().to_string() << std::endl;
+
+  protocol_interpreter_ = new protocol_interpreter_client(&connector_);
+  const size_t failures = protocol_interpreter_->run_batch(commands);
+  disconnect();
+  if (failures != 0) {
+    std::cerr << "[Client] " << failures << " commands failed" << std::endl;
+  }
+  return failures == 0;
+}
+
 // Disconnect from the server
 void ftp::client::disconnect() {
   std::clog << "[Client] " << "Disconnecting from "
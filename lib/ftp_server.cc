@@ -1,9 +1,38 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
 #include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 #include <thread>
 #include <unistd.h>
 
 #include "ftp_server.h"
+#include "utils/buffer_pool.h"
+#include "utils/config.h"
+#include "utils/file_cache.h"
 #include "utils/ftp.h"
+#include "utils/listing_cache.h"
+#include "utils/log_level.h"
+#include "utils/metrics.h"
+#include "utils/quota.h"
+#include "utils/stat_cache.h"
+#include "utils/trace.h"
+#include "utils/transfer_log.h"
+#include "utils/vfs_sharded.h"
+
+namespace {
+
+// Parse a whole decimal number, for admin commands
+bool parse_number(const std::string &text, uint64_t &value) {
+  const char *end = text.data() + text.size();
+  const auto [ptr, ec] = std::from_chars(text.data(), end, value);
+  return ec == std::errc() && ptr == end && !text.empty();
+}
+
+} // namespace
 
 // Constructor
 ftp::server::server(uint16_t command_port) {
@@ -22,36 +51,92 @@ ftp::server::~server() {
 
 // Start the server
 void ftp::server::start() {
-  // Create a TCP acceptor
-  const bool err = acceptor_.open(sockpp::inet_address(command_port_));
+  // Create a TCP acceptor, its queue holds the connections of many clients
+  // starting at once (asynchronous clients open hundreds)
+  const bool err =
+      acceptor_.open(sockpp::inet_address(command_port_), SOMAXCONN);
   if (!err) {
     std::cerr << "Error: " << acceptor_.last_error_str() << std::endl;
     return;
   }
 
+  // Log level, changed at runtime by the admin socket
+  ftp::install_log_filter();
+  const auto level_name = ftp::read_config().get("logLevel", "info").asString();
+  ftp::log_level level;
+  if (ftp::parse_log_level(level_name, level)) {
+    ftp::set_log_level(level);
+  } else {
+    std::cerr << "[Server] " << "Unknown log level " << level_name
+              << std::endl;
+  }
+
+  // Serve the metrics on a port of their own
+  const auto &metrics_settings = ftp::metrics_settings::instance();
+  if (metrics_settings.enabled) {
+    metrics_listener_ = std::make_unique<http_listener>(
+        metrics_settings.address, metrics_settings.port);
+    metrics_listener_->route("/metrics", "text/plain; version=0.0.4", []() {
+      return ftp::metrics::instance().render_prometheus();
+    });
+#ifdef FTP_ENABLE_TRACING
+    // Recent trace spans, to open in chrome://tracing or ui.perfetto.dev
+    metrics_listener_->route("/trace", "application/json",
+                             []() { return ftp::render_trace(); });
+#endif
+    if (!metrics_listener_->start()) {
+      metrics_listener_.reset();
+    }
+  }
+
+  // Check the quota journal against the storage, sessions go on meanwhile
+  auto &storage = ftp::vfs::instance();
+  ftp::quota_ledger::instance().start_scan(storage);
+
   // Start the server
   running_ = true;
   std::clog << "[Server] " << "Server started on command port " << command_port_
             << std::endl;
 
+  // Take commands from operators on a local socket
+  if (ftp::admin_settings::instance().enabled) {
+    start_admin_socket();
+  }
+
   // Accept a new client connection
   while (running_) {
     sockpp::tcp_socket sock = acceptor_.accept();
     if (!sock) {
+      // stop() wakes accept() up
+      if (!running_) {
+        break;
+      }
       std::cerr << "Error: " << acceptor_.last_error_str() << std::endl;
       return;
     }
 
     std::clog << "[Server] " << "Accepted connection from "
               << sock.peer_address().to_string() << std::endl;
+    // Replies are complete messages: send them at once, instead of waiting
+    // for the client to acknowledge the previous one (pipelined commands
+    // would otherwise wait for its delayed ACK)
+    sock.set_option(IPPROTO_TCP, TCP_NODELAY, 1);
 
     // After command port connection, we need use protocol interpreter
     // Create a new protocol interpreter
     auto interpreter = new protocol_interpreter_server(std::move(sock));
-    interpreters_.push_back(interpreter);
+    {
+      std::lock_guard<std::mutex> lock(interpreters_mutex_);
+      interpreters_.push_back(interpreter);
+    }
     // Start the protocol interpreter in a new thread
-    std::thread thr([interpreter = interpreters_.back()]() {
+    std::thread thr([this, interpreter]() {
       interpreter->run();
+      {
+        std::lock_guard<std::mutex> lock(interpreters_mutex_);
+        interpreters_.erase(std::find(interpreters_.begin(),
+                                      interpreters_.end(), interpreter));
+      }
       delete interpreter; // Delete the interpreter when done
     });
     thr.detach(); // Detach the thread to allow it to run independently
@@ -59,27 +144,350 @@ void ftp::server::start() {
 
   // Close the acceptor
   acceptor_.close();
+
+  // Drained: the sessions finish what they are doing, those still running
+  // at the deadline are killed
+  const int64_t drain_deadline = drain_deadline_.load();
+  if (drain_deadline != 0) {
+    const auto deadline = std::chrono::steady_clock::time_point(
+        std::chrono::nanoseconds(drain_deadline));
+    if (!wait_for_sessions(deadline)) {
+      const size_t killed = for_sessions(
+          "all", [](protocol_interpreter_server &interpreter) {
+            interpreter.kill();
+          });
+      std::clog << "[Server] " << "Killed " << killed
+                << " sessions at the end of the drain" << std::endl;
+      wait_for_sessions(std::chrono::steady_clock::now() +
+                        std::chrono::seconds(5));
+    }
+  }
   std::clog << "[Server] " << "Server stopped." << std::endl;
 }
 
 // Stop the server
 void ftp::server::stop() {
   // Stop the protocol interpreter
-  for (auto &interpreter : interpreters_) {
-    if (!interpreter->is_running()) {
-      continue; // Skip if the interpreter is not running
+  {
+    std::lock_guard<std::mutex> lock(interpreters_mutex_);
+    for (auto &interpreter : interpreters_) {
+      if (!interpreter->is_running()) {
+        continue; // Skip if the interpreter is not running
+      }
+      // The session thread closes its socket and removes the interpreter
+      interpreter->kill();
     }
-    interpreter->stop();
   }
 
   // Stop the server
   running_ = false;
 
-  // Close the acceptor
+  // Wake up accept(), then close the acceptor
+  acceptor_.shutdown();
   acceptor_.close();
+
+  // Stop serving the metrics
+  if (metrics_listener_) {
+    metrics_listener_->stop();
+  }
+  // Stop taking admin commands
+  if (admin_socket_) {
+    admin_socket_->stop();
+  }
+
+  // Report file cache counters
+  const auto &cache = ftp::file_cache::instance();
+  std::clog << "[Server] " << "File cache hits: " << cache.hits()
+            << ", misses: " << cache.misses()
+            << ", size: " << cache.size_bytes() << " bytes" << std::endl;
+
+  // Report buffer pool occupancy
+  const auto &pool = ftp::buffer_pool::instance();
+  std::clog << "[Server] " << "Buffer pool: " << pool.leased()
+            << " leased, peak " << pool.high_water() << ", "
+            << pool.allocated() << "/" << pool.max_buffers()
+            << " buffers in " << pool.slabs() << " slab(s), "
+            << pool.resident() << " resident" << std::endl;
+  // Report listing cache counters
+  const auto &listings = ftp::listing_cache::instance();
+  const uint64_t rebuilds = listings.misses();
+  std::clog << "[Server] " << "Listing cache hits: " << listings.hits()
+            << ", misses: " << rebuilds << ", rebuild avg "
+            << (rebuilds == 0 ? 0 : listings.rebuild_micros_total() / rebuilds)
+            << " us, max " << listings.rebuild_micros_max() << " us, "
+            << listings.size() << " directories" << std::endl;
+  // Report stat cache counters
+  const auto &stats = ftp::stat_cache::instance();
+  std::clog << "[Server] " << "Stat cache hits: " << stats.hits()
+            << ", misses: " << stats.misses() << ", size: " << stats.size()
+            << " paths" << std::endl;
+  // Report command latencies
+  auto &metrics = ftp::metrics::instance();
+  for (size_t op = 0; op < ftp::operation_count; ++op) {
+    const auto latency = metrics.command_latency(ftp::operation(op));
+    if (latency.count == 0) {
+      continue;
+    }
+    std::clog << "[Server] " << ftp::operation_name(ftp::operation(op))
+              << ": " << latency.count << " commands, p50 "
+              << latency.quantile(0.5) / 1000 << " us, p99 "
+              << latency.quantile(0.99) / 1000 << " us" << std::endl;
+  }
+  std::clog << "[Server] " << "Transferred "
+            << metrics.bytes(ftp::transfer_direction::download)
+            << " bytes down, "
+            << metrics.bytes(ftp::transfer_direction::upload)
+            << " bytes up in " << metrics.total_sessions() << " sessions"
+            << std::endl;
+  // Write the pending transfer records
+  auto &transfer_log = ftp::transfer_log::instance();
+  if (transfer_log.enabled()) {
+    transfer_log.stop();
+    std::clog << "[Server] " << "Transfer log: " << transfer_log.written()
+              << " records written, " << transfer_log.dropped()
+              << " dropped" << std::endl;
+  }
   std::clog << "Server stopped." << std::endl;
 }
 
+// Commands of the admin socket
+void ftp::server::start_admin_socket() {
+  admin_socket_ =
+      std::make_unique<admin_socket>(ftp::admin_settings::instance().path);
+
+  admin_socket_->command("sessions", "sessions",
+                         [this](const std::vector<std::string> &) {
+                           return describe_sessions();
+                         });
+
+  admin_socket_->command(
+      "kill", "kill <id|all>",
+      [this](const std::vector<std::string> &arguments) -> std::string {
+        if (arguments.size() != 1) {
+          return "error usage: kill <id|all>\n";
+        }
+        const size_t killed = for_sessions(
+            arguments[0], [](protocol_interpreter_server &interpreter) {
+              interpreter.kill();
+            });
+        if (killed == 0) {
+          return "error no session " + arguments[0] + "\n";
+        }
+        return "ok killed " + std::to_string(killed) + " sessions\n";
+      });
+
+  admin_socket_->command(
+      "limit", "limit [<id|all> <bytes/s>] (0: unlimited)",
+      [this](const std::vector<std::string> &arguments) -> std::string {
+        auto &settings = ftp::rate_limit_settings::instance();
+        if (arguments.empty()) {
+          return "ok default " +
+                 std::to_string(settings.bytes_per_second.load()) +
+                 " bytes/s\n";
+        }
+        uint64_t limit = 0;
+        if (arguments.size() != 2 || !parse_number(arguments[1], limit)) {
+          return "error usage: limit [<id|all> <bytes/s>]\n";
+        }
+        // "all" is also the limit of the sessions to come
+        if (arguments[0] == "all") {
+          settings.bytes_per_second.store(limit);
+        }
+        const size_t limited = for_sessions(
+            arguments[0], [limit](protocol_interpreter_server &interpreter) {
+              interpreter.status().rate_limit.store(
+                  limit, std::memory_order_relaxed);
+            });
+        if (limited == 0 && arguments[0] != "all") {
+          return "error no session " + arguments[0] + "\n";
+        }
+        return "ok limited " + std::to_string(limited) + " sessions to " +
+               std::to_string(limit) + " bytes/s\n";
+      });
+
+  admin_socket_->command(
+      "log", "log [error|info]",
+      [](const std::vector<std::string> &arguments) -> std::string {
+        ftp::log_level level = ftp::current_log_level();
+        if (arguments.size() > 1 ||
+            (arguments.size() == 1 &&
+             !ftp::parse_log_level(arguments[0], level))) {
+          return "error usage: log [error|info]\n";
+        }
+        ftp::set_log_level(level);
+        return std::string("ok ") + ftp::log_level_name(level) + "\n";
+      });
+
+  admin_socket_->command(
+      "drain", "drain [seconds] (default 30)",
+      [this](const std::vector<std::string> &arguments) -> std::string {
+        uint64_t seconds = 30;
+        if (arguments.size() > 1 ||
+            (arguments.size() == 1 && !parse_number(arguments[0], seconds)) ||
+            seconds > 24 * 3600) {
+          return "error usage: drain [seconds]\n";
+        }
+        int64_t expected = 0;
+        const int64_t deadline =
+            ftp::steady_nanoseconds() + int64_t(seconds) * 1000000000;
+        if (!drain_deadline_.compare_exchange_strong(expected, deadline)) {
+          return "error already draining\n";
+        }
+        // Stop accepting, start() waits for the sessions and returns
+        running_ = false;
+        acceptor_.shutdown();
+        std::lock_guard<std::mutex> lock(interpreters_mutex_);
+        return "ok draining " + std::to_string(interpreters_.size()) +
+               " sessions for " + std::to_string(seconds) + " seconds\n";
+      });
+
+  admin_socket_->command(
+      "rebalance", "rebalance [status] (sharded storage)",
+      [](const std::vector<std::string> &arguments) -> std::string {
+        auto *sharded = dynamic_cast<ftp::sharded_vfs *>(&ftp::vfs::instance());
+        if (sharded == nullptr) {
+          return "error the storage is not sharded\n";
+        }
+        if (arguments.size() > 1 ||
+            (arguments.size() == 1 && arguments[0] != "status")) {
+          return "error usage: rebalance [status]\n";
+        }
+        const std::string progress =
+            std::to_string(sharded->moved_files()) + " files moved, " +
+            std::to_string(sharded->failed_files()) + " failed\n";
+        if (!arguments.empty()) {
+          return std::string("ok ") +
+                 (sharded->rebalancing() ? "rebalancing, " : "idle, ") +
+                 progress;
+        }
+        if (!sharded->start_rebalance()) {
+          return "error already rebalancing, " + progress;
+        }
+        return "ok rebalancing " + std::to_string(sharded->shard_count()) +
+               " roots\n";
+      });
+
+  admin_socket_->command(
+      "quota", "quota [user]",
+      [](const std::vector<std::string> &arguments) -> std::string {
+        auto &quota = ftp::quota_ledger::instance();
+        if (!quota.enabled()) {
+          return "error quotas are off\n";
+        }
+        if (arguments.size() > 1) {
+          return "error usage: quota [user]\n";
+        }
+        auto usage = quota.all_usage();
+        if (arguments.size() == 1) {
+          usage = {{arguments[0], quota.usage(arguments[0])}};
+        }
+        // Limits of 0 are shown as "-"
+        auto limit = [](uint64_t value) {
+          return value == 0 ? std::string("-") : std::to_string(value);
+        };
+        std::string out = "ok " + std::to_string(usage.size()) + " users" +
+                          (quota.scanning() ? ", scanning" : "") + "\n";
+        char line[256];
+        snprintf(line, sizeof(line), "%-12s %14s %14s %10s %10s\n", "user",
+                 "bytes", "limit", "files", "limit");
+        out += line;
+        for (const auto &[user, used] : usage) {
+          const auto limits = quota.limits(user);
+          snprintf(line, sizeof(line), "%-12s %14llu %14s %10llu %10s\n",
+                   user.c_str(), (unsigned long long)used.bytes,
+                   limit(limits.bytes).c_str(),
+                   (unsigned long long)used.files,
+                   limit(limits.files).c_str());
+          out += line;
+        }
+        return out;
+      });
+
+  if (!admin_socket_->start()) {
+    admin_socket_.reset();
+  }
+}
+
+// Table of the live sessions
+std::string ftp::server::describe_sessions() {
+  const int64_t now = ftp::steady_nanoseconds();
+  char line[256];
+  std::lock_guard<std::mutex> lock(interpreters_mutex_);
+  std::string out = "ok " + std::to_string(interpreters_.size()) +
+                    " sessions\n";
+  snprintf(line, sizeof(line), "%6s  %-21s  %-12s  %-5s %9s %14s %12s %12s\n",
+           "id", "peer", "user", "cmd", "seconds", "bytes", "bytes/s",
+           "limit");
+  out += line;
+  for (auto *interpreter : interpreters_) {
+    const auto &status = interpreter->status();
+    const int command = status.command.load(std::memory_order_relaxed);
+    // Rate of the command in progress
+    double seconds = 0;
+    double rate = 0;
+    if (command >= 0) {
+      seconds =
+          double(now - status.command_started.load(std::memory_order_relaxed)) /
+          1e9;
+      rate = seconds > 0 ? double(status.command_bytes.load(
+                               std::memory_order_relaxed)) /
+                               seconds
+                         : 0;
+    }
+    const std::string user = status.user();
+    snprintf(line, sizeof(line),
+             "%6llu  %-21s  %-12s  %-5s %9.1f %14llu %12.0f %12llu\n",
+             (unsigned long long)status.id, status.peer.c_str(),
+             user.empty() ? "-" : user.c_str(),
+             command >= 0 ? ftp::operation_name(ftp::operation(command))
+                          : "idle",
+             seconds,
+             (unsigned long long)status.total_bytes.load(
+                 std::memory_order_relaxed),
+             rate,
+             (unsigned long long)status.rate_limit.load(
+                 std::memory_order_relaxed));
+    out += line;
+  }
+  return out;
+}
+
+// Apply action to the sessions matching target (an id, or "all")
+size_t ftp::server::for_sessions(
+    const std::string &target,
+    const std::function<void(protocol_interpreter_server &)> &action) {
+  uint64_t id = 0;
+  if (target != "all" && !parse_number(target, id)) {
+    return 0;
+  }
+  size_t matched = 0;
+  std::lock_guard<std::mutex> lock(interpreters_mutex_);
+  for (auto *interpreter : interpreters_) {
+    if (target == "all" || interpreter->status().id == id) {
+      action(*interpreter);
+      matched++;
+    }
+  }
+  return matched;
+}
+
+// Wait for the sessions to end
+bool ftp::server::wait_for_sessions(
+    std::chrono::steady_clock::time_point deadline) {
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(interpreters_mutex_);
+      if (interpreters_.empty()) {
+        return true;
+      }
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
 void ftp::server::run_echo(sockpp::tcp_socket sock) {
   std::shared_ptr<char> buf(new char[buffer_size],
                             std::default_delete<char[]>());
@@ -0,0 +1,921 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "proto/async_client.h"
+#include "utils/ftp.h"
+
+namespace {
+
+using clock = ftp::event_loop::clock;
+
+// Bytes moved by one read or sendfile() on a data connection
+constexpr size_t chunk_size = 256 * 1024;
+// Reads of a data connection per wake-up, so that a fast transfer does not
+// hold up the other clients of the loop
+constexpr int reads_per_event = 4;
+// Control messages are short, anything longer is a broken server
+constexpr size_t max_pending_size = 1024 * 1024;
+
+// Buffer for the data connections, shared by the clients of a loop thread
+std::vector<char> &scratch() {
+  thread_local std::vector<char> buffer(chunk_size);
+  return buffer;
+}
+
+// Replies start with a three-digit code ("226 File sent successfully")
+bool is_reply(const std::string &line) {
+  return line.size() >= 4 && std::isdigit((unsigned char)line[0]) &&
+         std::isdigit((unsigned char)line[1]) &&
+         std::isdigit((unsigned char)line[2]) &&
+         (line[3] == ' ' || line[3] == '-');
+}
+
+// Sizes of files are sent alone on a line
+bool parse_number(const std::string &line, uint64_t &value) {
+  const auto end = line.data() + line.size();
+  const auto [rest, ec] = std::from_chars(line.data(), end, value);
+  return !line.empty() && ec == std::errc() && rest == end;
+}
+
+// Start connecting a non-blocking socket, returns -1 on failure
+int connect_nonblocking(const sockaddr_in &address, std::string &error) {
+  const int fd =
+      socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    error = strerror(errno);
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&address),
+              sizeof(address)) == -1 &&
+      errno != EINPROGRESS) {
+    error = strerror(errno);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Write all of data to a descriptor
+bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = write(fd, data, size);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+// A host name resolved on a thread of its own, which posts the result to
+// the loop unless the session gave up on it meanwhile
+struct resolution {
+  std::mutex mutex;
+  ftp::event_loop *loop;
+};
+
+} // namespace
+
+// An operation, queued until those before it complete
+struct ftp::async_client::operation {
+  enum class kind { connect, login, execute, list, get, put, quit };
+  enum class stage {
+    queued,
+    resolving,       // Host name, on a thread of its own
+    connecting,      // Control connection
+    replies,         // Command sent, waiting for its replies
+    data_connecting, // Data connection
+    data,            // Moving the data
+    acknowledge,     // DONE sent, waiting for the final reply
+  };
+
+  kind type = kind::execute;
+  stage state = stage::queued;
+  // Commands sent, and the number of replies they get
+  std::string command;
+  size_t expected_replies = 1;
+  size_t replies = 0;
+
+  // connect()
+  std::string host;
+  uint16_t port = 0;
+
+  // Where the data comes from or goes: a descriptor, a buffer or entries
+  int fd = -1;
+  std::string *buffer = nullptr;
+  std::string data;
+  std::vector<remote_entry> *entries = nullptr;
+  std::string listing;
+
+  uint64_t size = 0;
+  bool size_known = false;
+  bool archive = false; // Directory sent as a tar archive, size unknown
+  uint64_t transferred = 0;
+  bool data_finished = false;
+
+  // Outcome so far, and a local failure the server cannot know about
+  bool successful = false;
+  std::string message;
+  std::string error;
+
+  completion done;
+  progress on_progress;
+  std::promise<async_result> promise;
+};
+
+// Connections and queued operations, on the loop thread only
+// Handlers of the loop hold it weakly, tasks strongly
+struct ftp::async_client::session
+    : std::enable_shared_from_this<ftp::async_client::session> {
+  explicit session(event_loop &loop) : loop(loop) {}
+  ~session() { close_connections(); }
+
+  event_loop &loop;
+  std::atomic<int64_t> timeout_millis = 30 * 1000;
+
+  int control = -1;
+  bool connected = false;
+  uint32_t control_events = 0;
+  std::string control_error; // Why writing the control connection failed
+  sockaddr_in server = {};
+  uint16_t data_port = 0; // Announced by PASV
+  std::string in;         // Received, not split into lines yet
+  std::string out;        // Not sent yet
+  int data = -1;
+  std::shared_ptr<resolution> resolving; // Host name of connect()
+
+  std::deque<std::shared_ptr<operation>> operations;
+  bool starting = false;
+  clock::time_point last_activity;
+  bool timer_armed = false;
+
+  void enqueue(std::shared_ptr<operation> op);
+  void start_next();
+  void start(operation &op);
+  void start_connect(operation &op);
+  // Connect to the address of the host, once resolved
+  void connect_to(const sockaddr_in &address, const std::string &error);
+  // Complete the front operation and start the next one
+  // Callers return right after: the operation is gone
+  void complete(bool successful, const std::string &message);
+  // Close the connections and fail every operation
+  void fail_all(const std::string &message);
+  void close_connections();
+  void close_data();
+
+  // Control connection
+  void send(const std::string &command);
+  void flush();
+  void watch_control(uint32_t events);
+  void on_control(uint32_t events);
+  void finish_connect();
+  void handle_line(const std::string &line);
+  void handle_reply(operation &op, const std::string &reply);
+
+  // Data connection
+  void open_data(operation &op);
+  void on_data(uint32_t events);
+  void receive_data(operation &op);
+  void send_data(operation &op);
+  void consume(operation &op, const char *bytes, size_t size);
+  void acknowledge(operation &op);
+
+  // Fail the session once the server stays silent too long
+  void arm_timer();
+  void check_timeout();
+};
+
+void ftp::async_client::session::enqueue(std::shared_ptr<operation> op) {
+  operations.push_back(std::move(op));
+  start_next();
+}
+
+void ftp::async_client::session::start_next() {
+  // Operations failing at once complete here, not in nested calls
+  if (starting) {
+    return;
+  }
+  starting = true;
+  while (!operations.empty() &&
+         operations.front()->state == operation::stage::queued) {
+    const auto op = operations.front();
+    start(*op);
+  }
+  starting = false;
+}
+
+void ftp::async_client::session::start(operation &op) {
+  last_activity = clock::now();
+  arm_timer();
+  using kind = operation::kind;
+  if (op.type == kind::connect) {
+    start_connect(op);
+    return;
+  }
+  if (!connected) {
+    complete(false, "Not connected");
+    return;
+  }
+  if ((op.type == kind::list || op.type == kind::get ||
+       op.type == kind::put) &&
+      data_port == 0) {
+    complete(false, "Not logged in");
+    return;
+  }
+  if (op.type == kind::put) {
+    if (op.fd != -1) {
+      struct stat file_stat;
+      if (fstat(op.fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode)) {
+        complete(false, "Not a regular file");
+        return;
+      }
+      op.size = uint64_t(file_stat.st_size);
+    } else {
+      op.size = op.data.size();
+    }
+    op.size_known = true;
+  }
+  op.state = operation::stage::replies;
+  send(op.command);
+}
+
+void ftp::async_client::session::start_connect(operation &op) {
+  if (control != -1) {
+    complete(false, "Already connected");
+    return;
+  }
+  // Addresses need no resolver
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(op.port);
+  if (inet_pton(AF_INET, op.host.c_str(), &address.sin_addr) == 1) {
+    connect_to(address, "");
+    return;
+  }
+
+  // getaddrinfo() blocks, sometimes for seconds: not on the loop thread
+  op.state = operation::stage::resolving;
+  resolving = std::make_shared<resolution>();
+  resolving->loop = &loop;
+  std::thread([pending = resolving, self = weak_from_this(), host = op.host,
+               port = op.port] {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    const int rc = getaddrinfo(host.c_str(), std::to_string(port).c_str(),
+                               &hints, &found);
+    sockaddr_in address = {};
+    std::string error;
+    if (rc != 0) {
+      error = gai_strerror(rc);
+    } else if (found == nullptr) {
+      error = "no address";
+    } else {
+      address = *reinterpret_cast<const sockaddr_in *>(found->ai_addr);
+    }
+    if (found != nullptr) {
+      freeaddrinfo(found);
+    }
+
+    std::lock_guard<std::mutex> lock(pending->mutex);
+    if (pending->loop == nullptr) {
+      return;
+    }
+    pending->loop->post([pending, self, address, error] {
+      const auto s = self.lock();
+      // Not given up on: the connect() is still the front operation
+      if (s != nullptr && s->resolving == pending) {
+        s->resolving.reset();
+        s->connect_to(address, error);
+      }
+    });
+  }).detach();
+}
+
+void ftp::async_client::session::connect_to(const sockaddr_in &address,
+                                            const std::string &error) {
+  auto &op = *operations.front();
+  if (!error.empty()) {
+    complete(false, "Cannot resolve " + op.host + ": " + error);
+    return;
+  }
+  server = address;
+  std::string connect_error;
+  control = connect_nonblocking(server, connect_error);
+  if (control == -1) {
+    complete(false, "Cannot connect: " + connect_error);
+    return;
+  }
+  op.state = operation::stage::connecting;
+  watch_control(EPOLLOUT);
+}
+
+void ftp::async_client::session::complete(bool successful,
+                                          const std::string &message) {
+  const auto op = operations.front();
+  operations.pop_front();
+  const async_result result{successful, message};
+  op->promise.set_value(result);
+  if (op->done) {
+    op->done(result);
+  }
+  start_next();
+}
+
+void ftp::async_client::session::fail_all(const std::string &message) {
+  close_connections();
+  auto failed = std::move(operations);
+  operations.clear();
+  const async_result result{false, message};
+  for (const auto &op : failed) {
+    op->promise.set_value(result);
+    if (op->done) {
+      op->done(result);
+    }
+  }
+}
+
+void ftp::async_client::session::close_connections() {
+  close_data();
+  // The resolver thread must not post to a loop that may be gone
+  if (resolving != nullptr) {
+    std::lock_guard<std::mutex> lock(resolving->mutex);
+    resolving->loop = nullptr;
+  }
+  resolving.reset();
+  if (control != -1) {
+    loop.unwatch(control);
+    close(control);
+  }
+  control = -1;
+  connected = false;
+  control_events = 0;
+  control_error.clear();
+  data_port = 0;
+  in.clear();
+  out.clear();
+}
+
+void ftp::async_client::session::close_data() {
+  if (data != -1) {
+    loop.unwatch(data);
+    close(data);
+  }
+  data = -1;
+}
+
+// Queue a command, ended with CRLF like the client does
+void ftp::async_client::session::send(const std::string &command) {
+  out += command + "\r\n";
+  flush();
+}
+
+// Send what the socket takes now, the rest once it is writable
+// A failure shuts the connection down, the read handler fails the session
+void ftp::async_client::session::flush() {
+  while (!out.empty()) {
+    const ssize_t n = ::send(control, out.data(), out.size(), MSG_NOSIGNAL);
+    if (n > 0) {
+      out.erase(0, size_t(n));
+      continue;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    control_error = "Connection lost: " + std::string(strerror(errno));
+    out.clear();
+    shutdown(control, SHUT_RDWR);
+    break;
+  }
+  watch_control(EPOLLIN | (out.empty() ? 0u : uint32_t(EPOLLOUT)));
+}
+
+void ftp::async_client::session::watch_control(uint32_t events) {
+  if (control == -1 || events == control_events) {
+    return;
+  }
+  control_events = events;
+  loop.watch(control, events, [weak = weak_from_this()](uint32_t e) {
+    if (const auto s = weak.lock()) {
+      s->on_control(e);
+    }
+  });
+}
+
+void ftp::async_client::session::on_control(uint32_t events) {
+  if (control == -1) {
+    return;
+  }
+  last_activity = clock::now();
+  if (!connected) {
+    finish_connect();
+    return;
+  }
+  if (events & EPOLLOUT) {
+    flush();
+  }
+  if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+    return;
+  }
+
+  auto &buffer = scratch();
+  bool closed = false;
+  std::string reason;
+  for (;;) {
+    const ssize_t n = recv(control, buffer.data(), buffer.size(), 0);
+    if (n > 0) {
+      in.append(buffer.data(), size_t(n));
+      if (size_t(n) < buffer.size()) {
+        break;
+      }
+      continue;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    closed = true;
+    reason = n == 0 ? "Connection closed by the server"
+                    : "Connection lost: " + std::string(strerror(errno));
+    break;
+  }
+
+  // Replies received before the connection closed still count
+  size_t start = 0;
+  for (size_t end; (end = in.find('\n', start)) != std::string::npos;) {
+    std::string line = in.substr(start, end - start);
+    start = end + 1;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    handle_line(line);
+    if (control == -1) {
+      return;
+    }
+  }
+  in.erase(0, start);
+  if (in.size() > max_pending_size) {
+    fail_all("Reply too long");
+    return;
+  }
+
+  if (!closed) {
+    return;
+  }
+  if (!control_error.empty()) {
+    reason = control_error;
+  }
+  // QUIT gets no reply, the server closes the connection
+  if (!operations.empty() &&
+      operations.front()->type == operation::kind::quit &&
+      operations.front()->state != operation::stage::queued) {
+    close_connections();
+    complete(true, "Session closed");
+    return;
+  }
+  fail_all(reason);
+}
+
+void ftp::async_client::session::finish_connect() {
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(control, SOL_SOCKET, SO_ERROR, &error, &length) == -1) {
+    error = errno;
+  }
+  if (error != 0) {
+    close_connections();
+    complete(false, "Cannot connect: " + std::string(strerror(error)));
+    return;
+  }
+  connected = true;
+  // Commands are small and answered one at a time
+  const int one = 1;
+  setsockopt(control, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  watch_control(EPOLLIN);
+  char address[INET_ADDRSTRLEN] = "";
+  inet_ntop(AF_INET, &server.sin_addr, address, sizeof(address));
+  complete(true, "Connected to " + std::string(address) + ":" +
+                     std::to_string(ntohs(server.sin_port)));
+}
+
+void ftp::async_client::session::handle_line(const std::string &line) {
+  if (operations.empty()) {
+    return;
+  }
+  const auto op = operations.front();
+  if (is_reply(line)) {
+    handle_reply(*op, line);
+    return;
+  }
+  // The size of a file, announced once the data connection is open
+  if (op->type == operation::kind::get && !op->size_known &&
+      (op->state == operation::stage::data_connecting ||
+       op->state == operation::stage::data) &&
+      parse_number(line, op->size)) {
+    op->size_known = true;
+    acknowledge(*op);
+  }
+  // Otherwise text following a reply (the welcome message), skipped
+}
+
+void ftp::async_client::session::handle_reply(operation &op,
+                                              const std::string &reply) {
+  using kind = operation::kind;
+  if (op.state == operation::stage::acknowledge) {
+    bool successful = reply.compare(0, 4, "226 ") == 0;
+    std::string message = reply;
+    if (!op.error.empty()) {
+      successful = false;
+      message = op.error;
+    } else if (op.type == kind::get && !op.archive &&
+               op.transferred != op.size) {
+      successful = false;
+      message = "Transfer incomplete: " + std::to_string(op.transferred) +
+                " of " + std::to_string(op.size) + " bytes";
+    }
+    if (successful && op.type == kind::list) {
+      ftp::parse_listing(op.listing, *op.entries);
+    }
+    complete(successful, message);
+    return;
+  }
+  if (op.state != operation::stage::replies) {
+    // Nothing is expected during a transfer, the session is out of step
+    fail_all("Unexpected reply: " + reply);
+    return;
+  }
+
+  op.replies++;
+  switch (op.type) {
+  case kind::login:
+    // USER, PASS and PASV were sent together, PASS decides
+    if (op.replies == 2) {
+      op.successful = reply.compare(0, 4, "230 ") == 0;
+      op.message = reply;
+    }
+    if (op.replies == 3 && op.successful) {
+      const std::string tag = "(data port ";
+      const auto position = reply.find(tag);
+      uint16_t port = 0;
+      if (position != std::string::npos) {
+        const char *first = reply.data() + position + tag.size();
+        std::from_chars(first, reply.data() + reply.size(), port);
+      }
+      if (port == 0) {
+        op.successful = false;
+        op.message = "No passive data port: " + reply;
+      }
+      data_port = port;
+    }
+    if (op.replies == op.expected_replies) {
+      complete(op.successful, op.message);
+    }
+    return;
+  case kind::execute:
+    complete(!ftp::is_error_reply(reply), reply);
+    return;
+  case kind::list:
+  case kind::get:
+  case kind::put:
+    if (op.type == kind::get && ftp::is_archive_reply(reply)) {
+      op.archive = true;
+      op.size_known = true;
+    } else if (reply.compare(0, 4, "200 ") != 0) {
+      complete(false, reply);
+      return;
+    }
+    open_data(op);
+    return;
+  default:
+    return;
+  }
+}
+
+void ftp::async_client::session::open_data(operation &op) {
+  sockaddr_in address = server;
+  address.sin_port = htons(data_port);
+  std::string error;
+  data = connect_nonblocking(address, error);
+  if (data == -1) {
+    // The server waits for the data connection, the session is stuck
+    fail_all("Cannot open the data connection: " + error);
+    return;
+  }
+  op.state = operation::stage::data_connecting;
+  loop.watch(data, EPOLLOUT, [weak = weak_from_this()](uint32_t e) {
+    if (const auto s = weak.lock()) {
+      s->on_data(e);
+    }
+  });
+}
+
+void ftp::async_client::session::on_data(uint32_t events) {
+  if (data == -1 || operations.empty()) {
+    return;
+  }
+  last_activity = clock::now();
+  const auto op = operations.front();
+  if (op->state == operation::stage::data_connecting) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(data, SOL_SOCKET, SO_ERROR, &error, &length) == -1) {
+      error = errno;
+    }
+    if (error != 0) {
+      fail_all("Cannot open the data connection: " +
+               std::string(strerror(error)));
+      return;
+    }
+    op->state = operation::stage::data;
+    const bool upload = op->type == operation::kind::put;
+    loop.watch(data, upload ? EPOLLOUT : EPOLLIN,
+               [weak = weak_from_this()](uint32_t e) {
+                 if (const auto s = weak.lock()) {
+                   s->on_data(e);
+                 }
+               });
+    // The server reads the size before the contents
+    if (upload) {
+      send(std::to_string(op->size));
+    }
+    return;
+  }
+  if (op->state != operation::stage::data) {
+    return;
+  }
+  if (op->type == operation::kind::put) {
+    send_data(*op);
+    return;
+  }
+  receive_data(*op);
+}
+
+// Until the server closes the data connection
+void ftp::async_client::session::receive_data(operation &op) {
+  auto &buffer = scratch();
+  for (int i = 0; i < reads_per_event; ++i) {
+    const ssize_t n = recv(data, buffer.data(), buffer.size(), 0);
+    if (n > 0) {
+      consume(op, buffer.data(), size_t(n));
+      continue;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (n == -1 && op.error.empty()) {
+      op.error = "Data connection lost: " + std::string(strerror(errno));
+    }
+    close_data();
+    op.data_finished = true;
+    acknowledge(op);
+    return;
+  }
+}
+
+// Until the whole file or buffer is sent
+void ftp::async_client::session::send_data(operation &op) {
+  while (op.transferred < op.size) {
+    const size_t n = size_t(std::min<uint64_t>(chunk_size,
+                                               op.size - op.transferred));
+    ssize_t sent = 0;
+    if (op.fd != -1) {
+      off_t offset = off_t(op.transferred);
+      sent = sendfile(data, op.fd, &offset, n);
+    } else {
+      sent = ::send(data, op.data.data() + op.transferred, n, MSG_NOSIGNAL);
+    }
+    if (sent > 0) {
+      op.transferred += uint64_t(sent);
+      if (op.on_progress) {
+        op.on_progress(op.transferred, op.size);
+      }
+      continue;
+    }
+    if (sent == -1 && errno == EINTR) {
+      continue;
+    }
+    if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    // The server discards an upload shorter than announced
+    op.error = sent == 0 ? "The file is shorter than its size"
+                         : "Cannot send: " + std::string(strerror(errno));
+    break;
+  }
+  close_data();
+  op.data_finished = true;
+  acknowledge(op);
+}
+
+void ftp::async_client::session::consume(operation &op, const char *bytes,
+                                         size_t size) {
+  op.transferred += size;
+  if (op.entries != nullptr) {
+    op.listing.append(bytes, size);
+    return;
+  }
+  if (op.buffer != nullptr) {
+    op.buffer->append(bytes, size);
+  } else if (op.error.empty() && !write_all(op.fd, bytes, size)) {
+    // Keep reading, so that the session stays in step with the server
+    op.error = "Cannot write: " + std::string(strerror(errno));
+  }
+  if (op.on_progress) {
+    op.on_progress(op.transferred, op.size_known ? op.size : 0);
+  }
+}
+
+// Tell the server the transfer is over, once the data and (for a file)
+// its size have arrived
+void ftp::async_client::session::acknowledge(operation &op) {
+  if (op.state != operation::stage::data || !op.data_finished ||
+      (op.type == operation::kind::get && !op.size_known)) {
+    return;
+  }
+  op.state = operation::stage::acknowledge;
+  send("DONE");
+}
+
+void ftp::async_client::session::arm_timer() {
+  const auto timeout = std::chrono::milliseconds(timeout_millis.load());
+  if (timer_armed || timeout.count() <= 0) {
+    return;
+  }
+  timer_armed = true;
+  loop.post_after(timeout, [weak = weak_from_this()]() {
+    if (const auto s = weak.lock()) {
+      s->check_timeout();
+    }
+  });
+}
+
+void ftp::async_client::session::check_timeout() {
+  timer_armed = false;
+  const auto timeout = std::chrono::milliseconds(timeout_millis.load());
+  if (operations.empty() ||
+      operations.front()->state == operation::stage::queued ||
+      timeout.count() <= 0) {
+    return;
+  }
+  const auto idle = clock::now() - last_activity;
+  if (idle >= timeout) {
+    fail_all("Timed out waiting for the server");
+    return;
+  }
+  timer_armed = true;
+  loop.post_after(timeout - idle, [weak = weak_from_this()]() {
+    if (const auto s = weak.lock()) {
+      s->check_timeout();
+    }
+  });
+}
+
+// Constructor
+ftp::async_client::async_client(event_loop &loop)
+    : loop_(loop), session_(std::make_shared<session>(loop)) {}
+
+// Destructor
+ftp::async_client::~async_client() {
+  loop_.post([s = session_]() { s->fail_all("The client was destroyed"); });
+}
+
+std::future<ftp::async_result>
+ftp::async_client::submit(std::shared_ptr<operation> op) {
+  auto future = op->promise.get_future();
+  loop_.post([s = session_, op = std::move(op)]() { s->enqueue(op); });
+  return future;
+}
+
+std::future<ftp::async_result>
+ftp::async_client::connect(const std::string &host, uint16_t port,
+                           completion done) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::connect;
+  op->host = host;
+  op->port = port;
+  op->done = std::move(done);
+  return submit(std::move(op));
+}
+
+std::future<ftp::async_result>
+ftp::async_client::login(const std::string &username,
+                         const std::string &password, completion done) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::login;
+  // Sent at once, the server answers them in order
+  op->command = "USER " + username + "\r\nPASS " + password + "\r\nPASV";
+  op->expected_replies = 3;
+  op->done = std::move(done);
+  return submit(std::move(op));
+}
+
+std::future<ftp::async_result>
+ftp::async_client::execute(const std::string &command, completion done) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::execute;
+  op->command = command;
+  op->done = std::move(done);
+  return submit(std::move(op));
+}
+
+std::future<ftp::async_result>
+ftp::async_client::list(const std::string &directory,
+                        std::vector<remote_entry> &entries,
+                        completion done) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::list;
+  op->command = directory.empty() ? "MLSD" : "MLSD " + directory;
+  op->entries = &entries;
+  op->done = std::move(done);
+  return submit(std::move(op));
+}
+
+std::future<ftp::async_result>
+ftp::async_client::get(const std::string &remote, int fd, completion done,
+                       progress on_progress) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::get;
+  op->command = "RETR " + remote;
+  op->fd = fd;
+  op->done = std::move(done);
+  op->on_progress = std::move(on_progress);
+  return submit(std::move(op));
+}
+
+std::future<ftp::async_result>
+ftp::async_client::get(const std::string &remote, std::string &buffer,
+                       completion done, progress on_progress) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::get;
+  op->command = "RETR " + remote;
+  op->buffer = &buffer;
+  op->done = std::move(done);
+  op->on_progress = std::move(on_progress);
+  return submit(std::move(op));
+}
+
+std::future<ftp::async_result>
+ftp::async_client::put(const std::string &remote, int fd, completion done,
+                       progress on_progress) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::put;
+  op->command = "STOR " + remote;
+  op->fd = fd;
+  op->done = std::move(done);
+  op->on_progress = std::move(on_progress);
+  return submit(std::move(op));
+}
+
+std::future<ftp::async_result>
+ftp::async_client::put(const std::string &remote, std::string data,
+                       completion done, progress on_progress) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::put;
+  op->command = "STOR " + remote;
+  op->data = std::move(data);
+  op->done = std::move(done);
+  op->on_progress = std::move(on_progress);
+  return submit(std::move(op));
+}
+
+std::future<ftp::async_result> ftp::async_client::quit(completion done) {
+  auto op = std::make_shared<operation>();
+  op->type = operation::kind::quit;
+  op->command = "QUIT";
+  op->done = std::move(done);
+  return submit(std::move(op));
+}
+
+void ftp::async_client::set_timeout(std::chrono::milliseconds timeout) {
+  session_->timeout_millis = timeout.count();
+}
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <memory>
 
 #include <fcntl.h>
 #include <indicators/cursor_control.hpp>
@@ -7,53 +10,115 @@
 #include <sys/stat.h>
 
 #include "proto/proto_interpreter.h"
+#include "utils/batch.h"
 #include "utils/ftp.h"
 #include "utils/io.h"
+#include "utils/tar.h"
+
+namespace {
+
+// Bytes moved by one splice() into a pipe
+constexpr size_t splice_size = 1024 * 1024;
+
+// Copy size bytes (all of the stream if negative) from a data connection to
+// fd, calling progress with the bytes copied so far
+// Pipes take the data straight from the socket with splice(), without a
+// copy through user space; other descriptors are written
+// Returns false if the stream ended early or fd could not be written
+bool copy_data(sockpp::tcp_socket &data_sock, int fd, int64_t size,
+               const std::function<void(uint64_t)> &progress) {
+  struct stat fd_stat;
+  bool to_pipe = fstat(fd, &fd_stat) == 0 && S_ISFIFO(fd_stat.st_mode);
+  std::unique_ptr<char[]> buffer; // Left uninitialized, it is read into
+  uint64_t copied = 0;
+  while (size < 0 || copied < uint64_t(size)) {
+    const size_t wanted =
+        size < 0 ? splice_size
+                 : size_t(std::min<uint64_t>(uint64_t(size) - copied,
+                                             splice_size));
+    ssize_t n = 0;
+    if (to_pipe) {
+      n = splice(data_sock.handle(), nullptr, fd, nullptr, wanted,
+                 SPLICE_F_MOVE | SPLICE_F_MORE);
+      // Not supported by this socket or pipe, copy it instead
+      if (n == -1 && errno == EINVAL) {
+        to_pipe = false;
+        continue;
+      }
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+    } else {
+      if (buffer == nullptr) {
+        buffer.reset(new char[ftp::buffer_size]);
+      }
+      n = data_sock.read(buffer.get(),
+                         std::min(wanted, size_t(ftp::buffer_size)));
+      for (ssize_t written = 0; n > 0 && written < n;) {
+        const ssize_t w = write(fd, buffer.get() + written, n - written);
+        if (w == -1 && errno == EINTR) {
+          continue;
+        }
+        if (w <= 0) {
+          std::cerr << "Error: " << strerror(errno) << std::endl;
+          return false;
+        }
+        written += w;
+      }
+    }
+    if (n == 0) {
+      // The end of the stream is expected only without a size
+      return size < 0;
+    }
+    if (n < 0) {
+      std::cerr << "Error: " << strerror(errno) << std::endl;
+      return false;
+    }
+    copied += uint64_t(n);
+    progress(copied);
+  }
+  return true;
+}
+
+} // namespace
 
 // send_file() and recv_file() are used to send and receive files over a
 // socket.
 // These functions will establish a data connection with the client
 // based on the mode (active or passive)
-void ftp::protocol_interpreter_client::send_file(std::string filename) {
+bool ftp::protocol_interpreter_client::send_file(std::string filename) {
   // Check if using passive mode or active mode
   if (is_passive_mode_) {
-    send_file_passive(filename);
-    return;
+    return send_file_passive(filename);
   }
 
   // Active mode
-  send_file_active(filename);
+  return send_file_active(filename);
 }
 
-void ftp::protocol_interpreter_client::receive_file(std::string filename) {
+bool ftp::protocol_interpreter_client::receive_file(std::string filename,
+                                                   int local_fd) {
   // Check if using passive mode or active mode
   if (is_passive_mode_) {
-    receive_file_passive(filename);
-    return;
+    return receive_file_passive(filename, local_fd);
   }
 
   // Active mode
-  receive_file_active(filename);
+  return receive_file_active(filename, local_fd);
 }
 
 // Implementation of file() and receive_file() in active mode and
 // passive mode
 
-void ftp::protocol_interpreter_client::send_file_active(std::string filename) {
-  // Create a connection to the server using a new sockpp::tcp_acceptor
-  sockpp::tcp_acceptor data_acceptor(client_data_port_);
-  if (!data_acceptor) {
-    std::cerr << "Error: " << data_acceptor.last_error_str() << std::endl;
-    return;
-  }
-
+bool ftp::protocol_interpreter_client::send_file_active(std::string filename) {
   // Log the file name
   std::clog << "[Proto][File] " << "File name: " << filename << std::endl;
   int send_file_fd = open(filename.c_str(), O_RDONLY);
   if (send_file_fd == -1) {
     std::cerr << "Error: " << strerror(errno) << std::endl;
-    data_acceptor.close();
-    return;
+    // Drop the connection the server may have queued already
+    data_acceptor_.close();
+    return false;
   }
 
   // Get the file status
@@ -61,8 +126,8 @@ void ftp::protocol_interpreter_client::send_file_active(std::string filename) {
   if (fstat(send_file_fd, &file_stat) == -1) {
     std::cerr << "Error: " << strerror(errno) << std::endl;
     close(send_file_fd);
-    data_acceptor.close();
-    return;
+    data_acceptor_.close();
+    return false;
   }
 
   // Log the file size
@@ -70,12 +135,10 @@ void ftp::protocol_interpreter_client::send_file_active(std::string filename) {
             << std::endl;
 
   // Accept a new connection from the server
-  sockpp::tcp_socket data_sock = data_acceptor.accept();
+  sockpp::tcp_socket data_sock = accept_data_connection();
   if (!data_sock) {
-    std::cerr << "Error: " << data_acceptor.last_error_str() << std::endl;
     close(send_file_fd);
-    data_acceptor.close();
-    return;
+    return false;
   }
   std::clog << "[Proto][File] "
             << "Accepted data connection from " << data_sock.peer_address()
@@ -115,20 +178,21 @@ void ftp::protocol_interpreter_client::send_file_active(std::string filename) {
   close(send_file_fd);
   // Close the data socket
   data_sock.close();
-  // Close the data acceptor
-  data_acceptor.close();
 
   // Tell user that the file transfer is done
-  std::cout << "File transfer done" << std::endl;
+  if (!quiet_) {
+    std::cout << "File transfer done" << std::endl;
+  }
+  return remaining_size == 0;
 }
 
-void ftp::protocol_interpreter_client::send_file_passive(std::string filename) {
+bool ftp::protocol_interpreter_client::send_file_passive(std::string filename) {
   // Log the file name
   std::clog << "[Proto][File] " << "File name: " << filename << std::endl;
   int send_file_fd = open(filename.c_str(), O_RDONLY);
   if (send_file_fd == -1) {
     std::cerr << "Error: " << strerror(errno) << std::endl;
-    return;
+    return false;
   }
 
   // Get the file status
@@ -136,29 +200,24 @@ void ftp::protocol_interpreter_client::send_file_passive(std::string filename) {
   if (fstat(send_file_fd, &file_stat) == -1) {
     std::cerr << "Error: " << strerror(errno) << std::endl;
     close(send_file_fd);
-    return;
+    return false;
   }
 
   // Log the file size
   std::clog << "[Proto][File] " << "File size: " << file_stat.st_size
             << std::endl;
 
-  // Sleep for 500ms to wait for the server to listen on the port
-  std::this_thread::sleep_for(std::chrono::milliseconds(500));
-  // Create a connection to the server using a new sockpp::tcp_connector
-  sockpp::tcp_connector data_connector(
-      sockpp::inet_address(connector_->peer_address().address(),
-                           connector_->peer_address().port() + 1));
-  if (!data_connector) {
-    std::cerr << "Error: " << data_connector.last_error_str() << std::endl;
+  // Connect to the server's data port
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
     close(send_file_fd);
-    return;
+    return false;
   }
 
   // Send the file to the server using established data connection
   std::clog << "[Proto][File] "
-            << "Established data connection to "
-            << data_connector.peer_address() << std::endl;
+            << "Established data connection to " << data_sock.peer_address()
+            << std::endl;
 
   // Send file size to the server
   std::string file_size_str = std::to_string(file_stat.st_size) + "\r\n";
@@ -170,8 +229,8 @@ void ftp::protocol_interpreter_client::send_file_passive(std::string filename) {
   off_t offset = 0;
   size_t remaining_size = file_stat.st_size;
   while (remaining_size > 0) {
-    const auto sent_bytes = sendfile(data_connector.handle(), send_file_fd,
-                                     &offset, remaining_size);
+    const auto sent_bytes =
+        sendfile(data_sock.handle(), send_file_fd, &offset, remaining_size);
     if (sent_bytes < 0) {
       std::cerr << "Error: " << strerror(errno) << std::endl;
       break;
@@ -194,47 +253,66 @@ void ftp::protocol_interpreter_client::send_file_passive(std::string filename) {
   // Close the file descriptor
   close(send_file_fd);
   // Close the data socket
-  data_connector.close();
+  data_sock.close();
   // Tell user that the file transfer is done
-  std::cout << "File transfer done" << std::endl;
+  if (!quiet_) {
+    std::cout << "File transfer done" << std::endl;
+  }
+  return remaining_size == 0;
 }
 
 // Receive file from the server using active mode
-void ftp::protocol_interpreter_client::receive_file_active(
-    std::string filename) {
-  // Create a new buffer to receive the file
-  std::shared_ptr<char> file_buf(new char[buffer_size],
-                                 std::default_delete<char[]>());
-  // Create a connection to the server using a new sockpp::tcp_acceptor
-  sockpp::tcp_acceptor data_acceptor(
-      sockpp::inet_address(connector_->address().address(), client_data_port_));
+bool ftp::protocol_interpreter_client::receive_file_active(
+    std::string filename, int local_fd) {
   // Accept a new connection from the server
-  sockpp::tcp_socket data_sock = data_acceptor.accept();
+  sockpp::tcp_socket data_sock = accept_data_connection();
+  if (!data_sock) {
+    return false;
+  }
 
+  std::clog << "[Proto][File] " << "Receiving " << filename << " into fd "
+            << local_fd << std::endl;
+  return receive_file_data(data_sock, local_fd);
+}
+
+// Receive file from the server using passive mode
+bool ftp::protocol_interpreter_client::receive_file_passive(
+    std::string filename, int local_fd) {
+  // Connect to the server's data port
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return false;
+  }
+
+  std::clog << "[Proto][File] " << "Receiving " << filename << " into fd "
+            << local_fd << std::endl;
+  return receive_file_data(data_sock, local_fd);
+}
+
+// Receive the size and the contents of a file over an established data
+// connection, into local_fd
+bool ftp::protocol_interpreter_client::receive_file_data(
+    sockpp::tcp_socket &data_sock, int local_fd) {
   // Receive the file size from the server
-  const auto file_size_str =
-      ftp::receive_message(connector_, buf_, buffer_size);
+  const auto file_size_str = receive_reply();
   // Convert the file size string to an integer
-  const long file_size = std::stoi(file_size_str);
+  const long file_size = std::stol(file_size_str);
   std::clog << "[Proto][File] "
             << "File size to receive: " << file_size << std::endl;
-
-  // Modify filename to have filename only, without "/" and all text before it
-  filename = filename.substr(filename.find_last_of("/") + 1);
-
-  // Create a new file to save the received file
-  auto const receive_file_fd = fopen(filename.c_str(), "w");
-  if (receive_file_fd == nullptr) {
-    std::cerr << "Error: " << strerror(errno) << std::endl;
+  // The local file could not be created
+  if (local_fd == -1) {
     data_sock.close();
-    data_acceptor.close();
-    return;
+    return false;
   }
 
-  // Hide cursor
-  indicators::show_console_cursor(false);
+  // The file may be streamed to standard output: leave the cursor alone
+  const bool show_progress = !quiet_ && local_fd != STDOUT_FILENO;
+  if (show_progress) {
+    indicators::show_console_cursor(false);
+  }
 
-  // Prepare the progress bar using indicators
+  // Prepare the progress bar using indicators, on standard error so that it
+  // never mixes with a file streamed to standard output
   indicators::ProgressBar bar{
       indicators::option::BarWidth{30},
       indicators::option::ShowElapsedTime{true},
@@ -245,148 +323,246 @@ void ftp::protocol_interpreter_client::receive_file_active(
       indicators::option::FontStyles{
           std::vector<indicators::FontStyle>{indicators::FontStyle::bold},
       },
+      indicators::option::Stream{std::cerr},
   };
 
-  bool successful = true;
-  long remaining_size = file_size;
-  while (remaining_size > 0) {
-    // Receive the file data from the server
-    const ssize_t n = data_sock.read(file_buf.get(), buffer_size);
-    if (n <= 0) {
-      std::cerr << "Error: " << data_sock.last_error_str() << std::endl;
-      successful = false;
-      break;
+  const bool successful =
+      copy_data(data_sock, local_fd, file_size, [&](uint64_t received) {
+        // If completed or quiet, skip the progress bar
+        if (quiet_ || bar.is_completed()) {
+          return;
+        }
+        // Otherwise, set the progress bar to the current value
+        bar.set_progress(size_t(received * 100 / uint64_t(file_size)));
+      });
+
+  if (!quiet_) {
+    if (successful) {
+      // Completed, set the progress bar to 100%
+      bar.set_option(indicators::option::PrefixText{"Download complete "});
+      bar.mark_as_completed();
+    } else {
+      // Error occurred, set the progress bar to error
+      bar.set_option(indicators::option::PrefixText{"Download failed "});
+      bar.mark_as_completed();
     }
-
-    // Write the received data to the file
-    fwrite(file_buf.get(), sizeof(char), n, receive_file_fd);
-    remaining_size -= n;
-
-    // If completed, skip the progress bar
-    if (bar.is_completed()) { // Set the progress bar value
-      continue;
-    }
-    // Otherwise, set the progress bar to the current value
-    // Update the progress bar
-    bar.set_progress(100 - (remaining_size * 100) / file_size);
   }
-
-  if (successful) {
-    // Completed, set the progress bar to 100%
-    bar.set_option(indicators::option::PrefixText{"Download complete "});
-    bar.mark_as_completed();
-  } else {
-    // Error occurred, set the progress bar to error
-    bar.set_option(indicators::option::PrefixText{"Download failed "});
-    bar.mark_as_completed();
+  if (show_progress) {
+    // Show cursor
+    indicators::show_console_cursor(true);
   }
 
-  // Show cursor
-  indicators::show_console_cursor(true);
-
-  // Close the file
-  fclose(receive_file_fd);
   // Close the data connection
   data_sock.close();
-  // Close the data acceptor
-  data_acceptor.close();
   // Tell user that the file transfer is done
-  std::cout << "File transfer done" << std::endl;
+  if (!quiet_) {
+    std::cout << "File transfer done" << std::endl;
+  }
+  return successful;
 }
 
-// Receive file from the server using passive mode
-void ftp::protocol_interpreter_client::receive_file_passive(
-    std::string filename) {
-  // Create a new buffer to receive the file
-  std::shared_ptr<char> file_buf(new char[buffer_size],
-                                 std::default_delete<char[]>());
-  // Sleep for 500ms to wait for the server to listen on the port
-  std::this_thread::sleep_for(std::chrono::milliseconds(500));
-  // Create a connection to the server using a new sockpp::tcp_connector
+// Establish a data connection with the server based on the mode
+sockpp::tcp_socket ftp::protocol_interpreter_client::open_data_connection() {
+  if (!is_passive_mode_) {
+    return accept_data_connection();
+  }
+
+  // The server announced its data port with PASV and is already listening
+  uint16_t data_port = server_data_port_;
+  if (data_port == 0) {
+    // Sleep for 500ms to wait for the server to listen on the port
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    data_port = connector_->peer_address().port() + 1;
+  }
   sockpp::tcp_connector data_connector(
-      sockpp::inet_address(connector_->peer_address().address(),
-                           connector_->peer_address().port() + 1));
+      sockpp::inet_address(connector_->peer_address().address(), data_port));
   if (!data_connector) {
     std::cerr << "Error: " << data_connector.last_error_str() << std::endl;
-    return;
+    return sockpp::tcp_socket();
   }
+  return sockpp::tcp_socket(data_connector.release());
+}
 
-  // Receive the file size from the server
-  const auto file_size_str =
-      ftp::receive_message(connector_, buf_, buffer_size);
-  // Convert the file size string to an integer
-  const long file_size = std::stoi(file_size_str);
-  std::clog << "[Proto][File] "
-            << "File size to receive: " << file_size << std::endl;
+// Listen on the client data port for the data connections of active mode
+bool ftp::protocol_interpreter_client::listen_for_data() {
+  data_acceptor_.close();
+  data_acceptor_.open(sockpp::inet_address(connector_->address().address(),
+                                           client_data_port_));
+  if (!data_acceptor_) {
+    std::cerr << "Error: " << data_acceptor_.last_error_str() << std::endl;
+    return false;
+  }
+  return true;
+}
 
-  // Modify filename to have filename only, without "/" and all text before it
-  filename = filename.substr(filename.find_last_of("/") + 1);
+// Accept the data connection of the server in active mode
+sockpp::tcp_socket ftp::protocol_interpreter_client::accept_data_connection() {
+  // Dropped after a failed transfer, listen again
+  if (!data_acceptor_ && !listen_for_data()) {
+    return sockpp::tcp_socket();
+  }
+  sockpp::tcp_socket data_sock = data_acceptor_.accept();
+  if (!data_sock) {
+    std::cerr << "Error: " << data_acceptor_.last_error_str() << std::endl;
+  }
+  return data_sock;
+}
 
-  // Create a new file to save the received file
-  auto const receive_file_fd = fopen(filename.c_str(), "w");
-  if (receive_file_fd == nullptr) {
-    std::cerr << "Error: " << strerror(errno) << std::endl;
-    data_connector.close();
-    return;
+// Stream files as one batch over a data connection
+uint64_t ftp::protocol_interpreter_client::send_batch(
+    const std::vector<std::string> &filenames) {
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return 0;
   }
+  std::clog << "[Proto][File] " << "Established batch data connection with "
+            << data_sock.peer_address() << std::endl;
 
-  // Hide cursor
-  indicators::show_console_cursor(false);
+  uint64_t sent_total = 0;
+  for (const auto &filename : filenames) {
+    int send_file_fd = open(filename.c_str(), O_RDONLY);
+    if (send_file_fd == -1) {
+      std::cerr << "Error: " << strerror(errno) << std::endl;
+      continue;
+    }
+    struct stat file_stat;
+    if (fstat(send_file_fd, &file_stat) == -1) {
+      std::cerr << "Error: " << strerror(errno) << std::endl;
+      close(send_file_fd);
+      continue;
+    }
 
-  // Prepare the progress bar using indicators
-  indicators::ProgressBar bar{
-      indicators::option::BarWidth{30},
-      indicators::option::ShowElapsedTime{true},
-      indicators::option::ShowRemainingTime{true},
-      indicators::option::PrefixText{"Downloading "},
-      indicators::option::ForegroundColor{indicators::Color::green},
-      indicators::option::ShowPercentage{true},
-      indicators::option::FontStyles{
-          std::vector<indicators::FontStyle>{indicators::FontStyle::bold},
-      },
-  };
+    // Header, then the contents of the file
+    const auto header = ftp::batch_file_header(filename, file_stat.st_size);
+    if (data_sock.write(header) != ssize_t(header.size())) {
+      std::cerr << "Error: " << data_sock.last_error_str() << std::endl;
+      close(send_file_fd);
+      break;
+    }
+    off_t offset = 0;
+    size_t remaining_size = file_stat.st_size;
+    while (remaining_size > 0) {
+      const auto sent_bytes =
+          sendfile(data_sock.handle(), send_file_fd, &offset, remaining_size);
+      if (sent_bytes <= 0) {
+        std::cerr << "Error: " << strerror(errno) << std::endl;
+        break;
+      }
+      remaining_size -= sent_bytes;
+    }
+    close(send_file_fd);
+    sent_total += file_stat.st_size - remaining_size;
+
+    // The stream cannot be resynchronized after a short file
+    if (remaining_size > 0) {
+      data_sock.close();
+      return sent_total;
+    }
+    std::clog << "[Proto][File] " << "Batched " << filename << " ("
+              << file_stat.st_size << " bytes)" << std::endl;
+  }
+
+  // Mark the end of the batch
+  data_sock.write(ftp::batch_end_marker);
+  data_sock.close();
+  return sent_total;
+}
+
+// Extract a directory sent as a tar stream into the current directory
+void ftp::protocol_interpreter_client::receive_archive(std::string directory) {
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return;
+  }
+  std::clog << "[Proto][File] " << "Established archive data connection with "
+            << data_sock.peer_address() << std::endl;
+
+  // Create a new buffer to receive the archive
+  std::shared_ptr<char> file_buf(new char[buffer_size],
+                                 std::default_delete<char[]>());
 
+  // Entries are extracted as soon as their data arrives
+  ftp::tar_extractor extractor(std::filesystem::current_path());
+  uint64_t received_bytes = 0;
   bool successful = true;
-  long remaining_size = file_size;
-  while (remaining_size > 0) {
-    // Receive the file data from the server
-    const ssize_t n = data_connector.read(file_buf.get(), buffer_size);
+  while (!extractor.finished()) {
+    const ssize_t n = data_sock.read(file_buf.get(), buffer_size);
     if (n <= 0) {
-      std::cerr << "Error: " << data_connector.last_error_str() << std::endl;
+      if (n < 0) {
+        std::cerr << "Error: " << data_sock.last_error_str() << std::endl;
+      }
       successful = false;
       break;
     }
-
-    // Write the received data to the file
-    fwrite(file_buf.get(), sizeof(char), n, receive_file_fd);
-    remaining_size -= n;
-
-    // If completed, skip the progress bar
-    if (bar.is_completed()) { // Set the progress bar value
-      continue;
+    received_bytes += n;
+    if (!extractor.feed(file_buf.get(), n)) {
+      successful = false;
+      break;
     }
-    // Otherwise, set the progress bar to the current value
-    // Update the progress bar
-    bar.set_progress(100 - (remaining_size * 100) / file_size);
   }
+  data_sock.close();
 
-  if (successful) {
-    // Completed, set the progress bar to 100%
-    bar.set_option(indicators::option::PrefixText{"Download complete "});
-    bar.mark_as_completed();
-  } else {
-    // Error occurred, set the progress bar to error
-    bar.set_option(indicators::option::PrefixText{"Download failed "});
-    bar.mark_as_completed();
+  // Tell user that the directory transfer is done
+  std::cout << (successful ? "Directory transfer done: "
+                           : "Directory transfer incomplete: ")
+            << extractor.directories() << " directories, "
+            << extractor.files() << " files, " << received_bytes
+            << " bytes received" << std::endl;
+}
+
+// Copy a directory sent as a tar stream to a descriptor, unextracted
+bool ftp::protocol_interpreter_client::receive_archive(int fd) {
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return false;
   }
+  std::clog << "[Proto][File] " << "Established archive data connection with "
+            << data_sock.peer_address() << std::endl;
+
+  // The archive ends when the server closes the data connection
+  uint64_t received_bytes = 0;
+  const bool successful =
+      copy_data(data_sock, fd, -1,
+                [&](uint64_t received) { received_bytes = received; });
+  data_sock.close();
 
-  // Show cursor
-  indicators::show_console_cursor(true);
+  // Tell user that the directory transfer is done
+  std::cout << (successful ? "Directory transfer done: "
+                           : "Directory transfer incomplete: ")
+            << received_bytes << " bytes received" << std::endl;
+  return successful;
+}
 
-  // Close the file
-  fclose(receive_file_fd);
-  // Close the data connection
-  data_connector.close();
-  // Tell user that the file transfer is done
-  std::cout << "File transfer done" << std::endl;
-}
\ No newline at end of file
+// Copy a listing sent over a data connection to standard output, or into
+// listing
+bool ftp::protocol_interpreter_client::receive_listing(std::string *listing) {
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return false;
+  }
+  std::clog << "[Proto][File] " << "Established listing data connection with "
+            << data_sock.peer_address() << std::endl;
+
+  // Lines are printed as they arrive, the listing is never held in memory
+  // unless asked for
+  char chunk[64 * 1024];
+  bool successful = true;
+  while (true) {
+    const ssize_t n = data_sock.read(chunk, sizeof(chunk));
+    if (n <= 0) {
+      if (n < 0) {
+        std::cerr << "Error: " << data_sock.last_error_str() << std::endl;
+        successful = false;
+      }
+      break;
+    }
+    if (listing != nullptr) {
+      listing->append(chunk, size_t(n));
+    } else {
+      std::cout.write(chunk, n);
+    }
+  }
+  std::cout.flush();
+  data_sock.close();
+  return successful;
+}
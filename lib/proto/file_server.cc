@@ -1,26 +1,79 @@
-#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
 #include <indicators/cursor_control.hpp>
 #include <indicators/progress_bar.hpp>
-#include <sys/sendfile.h>
 #include <sys/stat.h>
 
 #include "proto/proto_interpreter.h"
+#include "utils/batch.h"
+#include "utils/buffer_pool.h"
+#include "utils/file_cache.h"
 #include "utils/ftp.h"
 #include "utils/io.h"
+#include "utils/listing_cache.h"
+#include "utils/metrics.h"
+#include "utils/mlsd.h"
+#include "utils/quota.h"
+#include "utils/tar.h"
+#include "utils/trace.h"
+#include "utils/transfer_log.h"
+#include "utils/upload_pipeline.h"
+
+namespace {
+
+// Clients listen on their data port from PORT on; older ones only once
+// they read the reply to the command, which the server waits this long for
+constexpr auto active_connect_timeout = std::chrono::seconds(2);
+constexpr auto active_connect_retry = std::chrono::milliseconds(5);
+
+// Take the contents of a file from the file cache, or keep them in it
+// Only local files are cached, as the cache tells versions apart by their
+// inode; returns nullptr when the file itself is to be sent
+std::shared_ptr<const std::string>
+cached_contents(const std::filesystem::path &file_path,
+                const ftp::vfs_file &file) {
+  FTP_TRACE_SCOPE("prepare file");
+  auto &cache = ftp::file_cache::instance();
+  struct stat file_stat;
+  if (!cache.enabled() || file.fd() == -1 ||
+      fstat(file.fd(), &file_stat) == -1) {
+    return nullptr;
+  }
+
+  // Small, hot files are sent from memory
+  auto cached_data = cache.lookup(file_path, file_stat);
+  if (cached_data) {
+    std::clog << "[Proto][File] " << "Cache hit: " << file_path.string()
+              << " (hits: " << cache.hits() << ", misses: " << cache.misses()
+              << ")" << std::endl;
+    return cached_data;
+  }
+
+  // Keep small files in memory for the next requests
+  return cache.load(file_path, file.fd(), file_stat);
+}
+
+} // namespace
 
 // send_file() and recv_file() are used to send and receive files over a
 // socket.
 // These functions will establish a data connection with the client
 // based on the mode (active or passive)
-void ftp::protocol_interpreter_server::send_file(std::string filename) {
+void ftp::protocol_interpreter_server::send_file(
+    std::string filename, std::unique_ptr<ftp::vfs_file> file) {
   // Check if using the active mode or passive mode
   if (is_passive_mode_) {
-    send_file_passive(filename);
+    send_file_passive(filename, std::move(file));
     return;
   }
 
   // Active mode
-  send_file_active(filename);
+  send_file_active(filename, std::move(file));
 }
 
 void ftp::protocol_interpreter_server::receive_file(std::string filename) {
@@ -34,42 +87,72 @@ void ftp::protocol_interpreter_server::receive_file(std::string filename) {
   receive_file_active(filename);
 }
 
+// Account for file data moved by the current command, pace it to the rate
+// limit of the session
+bool ftp::protocol_interpreter_server::transfer_progress(
+    ftp::transfer_direction direction, uint64_t bytes) {
+  ftp::metrics::add_bytes(direction, bytes);
+  // Only this thread writes them, the admin socket reads them
+  auto bump = [](std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  };
+  bump(status_.command_bytes, bytes);
+  bump(status_.total_bytes, bytes);
+
+  // A new limit starts a new pace
+  const uint64_t limit = status_.rate_limit.load(std::memory_order_relaxed);
+  if (limit != pace_limit_) {
+    pace_limit_ = limit;
+    pace_started_ = std::chrono::steady_clock::now();
+    pace_bytes_ = 0;
+  }
+  pace_bytes_ += bytes;
+  if (limit != 0) {
+    // Sleep until the bytes so far fit in the limit
+    FTP_TRACE_SCOPE("rate limit");
+    std::this_thread::sleep_until(
+        pace_started_ + std::chrono::nanoseconds(uint64_t(
+                            double(pace_bytes_) * 1e9 / double(limit))));
+  }
+  return !status_.killed.load(std::memory_order_relaxed);
+}
+
+// Bytes to send between two calls to transfer_progress()
+size_t ftp::protocol_interpreter_server::transfer_chunk() const {
+  // Small enough to notice a kill soon, and to pace a limited session
+  // about 8 times a second
+  constexpr size_t unlimited_chunk = 4 * 1024 * 1024;
+  constexpr size_t min_chunk = 16 * 1024;
+  const uint64_t limit = status_.rate_limit.load(std::memory_order_relaxed);
+  if (limit == 0) {
+    return unlimited_chunk;
+  }
+  return size_t(std::clamp<uint64_t>(limit / 8, min_chunk, unlimited_chunk));
+}
+
 // Implementation of file() and receive_file() in active mode and
 // passive mode
 
 // Send file to the client using active mode
-void ftp::protocol_interpreter_server::send_file_active(std::string filename) {
-  const auto file_path =
-      current_working_directory_ / filename; // Get the file path
+void ftp::protocol_interpreter_server::send_file_active(
+    std::string filename, std::unique_ptr<ftp::vfs_file> file) {
+  const auto file_path = fs_.host_path(filename); // Get the file path
   // Log the file path
   std::clog << "[Proto][File] " << "File path: " << file_path.string()
             << std::endl;
-  int send_file_fd = open(file_path.c_str(), O_RDONLY);
-  if (send_file_fd == -1) {
-    std::cerr << "Error: " << strerror(errno) << std::endl;
-    return;
-  }
-
-  // Get the file status
-  struct stat file_stat;
-  if (fstat(send_file_fd, &file_stat) == -1) {
-    std::cerr << "Error: " << strerror(errno) << std::endl;
-    close(send_file_fd);
-    return;
+  const uint64_t file_size = file->status().size;
+  const auto cached_data = cached_contents(file_path, *file);
+  if (cached_data) {
+    file.reset();
   }
 
   // Log the file size
-  std::clog << "[Proto][File] " << "File size: " << file_stat.st_size
-            << std::endl;
+  std::clog << "[Proto][File] " << "File size: " << file_size << std::endl;
 
-  // Sleep for 500ms to wait for the client to listen on the port
-  std::this_thread::sleep_for(std::chrono::milliseconds(500));
-  // Create a connection to the client using a new sockpp::tcp_connector
-  sockpp::tcp_connector data_connector(
-      sockpp::inet_address(sock_.peer_address().address(), client_data_port_));
+  // Connect to the port the client listens on
+  sockpp::tcp_socket data_connector = open_data_connection();
   if (!data_connector) {
-    std::cerr << "Error: " << data_connector.last_error_str() << std::endl;
-    close(send_file_fd);
     return;
   }
 
@@ -77,159 +160,149 @@ void ftp::protocol_interpreter_server::send_file_active(std::string filename) {
   std::clog << "[Proto][File] "
             << "Established data connection to "
             << data_connector.peer_address() << std::endl;
+  const auto started = std::chrono::steady_clock::now();
 
   // Send file size to the client
-  std::string file_size_str = std::to_string(file_stat.st_size) + "\r\n";
+  std::string file_size_str = std::to_string(file_size) + "\r\n";
   // Using sock_ instead of data_sock to send the file size
   // to prevent collision with the data connection
   ftp::send_message(&sock_, file_size_str);
 
-  // Send the file to the client
-  off_t offset = 0;
-  size_t remaining_size = file_stat.st_size;
+  // Send the file to the client, a chunk at a time so that the rate limit
+  // and a kill apply; cached files straight from memory
+  uint64_t offset = 0;
+  uint64_t remaining_size = file_size;
+  auto &cache = ftp::file_cache::instance();
   while (remaining_size > 0) {
-    const auto sent_bytes = sendfile(data_connector.handle(), send_file_fd,
-                                     &offset, remaining_size);
+    const size_t chunk = std::min<uint64_t>(remaining_size, transfer_chunk());
+    ssize_t sent_bytes;
+    if (cached_data) {
+      FTP_TRACE_SCOPE("cache send");
+      sent_bytes =
+          ssize_t(cache.send(data_connector.handle(), cached_data, offset, chunk));
+    } else {
+      FTP_TRACE_SCOPE("sendfile");
+      sent_bytes = file->send(data_connector.handle(), offset, chunk);
+    }
     if (sent_bytes < 0) {
       std::cerr << "Error: " << strerror(errno) << std::endl;
       break;
     }
-    // fprintf(stdout, "1. Server sent %d bytes from file's data, offset is now
-    // : %d and remaining data = %d\n", sent_bytes, offset, remain_data);
-    std::clog << "[Proto][File] "
-              << "1. Server sent " << sent_bytes
-              << " bytes from file's data, offset is now: " << offset
-              << " and remaining data: " << remaining_size << std::endl;
+    // The file shrank while sending
+    if (sent_bytes == 0) {
+      break;
+    }
+    offset += sent_bytes;
     remaining_size -= sent_bytes;
-    // fprintf(stdout, "2. Server sent %d bytes from file's data, offset is now
-    // : %d and remaining data = %d\n", sent_bytes, offset, remain_data);
-    std::clog << "[Proto][File] "
-              << "2. Server sent " << sent_bytes
-              << " bytes from file's data, offset is now: " << offset
-              << " and remaining data: " << remaining_size << std::endl;
+    if (!transfer_progress(ftp::transfer_direction::download, sent_bytes)) {
+      break;
+    }
+  }
+  if (cached_data) {
+    cache.finish(data_connector.handle());
+    std::clog << "[Proto][File] " << "Server sent " << offset
+              << " bytes from cache" << std::endl;
   }
+  log_transfer(file_path, ftp::transfer_direction::download,
+               file_size - remaining_size,
+               ftp::nanoseconds_since(started), remaining_size == 0);
 
-  // Close the file descriptor
-  close(send_file_fd);
   // Close the data socket
   data_connector.close();
 }
 
 // Send file to the client using passive mode
-void ftp::protocol_interpreter_server::send_file_passive(std::string filename) {
-  // Create a connection to the client using a new sockpp::tcp_acceptor
-  sockpp::tcp_acceptor data_acceptor(sock_.address().port() + 1);
-  if (!data_acceptor) {
-    std::cerr << "Error: " << data_acceptor.last_error_str() << std::endl;
-    return;
-  }
-
-  // Next: send the file to the client using established data connection
-  const auto file_path =
-      current_working_directory_ / filename; // Get the file path
+void ftp::protocol_interpreter_server::send_file_passive(
+    std::string filename, std::unique_ptr<ftp::vfs_file> file) {
+  // Send the file to the client using established data connection
+  const auto file_path = fs_.host_path(filename); // Get the file path
   // Log the file path
   std::clog << "[Proto][File] " << "File path: " << file_path.string()
             << std::endl;
-  int send_file_fd = open(file_path.c_str(), O_RDONLY);
-  if (send_file_fd == -1) {
-    std::cerr << "Error: " << strerror(errno) << std::endl;
-    data_acceptor.close();
-    return;
-  }
-
-  // Get the file status
-  struct stat file_stat;
-  if (fstat(send_file_fd, &file_stat) == -1) {
-    std::cerr << "Error: " << strerror(errno) << std::endl;
-    close(send_file_fd);
-    data_acceptor.close();
-    return;
+  const uint64_t file_size = file->status().size;
+  const auto cached_data = cached_contents(file_path, *file);
+  if (cached_data) {
+    file.reset();
   }
 
   // Log the file size
-  std::clog << "[Proto][File] " << "File size: " << file_stat.st_size
-            << std::endl;
+  std::clog << "[Proto][File] " << "File size: " << file_size << std::endl;
 
   // Accept a new connection from the client
-  sockpp::tcp_socket data_sock = data_acceptor.accept();
+  sockpp::tcp_socket data_sock = open_data_connection();
   if (!data_sock) {
-    std::cerr << "Error: " << data_acceptor.last_error_str() << std::endl;
-    close(send_file_fd);
-    data_acceptor.close();
     return;
   }
   std::clog << "[Proto][File] "
             << "Accepted data connection from " << data_sock.peer_address()
             << std::endl;
+  const auto started = std::chrono::steady_clock::now();
   // Send file size to the client
-  std::string file_size_str = std::to_string(file_stat.st_size) + "\r\n";
+  std::string file_size_str = std::to_string(file_size) + "\r\n";
   // Using sock_ instead of data_sock to send the file size
   // to prevent collision with the data connection
   ftp::send_message(&sock_, file_size_str);
 
-  // Send the file to the client
-  off_t offset = 0;
-  size_t remaining_size = file_stat.st_size;
+  // Send the file to the client, a chunk at a time so that the rate limit
+  // and a kill apply; cached files straight from memory
+  uint64_t offset = 0;
+  uint64_t remaining_size = file_size;
+  auto &cache = ftp::file_cache::instance();
   while (remaining_size > 0) {
-    const auto sent_bytes =
-        sendfile(data_sock.handle(), send_file_fd, &offset, remaining_size);
+    const size_t chunk = std::min<uint64_t>(remaining_size, transfer_chunk());
+    ssize_t sent_bytes;
+    if (cached_data) {
+      FTP_TRACE_SCOPE("cache send");
+      sent_bytes =
+          ssize_t(cache.send(data_sock.handle(), cached_data, offset, chunk));
+    } else {
+      FTP_TRACE_SCOPE("sendfile");
+      sent_bytes = file->send(data_sock.handle(), offset, chunk);
+    }
     if (sent_bytes < 0) {
       std::cerr << "Error: " << strerror(errno) << std::endl;
       break;
     }
-    // fprintf(stdout, "1. Server sent %d bytes from file's data, offset is now
-    // : %d and remaining data = %d\n", sent_bytes, offset, remain_data);
-    std::clog << "[Proto][File] "
-              << "1. Server sent " << sent_bytes
-              << " bytes from file's data, offset is now: " << offset
-              << " and remaining data: " << remaining_size << std::endl;
+    // The file shrank while sending
+    if (sent_bytes == 0) {
+      break;
+    }
+    offset += sent_bytes;
     remaining_size -= sent_bytes;
-    // fprintf(stdout, "2. Server sent %d bytes from file's data, offset is now
-    // : %d and remaining data = %d\n", sent_bytes, offset, remain_data);
-    std::clog << "[Proto][File] "
-              << "2. Server sent " << sent_bytes
-              << " bytes from file's data, offset is now: " << offset
-              << " and remaining data: " << remaining_size << std::endl;
+    if (!transfer_progress(ftp::transfer_direction::download, sent_bytes)) {
+      break;
+    }
+  }
+  if (cached_data) {
+    cache.finish(data_sock.handle());
+    std::clog << "[Proto][File] " << "Server sent " << offset
+              << " bytes from cache" << std::endl;
   }
+  log_transfer(file_path, ftp::transfer_direction::download,
+               file_size - remaining_size,
+               ftp::nanoseconds_since(started), remaining_size == 0);
 
-  // Close the file descriptor
-  close(send_file_fd);
   // Close the data socket
   data_sock.close();
-  // Close the data acceptor
-  data_acceptor.close();
 }
 
 void ftp::protocol_interpreter_server::receive_file_active(
     std::string filename) {
-  // Create a new buffer to receive the file
-  std::shared_ptr<char> file_buf(new char[buffer_size],
-                                 std::default_delete<char[]>());
-  // Sleep for 500ms to wait for the client to listen on the port
-  std::this_thread::sleep_for(std::chrono::milliseconds(500));
-  // Create a connection to the client using a new sockpp::tcp_connector
-  sockpp::tcp_connector data_connector(
-      sockpp::inet_address(sock_.peer_address().address(), client_data_port_));
+  // Connect to the port the client listens on
+  sockpp::tcp_socket data_connector = open_data_connection();
   if (!data_connector) {
-    std::cerr << "Error: " << data_connector.last_error_str() << std::endl;
     return;
   }
 
   // Receive the file size from the client
-  const auto file_size_str = ftp::receive_message(&sock_, buf_, buffer_size);
+  const auto file_size_str = receive_command();
   // Convert the file size string to an integer
   const long file_size = std::stoi(file_size_str);
   std::clog << "[Proto][File] "
             << "File size to receive: " << file_size << std::endl;
 
-  // Modify filename to have filename only, without "/" and all text before it
-  filename = filename.substr(filename.find_last_of("/") + 1);
-
-  // Create a new file to save the received file
-  auto const receive_file_fd =
-      fopen((current_working_directory_ / filename).c_str(), "w");
-  if (receive_file_fd == nullptr) {
-    std::cerr << "Error: " << strerror(errno) << std::endl;
+  // Stage the received file until it is complete
+  if (!stage_upload(filename, uint64_t(std::max(file_size, 0L)))) {
     data_connector.close();
     return;
   }
@@ -250,29 +323,20 @@ void ftp::protocol_interpreter_server::receive_file_active(
       },
   };
 
-  bool successful = true;
+  // The network and the disk stages overlap, see utils/upload_pipeline.h
   long remaining_size = file_size;
-  while (remaining_size > 0) {
-    // Receive the file data from the client
-    const ssize_t n = data_connector.read(file_buf.get(), buffer_size);
-    if (n <= 0) {
-      std::cerr << "Error: " << data_connector.last_error_str() << std::endl;
-      successful = false;
-      break;
-    }
-
-    // Write the received data to the file
-    fwrite(file_buf.get(), sizeof(char), n, receive_file_fd);
-    remaining_size -= n;
-
-    // If completed, skip the progress bar
-    if (bar.is_completed()) { // Set the progress bar value
-      continue;
-    }
-    // Otherwise, set the progress bar to the current value
-    // Update the progress bar
-    bar.set_progress(100 - (remaining_size * 100) / file_size);
-  }
+  const bool successful = ftp::receive_to_upload(
+      data_connector, *staged_upload_.file, file_size,
+      ftp::upload_pipeline_settings::instance(), [&](uint64_t received) {
+        const uint64_t moved = received - uint64_t(file_size - remaining_size);
+        remaining_size = file_size - long(received);
+        // If completed, skip the progress bar
+        if (!bar.is_completed()) {
+          // Otherwise, set the progress bar to the current value
+          bar.set_progress(100 - (remaining_size * 100) / file_size);
+        }
+        return transfer_progress(ftp::transfer_direction::upload, moved);
+      });
 
   if (successful) {
     // Completed, set the progress bar to 100%
@@ -287,40 +351,33 @@ void ftp::protocol_interpreter_server::receive_file_active(
   // Show cursor
   indicators::show_console_cursor(true);
 
-  // Close the file
-  fclose(receive_file_fd);
+  staged_upload_.received = file_size - remaining_size;
+  staged_upload_.finished = std::chrono::steady_clock::now();
+
+  // Keep the upload until it is committed or aborted
+  staged_upload_.complete = successful && remaining_size == 0;
   // Close the data connection
   data_connector.close();
 }
 
 void ftp::protocol_interpreter_server::receive_file_passive(
     std::string filename) {
-  // Create a new buffer to receive the file
-  std::shared_ptr<char> file_buf(new char[buffer_size],
-                                 std::default_delete<char[]>());
-  // Create a connection to the client using a new sockpp::tcp_acceptor
-  sockpp::tcp_acceptor data_acceptor(sockpp::inet_address(
-      sock_.address().address(), sock_.address().port() + 1));
   // Accept a new connection from the client
-  sockpp::tcp_socket data_sock = data_acceptor.accept();
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return;
+  }
 
   // Receive the file size from the client
-  const auto file_size_str = ftp::receive_message(&sock_, buf_, buffer_size);
+  const auto file_size_str = receive_command();
   // Convert the file size string to an integer
   const long file_size = std::stoi(file_size_str);
   std::clog << "[Proto][File] "
             << "File size to receive: " << file_size << std::endl;
 
-  // Modify filename to have filename only, without "/" and all text before it
-  filename = filename.substr(filename.find_last_of("/") + 1);
-
-  // Create a new file to save the received file
-  auto const receive_file_fd =
-      fopen((current_working_directory_ / filename).c_str(), "w");
-  if (receive_file_fd == nullptr) {
-    std::cerr << "Error: " << strerror(errno) << std::endl;
+  // Stage the received file until it is complete
+  if (!stage_upload(filename, uint64_t(std::max(file_size, 0L)))) {
     data_sock.close();
-    data_acceptor.close();
     return;
   }
 
@@ -340,29 +397,20 @@ void ftp::protocol_interpreter_server::receive_file_passive(
       },
   };
 
-  bool successful = true;
+  // The network and the disk stages overlap, see utils/upload_pipeline.h
   long remaining_size = file_size;
-  while (remaining_size > 0) {
-    // Receive the file data from the client
-    const ssize_t n = data_sock.read(file_buf.get(), buffer_size);
-    if (n <= 0) {
-      std::cerr << "Error: " << data_sock.last_error_str() << std::endl;
-      successful = false;
-      break;
-    }
-
-    // Write the received data to the file
-    fwrite(file_buf.get(), sizeof(char), n, receive_file_fd);
-    remaining_size -= n;
-
-    // If completed, skip the progress bar
-    if (bar.is_completed()) { // Set the progress bar value
-      continue;
-    }
-    // Otherwise, set the progress bar to the current value
-    // Update the progress bar
-    bar.set_progress(100 - (remaining_size * 100) / file_size);
-  }
+  const bool successful = ftp::receive_to_upload(
+      data_sock, *staged_upload_.file, file_size,
+      ftp::upload_pipeline_settings::instance(), [&](uint64_t received) {
+        const uint64_t moved = received - uint64_t(file_size - remaining_size);
+        remaining_size = file_size - long(received);
+        // If completed, skip the progress bar
+        if (!bar.is_completed()) {
+          // Otherwise, set the progress bar to the current value
+          bar.set_progress(100 - (remaining_size * 100) / file_size);
+        }
+        return transfer_progress(ftp::transfer_direction::upload, moved);
+      });
 
   if (successful) {
     // Completed, set the progress bar to 100%
@@ -377,10 +425,465 @@ void ftp::protocol_interpreter_server::receive_file_passive(
   // Show cursor
   indicators::show_console_cursor(true);
 
-  // Close the file
-  fclose(receive_file_fd);
+  staged_upload_.received = file_size - remaining_size;
+  staged_upload_.finished = std::chrono::steady_clock::now();
+
+  // Keep the upload until it is committed or aborted
+  staged_upload_.complete = successful && remaining_size == 0;
   // Close the data connection
   data_sock.close();
-  // Close the data acceptor
-  data_acceptor.close();
+}
+
+// Start the upload of a file to the current working directory
+bool ftp::protocol_interpreter_server::stage_upload(std::string filename,
+                                                    uint64_t size) {
+  FTP_TRACE_SCOPE("stage upload");
+  // Discard the leftovers of a previous upload
+  abort_upload();
+
+  // Modify filename to have filename only, without "/" and all text before it
+  filename = filename.substr(filename.find_last_of("/") + 1);
+  if (filename.empty() || filename == "." || filename == "..") {
+    std::cerr << "[Proto][File] " << "Invalid file name" << std::endl;
+    return false;
+  }
+
+  // The upload stays in the current working directory even if the session
+  // changes directory before it is committed
+  const auto final_path = fs_.host_path(filename);
+  const auto path = fs_.resolve(filename);
+
+  // Refuse the upload before any data comes if it does not fit the quota
+  auto &quota = ftp::quota_ledger::instance();
+  if (!quota.reserve(current_username_, path, size)) {
+    std::cerr << "[Proto][File] " << "Upload of " << final_path << " ("
+              << size << " bytes) exceeds the quota of " << current_username_
+              << std::endl;
+    staged_upload_.over_quota = true;
+    return false;
+  }
+
+  auto file = fs_.storage().open_write(path);
+  if (file == nullptr) {
+    std::cerr << "[Proto][File] " << "Cannot store " << final_path << ": "
+              << strerror(errno) << std::endl;
+    quota.release(current_username_, size);
+    return false;
+  }
+
+  std::clog << "[Proto][File] " << "Staging upload of " << final_path
+            << std::endl;
+  staged_upload_ = {};
+  staged_upload_.file = std::move(file);
+  staged_upload_.final_path = final_path;
+  staged_upload_.path = path;
+  staged_upload_.quota_reserved = size;
+  staged_upload_.started = std::chrono::steady_clock::now();
+  return true;
+}
+
+// Make the staged upload visible under its final name
+bool ftp::protocol_interpreter_server::commit_upload() {
+  FTP_TRACE_SCOPE("commit upload");
+  if (staged_upload_.file == nullptr || !staged_upload_.complete) {
+    abort_upload();
+    return false;
+  }
+
+  if (!staged_upload_.file->commit()) {
+    std::cerr << "Error: " << strerror(errno) << std::endl;
+    abort_upload();
+    return false;
+  }
+  staged_upload_.file.reset();
+  ftp::quota_ledger::instance().commit_file(
+      current_username_, staged_upload_.path, staged_upload_.quota_reserved,
+      staged_upload_.received);
+
+  ftp::listing_cache::instance().invalidate(
+      staged_upload_.final_path.parent_path());
+  ftp::stat_cache::instance().invalidate(staged_upload_.final_path.string());
+
+  std::clog << "[Proto][File] " << "Committed upload "
+            << staged_upload_.final_path << std::endl;
+  log_upload(true);
+  staged_upload_ = {};
+  return true;
+}
+
+// Discard the staged upload
+void ftp::protocol_interpreter_server::abort_upload() {
+  if (staged_upload_.file != nullptr) {
+    std::clog << "[Proto][File] " << "Discarding upload of "
+              << staged_upload_.final_path << std::endl;
+    staged_upload_.file.reset();
+    ftp::quota_ledger::instance().release(current_username_,
+                                          staged_upload_.quota_reserved);
+    log_upload(false);
+  }
+  staged_upload_ = {};
+}
+
+// Queue a record of a finished transfer for the transfer log
+void ftp::protocol_interpreter_server::log_transfer(
+    const std::filesystem::path &path, ftp::transfer_direction direction,
+    uint64_t bytes, uint64_t duration_nanoseconds, bool complete) {
+  auto &log = ftp::transfer_log::instance();
+  if (!log.enabled()) {
+    return;
+  }
+  ftp::transfer_record record;
+  record.finished = std::chrono::system_clock::now();
+  record.duration_nanoseconds = duration_nanoseconds;
+  const auto peer = sock_.peer_address().to_string();
+  record.remote_host = peer.substr(0, peer.rfind(':'));
+  record.user = current_username_;
+  record.path = path.string();
+  record.bytes = bytes;
+  record.direction = direction;
+  record.passive = is_passive_mode_;
+  record.complete = complete;
+  log.record(std::move(record));
+}
+
+// Queue the record of the staged upload
+void ftp::protocol_interpreter_server::log_upload(bool complete) {
+  // The data stopped coming before the upload was synced and renamed
+  const auto finished =
+      staged_upload_.finished == std::chrono::steady_clock::time_point()
+          ? std::chrono::steady_clock::now()
+          : staged_upload_.finished;
+  log_transfer(staged_upload_.final_path, ftp::transfer_direction::upload,
+               staged_upload_.received,
+               uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            finished - staged_upload_.started)
+                            .count()),
+               complete);
+}
+
+// Establish a data connection with the client based on the mode
+sockpp::tcp_socket ftp::protocol_interpreter_server::open_data_connection() {
+  FTP_TRACE_SCOPE("data connection");
+  // Setup time, as the client waits for it
+  const auto started = std::chrono::steady_clock::now();
+
+  // PASV opened a listener on its own port: accept the client there
+  if (is_passive_mode_ && pasv_acceptor_) {
+    sockpp::tcp_socket data_sock = pasv_acceptor_.accept();
+    if (!data_sock) {
+      std::cerr << "Error: " << pasv_acceptor_.last_error_str() << std::endl;
+      return data_sock;
+    }
+    // Only the client of this session may connect to its data port
+    if (data_sock.peer_address().address() !=
+        sock_.peer_address().address()) {
+      std::cerr << "[Proto][File] " << "Rejected data connection from "
+                << data_sock.peer_address() << std::endl;
+      return sockpp::tcp_socket();
+    }
+    ftp::metrics::record_data_connection(ftp::nanoseconds_since(started));
+    return data_sock;
+  }
+
+  if (is_passive_mode_) {
+    // Listen on the port next to the command port, accept the client
+    sockpp::tcp_acceptor data_acceptor(sockpp::inet_address(
+        sock_.address().address(), sock_.address().port() + 1));
+    if (!data_acceptor) {
+      std::cerr << "Error: " << data_acceptor.last_error_str() << std::endl;
+      return sockpp::tcp_socket();
+    }
+    sockpp::tcp_socket data_sock = data_acceptor.accept();
+    if (!data_sock) {
+      std::cerr << "Error: " << data_acceptor.last_error_str() << std::endl;
+      return data_sock;
+    }
+    ftp::metrics::record_data_connection(ftp::nanoseconds_since(started));
+    return data_sock;
+  }
+
+  // Connect to the client at once, retrying while it is not listening yet
+  const sockpp::inet_address client_address(sock_.peer_address().address(),
+                                            client_data_port_);
+  sockpp::tcp_connector data_connector(client_address);
+  while (!data_connector &&
+         std::chrono::steady_clock::now() - started < active_connect_timeout) {
+    std::this_thread::sleep_for(active_connect_retry);
+    data_connector = sockpp::tcp_connector(client_address);
+  }
+  if (!data_connector) {
+    std::cerr << "Error: " << data_connector.last_error_str() << std::endl;
+    return sockpp::tcp_socket();
+  }
+  ftp::metrics::record_data_connection(ftp::nanoseconds_since(started));
+  return sockpp::tcp_socket(data_connector.release());
+}
+
+// Receive a batch stream and store every file in it
+std::vector<std::pair<std::string, bool>>
+ftp::protocol_interpreter_server::receive_batch() {
+  FTP_TRACE_SCOPE("receive batch");
+  std::vector<std::pair<std::string, bool>> results;
+
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return results;
+  }
+  std::clog << "[Proto][File] " << "Established batch data connection with "
+            << data_sock.peer_address() << std::endl;
+
+  // Lease a buffer from the pool to receive the stream
+  const auto file_buf = ftp::buffer_pool::instance().lease();
+  if (!file_buf) {
+    return results;
+  }
+
+  // Parser state: either reading a header line or the body of a file
+  std::string header;
+  std::string filename;
+  bool in_body = false;
+  bool end_of_batch = false;
+  bool file_ok = true;
+  uint64_t remaining_size = 0;
+
+  // Commit the current file and record its outcome
+  auto finish_file = [&]() {
+    staged_upload_.finished = std::chrono::steady_clock::now();
+    staged_upload_.complete = file_ok;
+    results.emplace_back(filename, commit_upload());
+    in_body = false;
+  };
+
+  while (!end_of_batch) {
+    const ssize_t n = data_sock.read(file_buf.data(), file_buf.size());
+    if (n <= 0) {
+      if (n < 0) {
+        std::cerr << "Error: " << data_sock.last_error_str() << std::endl;
+      }
+      break;
+    }
+
+    // Unpack the chunk: headers and file contents may span reads
+    const char *data = file_buf.data();
+    size_t pos = 0;
+    while (pos < size_t(n) && !end_of_batch) {
+      if (in_body) {
+        const size_t chunk = std::min<uint64_t>(remaining_size, n - pos);
+        if (file_ok && staged_upload_.file != nullptr &&
+            !staged_upload_.file->write(data + pos, chunk)) {
+          std::cerr << "Error: " << strerror(errno) << std::endl;
+          file_ok = false;
+        }
+        pos += chunk;
+        remaining_size -= chunk;
+        staged_upload_.received += chunk;
+        if (remaining_size == 0) {
+          finish_file();
+        }
+        if (!transfer_progress(ftp::transfer_direction::upload, chunk)) {
+          end_of_batch = true;
+        }
+        continue;
+      }
+
+      // Accumulate the header line
+      const char *line_end =
+          static_cast<const char *>(memchr(data + pos, '\n', n - pos));
+      const size_t line_size =
+          line_end == nullptr ? n - pos : line_end - (data + pos);
+      header.append(data + pos, line_size);
+      pos += line_size;
+      if (header.size() > ftp::batch_max_header_size) {
+        std::cerr << "[Proto][File] " << "Batch header too long" << std::endl;
+        end_of_batch = true;
+        break;
+      }
+      if (line_end == nullptr) {
+        continue;
+      }
+      pos++; // Skip '\n'
+
+      // Parse the header of the next file
+      uint64_t size = 0;
+      bool end = false;
+      const bool valid = ftp::parse_batch_header(header, filename, size, end);
+      header.clear();
+      if (!valid || end) {
+        if (!valid) {
+          std::cerr << "[Proto][File] " << "Malformed batch header"
+                    << std::endl;
+        }
+        end_of_batch = true;
+        break;
+      }
+
+      std::clog << "[Proto][File] " << "Batch file: " << filename << " ("
+                << size << " bytes)" << std::endl;
+      file_ok = stage_upload(filename, size);
+      filename = filename.substr(filename.find_last_of("/") + 1);
+      remaining_size = size;
+      in_body = true;
+      if (remaining_size == 0) {
+        finish_file();
+      }
+    }
+  }
+
+  // Connection closed in the middle of a file
+  if (in_body) {
+    abort_upload();
+    results.emplace_back(filename, false);
+  }
+
+  data_sock.close();
+  return results;
+}
+
+// Stream a directory tree as a tar archive, generated while walking it
+void ftp::protocol_interpreter_server::send_archive(
+    const std::string &directory) {
+  FTP_TRACE_SCOPE("send archive");
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return;
+  }
+  std::clog << "[Proto][File] " << "Established archive data connection with "
+            << data_sock.peer_address() << std::endl;
+
+  // Entries are named after the directory, so the archive holds the
+  // directory itself (the root is named after where it is stored)
+  auto &storage = fs_.storage();
+  const auto resolved = fs_.resolve(directory);
+  const auto directory_path = fs_.host_path(directory);
+  std::string root_name = ftp::split_path(resolved).second;
+  if (root_name.empty()) {
+    root_name = directory_path.filename().string();
+  }
+  const auto started = std::chrono::steady_clock::now();
+  uint64_t sent_files = 0;
+  uint64_t sent_bytes = 0; // File contents
+  const std::string zeros(ftp::tar_block_size, '\0');
+
+  // Send a header, then the contents of a file
+  auto send_file_entry = [&](const std::string &name,
+                             const std::string &path) {
+    const auto file = storage.open_read(path);
+    if (file == nullptr) {
+      return true; // Vanished while walking, or not a regular file
+    }
+    const auto &status = file->status();
+    const auto header = ftp::tar_header(name, ftp::tar_type_file, status.size,
+                                        status.mode, status.mtime);
+    if (data_sock.write(header) != ssize_t(header.size())) {
+      return false;
+    }
+    uint64_t offset = 0;
+    uint64_t remaining_size = status.size;
+    while (remaining_size > 0) {
+      const auto sent =
+          file->send(data_sock.handle(), offset,
+                     std::min<uint64_t>(remaining_size, transfer_chunk()));
+      if (sent <= 0) {
+        break;
+      }
+      offset += sent;
+      remaining_size -= sent;
+      if (!transfer_progress(ftp::transfer_direction::download, sent)) {
+        return false;
+      }
+    }
+    sent_bytes += offset;
+
+    // The file shrank while sending: keep the archive consistent with the
+    // size in the header
+    while (remaining_size > 0) {
+      const size_t chunk = std::min<uint64_t>(remaining_size, zeros.size());
+      if (data_sock.write(zeros.data(), chunk) != ssize_t(chunk)) {
+        return false;
+      }
+      remaining_size -= chunk;
+    }
+    const size_t padding = ftp::tar_padding(status.size);
+    sent_files++;
+    return data_sock.write(zeros.data(), padding) == ssize_t(padding);
+  };
+
+  // Send a directory and everything below it
+  // Symbolic links are never followed, so the walk cannot leave the tree
+  std::function<bool(const std::string &, const std::string &,
+                     const ftp::vfs_status &)>
+      send_directory = [&](const std::string &name, const std::string &path,
+                           const ftp::vfs_status &status) {
+        const auto header =
+            ftp::tar_header(name + "/", ftp::tar_type_directory, 0,
+                            status.mode, status.mtime);
+        bool successful = data_sock.write(header) == ssize_t(header.size());
+        if (!successful) {
+          return false;
+        }
+        // Unreadable directories are skipped
+        storage.list(path, false, [&](const ftp::vfs_entry &entry) {
+          if (entry.is_link) {
+            return true;
+          }
+          const auto entry_name = name + "/" + entry.name;
+          const auto entry_path = ftp::join_path(path, entry.name);
+          if (entry.status.is_directory) {
+            successful = send_directory(entry_name, entry_path, entry.status);
+          } else if (entry.status.is_regular) {
+            successful = send_file_entry(entry_name, entry_path);
+          }
+          return successful;
+        });
+        return successful;
+      };
+
+  const bool successful =
+      send_directory(root_name, resolved, storage.stat(resolved));
+
+  // Mark the end of the archive
+  if (successful) {
+    data_sock.write(ftp::tar_end_of_archive());
+  }
+  std::clog << "[Proto][File] " << "Archive of " << directory_path
+            << " sent (" << sent_files << " files)" << std::endl;
+  log_transfer(directory_path, ftp::transfer_direction::download, sent_bytes,
+               ftp::nanoseconds_since(started), successful);
+  data_sock.close();
+}
+
+// Stream the MLSD lines of a directory, generated while reading it
+void ftp::protocol_interpreter_server::send_listing(
+    const std::string &directory) {
+  FTP_TRACE_SCOPE("send listing");
+  sockpp::tcp_socket data_sock = open_data_connection();
+  if (!data_sock) {
+    return;
+  }
+  std::clog << "[Proto][File] " << "Established listing data connection with "
+            << data_sock.peer_address() << std::endl;
+
+  // Lines are sent in chunks as the directory is read, so a directory of
+  // any size costs one chunk and one batch of directory entries
+  constexpr size_t chunk_size = 64 * 1024;
+  std::string chunk;
+  chunk.reserve(chunk_size);
+  bool successful = true;
+  uint64_t entries = 0;
+  auto append_entry = [&](const ftp::vfs_entry &entry) {
+    ftp::append_mlsd_line(entry, chunk);
+    entries++;
+    if (chunk.size() >= chunk_size - 512) {
+      successful = data_sock.write(chunk) == ssize_t(chunk.size());
+      chunk.clear();
+    }
+    return successful;
+  };
+  fs_.storage().list(fs_.resolve(directory), false, append_entry);
+  if (successful && !chunk.empty()) {
+    data_sock.write(chunk);
+  }
+  std::clog << "[Proto][File] " << "Listing of " << fs_.resolve(directory)
+            << " sent (" << entries << " entries)" << std::endl;
+  data_sock.close();
 }
@@ -0,0 +1,417 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "proto/mirror.h"
+#include "utils/crc32.h"
+#include "utils/ftp.h"
+#include "utils/mlsd.h"
+#include "utils/stat_cache.h"
+
+namespace {
+
+// Is path beneath one of the conflicting paths?
+bool under_conflict(const std::string &path,
+                    const std::set<std::string> &conflicts) {
+  for (auto slash = path.rfind('/'); slash != std::string::npos;
+       slash = slash == 0 ? std::string::npos : path.rfind('/', slash - 1)) {
+    if (conflicts.count(path.substr(0, slash)) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Add the failures of a parallel transfer to those of the mirror
+void add_failures(ftp::mirror_summary &summary,
+                  const ftp::transfer_summary &part) {
+  summary.failures.insert(summary.failures.end(), part.failures.begin(),
+                          part.failures.end());
+}
+
+} // namespace
+
+// Parse the arguments of mirror, returns false on invalid options
+bool ftp::parse_mirror_options(const std::string &arguments,
+                               mirror_options &options) {
+  std::vector<std::string> tokens;
+  tokens = ftp::split(arguments, tokens, ' ');
+  std::vector<std::string> positional;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens[i] == "-n" || tokens[i] == "--dry-run") {
+      options.dry_run = true;
+      continue;
+    }
+    if (tokens[i] == "--delete") {
+      options.remove_extra = true;
+      continue;
+    }
+    if (tokens[i] == "--hash") {
+      options.compare_hashes = true;
+      continue;
+    }
+    // -j <sessions> or -j<sessions>
+    if (tokens[i].rfind("-j", 0) == 0) {
+      std::string value = tokens[i].substr(2);
+      if (value.empty() && i + 1 < tokens.size()) {
+        value = tokens[++i];
+      }
+      try {
+        const int concurrency = std::stoi(value);
+        if (concurrency < 1) {
+          return false;
+        }
+        options.concurrency = size_t(concurrency);
+      } catch (const std::exception &) {
+        return false;
+      }
+      continue;
+    }
+    positional.push_back(tokens[i]);
+  }
+  if (positional.size() != 3 ||
+      (positional[0] != "up" && positional[0] != "down")) {
+    return false;
+  }
+  options.upload = positional[0] == "up";
+  options.local = positional[1];
+  options.remote = positional[2];
+  return true;
+}
+
+// Constructor
+ftp::mirror::mirror(sockpp::inet_address server, std::string username,
+                    std::string password, mirror_options options,
+                    std::string remote_root)
+    : options_(std::move(options)), remote_root_(std::move(remote_root)),
+      pool_(server, std::move(username), std::move(password),
+            options_.concurrency) {}
+
+// Walk and compare both trees
+bool ftp::mirror::plan(mirror_plan &plan) {
+  plan = mirror_plan();
+  if (!open_control()) {
+    return false;
+  }
+  tree local;
+  tree remote;
+  const bool local_exists = walk_local(local);
+  const bool remote_exists = walk_remote(remote);
+  if (!error_.empty()) {
+    return false;
+  }
+  const bool source_exists = options_.upload ? local_exists : remote_exists;
+  if (!source_exists) {
+    error_ = "cannot read " + (options_.upload ? local_root().string()
+                                               : remote_root_);
+    return false;
+  }
+  plan.create_root = !(options_.upload ? remote_exists : local_exists);
+  const tree &source = options_.upload ? local : remote;
+  const tree &target = options_.upload ? remote : local;
+
+  // Entries of the source missing from the target or different there
+  std::set<std::string> conflicts;
+  for (const auto &[path, entry] : source) {
+    if (under_conflict(path, conflicts)) {
+      continue;
+    }
+    const auto found = target.find(path);
+    if (found == target.end()) {
+      if (entry.is_directory) {
+        plan.directories.push_back(path);
+      } else {
+        plan.transfers.emplace_back(path, entry);
+        plan.bytes += entry.size;
+      }
+      continue;
+    }
+    if (entry.is_directory != found->second.is_directory) {
+      conflicts.insert(path);
+      plan.conflicts.push_back(path);
+      continue;
+    }
+    if (entry.is_directory) {
+      continue;
+    }
+    bool changed = entry.size != found->second.size;
+    if (!changed) {
+      changed = options_.compare_hashes ? !same_contents(path)
+                                        : entry.modify > found->second.modify;
+    }
+    if (!changed) {
+      plan.unchanged++;
+      continue;
+    }
+    plan.transfers.emplace_back(path, entry);
+    plan.bytes += entry.size;
+  }
+
+  // Entries of the target the source lacks, children before their parents
+  for (auto it = target.rbegin(); it != target.rend(); ++it) {
+    const auto &[path, entry] = *it;
+    if (source.count(path) != 0 || under_conflict(path, conflicts)) {
+      continue;
+    }
+    if (!options_.remove_extra) {
+      plan.extra++;
+    } else if (entry.is_directory) {
+      plan.removed_directories.push_back(path);
+    } else {
+      plan.removals.push_back(path);
+    }
+  }
+  return true;
+}
+
+// Create the directories, transfer the files over the pool, then delete
+ftp::mirror_summary ftp::mirror::run(const mirror_plan &plan) {
+  mirror_summary summary;
+  const auto start = std::chrono::steady_clock::now();
+  if (options_.upload && !open_control()) {
+    summary.failures.emplace_back(remote_root_, error_);
+    return summary;
+  }
+
+  // Directories first, parents before their children
+  auto make_directory = [&](const std::string &relative) {
+    bool created = false;
+    if (options_.upload) {
+      const auto response =
+          control_->interpreter->execute("MKD " + remote_path(relative));
+      created = response.find("200") != std::string::npos ||
+                response.find("already exists") != std::string::npos;
+    } else {
+      std::error_code error;
+      std::filesystem::create_directories(local_root() / relative, error);
+      created = !error;
+    }
+    if (created) {
+      summary.directories_created++;
+    } else {
+      summary.failures.emplace_back(relative, "cannot create the directory");
+    }
+    return created;
+  };
+  if (plan.create_root && !make_directory("")) {
+    return summary;
+  }
+  for (const auto &relative : plan.directories) {
+    make_directory(relative);
+  }
+
+  // Files over the pool of sessions
+  std::vector<parallel_transfer::job> jobs;
+  for (const auto &[relative, entry] : plan.transfers) {
+    const std::filesystem::path path(remote_path(relative));
+    jobs.push_back({path.parent_path().generic_string(),
+                    path.filename().string(), local_root() / relative,
+                    options_.upload ? "" : entry.modify});
+  }
+  if (!jobs.empty()) {
+    const auto transferred =
+        options_.upload ? pool_.upload(jobs) : pool_.download(jobs);
+    summary.files_transferred = transferred.files_ok;
+    summary.bytes = transferred.bytes;
+    add_failures(summary, transferred);
+  }
+
+  // Files the source lacks
+  if (options_.upload) {
+    jobs.clear();
+    for (const auto &relative : plan.removals) {
+      const std::filesystem::path path(remote_path(relative));
+      jobs.push_back({path.parent_path().generic_string(),
+                      path.filename().string(), {}, {}});
+    }
+    if (!jobs.empty()) {
+      const auto removed = pool_.remove(jobs);
+      summary.entries_removed += removed.files_ok;
+      add_failures(summary, removed);
+    }
+  } else {
+    for (const auto &relative : plan.removals) {
+      std::error_code error;
+      if (std::filesystem::remove(local_root() / relative, error)) {
+        summary.entries_removed++;
+      } else {
+        summary.failures.emplace_back(relative, error.message());
+      }
+    }
+  }
+
+  // Then the directories they were in, children first
+  for (const auto &relative : plan.removed_directories) {
+    bool removed = false;
+    if (options_.upload) {
+      const auto response =
+          control_->interpreter->execute("RMD " + remote_path(relative));
+      removed = response.find("200") != std::string::npos;
+    } else {
+      std::error_code error;
+      removed = std::filesystem::remove(local_root() / relative, error);
+    }
+    if (removed) {
+      summary.entries_removed++;
+    } else {
+      summary.failures.emplace_back(relative, "cannot remove the directory");
+    }
+  }
+
+  if (control_ != nullptr) {
+    control_->interpreter->stop();
+    control_.reset();
+  }
+  summary.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  return summary;
+}
+
+// Read the local tree, false if its root does not exist
+bool ftp::mirror::walk_local(tree &entries) {
+  const auto root = local_root();
+  std::error_code error;
+  if (!std::filesystem::is_directory(root, error)) {
+    return false;
+  }
+  std::filesystem::recursive_directory_iterator it(root, error), end;
+  for (; !error && it != end; it.increment(error)) {
+    // Symbolic links and special files are skipped, like on the server
+    struct stat entry_stat;
+    if (lstat(it->path().c_str(), &entry_stat) != 0 ||
+        !(S_ISREG(entry_stat.st_mode) || S_ISDIR(entry_stat.st_mode))) {
+      continue;
+    }
+    tree_entry entry;
+    entry.is_directory = S_ISDIR(entry_stat.st_mode);
+    entry.size = entry.is_directory ? 0 : uint64_t(entry_stat.st_size);
+    entry.modify = ftp::format_timestamp(entry_stat.st_mtime);
+    entries.emplace(it->path().lexically_relative(root).generic_string(),
+                    std::move(entry));
+  }
+  if (error) {
+    error_ = root.string() + ": " + error.message();
+  }
+  return true;
+}
+
+// Read the remote tree with MLSD, false if its root does not exist
+bool ftp::mirror::walk_remote(tree &entries) {
+  // Breadth first, one listing per directory
+  std::vector<std::string> pending{""};
+  for (size_t next = 0; next < pending.size(); ++next) {
+    const auto relative = pending[next];
+    std::vector<remote_entry> listing;
+    if (!control_->interpreter->list(remote_path(relative), listing)) {
+      if (relative.empty()) {
+        return false;
+      }
+      error_ = "cannot list " + remote_path(relative);
+      return true;
+    }
+    for (auto &listed : listing) {
+      if (listed.name == "." || listed.name == "..") {
+        continue;
+      }
+      const auto path =
+          relative.empty() ? listed.name : relative + "/" + listed.name;
+      if (listed.is_directory) {
+        pending.push_back(path);
+      }
+      entries.emplace(path, tree_entry{listed.is_directory, listed.size,
+                                       std::move(listed.modify)});
+    }
+  }
+  return true;
+}
+
+// Same CRC-32 on both sides?
+bool ftp::mirror::same_contents(const std::string &relative) {
+  // Remote one: "213 1A2B3C4D"
+  const auto response =
+      control_->interpreter->execute("XCRC " + remote_path(relative));
+  if (response.rfind("213 ", 0) != 0) {
+    return false;
+  }
+  const uint32_t remote_crc =
+      uint32_t(std::strtoul(response.c_str() + 4, nullptr, 16));
+
+  const int fd = open((local_root() / relative).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  if (buffer_ == nullptr) {
+    buffer_ = std::make_unique<char[]>(ftp::buffer_size);
+  }
+  uint32_t local_crc = 0;
+  const bool successful =
+      ftp::crc32_file(fd, buffer_.get(), ftp::buffer_size, local_crc);
+  close(fd);
+  return successful && local_crc == remote_crc;
+}
+
+// Session of the walk and of the directory operations
+bool ftp::mirror::open_control() {
+  if (control_ == nullptr) {
+    control_ = pool_.open_session();
+  }
+  if (control_ == nullptr) {
+    error_ = "could not open a session";
+    return false;
+  }
+  return true;
+}
+
+std::filesystem::path ftp::mirror::local_root() const {
+  return std::filesystem::path(options_.local).lexically_normal();
+}
+
+std::string ftp::mirror::remote_path(const std::string &relative) const {
+  return relative.empty() ? remote_root_
+                          : ftp::remote_join(remote_root_, relative);
+}
+
+// Print a plan, one line per operation, and the transfer volume
+void ftp::print_mirror_plan(const mirror_plan &plan,
+                            const mirror_options &options,
+                            std::ostream &out) {
+  if (plan.create_root) {
+    out << "    mkdir    " << (options.upload ? options.remote : options.local)
+        << std::endl;
+  }
+  for (const auto &path : plan.directories) {
+    out << "    mkdir    " << path << std::endl;
+  }
+  const char *verb = options.upload ? "    put      " : "    get      ";
+  for (const auto &[path, entry] : plan.transfers) {
+    out << verb << path << " (" << entry.size << " bytes)" << std::endl;
+  }
+  for (const auto &path : plan.removals) {
+    out << "    delete   " << path << std::endl;
+  }
+  for (const auto &path : plan.removed_directories) {
+    out << "    rmdir    " << path << std::endl;
+  }
+  for (const auto &path : plan.conflicts) {
+    out << "    conflict " << path
+        << " (a file on one side, a directory on the other)" << std::endl;
+  }
+  out << plan.transfers.size() << " file(s) to "
+      << (options.upload ? "upload, " : "download, ")
+      << plan.directories.size() + (plan.create_root ? 1 : 0)
+      << " directory(ies) to create, "
+      << plan.removals.size() + plan.removed_directories.size()
+      << " entry(ies) to delete, " << plan.unchanged << " unchanged";
+  if (plan.extra != 0) {
+    out << ", " << plan.extra << " kept (not in the source, see --delete)";
+  }
+  out << std::endl;
+  out << "Estimated transfer volume: " << plan.bytes << " bytes ("
+      << double(plan.bytes) / (1024 * 1024) << " MB)" << std::endl;
+}
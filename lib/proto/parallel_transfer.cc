@@ -0,0 +1,391 @@
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "proto/parallel_transfer.h"
+#include "utils/ftp.h"
+#include "utils/mlsd.h"
+#include "utils/stat_cache.h"
+
+namespace {
+
+// Give a downloaded file the modification time of the remote one
+bool set_modification_time(const std::filesystem::path &path,
+                           const std::string &modify) {
+  const int64_t seconds = ftp::parse_timestamp(modify);
+  if (seconds < 0) {
+    return false;
+  }
+  const struct timespec times[2] = {{0, UTIME_OMIT}, {time_t(seconds), 0}};
+  return utimensat(AT_FDCWD, path.c_str(), times, 0) == 0;
+}
+
+} // namespace
+
+// Join a remote directory and a relative path
+// Without a trailing slash, so that "dir/" names dir
+std::string ftp::remote_join(const std::string &directory,
+                             const std::string &relative) {
+  auto joined = (std::filesystem::path(directory) / relative)
+                    .lexically_normal()
+                    .generic_string();
+  if (joined.size() > 1 && joined.back() == '/') {
+    joined.pop_back();
+  }
+  return joined;
+}
+
+// Parse the arguments of mget/mput, returns false on invalid options
+bool ftp::parse_transfer_options(const std::string &arguments,
+                                 transfer_options &options) {
+  std::vector<std::string> tokens;
+  tokens = ftp::split(arguments, tokens, ' ');
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (tokens[i] == "-r") {
+      options.recursive = true;
+      options.parallel = true;
+      continue;
+    }
+    // -j <sessions> or -j<sessions>
+    if (tokens[i].rfind("-j", 0) == 0) {
+      std::string value = tokens[i].substr(2);
+      if (value.empty() && i + 1 < tokens.size()) {
+        value = tokens[++i];
+      }
+      try {
+        const int concurrency = std::stoi(value);
+        if (concurrency < 1) {
+          return false;
+        }
+        options.concurrency = size_t(concurrency);
+        options.parallel = true;
+      } catch (const std::exception &) {
+        return false;
+      }
+      continue;
+    }
+    options.paths.push_back(tokens[i]);
+  }
+  return !options.paths.empty();
+}
+
+// Constructor
+ftp::parallel_transfer::parallel_transfer(sockpp::inet_address server,
+                                          std::string username,
+                                          std::string password,
+                                          size_t concurrency) {
+  server_ = server;
+  username_ = std::move(username);
+  password_ = std::move(password);
+  concurrency_ = std::max<size_t>(concurrency, 1);
+}
+
+// Download remote paths (relative to remote_directory) into the current
+// local directory
+ftp::transfer_summary
+ftp::parallel_transfer::download(const std::string &remote_directory,
+                                 const std::vector<std::string> &paths,
+                                 bool recursive) {
+  return run(
+      [&](session &walker) {
+        walk_remote(walker, remote_directory, paths, recursive);
+      },
+      [](session &s, const job &j) {
+        return s.interpreter->retrieve(j.remote_name, j.local_path);
+      });
+}
+
+// Upload local paths into remote_directory
+ftp::transfer_summary
+ftp::parallel_transfer::upload(const std::string &remote_directory,
+                               const std::vector<std::string> &paths,
+                               bool recursive) {
+  return run(
+      [&](session &walker) {
+        walk_local(walker, remote_directory, paths, recursive);
+      },
+      [](session &s, const job &j) {
+        return s.interpreter->store(j.local_path.string());
+      });
+}
+
+// Transfer files listed beforehand (by mirror), without walking
+ftp::transfer_summary
+ftp::parallel_transfer::download(const std::vector<job> &jobs) {
+  return run(
+      [&](session &) {
+        for (const auto &j : jobs) {
+          queue_->push(j);
+        }
+      },
+      [](session &s, const job &j) {
+        if (!s.interpreter->retrieve(j.remote_name, j.local_path)) {
+          return false;
+        }
+        // A later comparison of modification times finds it unchanged
+        return j.modify.empty() || set_modification_time(j.local_path,
+                                                         j.modify);
+      });
+}
+
+ftp::transfer_summary
+ftp::parallel_transfer::upload(const std::vector<job> &jobs) {
+  return run(
+      [&](session &) {
+        for (const auto &j : jobs) {
+          queue_->push(j);
+        }
+      },
+      [](session &s, const job &j) {
+        return s.interpreter->store(j.remote_name, j.local_path);
+      });
+}
+
+// Delete remote files
+ftp::transfer_summary
+ftp::parallel_transfer::remove(const std::vector<job> &jobs) {
+  return run(
+      [&](session &) {
+        for (const auto &j : jobs) {
+          queue_->push(j);
+        }
+      },
+      [](session &s, const job &j) {
+        const auto response = s.interpreter->execute("DELE " + j.remote_name);
+        return response.find("200") != std::string::npos;
+      });
+}
+
+// Connect, log in and enter passive mode, returns nullptr on failure
+std::unique_ptr<ftp::parallel_transfer::session>
+ftp::parallel_transfer::open_session() {
+  auto s = std::make_unique<session>();
+  if (!s->connector.connect(server_)) {
+    std::cerr << "[Transfer] " << "Error: " << s->connector.last_error_str()
+              << std::endl;
+    return nullptr;
+  }
+  s->interpreter =
+      std::make_unique<protocol_interpreter_client>(&s->connector);
+  s->interpreter->set_quiet(true);
+  if (!s->interpreter->login(username_, password_) ||
+      !s->interpreter->enter_passive_mode()) {
+    std::cerr << "[Transfer] " << "Error: could not set up a session"
+              << std::endl;
+    s->interpreter->stop();
+    return nullptr;
+  }
+  return s;
+}
+
+// Change the remote directory of a session if needed
+bool ftp::parallel_transfer::change_directory(
+    session &s, const std::string &remote_directory) {
+  if (s.remote_directory == remote_directory) {
+    return true;
+  }
+  const auto response = s.interpreter->execute("CWD " + remote_directory);
+  if (response.find("200") == std::string::npos) {
+    s.remote_directory.clear();
+    return false;
+  }
+  s.remote_directory = remote_directory;
+  return true;
+}
+
+// Run the workers while walk() feeds the queue
+template <typename Walk, typename Transfer>
+ftp::transfer_summary ftp::parallel_transfer::run(Walk walk,
+                                                  Transfer transfer) {
+  summary_ = transfer_summary();
+  queue_ = std::make_unique<work_stealing_queue<job>>(concurrency_);
+  const auto start = std::chrono::steady_clock::now();
+
+  // Each worker owns one session for its whole life
+  std::vector<std::thread> workers;
+  for (size_t worker = 0; worker < concurrency_; ++worker) {
+    workers.emplace_back([this, worker, &transfer]() {
+      auto s = open_session();
+      if (s == nullptr) {
+        return; // The other workers steal its share
+      }
+      while (auto j = queue_->pop(worker)) {
+        const auto path =
+            j->local_path.empty()
+                ? remote_join(j->remote_directory, j->remote_name)
+                : j->local_path.string();
+        if (!change_directory(*s, j->remote_directory)) {
+          fail(path, "cannot change to " + j->remote_directory);
+          continue;
+        }
+        if (!transfer(*s, *j)) {
+          fail(path, "transfer failed");
+          continue;
+        }
+        std::error_code error;
+        const auto size = j->local_path.empty()
+                              ? 0
+                              : std::filesystem::file_size(j->local_path,
+                                                           error);
+        std::lock_guard<std::mutex> lock(summary_mutex_);
+        summary_.files_ok++;
+        summary_.bytes += error ? 0 : size;
+      }
+      s->interpreter->stop();
+    });
+  }
+
+  // Walk in this thread, on a session of its own
+  if (auto walker = open_session()) {
+    walk(*walker);
+    walker->interpreter->stop();
+  } else {
+    fail("-", "could not open the walker session");
+  }
+  queue_->close();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  // Jobs left over if no worker could open a session
+  while (auto j = queue_->pop(0)) {
+    fail(j->local_path.string(), "no session available");
+  }
+
+  summary_.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  return summary_;
+}
+
+// Record a failed file
+void ftp::parallel_transfer::fail(const std::string &path,
+                                  const std::string &reason) {
+  std::clog << "[Transfer] " << "Failed: " << path << " (" << reason << ")"
+            << std::endl;
+  std::lock_guard<std::mutex> lock(summary_mutex_);
+  summary_.failures.emplace_back(path, reason);
+}
+
+// Walk remote trees with CWD + MLSD, creating the local directories
+void ftp::parallel_transfer::walk_remote(
+    session &walker, const std::string &remote_directory,
+    const std::vector<std::string> &paths, bool recursive) {
+  for (const auto &path : paths) {
+    const auto remote_path = remote_join(remote_directory, path);
+    const std::filesystem::path local_root =
+        std::filesystem::path(remote_path).filename();
+
+    // Not a directory: a single file
+    if (!change_directory(walker, remote_path)) {
+      const auto parent = std::filesystem::path(remote_path).parent_path();
+      queue_->push(job{parent.generic_string(), local_root.string(),
+                       local_root});
+      continue;
+    }
+    if (!recursive) {
+      fail(path, "is a directory (use -r)");
+      continue;
+    }
+
+    // Depth first walk, the workers start on the first files right away
+    std::vector<std::pair<std::string, std::filesystem::path>> pending{
+        {remote_path, local_root}};
+    while (!pending.empty()) {
+      const auto [directory, local_directory] = pending.back();
+      pending.pop_back();
+
+      std::error_code error;
+      std::filesystem::create_directories(local_directory, error);
+      if (error) {
+        fail(local_directory.string(), error.message());
+        continue;
+      }
+      std::vector<remote_entry> listing;
+      if (!walker.interpreter->list(directory, listing)) {
+        fail(local_directory.string(), "cannot list " + directory);
+        continue;
+      }
+      for (const auto &entry : listing) {
+        if (entry.name == "." || entry.name == "..") {
+          continue;
+        }
+        if (entry.is_directory) {
+          pending.emplace_back(remote_join(directory, entry.name),
+                               local_directory / entry.name);
+          continue;
+        }
+        queue_->push(job{directory, entry.name, local_directory / entry.name});
+      }
+    }
+  }
+}
+
+// Walk local trees, creating the remote directories with MKD
+void ftp::parallel_transfer::walk_local(session &walker,
+                                        const std::string &remote_directory,
+                                        const std::vector<std::string> &paths,
+                                        bool recursive) {
+  for (const auto &path : paths) {
+    const std::filesystem::path local_path(path);
+    std::error_code error;
+    if (std::filesystem::is_regular_file(local_path, error)) {
+      queue_->push(job{remote_directory, local_path.filename().string(),
+                       local_path});
+      continue;
+    }
+    if (!std::filesystem::is_directory(local_path, error)) {
+      fail(path, "does not exist or is not a regular file");
+      continue;
+    }
+    if (!recursive) {
+      fail(path, "is a directory (use -r)");
+      continue;
+    }
+
+    // Directories come before their contents, so that MKD of the parent
+    // is always done first
+    // "dir/" names dir, like "dir"
+    auto root = local_path.lexically_normal();
+    if (!root.has_filename()) {
+      root = root.parent_path();
+    }
+    const auto base = root.parent_path();
+    const auto remote_root =
+        remote_join(remote_directory, root.filename().string());
+    auto make_directory = [&](const std::string &directory) {
+      const auto response = walker.interpreter->execute("MKD " + directory);
+      return response.find("200") != std::string::npos ||
+             response.find("already exists") != std::string::npos;
+    };
+    if (!make_directory(remote_root)) {
+      fail(path, "cannot create " + remote_root);
+      continue;
+    }
+    std::filesystem::recursive_directory_iterator it(root, error), end;
+    for (; !error && it != end; it.increment(error)) {
+      const auto relative = it->path().lexically_relative(base);
+      const auto remote_path = remote_join(remote_directory, relative.string());
+      if (it->is_directory(error)) {
+        if (!make_directory(remote_path)) {
+          fail(it->path().string(), "cannot create " + remote_path);
+          it.disable_recursion_pending();
+        }
+        continue;
+      }
+      if (!it->is_regular_file(error)) {
+        continue; // Symlinks and special files are skipped
+      }
+      queue_->push(job{std::filesystem::path(remote_path)
+                           .parent_path()
+                           .generic_string(),
+                       it->path().filename().string(), it->path()});
+    }
+    if (error) {
+      fail(path, error.message());
+    }
+  }
+}
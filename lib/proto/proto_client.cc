@@ -1,6 +1,80 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <set>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "proto/mirror.h"
+#include "proto/parallel_transfer.h"
 #include "proto/proto_interpreter.h"
 #include "utils/ftp.h"
 #include "utils/io.h"
+#include "utils/mlsd.h"
+
+namespace {
+
+// Commands in flight at once in batch mode
+constexpr size_t max_pipelined_commands = 64;
+
+// Create (or truncate) a local file to receive a download, -1 on failure
+int open_local_file(const std::filesystem::path &local_path) {
+  const int fd =
+      open(local_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd == -1) {
+    std::cerr << "Error: " << strerror(errno) << std::endl;
+  }
+  return fd;
+}
+
+// Sends what is written to std::cout to standard error while it lives, so
+// that standard output carries nothing but a streamed file
+class stdout_to_stderr {
+public:
+  explicit stdout_to_stderr(bool enabled) {
+    if (enabled) {
+      std::cout.flush();
+      previous_ = std::cout.rdbuf(std::cerr.rdbuf());
+    }
+  }
+  ~stdout_to_stderr() {
+    if (previous_ != nullptr) {
+      std::cout.rdbuf(previous_);
+    }
+  }
+  stdout_to_stderr(const stdout_to_stderr &) = delete;
+  stdout_to_stderr &operator=(const stdout_to_stderr &) = delete;
+
+private:
+  std::streambuf *previous_ = nullptr;
+};
+
+// Is input "retr <filename> <local filename>|-" (or "get ...")? The local
+// name is the client's own: the grammar shared with the server has one
+// argument. Sets argument to both names
+bool is_retr_to_local(const std::string &input, std::string &argument) {
+  std::vector<std::string> tokens;
+  tokens = ftp::split(ftp::trim(input), tokens, ' ');
+  if (tokens.size() != 3) {
+    return false;
+  }
+  std::transform(tokens[0].begin(), tokens[0].end(), tokens[0].begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (tokens[0] != "retr" && tokens[0] != "get") {
+    return false;
+  }
+  argument = tokens[1] + " " + tokens[2];
+  return true;
+}
+
+} // namespace
 
 // Protocol interpreter client implementation
 // Constructor
@@ -8,16 +82,21 @@ ftp::protocol_interpreter_client::protocol_interpreter_client(
     sockpp::tcp_connector *const connector) {
   // Set the connector
   connector_ = connector;
+  // Commands are complete messages: send them at once, instead of waiting
+  // for the server to acknowledge the previous one
+  connector_->set_option(IPPROTO_TCP, TCP_NODELAY, 1);
   // Set running to false
   running_ = false;
-  // Initialize the buffer
-  buf_ = std::shared_ptr<char>(new char[buffer_size],
-                               std::default_delete<char[]>());
   // Set the default to passive mode
   is_passive_mode_ = true;
 
   // Set the default client data port to current port + 1 (active mode)
   client_data_port_ = uint16_t(connector_->address().port() + 1);
+  // Until PASV tells otherwise, the server data port is command port + 1
+  server_data_port_ = 0;
+
+  // Interactive by default
+  quiet_ = false;
 }
 
 // Run the protocol interpreter
@@ -35,146 +114,452 @@ void ftp::protocol_interpreter_client::run() {
     if (input.find_first_not_of(" \t\n") == std::string::npos) {
       continue; // Skip empty input
     }
+    dispatch(input);
+  }
+}
 
-    // Parse the command (feed the command to the ftp::parse_command function)
-    auto [operation, argument] = ftp::parse_command(input);
+// Run a command as typed in the prompt
+void ftp::protocol_interpreter_client::dispatch(const std::string &input) {
+  // Download under another local name, do_retr() splits the names
+  std::string names;
+  if (is_retr_to_local(input, names)) {
+    do_retr(names);
+    return;
+  }
 
-    // Do the do_... functions based on the operation
+  // Parse the command (feed the command to the ftp::parse_command function)
+  auto [operation, argument] = ftp::parse_command(input);
 
-    // Debugging: send the command to the server
-    std::clog << "[Proto] " << "Sending command: " << operation << " "
-              << argument << std::endl;
-    // Send the command to the server (debug only)
-    // ssize_t n = connector_->write(input.c_str(), input.size());
-    // if (n <= 0) {
-    //   std::cerr << "Error: " << connector_->last_error_str() << std::endl;
-    //   break;
-    // }
+  // Do the do_... functions based on the operation
 
-    // Authentication and quit
-    if (operation == ftp::USER) {
-      do_user(argument);
-      continue;
-    }
-    if (operation == ftp::PASS) {
-      do_pass(argument);
-      continue;
-    }
-    if (operation == ftp::QUIT) {
-      std::clog << "[Proto] " << "Quitting..." << std::endl;
-      stop();
-      continue;
-    }
+  // Debugging: send the command to the server
+  std::clog << "[Proto] " << "Sending command: " << operation << " "
+            << argument << std::endl;
+  // Send the command to the server (debug only)
+  // ssize_t n = connector_->write(input.c_str(), input.size());
+  // if (n <= 0) {
+  //   std::cerr << "Error: " << connector_->last_error_str() << std::endl;
+  //   break;
+  // }
 
-    // Specify active or passive mode (default to passive mode)
-    if (operation == ftp::PORT) {
-      do_port(argument);
-      continue;
-    }
-    if (operation == ftp::PASV) {
-      do_pasv();
-      continue;
-    }
+  // Authentication and quit
+  if (operation == ftp::USER) {
+    do_user(argument);
+    return;
+  }
+  if (operation == ftp::PASS) {
+    do_pass(argument);
+    return;
+  }
+  if (operation == ftp::QUIT) {
+    std::clog << "[Proto] " << "Quitting..." << std::endl;
+    stop();
+    return;
+  }
 
-    // File transfer
-    if (operation == ftp::RETR) {
-      do_retr(argument);
-      continue;
+  // Specify active or passive mode (default to passive mode)
+  if (operation == ftp::PORT) {
+    do_port(argument);
+    return;
+  }
+  if (operation == ftp::PASV) {
+    do_pasv();
+    return;
+  }
+
+  // File transfer
+  if (operation == ftp::RETR) {
+    do_retr(argument);
+    return;
+  }
+  if (operation == ftp::STOR) {
+    do_stor(argument);
+    return;
+  }
+  if (operation == ftp::LIST) {
+    do_list();
+    return;
+  }
+  if (operation == ftp::MLSD) {
+    do_mlsd(argument);
+    return;
+  }
+  if (operation == ftp::SIZE) {
+    do_size(argument);
+    return;
+  }
+  if (operation == ftp::MDTM) {
+    do_mdtm(argument);
+    return;
+  }
+  if (operation == ftp::XCRC) {
+    do_xcrc(argument);
+    return;
+  }
+  if (operation == ftp::CWD) {
+    do_cwd(argument);
+    return;
+  }
+  if (operation == ftp::CDUP) {
+    do_cdup();
+    return;
+  }
+  if (operation == ftp::PWD) {
+    do_pwd();
+    return;
+  }
+  if (operation == ftp::MKD) {
+    do_mkd(argument);
+    return;
+  }
+  if (operation == ftp::RMD) {
+    do_rmd(argument);
+    return;
+  }
+  if (operation == ftp::DELE) {
+    do_dele(argument);
+    return;
+  }
+  if (operation == ftp::RNFR) {
+    do_rnfr(argument);
+    return;
+  }
+  if (operation == ftp::RNTO) {
+    do_rnto(argument);
+    return;
+  }
+  if (operation == ftp::MPUT) {
+    do_mput(argument);
+    return;
+  }
+  if (operation == ftp::MGET) {
+    do_mget(argument);
+    return;
+  }
+  if (operation == ftp::MIRROR) {
+    do_mirror(argument);
+    return;
+  }
+
+  // Help command
+  if (operation == ftp::HELP) {
+    do_help();
+    return;
+  }
+
+  // NOOP command
+  if (operation == ftp::NOOP) {
+    std::clog << "[Proto] " << "Invalid command." << std::endl;
+    failures_++;
+    return;
+  }
+}
+
+// Stop the protocol interpreter
+void ftp::protocol_interpreter_client::stop() {
+  // Set running to false
+  running_ = false;
+  // Send QUIT command to the server
+  std::string quit_command = "QUIT";
+  send_command(quit_command);
+}
+
+// Check if the protocol interpreter is running
+bool ftp::protocol_interpreter_client::is_running() const { return running_; }
+
+// Run commands without a prompt
+size_t ftp::protocol_interpreter_client::run_batch(
+    const std::vector<std::string> &commands) {
+  running_ = true;
+  failures_ = 0;
+
+  // Commands waiting to be pipelined, sent when a command that needs the
+  // outcome of the previous ones (or a data connection) comes
+  std::vector<std::pair<ftp::operation, std::string>> pipeline;
+  for (const auto &input : commands) {
+    if (!running_) {
+      break;
     }
-    if (operation == ftp::STOR) {
-      do_stor(argument);
+    if (input.find_first_not_of(" \t\n") == std::string::npos) {
       continue;
     }
-    if (operation == ftp::LIST) {
-      do_list();
+    auto command = ftp::parse_command(input);
+    switch (command.first) {
+    case ftp::CWD:
+    case ftp::CDUP:
+    case ftp::PWD:
+    case ftp::MKD:
+    case ftp::RMD:
+    case ftp::DELE:
+    case ftp::SIZE:
+    case ftp::MDTM:
+    case ftp::XCRC:
+      pipeline.push_back(std::move(command));
+      // Bounded, so that neither side blocks on a full socket buffer
+      if (pipeline.size() == max_pipelined_commands) {
+        run_pipelined(pipeline);
+        pipeline.clear();
+      }
       continue;
+    default:
+      break;
     }
-    if (operation == ftp::CWD) {
-      do_cwd(argument);
-      continue;
+    if (!pipeline.empty()) {
+      run_pipelined(pipeline);
+      pipeline.clear();
     }
+    dispatch(input);
+  }
+  if (!pipeline.empty()) {
+    run_pipelined(pipeline);
+  }
+
+  if (running_) {
+    stop();
+  }
+  return failures_;
+}
+
+// Send commands in one write, then print their replies
+void ftp::protocol_interpreter_client::run_pipelined(
+    const std::vector<std::pair<ftp::operation, std::string>> &commands) {
+  std::string message;
+  for (const auto &[operation, argument] : commands) {
+    // As sent by the do_... functions, in one write
     if (operation == ftp::CDUP) {
-      do_cdup();
-      continue;
+      message += "CWD ..\r\n";
+    } else if (argument.empty()) {
+      message += std::string(ftp::operation_name(operation)) + "\r\n";
+    } else {
+      message += ftp::operation_name(operation) + (" " + argument) + "\r\n";
     }
-    if (operation == ftp::PWD) {
-      do_pwd();
-      continue;
+  }
+  ftp::send_message(connector_, message);
+
+  // Replies of these commands are one line, or several from "ddd-"
+  std::string received = std::exchange(pending_replies_, std::string());
+  for (size_t i = 0; i < commands.size(); ++i) {
+    size_t size;
+    while ((size = ftp::reply_size(received)) == 0) {
+      const auto more = ftp::receive_message(connector_, buf_);
+      if (more.empty()) {
+        // Disconnected, the commands left have no reply
+        failures_ += commands.size() - i;
+        running_ = false;
+        return;
+      }
+      received += more;
     }
-    if (operation == ftp::MKD) {
-      do_mkd(argument);
-      continue;
+    const std::string reply = received.substr(0, size);
+    received.erase(0, size);
+    if (ftp::is_error_reply(reply)) {
+      failures_++;
     }
-    if (operation == ftp::RMD) {
-      do_rmd(argument);
+    if (quiet_) {
       continue;
     }
-    if (operation == ftp::DELE) {
-      do_dele(argument);
-      continue;
+    for (size_t start = 0; start < reply.size();) {
+      const size_t end = reply.find('\n', start);
+      std::string line = reply.substr(start, end - start);
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      std::cout << line << std::endl;
+      start = end + 1;
     }
-    if (operation == ftp::RNFR) {
-      do_rnfr(argument);
-      continue;
+  }
+  pending_replies_ = std::move(received);
+}
+
+// Send a command, ended with CRLF
+void ftp::protocol_interpreter_client::send_command(
+    const std::string &command) {
+  ftp::send_message(connector_, command + "\r\n");
+}
+
+// Wait for the response of the server
+std::string ftp::protocol_interpreter_client::receive_reply() {
+  // Read until a whole reply arrived, or the rest of one left by the last
+  // call: a line, or all lines of a reply of several
+  std::string reply = std::exchange(pending_replies_, std::string());
+  while (ftp::reply_size(reply) == 0) {
+    const auto more = ftp::receive_message(connector_, buf_);
+    if (more.empty()) {
+      break; // Disconnected
     }
-    if (operation == ftp::RNTO) {
-      do_rnto(argument);
-      continue;
+    reply += more;
+  }
+  // In active mode the server sends the size of a file as soon as it
+  // connected, which may come along with the reply to the transfer command:
+  // leave it for the next call
+  const size_t line_end = reply.find('\n');
+  if (line_end != std::string::npos && line_end + 1 < reply.size() &&
+      std::isdigit((unsigned char)reply[line_end + 1])) {
+    const size_t size_end =
+        reply.find_first_not_of("0123456789", line_end + 1);
+    if (size_end != std::string::npos &&
+        reply.compare(size_end, 2, "\r\n") == 0) {
+      pending_replies_ = reply.substr(line_end + 1);
+      reply.resize(line_end + 1);
     }
+  }
+  if (reply.empty() || ftp::is_error_reply(reply)) {
+    failures_++;
+  }
+  return reply;
+}
 
-    // Help command
-    if (operation == ftp::HELP) {
-      do_help();
-      continue;
-    }
+// Log in with USER (and PASS if the server asks for it)
+bool ftp::protocol_interpreter_client::login(const std::string &username,
+                                             const std::string &password) {
+  auto response = execute("USER " + username);
+  if (response.find("331") != std::string::npos) {
+    response = execute("PASS " + password);
+  }
+  return response.find("230") != std::string::npos;
+}
 
-    // NOOP command
-    if (operation == ftp::NOOP) {
-      std::clog << "[Proto] " << "Invalid command." << std::endl;
-      continue;
-    }
+// Send PASV and remember the announced data port
+bool ftp::protocol_interpreter_client::enter_passive_mode() {
+  do_pasv();
+  return is_passive_mode_;
+}
+
+// Send PORT and listen on port for data connections
+bool ftp::protocol_interpreter_client::enter_active_mode(uint16_t port) {
+  const auto response = execute("PORT " + std::to_string(port));
+  if (response.find("200") == std::string::npos) {
+    return false;
   }
+  is_passive_mode_ = false;
+  server_data_port_ = 0;
+  client_data_port_ = port;
+  return listen_for_data();
 }
 
-// Stop the protocol interpreter
-void ftp::protocol_interpreter_client::stop() {
-  // Set running to false
-  running_ = false;
-  // Send QUIT command to the server
-  std::string quit_command = "QUIT";
-  ftp::send_message(connector_, quit_command);
+// Send a command and wait for the response
+std::string
+ftp::protocol_interpreter_client::execute(const std::string &command) {
+  send_command(command);
+  return receive_reply();
 }
 
-// Check if the protocol interpreter is running
-bool ftp::protocol_interpreter_client::is_running() const { return running_; }
+// Retrieve a file from the server into local_path
+bool ftp::protocol_interpreter_client::retrieve(
+    const std::string &filename, const std::filesystem::path &local_path) {
+  const auto response = execute("RETR " + filename);
+  // Directories are not retrieved one by one
+  if (ftp::is_archive_reply(response) ||
+      response.find("200") == std::string::npos) {
+    return false;
+  }
+  // Opened once the server has the file, a missing one leaves it alone
+  const int fd = open_local_file(local_path);
+  bool successful = receive_file(filename, fd);
+  if (fd != -1) {
+    successful = close(fd) == 0 && successful;
+  }
+
+  // Tell the server that receiving is done, wait for its confirmation
+  const auto stored_response = execute("DONE");
+  return successful && stored_response.find("226") != std::string::npos;
+}
+
+// Retrieve a file from the server into a descriptor
+bool ftp::protocol_interpreter_client::retrieve(const std::string &filename,
+                                                int fd) {
+  const auto response = execute("RETR " + filename);
+  // Directories are not retrieved one by one
+  if (ftp::is_archive_reply(response) ||
+      response.find("200") == std::string::npos) {
+    return false;
+  }
+  const bool successful = receive_file(filename, fd);
+
+  // Tell the server that receiving is done, wait for its confirmation
+  const auto stored_response = execute("DONE");
+  return successful && stored_response.find("226") != std::string::npos;
+}
+
+// Store a local file into the server's current directory
+bool ftp::protocol_interpreter_client::store(const std::string &filename) {
+  return store(filename, filename);
+}
+
+// Store local_path as filename in the server's current directory
+bool ftp::protocol_interpreter_client::store(
+    const std::string &filename, const std::filesystem::path &local_path) {
+  const auto response = execute("STOR " + filename);
+  if (response.find("200") == std::string::npos) {
+    return false;
+  }
+  const bool successful = send_file(local_path.string());
+
+  // Tell the server that sending is done, wait for it to store the file
+  const auto stored_response = execute("DONE");
+  return successful && stored_response.find("226") != std::string::npos;
+}
+
+// Receive the machine readable listing of a directory into entries
+bool ftp::protocol_interpreter_client::list(
+    const std::string &directory, std::vector<ftp::remote_entry> &entries) {
+  const auto response =
+      execute(directory.empty() ? "MLSD" : "MLSD " + directory);
+  if (response.find("200") == std::string::npos) {
+    return false;
+  }
+  std::string listing;
+  const bool received = receive_listing(&listing);
+
+  // Tell the server that receiving is done, wait for its confirmation
+  const auto sent_response = execute("DONE");
+  if (!received || sent_response.find("226") == std::string::npos) {
+    return false;
+  }
+  ftp::parse_listing(listing, entries);
+  return true;
+}
+
+// Do not print responses or progress bars
+void ftp::protocol_interpreter_client::set_quiet(bool quiet) {
+  quiet_ = quiet;
+}
 
 // Send username to the server, wait for response
 void ftp::protocol_interpreter_client::do_user(std::string username) {
   const std::string user_command = "USER " + username;
-  ftp::send_message(connector_, user_command);
+  send_command(user_command);
 
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   std::cout << response << std::endl;
+
+  // Remember the user, parallel transfers log in again with it
+  username_ = username;
 }
 
 // Send password to the server, wait for response
 void ftp::protocol_interpreter_client::do_pass(std::string password) {
   const std::string pass_command = "PASS " + password;
-  ftp::send_message(connector_, pass_command);
+  send_command(pass_command);
 
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   std::cout << response << std::endl;
+
+  // Remember the password, parallel transfers log in again with it
+  if (response.find("230") != std::string::npos) {
+    password_ = password;
+  }
 }
 
 // Specify active or passive mode
 void ftp::protocol_interpreter_client::do_port(std::string port) {
   const std::string port_command = "PORT " + port;
-  ftp::send_message(connector_, port_command);
+  send_command(port_command);
 
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If the response is not 200, remain client_port_ and is_passive_mode_
   // unchanged
   if (response.find("200") == std::string::npos) {
@@ -188,6 +573,8 @@ void ftp::protocol_interpreter_client::do_port(std::string port) {
   // Otherwise, set client_port_ to the port number and set is_passive_mode_ to
   // false
   is_passive_mode_ = false;
+  // The server closed its passive data port
+  server_data_port_ = 0;
 
   // If the port number is not specified (empty), set it to the default port
   if (port.empty()) {
@@ -200,6 +587,7 @@ void ftp::protocol_interpreter_client::do_port(std::string port) {
 
     // Print the port number
     std::clog << "[Proto] " << "Port set to " << client_data_port_ << std::endl;
+    listen_for_data();
     // Print the response to the user
     std::cout << response << std::endl;
     return;
@@ -215,6 +603,7 @@ void ftp::protocol_interpreter_client::do_port(std::string port) {
 
   // Print the port number
   std::clog << "[Proto] " << "Port set to " << client_data_port_ << std::endl;
+  listen_for_data();
   // Print the response to the user
   std::cout << response << std::endl;
 }
@@ -223,53 +612,120 @@ void ftp::protocol_interpreter_client::do_port(std::string port) {
 void ftp::protocol_interpreter_client::do_pasv() {
   // Send PASV command to the server
   const std::string pasv_command = "PASV";
-  ftp::send_message(connector_, pasv_command);
+  send_command(pasv_command);
 
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, remain is_passive_mode_ unchanged
   if (response.find("200") == std::string::npos) {
     // Log the response
     std::clog << response << std::endl;
     // Show user the response
-    std::cout << response << std::endl;
+    if (!quiet_) {
+      std::cout << response << std::endl;
+    }
     return;
   }
 
-  // Otherwise, set is_passive_mode_ to true
+  // Use the data port announced by the server, if any
+  const std::string data_port_tag = "(data port ";
+  const auto tag_position = response.find(data_port_tag);
+  uint16_t data_port = 0;
+  if (tag_position != std::string::npos) {
+    const char *first = response.data() + tag_position + data_port_tag.size();
+    const auto [rest, ec] =
+        std::from_chars(first, response.data() + response.size(), data_port);
+    if (ec != std::errc() || data_port == 0) {
+      std::cerr << "[Proto] " << "Error: invalid data port in " << response
+                << std::endl;
+      if (!quiet_) {
+        std::cout << "Invalid PASV reply: " << response << std::endl;
+      }
+      return;
+    }
+  }
+
+  // Passive mode from now on
   is_passive_mode_ = true;
+  data_acceptor_.close();
+  server_data_port_ = data_port;
 
   // Log the response
-  std::clog << "[Proto] " << "Passive mode set" << std::endl;
+  std::clog << "[Proto] " << "Passive mode set, data port "
+            << (server_data_port_ != 0
+                    ? std::to_string(server_data_port_)
+                    : std::to_string(connector_->peer_address().port() + 1))
+            << std::endl;
 
   // Show user the response
-  std::cout << response << std::endl;
+  if (!quiet_) {
+    std::cout << response << std::endl;
+  }
 }
 
-// Retrieve file from the server, save it to the local file system
+// Retrieve file from the server, save it to the local file system (or
+// stream it to standard output, for "get <file> -")
 // And wait for response
-void ftp::protocol_interpreter_client::do_retr(std::string filename) {
+void ftp::protocol_interpreter_client::do_retr(std::string argument) {
+  // <file> [<local file>|-]
+  const auto tokens = ftp::split(argument, {}, ' ');
+  const std::string filename = tokens.empty() ? "" : tokens[0];
+  const std::string local_name =
+      tokens.size() > 1 ? tokens[1]
+                        : filename.substr(filename.find_last_of("/") + 1);
+  const bool to_stdout = local_name == "-";
+  // Messages of the command go to standard error, not into the stream
+  const stdout_to_stderr redirect(to_stdout);
+
   // Send RETR command to the server
   const std::string retr_command = "RETR " + filename;
-  ftp::send_message(connector_, retr_command);
+  send_command(retr_command);
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
-  // If response is not 200, return
-  if (response.find("200") == std::string::npos) {
+  const auto response = receive_reply();
+  // If response is not 200 (or that of a directory), return
+  const bool is_archive = ftp::is_archive_reply(response);
+  if (!is_archive && response.find("200") == std::string::npos) {
     // Show user the response
     std::cout << response << std::endl;
     return;
   }
 
-  // Server is ready to send the file, prepare to receive the file
-  std::clog << "[Proto] " << "Receiving file: " << filename << std::endl;
-  receive_file(filename);
+  // Directories arrive as a tar archive, extract it while it arrives (or
+  // pass it on as it is)
+  bool successful = true;
+  if (is_archive) {
+    std::clog << "[Proto] " << "Receiving directory: " << filename
+              << std::endl;
+    if (to_stdout) {
+      successful = receive_archive(STDOUT_FILENO);
+    } else {
+      receive_archive(filename);
+    }
+  } else {
+    // Server is ready to send the file, prepare to receive the file
+    // Save it under its name only (without "/" and all text before it)
+    // unless given another one
+    std::clog << "[Proto] " << "Receiving file: " << filename << std::endl;
+    const int fd = to_stdout ? STDOUT_FILENO : open_local_file(local_name);
+    successful = receive_file(filename, fd);
+    if (fd != -1 && fd != STDOUT_FILENO) {
+      successful = close(fd) == 0 && successful;
+    }
+  }
+  // A reader of the stream needs to know it is incomplete
+  if (!successful) {
+    failures_++;
+  }
 
   // After sending the file, tell the server that sending is done
   const std::string done_command = "DONE";
-  ftp::send_message(connector_, done_command);
+  send_command(done_command);
   // Log that the file is done
   std::clog << "[Proto] " << "File transfer done" << std::endl;
+
+  // Wait for the server to finish the transfer
+  const auto sent_response = receive_reply();
+  std::clog << "[Proto] " << sent_response << std::endl;
 }
 // Store file to the server, read it from the local file system
 // And wait for response
@@ -283,10 +739,10 @@ void ftp::protocol_interpreter_client::do_stor(std::string filename) {
 
   // Send STOR command to the server
   const std::string retr_command = "STOR " + filename;
-  ftp::send_message(connector_, retr_command);
+  send_command(retr_command);
 
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -300,18 +756,22 @@ void ftp::protocol_interpreter_client::do_stor(std::string filename) {
 
   // After sending the file, tell the server that sending is done
   const std::string done_command = "DONE";
-  ftp::send_message(connector_, done_command);
+  send_command(done_command);
   // Log that the file is done
   std::clog << "[Proto] " << "File transfer done" << std::endl;
+
+  // Wait for the server to store the file
+  const auto stored_response = receive_reply();
+  std::cout << stored_response << std::endl;
 }
 // List files in the current directory, wait for response
 void ftp::protocol_interpreter_client::do_list() {
   // Send LIST command to the server
   const std::string list_command = "LIST";
-  ftp::send_message(connector_, list_command);
+  send_command(list_command);
 
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -324,13 +784,69 @@ void ftp::protocol_interpreter_client::do_list() {
   std::cout << response << std::endl;
 }
 
+// Print the machine readable listing of a directory, wait for response
+void ftp::protocol_interpreter_client::do_mlsd(std::string directory) {
+  // Send MLSD command to the server
+  const std::string command =
+      directory.empty() ? "MLSD" : "MLSD " + directory;
+  send_command(command);
+
+  // Wait for response from the server
+  const auto response = receive_reply();
+  // If response is not 200, return
+  if (response.find("200") == std::string::npos) {
+    // Show user the response
+    std::cout << response << std::endl;
+    return;
+  }
+
+  // The listing arrives over a data connection
+  receive_listing(nullptr);
+
+  // After receiving the listing, tell the server that receiving is done
+  const std::string done_command = "DONE";
+  send_command(done_command);
+  const auto sent_response = receive_reply();
+  std::clog << "[Proto] " << sent_response << std::endl;
+}
+
+// Ask for the size of a file, wait for response
+void ftp::protocol_interpreter_client::do_size(std::string filename) {
+  // Send SIZE command to the server
+  const std::string command = "SIZE " + filename;
+  send_command(command);
+  // Wait for response from the server, and show it to the user
+  const auto response = receive_reply();
+  std::cout << response << std::endl;
+}
+
+// Ask for the modification time of a file, wait for response
+void ftp::protocol_interpreter_client::do_mdtm(std::string filename) {
+  // Send MDTM command to the server
+  const std::string command = "MDTM " + filename;
+  send_command(command);
+  // Wait for response from the server, and show it to the user
+  const auto response = receive_reply();
+  std::cout << response << std::endl;
+}
+
+// Ask for the CRC-32 of a file, wait for response
+void ftp::protocol_interpreter_client::do_xcrc(std::string filename) {
+  // Send XCRC command to the server
+  const std::string command = "XCRC " + filename;
+  send_command(command);
+  // Wait for response from the server, and show it to the user
+  const auto response = receive_reply();
+  std::cout << response << std::endl;
+}
+
 // Change working directory, wait for response
 void ftp::protocol_interpreter_client::do_cwd(std::string directory) {
   // Send CWD command to the server
   const std::string command = "CWD " + directory;
-  ftp::send_message(connector_, command);
+  send_command(command);
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -352,9 +868,9 @@ void ftp::protocol_interpreter_client::do_cdup() {
 void ftp::protocol_interpreter_client::do_pwd() {
   // Send PWD command to the server
   const std::string command = "PWD";
-  ftp::send_message(connector_, command);
+  send_command(command);
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -371,9 +887,9 @@ void ftp::protocol_interpreter_client::do_pwd() {
 void ftp::protocol_interpreter_client::do_mkd(std::string directory) {
   // Send MKD command to the server
   const std::string command = "MKD " + directory;
-  ftp::send_message(connector_, command);
+  send_command(command);
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -389,9 +905,9 @@ void ftp::protocol_interpreter_client::do_mkd(std::string directory) {
 void ftp::protocol_interpreter_client::do_rmd(std::string directory) {
   // Send RMD command to the server
   const std::string command = "RMD " + directory;
-  ftp::send_message(connector_, command);
+  send_command(command);
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -407,9 +923,9 @@ void ftp::protocol_interpreter_client::do_rmd(std::string directory) {
 void ftp::protocol_interpreter_client::do_dele(std::string filename) {
   // Send DELE command to the server
   const std::string command = "DELE " + filename;
-  ftp::send_message(connector_, command);
+  send_command(command);
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -425,9 +941,9 @@ void ftp::protocol_interpreter_client::do_dele(std::string filename) {
 void ftp::protocol_interpreter_client::do_rnfr(std::string oldname) {
   // Send RNFR command to the server
   const std::string command = "RNFR " + oldname;
-  ftp::send_message(connector_, command);
+  send_command(command);
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -443,9 +959,9 @@ void ftp::protocol_interpreter_client::do_rnfr(std::string oldname) {
 void ftp::protocol_interpreter_client::do_rnto(std::string newname) {
   // Send RNTO command to the server
   const std::string command = "RNTO " + newname;
-  ftp::send_message(connector_, command);
+  send_command(command);
   // Wait for response from the server
-  const auto response = ftp::receive_message(connector_, buf_, buffer_size);
+  const auto response = receive_reply();
   // If response is not 200, return
   if (response.find("200") == std::string::npos) {
     // Show user the response
@@ -457,6 +973,194 @@ void ftp::protocol_interpreter_client::do_rnto(std::string newname) {
   std::cout << response << std::endl;
 }
 
+// Upload many files over one data connection, wait for response
+// With -r, upload directory trees using parallel sessions
+void ftp::protocol_interpreter_client::do_mput(std::string arguments) {
+  // Recursive or explicitly parallel uploads use a pool of sessions
+  ftp::transfer_options options;
+  if (!ftp::parse_transfer_options(arguments, options)) {
+    std::cout << "Usage: mput [-r] [-j <sessions>] <path>..." << std::endl;
+    return;
+  }
+  if (options.parallel) {
+    run_parallel_transfer(false, options);
+    return;
+  }
+  const std::string &filenames = arguments;
+
+  // Only send the files that exist in the local file system
+  std::vector<std::string> tokens;
+  std::vector<std::string> files;
+  for (const auto &filename : ftp::split(filenames, tokens, ' ')) {
+    if (!std::filesystem::is_regular_file(filename)) {
+      std::clog << "[Proto] " << "File \"" << filename
+                << "\" does not exist or is not a regular file" << std::endl;
+      std::cout << "Skipping \"" << filename << "\"" << std::endl;
+      continue;
+    }
+    files.push_back(filename);
+  }
+  if (files.empty()) {
+    return;
+  }
+  // The server stores the files by name only, in its working directory: two
+  // of the same name would overwrite each other
+  std::set<std::string> names;
+  for (const auto &file : files) {
+    const auto name = std::filesystem::path(file).filename().string();
+    if (!names.insert(name).second) {
+      std::cout << "Error: more than one file named \"" << name
+                << "\", upload them in separate batches" << std::endl;
+      failures_++;
+      return;
+    }
+  }
+
+  // Send MPUT command to the server
+  const std::string mput_command = "MPUT " + std::to_string(files.size());
+  send_command(mput_command);
+
+  // Wait for response from the server
+  const auto response = receive_reply();
+  // If response is not 200, return
+  if (response.find("200") == std::string::npos) {
+    // Show user the response
+    std::cout << response << std::endl;
+    return;
+  }
+
+  // Stream all files over one data connection
+  std::clog << "[Proto] " << "Sending batch of " << files.size() << " file(s)"
+            << std::endl;
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t sent_bytes = send_batch(files);
+
+  // After sending the batch, tell the server that sending is done
+  const std::string done_command = "DONE";
+  send_command(done_command);
+
+  // Wait for the results, which list the files that failed
+  const auto results = receive_reply();
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  std::cout << results << std::endl;
+  std::cout << "Sent " << files.size() << " file(s), " << sent_bytes
+            << " bytes in " << seconds << " s ("
+            << files.size() / seconds << " files/s)" << std::endl;
+}
+
+// Download files or (with -r) directory trees using parallel sessions
+void ftp::protocol_interpreter_client::do_mget(std::string arguments) {
+  ftp::transfer_options options;
+  if (!ftp::parse_transfer_options(arguments, options)) {
+    std::cout << "Usage: mget [-r] [-j <sessions>] <path>..." << std::endl;
+    return;
+  }
+  run_parallel_transfer(true, options);
+}
+
+// Current directory on the server, empty (and the reply printed) on failure
+std::string ftp::protocol_interpreter_client::remote_working_directory() {
+  const auto response = execute("PWD");
+  const std::string pwd_tag = "Current working directory: ";
+  const auto tag_position = response.find(pwd_tag);
+  if (response.find("200") == std::string::npos ||
+      tag_position == std::string::npos) {
+    std::cout << response << std::endl;
+    return "";
+  }
+  std::string remote_directory =
+      response.substr(tag_position + pwd_tag.size());
+  remote_directory.erase(remote_directory.find_last_not_of("\r\n") + 1);
+  return remote_directory;
+}
+
+// Run mget/mput over a pool of sessions and print the summary
+void ftp::protocol_interpreter_client::run_parallel_transfer(
+    bool download, const ftp::transfer_options &options) {
+  // The transfer happens relative to the current remote directory
+  const auto remote_directory = remote_working_directory();
+  if (remote_directory.empty()) {
+    return;
+  }
+
+  std::clog << "[Proto] " << (download ? "Downloading" : "Uploading")
+            << " with " << options.concurrency << " session(s)" << std::endl;
+  ftp::parallel_transfer transfer(connector_->peer_address(), username_,
+                                  password_, options.concurrency);
+  const auto summary =
+      download ? transfer.download(remote_directory, options.paths,
+                                   options.recursive)
+               : transfer.upload(remote_directory, options.paths,
+                                 options.recursive);
+
+  // Summary: throughput and failures
+  const double megabytes = double(summary.bytes) / (1024 * 1024);
+  std::cout << (download ? "Downloaded " : "Uploaded ") << summary.files_ok
+            << " file(s), " << summary.failures.size() << " failed, "
+            << summary.bytes << " bytes in " << summary.seconds << " s ("
+            << megabytes / summary.seconds << " MB/s, "
+            << summary.files_ok / summary.seconds << " files/s, "
+            << options.concurrency << " session(s))" << std::endl;
+  for (const auto &[path, reason] : summary.failures) {
+    std::cout << "    failed " << path << ": " << reason << std::endl;
+  }
+}
+
+// Synchronize a local and a remote tree over a pool of sessions
+void ftp::protocol_interpreter_client::do_mirror(std::string arguments) {
+  ftp::mirror_options options;
+  if (!ftp::parse_mirror_options(arguments, options)) {
+    std::cout << "Usage: mirror [-n] [-j <sessions>] [--delete] [--hash] "
+                 "up|down <local dir> <remote dir>"
+              << std::endl;
+    return;
+  }
+  // The remote directory is relative to the current one
+  const auto remote_directory = remote_working_directory();
+  if (remote_directory.empty()) {
+    failures_++;
+    return;
+  }
+  const auto remote_root = ftp::remote_join(remote_directory, options.remote);
+
+  std::clog << "[Proto] " << "Comparing " << options.local << " and "
+            << remote_root << std::endl;
+  ftp::mirror mirror(connector_->peer_address(), username_, password_,
+                     options, remote_root);
+  ftp::mirror_plan plan;
+  if (!mirror.plan(plan)) {
+    std::cout << "Error: " << mirror.error() << std::endl;
+    failures_++;
+    return;
+  }
+  if (options.dry_run) {
+    ftp::print_mirror_plan(plan, options, std::cout);
+    return;
+  }
+
+  // Summary: throughput and failures
+  const auto summary = mirror.run(plan);
+  const double megabytes = double(summary.bytes) / (1024 * 1024);
+  std::cout << (options.upload ? "Uploaded " : "Downloaded ")
+            << summary.files_transferred << " file(s), " << summary.bytes
+            << " bytes in " << summary.seconds << " s ("
+            << megabytes / summary.seconds << " MB/s, "
+            << options.concurrency << " session(s)), created "
+            << summary.directories_created << " directory(ies), deleted "
+            << summary.entries_removed << " entry(ies), "
+            << plan.unchanged << " unchanged, " << summary.failures.size()
+            << " failed" << std::endl;
+  for (const auto &path : plan.conflicts) {
+    std::cout << "    conflict " << path << std::endl;
+  }
+  for (const auto &[path, reason] : summary.failures) {
+    std::cout << "    failed " << path << ": " << reason << std::endl;
+  }
+  failures_ += summary.failures.size();
+}
+
 // Help command, runs locally without server
 void ftp::protocol_interpreter_client::do_help() {
   // Print the help message
@@ -472,9 +1176,18 @@ void ftp::protocol_interpreter_client::do_help() {
   std::cout << "PASV             - Use passive mode (default)\n";
 
   // File transfer commands
-  std::cout << "RETR <filename>  - Download a file from server\n";
+  std::cout << "RETR <filename>  - Download a file or directory (as tar)\n";
+  std::cout << "RETR <filename> <local>|-\n"
+               "                 - Download into another file, or stream it "
+               "to stdout\n";
   std::cout << "STOR <filename>  - Upload a file to server\n";
   std::cout << "LIST             - List files in current directory\n";
+  std::cout << "MLSD [<dir>]     - Machine readable listing (type, size, "
+               "mtime)\n";
+  std::cout << "SIZE <filename>  - Show the size of a file\n";
+  std::cout << "MDTM <filename>  - Show the modification time of a file "
+               "(UTC)\n";
+  std::cout << "XCRC <filename>  - Show the CRC-32 of a file\n";
 
   // Directory navigation commands
   std::cout << "CWD <directory>  - Change working directory\n";
@@ -487,6 +1200,16 @@ void ftp::protocol_interpreter_client::do_help() {
   std::cout << "DELE <filename>  - Delete a file\n";
   std::cout << "RNFR <oldname>   - Rename from (specify old filename)\n";
   std::cout << "RNTO <newname>   - Rename to (specify new filename)\n";
+  std::cout << "MPUT <file>...   - Upload many files over one connection\n";
+  std::cout << "MPUT -r [-j N] <path>...\n"
+               "                 - Upload directory trees over N sessions\n";
+  std::cout << "MGET [-r] [-j N] <path>...\n"
+               "                 - Download files or directory trees over N "
+               "sessions\n";
+  std::cout << "MIRROR [-n] [-j N] [--delete] [--hash] up|down <local> "
+               "<remote>\n"
+               "                 - Synchronize a directory tree (-n: print "
+               "the plan)\n";
 
   // Other commands
   std::cout << "QUIT             - Exit the FTP client\n";
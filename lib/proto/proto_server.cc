@@ -1,52 +1,42 @@
-#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <json/json.h>
 #include <string>
 #include <utility>
-#include <vector>
 
 #include "proto/proto_interpreter.h"
+#include "utils/buffer_pool.h"
+#include "utils/config.h"
+#include "utils/crc32.h"
+#include "utils/file_cache.h"
 #include "utils/ftp.h"
 #include "utils/io.h"
+#include "utils/listing_cache.h"
+#include "utils/metrics.h"
+#include "utils/quota.h"
+#include "utils/trace.h"
 
 // Protocol interpreter server implementation
 ftp::protocol_interpreter_server::protocol_interpreter_server(
-    sockpp::tcp_socket sock) {
+    sockpp::tcp_socket sock)
+    : status_(sock.peer_address().to_string()), fs_(ftp::vfs::instance()) {
   // Set the socket
   sock_ = std::move(sock);
   // Set running to false
   running_ = false;
 
-  // Initialize the buffer
-  buf_ = std::shared_ptr<char>(new char[buffer_size],
-                               std::default_delete<char[]>());
+  // Read config.json to get the username and password
+  const Json::Value root = ftp::read_config();
 
-  // Read config.json to get the username and password also working directory
-  Json::Value root;
-  Json::CharReaderBuilder builder;
-  std::ifstream config_file("config.json", std::ifstream::binary);
-
-  std::string errors;
-  bool parsing_successful =
-      Json::parseFromStream(builder, config_file, &root, &errors);
-  if (!parsing_successful) {
-    std::cerr << "[Proto] " << "Failed to parse config.json: " << errors
-              << std::endl;
-    throw std::runtime_error("Failed to parse config.json");
-  }
-
-  // Set the current working directory based on config.json
-  current_working_directory_ = root["workingDirectory"].asString();
-  // If not set, use the home directory
-  if (current_working_directory_.empty()) {
-    current_working_directory_ = getenv("HOME");
+  // The session cannot leave the root of the storage, and starts in it
+  if (!fs_.storage().stat("/").is_directory) {
+    throw std::runtime_error("Cannot open the working directory");
   }
 
-  // Log the current working directory
-  std::clog << "[Proto] " << "Current working directory: "
-            << current_working_directory_.string() << std::endl;
-  // Log the relative path
-  std::clog << "[Proto] " << "Relative path: "
-            << current_working_directory_.relative_path().string() << std::endl;
+  // Log the root directory
+  std::clog << "[Proto] " << "Root directory: " << fs_.host_path("/").string()
+            << std::endl;
 
   // Set is_logged_in to false
   is_username_valid_ = false;
@@ -90,17 +80,40 @@ ftp::protocol_interpreter_server::protocol_interpreter_server(
             << std::endl;
 }
 
+// An upload still staged when the session ends (the client went away
+// during a transfer) is discarded, and its quota reservation released
+ftp::protocol_interpreter_server::~protocol_interpreter_server() {
+  abort_upload();
+}
+
 // Run the protocol interpreter
 void ftp::protocol_interpreter_server::run() {
   // Set running to true
   running_ = true;
+  ftp::metrics::instance().session_started();
   // Keep receiving commands from the client
   while (running_) {
     // Read the command from the client
-    std::string input = ftp::receive_message(&sock_, buf_, buffer_size);
+    status_.command.store(-1, std::memory_order_relaxed);
+    std::string input = receive_command();
+    if (status_.killed.load(std::memory_order_relaxed)) {
+      std::clog << "[Proto] " << "Session killed" << std::endl;
+      break;
+    }
 
     // Parse the command (feed the command to the ftp::parse_command function)
     auto [operation, argument] = ftp::parse_command(input);
+    // Shown by the admin socket, transfers start a new pace
+    status_.command_bytes.store(0, std::memory_order_relaxed);
+    status_.command_started.store(ftp::steady_nanoseconds(),
+                                  std::memory_order_relaxed);
+    status_.command.store(int(operation), std::memory_order_relaxed);
+    pace_started_ = std::chrono::steady_clock::now();
+    pace_bytes_ = 0;
+    pace_limit_ = status_.rate_limit.load(std::memory_order_relaxed);
+    // Latency of the command, recorded at the end of the iteration
+    const ftp::command_timer timer(operation);
+    FTP_TRACE_SCOPE(ftp::operation_name(operation));
     // Log the command
     std::clog << "[Proto] " << "Parsed command: " << operation << " "
               << argument << std::endl;
@@ -170,6 +183,22 @@ void ftp::protocol_interpreter_server::run() {
       do_list();
       continue;
     }
+    if (operation == ftp::MLSD) {
+      do_mlsd(argument);
+      continue;
+    }
+    if (operation == ftp::SIZE) {
+      do_size(argument);
+      continue;
+    }
+    if (operation == ftp::MDTM) {
+      do_mdtm(argument);
+      continue;
+    }
+    if (operation == ftp::XCRC) {
+      do_xcrc(argument);
+      continue;
+    }
     if (operation == ftp::CWD) {
       do_cwd(argument);
       continue;
@@ -198,6 +227,10 @@ void ftp::protocol_interpreter_server::run() {
       do_rnfr(argument);
       continue;
     }
+    if (operation == ftp::MPUT) {
+      do_mput(argument);
+      continue;
+    }
   }
 
   // Disconnect from the client
@@ -205,6 +238,7 @@ void ftp::protocol_interpreter_server::run() {
             << sock_.peer_address().to_string() << "..." << std::endl;
   // Stop the protocol interpreter
   stop();
+  ftp::metrics::instance().session_ended();
 }
 
 // Stop the protocol interpreter
@@ -212,13 +246,42 @@ void ftp::protocol_interpreter_server::stop() {
   // Close the socket
   std::clog << "[Proto] " << "Protocol interpreter server for client "
             << sock_.peer_address().to_string() << " stopped" << std::endl;
+  std::lock_guard<std::mutex> lock(socket_mutex_);
   sock_.close();
   // End the thread
 }
 
+// End the session from another thread
+void ftp::protocol_interpreter_server::kill() {
+  status_.killed.store(true, std::memory_order_relaxed);
+  // Wakes up the read of the next command; the socket stays open until the
+  // session thread closes it
+  std::lock_guard<std::mutex> lock(socket_mutex_);
+  sock_.shutdown();
+}
+
 // Is protocol interpreter running?
 bool ftp::protocol_interpreter_server::is_running() const { return running_; }
 
+// Wait for the next message of the client
+std::string ftp::protocol_interpreter_server::receive_command() {
+  while (true) {
+    auto message = framer_.next(&sock_, buf_);
+    if (!framer_.overflowed()) {
+      return message;
+    }
+    std::clog << "[Proto] " << "Line longer than "
+              << ftp::message_framer::max_line_size << " bytes" << std::endl;
+    ftp::send_message(&sock_, "500 Line too long\r\n");
+  }
+}
+
+// Wait for what the client sends after a transfer ("DONE")
+std::string ftp::protocol_interpreter_server::receive_acknowledge() {
+  FTP_TRACE_SCOPE("DONE handshake");
+  return receive_command();
+}
+
 // Check username and password
 void ftp::protocol_interpreter_server::do_user(std::string username) {
   // If already logged in, send response
@@ -281,6 +344,7 @@ void ftp::protocol_interpreter_server::do_pass(std::string password) {
 
   // Password is valid
   is_logged_in_ = true;
+  status_.set_user(current_username_);
   std::clog << "[Proto] " << "Valid password" << std::endl;
   const std::string response = "230 User logged in, proceed.\r\n";
 
@@ -290,7 +354,7 @@ void ftp::protocol_interpreter_server::do_pass(std::string password) {
                               "Welcome to the FTP server! "
                               "\033[0m"
                               "\r\n \"" +
-                              current_working_directory_.string() +
+                              fs_.pwd() +
                               "\" is the current "
                               "directory.\r\n";
   ftp::send_message(&sock_, response + welcome);
@@ -314,6 +378,7 @@ void ftp::protocol_interpreter_server::do_port(std::string port) {
 
     // Set passive mode false
     is_passive_mode_ = false;
+    pasv_acceptor_.close();
 
     // Set client_port_ to default port
     client_data_port_ = uint16_t(default_port_num);
@@ -343,6 +408,7 @@ void ftp::protocol_interpreter_server::do_port(std::string port) {
 
   // Set passive mode false
   is_passive_mode_ = false;
+  pasv_acceptor_.close();
 
   // Set client_port_ to provided port
   client_data_port_ = uint16_t(port_num);
@@ -366,26 +432,67 @@ void ftp::protocol_interpreter_server::do_pasv() {
   // Set passive mode true
   is_passive_mode_ = true;
 
+  // Listen on an ephemeral port, so that concurrent sessions do not compete
+  // for the same data port
+  if (!pasv_acceptor_) {
+    pasv_acceptor_.open(sockpp::inet_address(sock_.address().address(), 0));
+  }
+  if (!pasv_acceptor_) {
+    std::clog << "[Proto] " << "Failed to open data port: "
+              << pasv_acceptor_.last_error_str() << std::endl;
+    const std::string response = "200 Passive mode set to true.\r\n";
+    ftp::send_message(&sock_, response);
+    return;
+  }
+
   // Log result
-  std::clog << "[Proto] " << "Passive mode set" << std::endl;
+  const uint16_t data_port = pasv_acceptor_.address().port();
+  std::clog << "[Proto] " << "Passive mode set, data port " << data_port
+            << std::endl;
 
   // Tell the client that the port is set
-  const std::string response = "200 Passive mode set to true.\r\n";
+  const std::string response = "200 Passive mode set to true (data port " +
+                               std::to_string(data_port) + ").\r\n";
   ftp::send_message(&sock_, response);
 }
 
 // Send the file to the client
 void ftp::protocol_interpreter_server::do_retr(std::string filename) {
-  // Check if the file exists
-  // Get path by filename
-  std::filesystem::path file_path = current_working_directory_ / filename;
-  if (!std::filesystem::exists(file_path)) {
-    std::clog << "[Proto] " << "File \"" << file_path << "\" does not exist"
-              << std::endl;
+  // Open the file once, it is sent from this handle
+  std::unique_ptr<ftp::vfs_file> file;
+  {
+    FTP_TRACE_SCOPE("open");
+    file = fs_.storage().open_read(fs_.resolve(filename));
+  }
+  const bool is_directory = file == nullptr && errno == EISDIR;
+  if (file == nullptr && !is_directory) {
+    std::clog << "[Proto] " << "File \"" << fs_.resolve(filename)
+              << "\" does not exist" << std::endl;
     const std::string response = "550 File not found\r\n";
     ftp::send_message(&sock_, response);
     return;
   }
+  // Directories are sent as a tar archive built on the fly
+  if (is_directory) {
+    const std::string response_one =
+        std::string(ftp::archive_reply_code) +
+        " Directory status okay; about to send tar archive\r\n";
+    ftp::send_message(&sock_, response_one);
+    std::clog << "[Proto] " << "Sending directory: " << filename << std::endl;
+    send_archive(filename);
+
+    // After sending the archive, wait for response from the client
+    std::string acknowledge = receive_acknowledge();
+    if (acknowledge.find("DONE") == std::string::npos) {
+      std::clog << "[Proto] " << "Error: " << acknowledge << std::endl;
+      return;
+    }
+    std::clog << "[Proto] " << "Directory transfer done" << std::endl;
+    const std::string response = "226 Directory sent successfully\r\n";
+    ftp::send_message(&sock_, response);
+    return;
+  }
+
   // File exists, tell the client that the file is ready to be sent
   std::string response_one = "200 File status okay; about to open data "
                              "connection\r\n";
@@ -397,19 +504,33 @@ void ftp::protocol_interpreter_server::do_retr(std::string filename) {
 
   // Start sending the file
   std::clog << "[Proto] " << "Sending file: " << filename << std::endl;
-  send_file(filename);
+  send_file(filename, std::move(file));
 
   // After sending the file, wait for response from the client
-  std::string acknowledge = ftp::receive_message(&sock_, buf_, buffer_size);
+  std::string acknowledge = receive_acknowledge();
   if (acknowledge.find("DONE") == std::string::npos) {
     std::clog << "[Proto] " << "Error: " << acknowledge << std::endl;
     return;
   }
   std::clog << "[Proto] " << "File transfer done" << std::endl;
+
+  // Confirm the end of the transfer, the client waits for it before sending
+  // its next command
+  const std::string response = "226 File sent successfully\r\n";
+  ftp::send_message(&sock_, response);
 }
 
 // Receive file from the client
 void ftp::protocol_interpreter_server::do_stor(std::string filename) {
+  // A user with no room left is refused before the data connection
+  if (!ftp::quota_ledger::instance().has_room(current_username_)) {
+    std::clog << "[Proto] " << "Quota of " << current_username_
+              << " exceeded" << std::endl;
+    const std::string response = "552 Quota exceeded\r\n";
+    ftp::send_message(&sock_, response);
+    return;
+  }
+
   // Tell the client that the server is ready to receive the file
   std::string response_one = "200 OK to open data connection\r\n";
   ftp::send_message(&sock_, response_one);
@@ -418,20 +539,43 @@ void ftp::protocol_interpreter_server::do_stor(std::string filename) {
   // Start receiving the file
   std::clog << "[Proto] " << "Receiving file: " << filename << std::endl;
   receive_file(filename);
+  // The declared size did not fit the quota, the data was not taken
+  const bool over_quota = staged_upload_.over_quota;
 
   // After receiving the file, wait for response from the client
-  std::string acknowledge = ftp::receive_message(&sock_, buf_, buffer_size);
+  std::string acknowledge = receive_acknowledge();
   if (acknowledge.find("DONE") == std::string::npos) {
     std::clog << "[Proto] " << "Error: " << acknowledge << std::endl;
+    abort_upload();
+    const std::string response = "451 Transfer aborted; file discarded\r\n";
+    ftp::send_message(&sock_, response);
+    return;
+  }
+
+  // Only a complete upload replaces the destination file
+  if (!commit_upload()) {
+    std::clog << "[Proto] " << "Upload incomplete, file discarded"
+              << std::endl;
+    const std::string response =
+        over_quota ? "552 Quota exceeded; file discarded\r\n"
+                   : "451 Upload incomplete; file discarded\r\n";
+    ftp::send_message(&sock_, response);
     return;
   }
+
+  // Drop the old contents from the file cache
+  ftp::file_cache::instance().invalidate(
+      fs_.host_path(filename.substr(filename.find_last_of("/") + 1)));
+
   std::clog << "[Proto] " << "File transfer done" << std::endl;
+  const std::string response = "226 File stored successfully\r\n";
+  ftp::send_message(&sock_, response);
 }
 
 // List files in the current working directory and send it to the client
 void ftp::protocol_interpreter_server::do_list() {
   // Check if the current working directory is valid
-  if (!std::filesystem::exists(current_working_directory_)) {
+  if (!fs_.cwd_exists()) {
     std::clog << "[Proto] " << "Current working directory does not exist"
               << std::endl;
     const std::string response =
@@ -440,116 +584,156 @@ void ftp::protocol_interpreter_server::do_list() {
     return;
   }
 
-  // List files in the current working directory
-  std::string response = "200 Directory listing:\r\n\n";
-  // Array of file name for further alphabetical sorting
-  std::vector<std::string> file_list;
-  for (const auto &entry :
-       std::filesystem::directory_iterator(current_working_directory_)) {
-    // Check if the entry is a file or directory
-    if (entry.is_regular_file()) {
-      // Add the file name to the list
-      file_list.push_back(entry.path().filename().string());
-      continue;
-    }
+  // Rendered listing, shared by all sessions until the directory changes
+  FTP_TRACE_SCOPE("listing");
+  const auto listing =
+      ftp::listing_cache::instance().listing(fs_.storage(), fs_.pwd());
 
-    if (entry.is_directory()) {
-      // Add the directory name to the list
-      file_list.push_back(entry.path().filename().string() + "/");
-      continue;
-    }
+  // Send the response to the client
+  ftp::send_message(&sock_, *listing);
+  std::clog << "[Proto] " << "File list sent to client" << std::endl;
+}
+
+// Stream a machine readable listing of a directory over a data connection
+void ftp::protocol_interpreter_server::do_mlsd(std::string directory) {
+  // Without an argument, list the current working directory
+  if (!fs_.storage().stat(fs_.resolve(directory)).is_directory) {
+    std::clog << "[Proto] " << "Directory \"" << fs_.resolve(directory)
+              << "\" does not exist" << std::endl;
+    const std::string response = "550 Directory not found\r\n";
+    ftp::send_message(&sock_, response);
+    return;
   }
-  // Sort the file list (With alphabetical order, and directories first)
-  auto str_comp = [](const std::string &a, const std::string &b) {
-    // Check for empty strings
-    if (a.empty() && b.empty()) {
-      return false;
-    }
-    if (a.empty()) {
-      return false;
-    }
-    if (b.empty()) {
-      return true;
-    }
 
-    // Sort directories first, then files
-    bool a_is_dir = a.back() == '/';
-    bool b_is_dir = b.back() == '/';
-    if (a_is_dir != b_is_dir) {
-      return a_is_dir;
-    }
+  const std::string response_one = "200 Directory status okay; about to send "
+                                   "listing\r\n";
+  ftp::send_message(&sock_, response_one);
+  send_listing(directory);
 
-    // Finally sort alphabetically
-    return a < b;
-  };
-  std::sort(file_list.begin(), file_list.end(), str_comp);
-  // Add the file names to the response string, note that directories are in
-  // blue color
-  for (const auto &file : file_list) {
-    if (file.back() == '/') {
-      // Remove the trailing slash
-      std::string file_no_slash = file.substr(0, file.size() - 1);
-      response += "    \e[1m\033[34m" + file_no_slash + "\033[0m\e[m\r\n";
-      continue;
-    }
-    response += "    " + file + "\r\n";
+  // After sending the listing, wait for response from the client
+  std::string acknowledge = receive_acknowledge();
+  if (acknowledge.find("DONE") == std::string::npos) {
+    std::clog << "[Proto] " << "Error: " << acknowledge << std::endl;
+    return;
   }
-
-  // Send the response to the client
+  const std::string response = "226 Listing sent successfully\r\n";
   ftp::send_message(&sock_, response);
-  std::clog << "[Proto] " << "File list sent to client" << std::endl;
 }
 
-// Change current working directory, send response to the client
-void ftp::protocol_interpreter_server::do_cwd(std::string directory) {
-  // Check if the directory is "."
-  if (directory == ".") {
-    std::clog << "[Proto] " << "Current working directory is already "
-              << current_working_directory_.string() << std::endl;
-    const std::string response = "200 Directory changed to " +
-                                 current_working_directory_.string() + "\r\n";
+// Status of a file, from the stat cache
+bool ftp::protocol_interpreter_server::regular_file_status(
+    const std::string &filename, ftp::file_status &status) {
+  const auto file_path = fs_.host_path(filename);
+  status = ftp::stat_cache::instance().status(file_path.string(), [&]() {
+    FTP_TRACE_SCOPE("stat");
+    const auto found = fs_.storage().stat(fs_.resolve(filename));
+    ftp::file_status loaded;
+    loaded.exists = found.exists;
+    loaded.is_regular = found.is_regular;
+    loaded.size = found.size;
+    loaded.mtime = found.mtime;
+    return loaded;
+  });
+  if (!status.exists) {
+    std::clog << "[Proto] " << "File " << file_path << " does not exist"
+              << std::endl;
+    const std::string response = "550 File not found\r\n";
     ftp::send_message(&sock_, response);
+    return false;
+  }
+  if (!status.is_regular) {
+    std::clog << "[Proto] " << "Path " << file_path
+              << " is not a regular file" << std::endl;
+    const std::string response = "550 Path is not a regular file\r\n";
+    ftp::send_message(&sock_, response);
+    return false;
+  }
+  return true;
+}
+
+// Send the size of a file to the client
+void ftp::protocol_interpreter_server::do_size(std::string filename) {
+  ftp::file_status status;
+  if (!regular_file_status(filename, status)) {
     return;
   }
+  const std::string response = "213 " + std::to_string(status.size) + "\r\n";
+  ftp::send_message(&sock_, response);
+}
 
-  // Check if the directory is ".."
-  if (directory == "..") {
-    // Change to parent directory
-    current_working_directory_ = current_working_directory_.parent_path();
-    std::clog << "[Proto] " << "Changed working directory to "
-              << current_working_directory_.string() << std::endl;
-    const std::string response = "200 Directory changed to " +
-                                 current_working_directory_.string() + "\r\n";
-    ftp::send_message(&sock_, response);
+// Send the modification time of a file to the client
+void ftp::protocol_interpreter_server::do_mdtm(std::string filename) {
+  ftp::file_status status;
+  if (!regular_file_status(filename, status)) {
     return;
   }
+  const std::string response =
+      "213 " + ftp::format_timestamp(status.mtime) + "\r\n";
+  ftp::send_message(&sock_, response);
+}
 
-  // Check if the directory is valid
-  std::filesystem::path new_directory = current_working_directory_ / directory;
-  if (!std::filesystem::exists(new_directory)) {
-    std::clog << "[Proto] " << "Directory \"" << new_directory
-              << "\" does not exist" << std::endl;
-    const std::string response = "550 Directory not found\r\n";
+// Send the CRC-32 of a whole file to the client
+void ftp::protocol_interpreter_server::do_xcrc(std::string filename) {
+  ftp::file_status status;
+  if (!regular_file_status(filename, status)) {
+    return;
+  }
+  const auto file = fs_.storage().open_read(fs_.resolve(filename));
+  uint32_t crc = 0;
+  bool successful = false;
+  if (file != nullptr) {
+    FTP_TRACE_SCOPE("crc32");
+    // Read through a pool buffer, like a download
+    const auto file_buf = ftp::buffer_pool::instance().lease();
+    const int fd = file->fd();
+    if (!file_buf) {
+      successful = false;
+    } else if (fd != -1) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      successful = ftp::crc32_file(fd, file_buf.data(), file_buf.size(), crc);
+    } else {
+      uint64_t offset = 0;
+      ssize_t n = 0;
+      while ((n = file->read(file_buf.data(), file_buf.size(), offset)) > 0) {
+        crc = ftp::crc32(file_buf.data(), size_t(n), crc);
+        offset += uint64_t(n);
+      }
+      successful = n == 0;
+    }
+  }
+  if (!successful) {
+    std::clog << "[Proto] " << "Cannot read " << fs_.host_path(filename)
+              << ": " << strerror(errno) << std::endl;
+    const std::string response = "550 Cannot read the file\r\n";
     ftp::send_message(&sock_, response);
     return;
   }
+  char digits[9];
+  snprintf(digits, sizeof(digits), "%08X", crc);
+  const std::string response = "213 " + std::string(digits) + "\r\n";
+  ftp::send_message(&sock_, response);
+}
 
-  // Check if the directory is a directory
-  if (!std::filesystem::is_directory(new_directory)) {
-    std::clog << "[Proto] " << "Path \"" << new_directory
-              << "\" is not a directory" << std::endl;
-    const std::string response = "550 Path is not a directory\r\n";
+// Change current working directory, send response to the client
+void ftp::protocol_interpreter_server::do_cwd(std::string directory) {
+  // "." and ".." are resolved like any other path, ".." stops at the root
+  if (!fs_.change_directory(directory)) {
+    const int error = errno;
+    std::clog << "[Proto] " << "Cannot change to \"" << fs_.resolve(directory)
+              << "\": " << strerror(error) << std::endl;
+    const std::string response = error == ENOTDIR
+                                     ? "550 Path is not a directory\r\n"
+                                     : "550 Directory not found\r\n";
     ftp::send_message(&sock_, response);
     return;
   }
 
-  // Change the current working directory
-  current_working_directory_ = new_directory;
-  std::clog << "[Proto] " << "Changed working directory to "
-            << current_working_directory_.string() << std::endl;
+  // The current working directory has changed
+  std::clog << "[Proto] " << "Changed working directory to " << fs_.pwd()
+            << std::endl;
   // Send response to the client
-  const std::string response = "200 Directory changed to " +
-                               current_working_directory_.string() + "\r\n";
+  const std::string response = "200 Directory changed to " + fs_.pwd() +
+                               "\r\n";
   ftp::send_message(&sock_, response);
 }
 
@@ -562,7 +746,7 @@ void ftp::protocol_interpreter_server::do_cdup() {
 // Send the current working directory name to the client
 void ftp::protocol_interpreter_server::do_pwd() {
   // Check if the current working directory is valid
-  if (!std::filesystem::exists(current_working_directory_)) {
+  if (!fs_.cwd_exists()) {
     std::clog << "[Proto] " << "Current working directory does not exist"
               << std::endl;
     const std::string response =
@@ -571,12 +755,11 @@ void ftp::protocol_interpreter_server::do_pwd() {
     return;
   }
 
-  // Send the current working directory to the client
-  std::clog << "[Proto] " << "Current working directory: "
-            << current_working_directory_.string() << std::endl;
+  // Send the current working directory to the client, "/" being the root
+  std::clog << "[Proto] " << "Current working directory: " << fs_.pwd()
+            << std::endl;
   std::string response =
-      "200 Current working directory: " + current_working_directory_.string() +
-      "\r\n";
+      "200 Current working directory: " + fs_.pwd() + "\r\n";
   ftp::send_message(&sock_, response);
 }
 
@@ -590,28 +773,36 @@ void ftp::protocol_interpreter_server::do_mkd(std::string directory) {
     return;
   }
 
-  // Check if the directory already exists
-  std::filesystem::path new_directory = current_working_directory_ / directory;
-  if (std::filesystem::exists(new_directory)) {
-    std::clog << "[Proto] " << "Directory \"" << new_directory
-              << "\" already exists" << std::endl;
-    const std::string response = "550 Directory already exists\r\n";
+  // A directory counts as a file in the quota of the user
+  auto &quota = ftp::quota_ledger::instance();
+  if (!quota.has_room(current_username_)) {
+    std::clog << "[Proto] " << "Quota of " << current_username_
+              << " exceeded" << std::endl;
+    const std::string response = "552 Quota exceeded\r\n";
     ftp::send_message(&sock_, response);
     return;
   }
 
-  // Create the directory
-  if (!std::filesystem::create_directory(new_directory)) {
-    std::clog << "[Proto] " << "Failed to create directory \"" << new_directory
-              << "\"" << std::endl;
-    const std::string response = "550 Failed to create directory\r\n";
+  // Create the directory, the storage fails if it already exists
+  const auto new_directory = fs_.host_path(directory);
+  if (!fs_.storage().make_directory(fs_.resolve(directory))) {
+    const int error = errno;
+    std::clog << "[Proto] " << "Failed to create directory " << new_directory
+              << ": " << strerror(error) << std::endl;
+    const std::string response = error == EEXIST
+                                     ? "550 Directory already exists\r\n"
+                                     : "550 Failed to create directory\r\n";
     ftp::send_message(&sock_, response);
     return;
   }
 
+  quota.add_directory(current_username_, fs_.resolve(directory));
+  ftp::listing_cache::instance().invalidate(new_directory.parent_path());
+  ftp::stat_cache::instance().invalidate(new_directory.string());
+
   // Directory created successfully
-  std::clog << "[Proto] " << "Directory \"" << new_directory
-            << "\" created successfully" << std::endl;
+  std::clog << "[Proto] " << "Directory " << new_directory
+            << " created successfully" << std::endl;
   const std::string response = "200 Directory created successfully\r\n";
   ftp::send_message(&sock_, response);
 }
@@ -626,82 +817,62 @@ void ftp::protocol_interpreter_server::do_rmd(std::string directory) {
     return;
   }
 
-  // Check if the directory exists
-  std::filesystem::path new_directory = current_working_directory_ / directory;
-  if (!std::filesystem::exists(new_directory)) {
-    std::clog << "[Proto] " << "Directory \"" << new_directory
-              << "\" does not exist" << std::endl;
-    const std::string response = "550 Directory does not exist\r\n";
-    ftp::send_message(&sock_, response);
-    return;
-  }
-
-  // Check if the directory is a directory
-  if (!std::filesystem::is_directory(new_directory)) {
-    std::clog << "[Proto] " << "Path \"" << new_directory
-              << "\" is not a directory" << std::endl;
-    const std::string response = "550 Path is not a directory\r\n";
+  // Remove the directory, the storage checks that it exists, is a
+  // directory and is empty
+  const auto old_directory = fs_.host_path(directory);
+  if (!fs_.storage().remove_directory(fs_.resolve(directory))) {
+    const int error = errno;
+    std::clog << "[Proto] " << "Failed to remove directory " << old_directory
+              << ": " << strerror(error) << std::endl;
+    std::string response = "550 Failed to remove directory\r\n";
+    if (error == ENOENT) {
+      response = "550 Directory does not exist\r\n";
+    } else if (error == ENOTDIR) {
+      response = "550 Path is not a directory\r\n";
+    } else if (error == ENOTEMPTY || error == EEXIST) {
+      response = "550 Directory is not empty\r\n";
+    }
     ftp::send_message(&sock_, response);
     return;
   }
 
-  // Check if the directory is empty
-  if (!std::filesystem::is_empty(new_directory)) {
-    std::clog << "[Proto] " << "Directory \"" << new_directory
-              << "\" is not empty" << std::endl;
-    const std::string response = "550 Directory is not empty\r\n";
-    ftp::send_message(&sock_, response);
-    return;
-  }
-
-  // Remove the directory
-  if (!std::filesystem::remove(new_directory)) {
-    std::clog << "[Proto] " << "Failed to remove directory \"" << new_directory
-              << "\"" << std::endl;
-    const std::string response = "550 Failed to remove directory\r\n";
-    ftp::send_message(&sock_, response);
-    return;
-  }
+  ftp::quota_ledger::instance().remove(fs_.resolve(directory));
+  ftp::listing_cache::instance().invalidate(old_directory.parent_path());
+  ftp::stat_cache::instance().invalidate_tree(old_directory.string());
 
   // Directory removed successfully
-  std::clog << "[Proto] " << "Directory \"" << new_directory
-            << "\" removed successfully" << std::endl;
+  std::clog << "[Proto] " << "Directory " << old_directory
+            << " removed successfully" << std::endl;
   const std::string response = "200 Directory removed successfully\r\n";
   ftp::send_message(&sock_, response);
 }
 
 // Delete file, send response to the client
 void ftp::protocol_interpreter_server::do_dele(std::string filename) {
-  // Check if the file exists
-  std::filesystem::path file_path = current_working_directory_ / filename;
-  if (!std::filesystem::exists(file_path)) {
-    std::clog << "[Proto] " << "File \"" << file_path << "\" does not exist"
-              << std::endl;
-    const std::string response = "550 File not found\r\n";
-    ftp::send_message(&sock_, response);
-    return;
-  }
-
-  // Check if the file is a file
-  if (!std::filesystem::is_regular_file(file_path)) {
-    std::clog << "[Proto] " << "Path \"" << file_path
-              << "\" is not a regular file" << std::endl;
-    const std::string response = "550 Path is not a regular file\r\n";
+  // Remove the file, the storage checks that it exists and is not a
+  // directory
+  const auto file_path = fs_.host_path(filename);
+  if (!fs_.storage().remove(fs_.resolve(filename))) {
+    const int error = errno;
+    std::clog << "[Proto] " << "Failed to remove file " << file_path << ": "
+              << strerror(error) << std::endl;
+    std::string response = "550 Failed to remove file\r\n";
+    if (error == ENOENT) {
+      response = "550 File not found\r\n";
+    } else if (error == EISDIR || error == EINVAL) {
+      response = "550 Path is not a regular file\r\n";
+    }
     ftp::send_message(&sock_, response);
     return;
   }
 
-  // Remove the file
-  if (!std::filesystem::remove(file_path)) {
-    std::clog << "[Proto] " << "Failed to remove file \"" << file_path << "\""
-              << std::endl;
-    const std::string response = "550 Failed to remove file\r\n";
-    ftp::send_message(&sock_, response);
-    return;
-  }
+  ftp::quota_ledger::instance().remove(fs_.resolve(filename));
+  ftp::file_cache::instance().invalidate(file_path);
+  ftp::listing_cache::instance().invalidate(file_path.parent_path());
+  ftp::stat_cache::instance().invalidate(file_path.string());
 
   // File removed successfully
-  std::clog << "[Proto] " << "File \"" << file_path << "\" removed successfully"
+  std::clog << "[Proto] " << "File " << file_path << " removed successfully"
             << std::endl;
   const std::string response = "200 File removed successfully\r\n";
   ftp::send_message(&sock_, response);
@@ -718,19 +889,18 @@ void ftp::protocol_interpreter_server::do_rnfr(std::string oldname) {
   }
 
   // Check if the file exists
-  std::filesystem::path file_path = current_working_directory_ / oldname;
-  if (!std::filesystem::exists(file_path)) {
-    std::clog << "[Proto] " << "File \"" << file_path << "\" does not exist"
-              << std::endl;
+  const auto status = fs_.storage().stat(fs_.resolve(oldname));
+  if (!status.exists) {
+    std::clog << "[Proto] " << "File \"" << fs_.resolve(oldname)
+              << "\" does not exist" << std::endl;
     const std::string response = "550 File not found\r\n";
     ftp::send_message(&sock_, response);
     return;
   }
 
   // Either this is a file or directory is ok
-  if (!std::filesystem::is_regular_file(file_path) &&
-      !std::filesystem::is_directory(file_path)) {
-    std::clog << "[Proto] " << "Path \"" << file_path
+  if (!status.is_regular && !status.is_directory) {
+    std::clog << "[Proto] " << "Path \"" << fs_.resolve(oldname)
               << "\" is not a regular file or directory" << std::endl;
     const std::string response =
         "550 Path is not a regular file or directory\r\n";
@@ -738,8 +908,8 @@ void ftp::protocol_interpreter_server::do_rnfr(std::string oldname) {
     return;
   }
 
-  // File exists, put the file path in the rename_stack_
-  rename_oldname_path_ = file_path;
+  // File exists, remember where it is (even if the directory changes)
+  rename_oldname_path_ = fs_.resolve(oldname);
 
   // Tell the client that the file is ready to be renamed
   std::clog << "[Proto] " << "File status okay; about to rename file"
@@ -767,25 +937,94 @@ void ftp::protocol_interpreter_server::do_rnto(std::string newname) {
     return;
   }
 
-  // Check if the file exists
-  std::filesystem::path new_file_path = current_working_directory_ / newname;
-  if (std::filesystem::exists(new_file_path)) {
-    std::clog << "[Proto] " << "File \"" << new_file_path << "\" already exists"
-              << std::endl;
-    const std::string response = "550 File already exists\r\n";
+  // Rename the file, the storage refuses to replace an existing file
+  const auto old_file_path = fs_.host_path(rename_oldname_path_);
+  const auto new_file_path = fs_.host_path(newname);
+  if (!fs_.storage().rename(rename_oldname_path_, fs_.resolve(newname))) {
+    const int error = errno;
+    std::clog << "[Proto] " << "Failed to rename " << old_file_path << " to "
+              << new_file_path << ": " << strerror(error) << std::endl;
+    const std::string response = error == EEXIST
+                                     ? "550 File already exists\r\n"
+                                     : "550 Failed to rename file\r\n";
     ftp::send_message(&sock_, response);
     return;
   }
 
-  // Rename the file
-  std::filesystem::rename(rename_oldname_path_, new_file_path);
+  // The paths keep their owners
+  ftp::quota_ledger::instance().rename(rename_oldname_path_,
+                                       fs_.resolve(newname));
+  ftp::file_cache::instance().invalidate(old_file_path);
+  auto &listings = ftp::listing_cache::instance();
+  listings.invalidate(old_file_path.parent_path());
+  listings.invalidate(new_file_path.parent_path());
+  // Either may be a directory, with the paths below it
+  auto &stats = ftp::stat_cache::instance();
+  stats.invalidate_tree(old_file_path.string());
+  stats.invalidate_tree(new_file_path.string());
 
   // File renamed successfully
-  std::clog << "[Proto] " << "File \"" << rename_oldname_path_
-            << "\" renamed to \"" << new_file_path << "\"" << std::endl;
+  std::clog << "[Proto] " << "File " << old_file_path << " renamed to "
+            << new_file_path << std::endl;
   const std::string response = "200 File renamed successfully\r\n";
   ftp::send_message(&sock_, response);
 
   // After renaming, clear the rename_oldname_
   rename_oldname_path_.clear();
 }
+
+// Receive many files over one data connection, report the failed ones
+void ftp::protocol_interpreter_server::do_mput(std::string count) {
+  // A user with no room left is refused before the data connection
+  if (!ftp::quota_ledger::instance().has_room(current_username_)) {
+    std::clog << "[Proto] " << "Quota of " << current_username_
+              << " exceeded" << std::endl;
+    const std::string response = "552 Quota exceeded\r\n";
+    ftp::send_message(&sock_, response);
+    return;
+  }
+
+  // Tell the client that the server is ready to receive the batch
+  std::string response_one = "200 OK to open data connection\r\n";
+  ftp::send_message(&sock_, response_one);
+  std::clog << "[Proto] " << "Receiving batch of " << count << " file(s)"
+            << std::endl;
+
+  // Files are unpacked and committed while the stream arrives
+  const auto results = receive_batch();
+
+  // After receiving the batch, wait for response from the client
+  std::string acknowledge = receive_acknowledge();
+  if (acknowledge.find("DONE") == std::string::npos) {
+    std::clog << "[Proto] " << "Error: " << acknowledge << std::endl;
+  }
+
+  // Invalidate cached contents, and report the files that failed (a
+  // bounded number of them, so that a large batch gets a short reply)
+  constexpr size_t max_reported_failures = 100;
+  size_t failed = 0;
+  std::string failures;
+  for (const auto &[filename, successful] : results) {
+    if (successful) {
+      ftp::file_cache::instance().invalidate(fs_.host_path(filename));
+    } else if (++failed <= max_reported_failures) {
+      failures += "    failed " + filename + "\r\n";
+    }
+  }
+  if (failed > max_reported_failures) {
+    failures += "    and " + std::to_string(failed - max_reported_failures) +
+                " more\r\n";
+  }
+  const size_t stored = results.size() - failed;
+  const std::string code = failed == 0 ? "226" : "451";
+  const std::string summary = "Batch: " + std::to_string(stored) +
+                              " stored, " + std::to_string(failed) +
+                              " failed";
+  // Failures make a reply of several lines, ended by one with the code
+  const std::string response =
+      failed == 0 ? code + " " + summary + "\r\n"
+                  : code + "-" + summary + "\r\n" + failures + code +
+                        " End of batch\r\n";
+  ftp::send_message(&sock_, response);
+  std::clog << "[Proto] " << "Batch transfer done" << std::endl;
+}
@@ -0,0 +1,216 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "utils/admin_socket.h"
+#include "utils/config.h"
+
+namespace {
+
+// Commands are short lines, anything longer is refused
+constexpr size_t max_line_size = 4096;
+// A connection left idle this long is closed, so that it cannot hold the
+// socket (connections are served one at a time)
+constexpr int idle_timeout_millis = 60 * 1000;
+
+// Write all of data, returns false if the peer went away
+bool write_all(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t n = send(fd, data.data() + written, data.size() - written,
+                           MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    written += size_t(n);
+  }
+  return true;
+}
+
+} // namespace
+
+// Server-wide settings, read from config.json once
+const ftp::admin_settings &ftp::admin_settings::instance() {
+  static const admin_settings settings = []() {
+    const auto config = ftp::read_config()["admin"];
+    admin_settings s;
+    s.enabled = config.get("enabled", s.enabled).asBool();
+    s.path = config.get("path", s.path).asString();
+    return s;
+  }();
+  return settings;
+}
+
+// Constructor
+ftp::admin_socket::admin_socket(std::string path) : path_(std::move(path)) {
+  command("help", "help", [this](const std::vector<std::string> &) {
+    std::string out = "ok\n";
+    for (const auto &[name, entry] : commands_) {
+      out += "  " + entry.usage + "\n";
+    }
+    return out;
+  });
+}
+
+// Destructor
+ftp::admin_socket::~admin_socket() { stop(); }
+
+// Answer a command
+void ftp::admin_socket::command(const std::string &name,
+                                const std::string &usage, handler reply) {
+  commands_[name] = command_entry{usage, std::move(reply)};
+}
+
+// Start listening
+bool ftp::admin_socket::start() {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path_.empty() || path_.size() >= sizeof(address.sun_path)) {
+    std::cerr << "[Admin] " << "Invalid socket path " << path_ << std::endl;
+    return false;
+  }
+  path_.copy(address.sun_path, path_.size());
+
+  // Remove the socket left by a previous run, but nothing else
+  struct stat path_stat;
+  if (lstat(path_.c_str(), &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+    unlink(path_.c_str());
+  }
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ == -1 || pipe2(wake_fds_, O_CLOEXEC) == -1) {
+    std::cerr << "[Admin] " << "Error: " << strerror(errno) << std::endl;
+    stop();
+    return false;
+  }
+  // Only the user running the server may connect: the mode is set before
+  // listen(), until which nobody can connect (umask() would change it for
+  // the files every thread creates meanwhile)
+  const bool bound =
+      bind(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) == 0 &&
+      chmod(path_.c_str(), 0600) == 0;
+  if (!bound || listen(listen_fd_, 4) == -1) {
+    std::cerr << "[Admin] " << "Cannot listen on " << path_ << ": "
+              << strerror(errno) << std::endl;
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+
+  running_ = true;
+  thread_ = std::thread([this]() { serve(); });
+  std::clog << "[Admin] " << "Listening on " << path_ << std::endl;
+  return true;
+}
+
+// Stop listening, wait for the thread and remove the socket
+void ftp::admin_socket::stop() {
+  if (running_.exchange(false)) {
+    // Wakes up the thread, waiting for a connection or a command
+    const char wake = 0;
+    if (write(wake_fds_[1], &wake, 1) != 1) {
+      std::cerr << "[Admin] " << "Error: " << strerror(errno) << std::endl;
+    }
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    unlink(path_.c_str());
+  }
+  for (int *fd : {&listen_fd_, &wake_fds_[0], &wake_fds_[1]}) {
+    if (*fd != -1) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+// Wait for fd to be readable
+bool ftp::admin_socket::wait_readable(int fd) {
+  pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fds_[0], POLLIN, 0}};
+  while (running_) {
+    const int n = poll(fds, 2, idle_timeout_millis);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    return n > 0 && fds[0].revents != 0 && fds[1].revents == 0;
+  }
+  return false;
+}
+
+// Accept connections until stopped
+void ftp::admin_socket::serve() {
+  while (running_) {
+    if (!wait_readable(listen_fd_)) {
+      continue;
+    }
+    const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (running_) {
+        std::cerr << "[Admin] " << "Error: " << strerror(errno) << std::endl;
+      }
+      continue;
+    }
+    answer(fd);
+    close(fd);
+  }
+}
+
+// Answer the commands of one connection until it is closed
+void ftp::admin_socket::answer(int fd) {
+  std::string pending;
+  char buf[1024];
+  while (wait_readable(fd)) {
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      return;
+    }
+    pending.append(buf, size_t(n));
+
+    size_t line_end;
+    while ((line_end = pending.find('\n')) != std::string::npos) {
+      std::string line = pending.substr(0, line_end);
+      pending.erase(0, line_end + 1);
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (!write_all(fd, reply(line))) {
+        return;
+      }
+    }
+    if (pending.size() > max_line_size) {
+      write_all(fd, "error line too long\n");
+      return;
+    }
+  }
+}
+
+// Reply to one command line
+std::string ftp::admin_socket::reply(const std::string &line) {
+  std::istringstream words(line);
+  std::string name;
+  words >> name;
+  if (name.empty()) {
+    return "error empty command, try help\n";
+  }
+  std::vector<std::string> arguments;
+  for (std::string word; words >> word;) {
+    arguments.push_back(word);
+  }
+
+  const auto it = commands_.find(name);
+  if (it == commands_.end()) {
+    return "error unknown command " + name + ", try help\n";
+  }
+  std::clog << "[Admin] " << "Command: " << line << std::endl;
+  return it->second.reply(arguments);
+}
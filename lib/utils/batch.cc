@@ -0,0 +1,35 @@
+#include <charconv>
+
+#include "utils/batch.h"
+
+// Build the header of a file in the batch stream
+std::string ftp::batch_file_header(const std::string &name, uint64_t size) {
+  return "FILE " + std::to_string(size) + " " + name + "\n";
+}
+
+// Parse a header line (without the trailing newline)
+bool ftp::parse_batch_header(const std::string &line, std::string &name,
+                             uint64_t &size, bool &end) {
+  end = false;
+  if (line == "END") {
+    end = true;
+    return true;
+  }
+
+  // FILE <size> <name>
+  if (line.rfind("FILE ", 0) != 0) {
+    return false;
+  }
+  const size_t size_begin = 5;
+  const size_t size_end = line.find(' ', size_begin);
+  if (size_end == std::string::npos || size_end + 1 >= line.size()) {
+    return false;
+  }
+  const auto [ptr, ec] =
+      std::from_chars(line.data() + size_begin, line.data() + size_end, size);
+  if (ec != std::errc() || ptr != line.data() + size_end) {
+    return false;
+  }
+  name = line.substr(size_end + 1);
+  return true;
+}
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/mman.h>
+
+#include "utils/buffer_pool.h"
+#include "utils/config.h"
+
+namespace {
+
+// Huge pages are 2 MB on the platforms we run on
+constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+} // namespace
+
+// Parse "none", "transparent" or "reserved" (defaults to none)
+ftp::huge_page_mode ftp::parse_huge_page_mode(const std::string &name) {
+  if (name == "transparent") {
+    return huge_page_mode::transparent;
+  }
+  if (name == "reserved") {
+    return huge_page_mode::reserved;
+  }
+  return huge_page_mode::none;
+}
+
+// Lease
+ftp::buffer_lease::buffer_lease(buffer_pool *pool, char *data, size_t size) {
+  pool_ = pool;
+  data_ = data;
+  size_ = size;
+}
+
+ftp::buffer_lease::buffer_lease(buffer_lease &&other) noexcept {
+  *this = std::move(other);
+}
+
+ftp::buffer_lease &
+ftp::buffer_lease::operator=(buffer_lease &&other) noexcept {
+  if (this != &other) {
+    if (pool_ != nullptr) {
+      pool_->release(data_);
+    }
+    pool_ = std::exchange(other.pool_, nullptr);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+ftp::buffer_lease::~buffer_lease() {
+  if (pool_ != nullptr) {
+    pool_->release(data_);
+  }
+}
+
+// Constructor
+ftp::buffer_pool::buffer_pool(size_t buffer_size, size_t buffers_per_slab,
+                              size_t max_buffers, huge_page_mode mode,
+                              size_t idle_buffers,
+                              std::chrono::milliseconds lease_timeout) {
+  buffer_size_ = std::max<size_t>(buffer_size, 4096);
+  buffers_per_slab_ = std::max<size_t>(buffers_per_slab, 1);
+  max_buffers_ = std::max<size_t>(max_buffers, 1);
+  huge_pages_ = mode;
+  idle_buffers_ = idle_buffers;
+  lease_timeout_ = lease_timeout;
+}
+
+// Destructor
+ftp::buffer_pool::~buffer_pool() {
+  for (const auto &[address, length] : slabs_) {
+    munmap(address, length);
+  }
+}
+
+// Server-wide instance, configured by "bufferPool" in config.json
+ftp::buffer_pool &ftp::buffer_pool::instance() {
+  static buffer_pool pool = []() {
+    const auto config = ftp::read_config()["bufferPool"];
+    const size_t buffer_size =
+        config.get("bufferSize", 256 * 1024).asUInt64();
+    const size_t buffers_per_slab = config.get("buffersPerSlab", 16).asUInt64();
+    const size_t max_buffers = config.get("maxBuffers", 1024).asUInt64();
+    const auto huge_pages = config.get("hugePages", "none").asString();
+    const size_t idle_buffers =
+        config.get("idleBuffers", Json::UInt64(buffers_per_slab)).asUInt64();
+    const auto lease_timeout = std::chrono::milliseconds(
+        config.get("leaseTimeoutMillis", 30000).asUInt64());
+
+    std::clog << "[Pool] " << "Buffer pool: up to " << max_buffers
+              << " buffers of " << buffer_size << " bytes, " << idle_buffers
+              << " kept when idle, huge pages: " << huge_pages << std::endl;
+    return buffer_pool(buffer_size, buffers_per_slab, max_buffers,
+                       parse_huge_page_mode(huge_pages), idle_buffers,
+                       lease_timeout);
+  }();
+  return pool;
+}
+
+size_t ftp::buffer_pool::buffer_size() const { return buffer_size_; }
+
+// Lease one buffer
+ftp::buffer_lease ftp::buffer_pool::lease() {
+  auto leases = lease(1);
+  return leases.empty() ? buffer_lease() : std::move(leases.front());
+}
+
+// Lease up to count buffers at once, at least one
+std::vector<ftp::buffer_lease> ftp::buffer_pool::lease(size_t count) {
+  count = std::clamp<size_t>(count, 1, max_buffers_);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Map slabs while the free list is short and the pool may still grow
+  while (free_.size() < count && allocated_ < max_buffers_ && grow()) {
+  }
+  if (free_.empty()) {
+    std::clog << "[Pool] " << "Pool exhausted (" << leased_ << "/"
+              << max_buffers_ << " buffers leased), waiting" << std::endl;
+    if (!available_cv_.wait_for(lock, lease_timeout_,
+                                [this]() { return !free_.empty(); })) {
+      std::cerr << "[Pool] " << "No buffer returned in "
+                << lease_timeout_.count() << " ms" << std::endl;
+      return {};
+    }
+  }
+
+  count = std::min(count, free_.size());
+  std::vector<buffer_lease> leases;
+  leases.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    leases.push_back(buffer_lease(this, free_.back(), buffer_size_));
+    free_.pop_back();
+  }
+  trimmed_ = std::min(trimmed_, free_.size());
+  leased_ += count;
+  high_water_ = std::max(high_water_, leased_);
+  return leases;
+}
+
+// Return a buffer to the free list
+// Past idle_buffers_ free ones with pages, the pages of those returned the
+// longest ago are dropped (they read as zeros when leased again); reserved
+// huge pages are kept, they cannot be dropped a buffer at a time
+void ftp::buffer_pool::release(char *data) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(data);
+    leased_--;
+    while (huge_pages_ != huge_page_mode::reserved &&
+           free_.size() - trimmed_ > idle_buffers_) {
+      madvise(free_[trimmed_], buffer_size_, MADV_DONTNEED);
+      trimmed_++;
+    }
+  }
+  available_cv_.notify_one();
+}
+
+// Map a new slab, mutex_ must be held
+bool ftp::buffer_pool::grow() {
+  const size_t buffers =
+      std::min(buffers_per_slab_, max_buffers_ - allocated_);
+  size_t length = buffers * buffer_size_;
+  void *address = MAP_FAILED;
+
+  if (huge_pages_ != huge_page_mode::none) {
+    length = (length + huge_page_size - 1) / huge_page_size * huge_page_size;
+  }
+  if (huge_pages_ == huge_page_mode::reserved) {
+    address = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (address == MAP_FAILED) {
+      std::clog << "[Pool] " << "No reserved huge pages (" << strerror(errno)
+                << "), using regular pages" << std::endl;
+    }
+  }
+  if (address == MAP_FAILED) {
+    address = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (address == MAP_FAILED) {
+    std::cerr << "[Pool] " << "Error: " << strerror(errno) << std::endl;
+    return false;
+  }
+  if (huge_pages_ == huge_page_mode::transparent) {
+    madvise(address, length, MADV_HUGEPAGE);
+  }
+
+  // Untouched buffers have no pages yet: they go with the trimmed ones, and
+  // those with pages are leased first
+  slabs_.emplace_back(address, length);
+  std::vector<char *> fresh;
+  for (size_t i = 0; i < buffers; ++i) {
+    fresh.push_back(static_cast<char *>(address) + i * buffer_size_);
+  }
+  free_.insert(free_.begin(), fresh.begin(), fresh.end());
+  trimmed_ += buffers;
+  allocated_ += buffers;
+  return true;
+}
+
+// Occupancy
+size_t ftp::buffer_pool::leased() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return leased_;
+}
+
+size_t ftp::buffer_pool::high_water() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return high_water_;
+}
+
+size_t ftp::buffer_pool::allocated() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return allocated_;
+}
+
+size_t ftp::buffer_pool::resident() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return allocated_ - trimmed_;
+}
+
+size_t ftp::buffer_pool::max_buffers() const { return max_buffers_; }
+
+size_t ftp::buffer_pool::slabs() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return slabs_.size();
+}
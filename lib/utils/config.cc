@@ -0,0 +1,24 @@
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "utils/config.h"
+
+// Read and parse config.json from the current directory
+Json::Value ftp::read_config() {
+  Json::Value root;
+  Json::CharReaderBuilder builder;
+  std::ifstream config_file("config.json", std::ifstream::binary);
+
+  std::string errors;
+  bool parsing_successful =
+      Json::parseFromStream(builder, config_file, &root, &errors);
+  if (!parsing_successful) {
+    std::cerr << "[Config] " << "Failed to parse config.json: " << errors
+              << std::endl;
+    throw std::runtime_error("Failed to parse config.json");
+  }
+
+  return root;
+}
@@ -0,0 +1,88 @@
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "utils/crc32.h"
+
+namespace {
+
+// Reversed polynomial of CRC-32
+constexpr uint32_t polynomial = 0xEDB88320;
+
+// Tables of the slicing-by-8 algorithm: table[k][b] is the CRC of byte b
+// followed by k zero bytes, so that eight bytes take eight lookups
+struct crc32_tables {
+  uint32_t table[8][256];
+};
+
+const crc32_tables &tables() {
+  static const crc32_tables instance = []() {
+    crc32_tables tables;
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+      uint32_t crc = byte;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc >> 1) ^ (polynomial & (0u - (crc & 1)));
+      }
+      tables.table[0][byte] = crc;
+    }
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+      for (int k = 1; k < 8; ++k) {
+        const uint32_t previous = tables.table[k - 1][byte];
+        tables.table[k][byte] =
+            (previous >> 8) ^ tables.table[0][previous & 0xFF];
+      }
+    }
+    return tables;
+  }();
+  return instance;
+}
+
+} // namespace
+
+// CRC-32 of size bytes, continuing from crc
+uint32_t ftp::crc32(const void *data, size_t size, uint32_t crc) {
+  const auto &table = tables().table;
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  crc = ~crc;
+
+  // Eight bytes at a time, loaded as two little endian words
+  if constexpr (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) {
+    while (size >= 8) {
+      uint32_t low;
+      uint32_t high;
+      memcpy(&low, bytes, sizeof(low));
+      memcpy(&high, bytes + 4, sizeof(high));
+      low ^= crc;
+      crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+            table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+            table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^
+            table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+      bytes += 8;
+      size -= 8;
+    }
+  }
+  // The rest byte by byte
+  while (size-- > 0) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *bytes++) & 0xFF];
+  }
+  return ~crc;
+}
+
+// CRC-32 of the whole file open at fd
+bool ftp::crc32_file(int fd, char *buffer, size_t buffer_size,
+                     uint32_t &crc) {
+  crc = 0;
+  off_t offset = 0;
+  while (true) {
+    const ssize_t n = pread(fd, buffer, buffer_size, offset);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n == 0;
+    }
+    crc = crc32(buffer, size_t(n), crc);
+    offset += n;
+  }
+}
@@ -0,0 +1,146 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/config.h"
+#include "utils/durability.h"
+#include "utils/trace.h"
+
+// Parse "none", "fsync" or "group" (defaults to none)
+ftp::durability_policy
+ftp::parse_durability_policy(const std::string &name) {
+  if (name == "fsync") {
+    return durability_policy::fsync;
+  }
+  if (name == "group") {
+    return durability_policy::group_commit;
+  }
+  return durability_policy::none;
+}
+
+// Constructor
+ftp::durability_manager::durability_manager(
+    durability_policy policy, std::chrono::microseconds group_commit_window) {
+  policy_ = policy;
+  group_commit_window_ = group_commit_window;
+
+  // Only group commit needs the background thread
+  if (policy_ == durability_policy::group_commit) {
+    group_commit_thread_ = std::thread([this]() { run_group_commit(); });
+  }
+}
+
+// Destructor
+ftp::durability_manager::~durability_manager() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  pending_cv_.notify_all();
+  if (group_commit_thread_.joinable()) {
+    group_commit_thread_.join();
+  }
+}
+
+// Server-wide instance, configured by "uploadDurability" in config.json
+ftp::durability_manager &ftp::durability_manager::instance() {
+  static durability_manager manager = []() {
+    const auto config = ftp::read_config()["uploadDurability"];
+    const auto policy =
+        parse_durability_policy(config.get("policy", "none").asString());
+    const auto window = std::chrono::microseconds(
+        config.get("groupCommitWindowMicros", 1000).asInt64());
+
+    std::clog << "[Durability] " << "Upload durability policy: "
+              << config.get("policy", "none").asString() << std::endl;
+    return durability_manager(policy, window);
+  }();
+  return manager;
+}
+
+ftp::durability_policy ftp::durability_manager::policy() const {
+  return policy_;
+}
+
+// Make the data of fd durable, blocks until done
+bool ftp::durability_manager::sync(int fd) {
+  FTP_TRACE_SCOPE("durability sync");
+  if (policy_ == durability_policy::none) {
+    return true;
+  }
+
+  if (policy_ == durability_policy::fsync) {
+    if (fdatasync(fd) == -1) {
+      std::cerr << "[Durability] " << "Error: " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Group commit: queue the request and wait for the next batch
+  request req{fd};
+  std::unique_lock<std::mutex> lock(mutex_);
+  pending_.push_back(&req);
+  pending_cv_.notify_one();
+  done_cv_.wait(lock, [&req]() { return req.done; });
+  return req.successful;
+}
+
+// Group commit thread
+void ftp::durability_manager::run_group_commit() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    pending_cv_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+    if (pending_.empty()) {
+      return; // Stopping and nothing left to sync
+    }
+
+    // Give concurrent uploads a moment to join this batch
+    lock.unlock();
+    std::this_thread::sleep_for(group_commit_window_);
+    lock.lock();
+
+    std::vector<request *> batch;
+    batch.swap(pending_);
+    lock.unlock();
+
+    bool successful = true;
+    if (batch.size() == 1) {
+      successful = fdatasync(batch.front()->fd) == 0;
+    } else {
+      // One syncfs() per file system flushes the whole batch at once
+      std::set<dev_t> synced_devices;
+      for (const auto req : batch) {
+        struct stat file_stat;
+        if (fstat(req->fd, &file_stat) == -1) {
+          successful = false;
+          continue;
+        }
+        if (!synced_devices.insert(file_stat.st_dev).second) {
+          continue;
+        }
+        if (syncfs(req->fd) == -1) {
+          successful = false;
+        }
+      }
+    }
+    if (!successful) {
+      std::cerr << "[Durability] " << "Error: " << strerror(errno)
+                << std::endl;
+    }
+    std::clog << "[Durability] " << "Group commit of " << batch.size()
+              << " file(s)" << std::endl;
+
+    lock.lock();
+    for (const auto req : batch) {
+      req->successful = successful;
+      req->done = true;
+    }
+    done_cv_.notify_all();
+  }
+}
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "utils/event_loop.h"
+
+namespace {
+
+// Events reported by one epoll_wait()
+constexpr int max_events = 256;
+
+} // namespace
+
+// Constructor
+ftp::event_loop::event_loop() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (!is_open()) {
+    std::cerr << "[Loop] " << "Error: " << strerror(errno) << std::endl;
+    return;
+  }
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wake_fd_;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+}
+
+// Destructor
+ftp::event_loop::~event_loop() {
+  // Tasks and handlers may own what unwatches itself when destroyed, so
+  // they go while the loop still works
+  std::vector<task> tasks;
+  std::multimap<clock::time_point, task> timers;
+  std::unordered_map<int, std::shared_ptr<handler>> handlers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks.swap(tasks_);
+    timers.swap(timers_);
+    handlers.swap(handlers_);
+  }
+  tasks.clear();
+  timers.clear();
+  handlers.clear();
+  if (wake_fd_ != -1) {
+    close(wake_fd_);
+  }
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
+  }
+}
+
+// Call h whenever fd is ready for events
+bool ftp::event_loop::watch(int fd, uint32_t events, handler h) {
+  epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const bool watched = handlers_.count(fd) != 0;
+  if (epoll_ctl(epoll_fd_, watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd,
+                &event) == -1) {
+    std::cerr << "[Loop] " << "Cannot watch " << fd << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  handlers_[fd] = std::make_shared<handler>(std::move(h));
+  return true;
+}
+
+// Stop watching fd
+void ftp::event_loop::unwatch(int fd) {
+  std::shared_ptr<handler> h;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = handlers_.find(fd);
+    if (it == handlers_.end()) {
+      return;
+    }
+    h = std::move(it->second);
+    handlers_.erase(it);
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  }
+  // Destroyed out of the lock, it may unwatch more
+}
+
+// Run t on the loop thread
+void ftp::event_loop::post(task t) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(t));
+  }
+  if (!in_loop_thread()) {
+    wake();
+  }
+}
+
+// Run t on the loop thread once delay has passed
+void ftp::event_loop::post_after(clock::duration delay, task t) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    timers_.emplace(clock::now() + delay, std::move(t));
+  }
+  if (!in_loop_thread()) {
+    wake();
+  }
+}
+
+// Dispatch events, tasks and timers until stop()
+void ftp::event_loop::run() {
+  if (!is_open()) {
+    return;
+  }
+  thread_ = std::this_thread::get_id();
+  epoll_event events[max_events];
+  while (!stopped_) {
+    const int n = epoll_wait(epoll_fd_, events, max_events, wait_timeout());
+    if (n == -1 && errno != EINTR) {
+      std::cerr << "[Loop] " << "Error: " << strerror(errno) << std::endl;
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      const int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        uint64_t count;
+        while (read(wake_fd_, &count, sizeof(count)) > 0) {
+        }
+        continue;
+      }
+      std::shared_ptr<handler> h;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto it = handlers_.find(fd);
+        if (it != handlers_.end()) {
+          h = it->second;
+        }
+      }
+      if (h != nullptr) {
+        (*h)(events[i].events);
+      }
+    }
+    run_due();
+  }
+  thread_ = std::thread::id();
+  stopped_ = false;
+}
+
+// Make run() return
+void ftp::event_loop::stop() {
+  stopped_ = true;
+  wake();
+}
+
+// Interrupt epoll_wait()
+void ftp::event_loop::wake() {
+  const uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+    std::cerr << "[Loop] " << "Error: " << strerror(errno) << std::endl;
+  }
+}
+
+// Milliseconds epoll_wait() may sleep until the next task or timer
+int ftp::event_loop::wait_timeout() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!tasks_.empty()) {
+    return 0;
+  }
+  if (timers_.empty()) {
+    return -1;
+  }
+  // Rounded up, so that the timer is due when the loop wakes up
+  const auto left = timers_.begin()->first - clock::now();
+  const auto millis =
+      std::chrono::ceil<std::chrono::milliseconds>(left).count();
+  return int(std::clamp<int64_t>(millis, 0, 60 * 1000));
+}
+
+// Run the posted tasks and the timers due
+void ftp::event_loop::run_due() {
+  std::vector<task> tasks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks.swap(tasks_);
+  }
+  for (auto &t : tasks) {
+    t();
+  }
+
+  const auto now = clock::now();
+  std::vector<task> due;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!timers_.empty() && timers_.begin()->first <= now) {
+      due.push_back(std::move(timers_.begin()->second));
+      timers_.erase(timers_.begin());
+    }
+  }
+  for (auto &t : due) {
+    t();
+  }
+}
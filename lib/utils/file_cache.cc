@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include <linux/errqueue.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "utils/config.h"
+#include "utils/file_cache.h"
+
+namespace {
+
+// Nanoseconds since epoch of a timespec
+int64_t to_ns(const struct timespec &ts) {
+  return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Cache key of a path, so that "a//b" and "a/./b" share an entry
+std::string key(const std::string &path) {
+  return std::filesystem::path(path).lexically_normal().string();
+}
+
+} // namespace
+
+// Constructor
+// Entries weigh the size of their contents
+ftp::file_cache::file_cache(size_t capacity_bytes, size_t max_file_bytes,
+                            size_t shard_count, bool zero_copy,
+                            size_t zero_copy_min_bytes)
+    : max_file_bytes_(std::min(
+          max_file_bytes, capacity_bytes / std::max<size_t>(shard_count, 1))),
+      zero_copy_(zero_copy), zero_copy_min_bytes_(zero_copy_min_bytes),
+      entries_(shard_count, capacity_bytes / std::max<size_t>(shard_count, 1),
+               [](const entry &e) { return e.data->size(); }) {}
+
+// Server-wide instance, configured by "fileCache" in config.json
+ftp::file_cache &ftp::file_cache::instance() {
+  static file_cache cache = []() {
+    const auto config = ftp::read_config()["fileCache"];
+    // Disabled unless configured
+    const size_t capacity_bytes = config.get("capacityBytes", 0).asUInt64();
+    const size_t max_file_bytes =
+        config.get("maxFileBytes", 256 * 1024).asUInt64();
+    const size_t shard_count = config.get("shards", 16).asUInt();
+    const bool zero_copy = config.get("zeroCopy", false).asBool();
+    // Below about 10 KiB, pinning pages costs more than copying them
+    const size_t zero_copy_min_bytes =
+        config.get("zeroCopyMinBytes", 16384).asUInt64();
+
+    std::clog << "[Cache] " << "File cache capacity: " << capacity_bytes
+              << " bytes, max file size: " << max_file_bytes
+              << " bytes, shards: " << shard_count
+              << (zero_copy ? ", zerocopy from " : "");
+    if (zero_copy) {
+      std::clog << zero_copy_min_bytes << " bytes";
+    }
+    std::clog << std::endl;
+    return file_cache(capacity_bytes, max_file_bytes, shard_count, zero_copy,
+                      zero_copy_min_bytes);
+  }();
+  return cache;
+}
+
+// Is the cache enabled (capacity > 0)?
+bool ftp::file_cache::enabled() const { return max_file_bytes_ > 0; }
+
+// Files larger than this are never cached
+size_t ftp::file_cache::max_file_bytes() const { return max_file_bytes_; }
+
+// Look up the contents of a file, nullptr on miss or stale entry
+std::shared_ptr<const std::string>
+ftp::file_cache::lookup(const std::string &file_path,
+                        const struct stat &file_stat) {
+  // An entry of a file changed since it was cached is dropped
+  const auto cached = entries_.find(key(file_path), [&](const entry &e) {
+    return e.device == file_stat.st_dev && e.inode == file_stat.st_ino &&
+           e.size == file_stat.st_size &&
+           e.mtime_ns == to_ns(file_stat.st_mtim) &&
+           e.ctime_ns == to_ns(file_stat.st_ctim);
+  });
+  if (!cached) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  return cached->data;
+}
+
+// Read the whole file from fd and insert it into the cache
+std::shared_ptr<const std::string>
+ftp::file_cache::load(const std::string &file_path, int fd,
+                      const struct stat &file_stat) {
+  if (!S_ISREG(file_stat.st_mode) ||
+      size_t(file_stat.st_size) > max_file_bytes_) {
+    return nullptr;
+  }
+
+  // Read the contents without moving the file offset
+  auto contents = std::make_shared<std::string>(file_stat.st_size, '\0');
+  size_t read_bytes = 0;
+  while (read_bytes < contents->size()) {
+    const ssize_t n = pread(fd, contents->data() + read_bytes,
+                            contents->size() - read_bytes, read_bytes);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // Error or file truncated while reading, do not cache it
+      return nullptr;
+    }
+    read_bytes += n;
+  }
+  std::shared_ptr<const std::string> data = std::move(contents);
+
+  // Replaces an existing entry of the same path
+  entries_.insert(key(file_path), entry{file_stat.st_dev, file_stat.st_ino,
+                                        file_stat.st_size,
+                                        to_ns(file_stat.st_mtim),
+                                        to_ns(file_stat.st_ctim), data});
+  return data;
+}
+
+// Drop the entry of a path
+void ftp::file_cache::invalidate(const std::string &file_path) {
+  entries_.erase(key(file_path));
+}
+
+// Send cached contents to a socket, using MSG_ZEROCOPY if enabled
+size_t
+ftp::file_cache::send(int socket_fd,
+                      const std::shared_ptr<const std::string> &data,
+                      size_t offset, size_t count) {
+  offset = std::min(offset, data->size());
+  const size_t end = offset + std::min(count, data->size() - offset);
+  int flags = MSG_NOSIGNAL;
+  zero_copy_socket *state = nullptr;
+  if (zero_copy_ && end - offset >= zero_copy_min_bytes_) {
+    state = &zero_copy_state(socket_fd);
+    if (state->enabled) {
+      flags |= MSG_ZEROCOPY;
+    }
+  }
+
+  size_t sent_bytes = 0;
+  while (offset + sent_bytes < end) {
+    const ssize_t n = ::send(socket_fd, data->data() + offset + sent_bytes,
+                             end - offset - sent_bytes, flags);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    // Out of optmem for pinned pages: completions free some, fall back to
+    // copying meanwhile
+    if (n < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+      reap(socket_fd, *state);
+      flags &= ~MSG_ZEROCOPY;
+      continue;
+    }
+    if (n < 0) {
+      std::cerr << "[Cache] " << "Error: " << strerror(errno) << std::endl;
+      break;
+    }
+    // The pages stay pinned until the kernel is done with them, each send
+    // gets a completion
+    if (flags & MSG_ZEROCOPY) {
+      state->in_flight.push_back({state->next_id++, false, data});
+    }
+    sent_bytes += n;
+  }
+  return sent_bytes;
+}
+
+// Before a socket that send() used is closed, wait for its completions
+void ftp::file_cache::finish(int socket_fd) {
+  std::unique_lock<std::mutex> lock(zero_copy_mutex_);
+  // Close the parked sockets whose completions all arrived meanwhile
+  for (auto it = parked_sockets_.begin(); it != parked_sockets_.end();) {
+    reap(it->first, it->second);
+    if (it->second.in_flight.empty()) {
+      close(it->first);
+      it = parked_sockets_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  const auto it = zero_copy_sockets_.find(socket_fd);
+  if (it == zero_copy_sockets_.end()) {
+    return;
+  }
+  auto state = std::move(it->second);
+  zero_copy_sockets_.erase(it);
+  lock.unlock();
+
+  // The last completions usually follow the last send closely
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (true) {
+    reap(socket_fd, state);
+    if (state.in_flight.empty()) {
+      return;
+    }
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) {
+      break;
+    }
+    // POLLERR is always reported
+    struct pollfd pfd = {socket_fd, 0, 0};
+    poll(&pfd, 1, int(left.count()));
+  }
+
+  // The peer is slow to read the rest: keep the socket, and the contents,
+  // until the kernel is done with them; closing it must still end the
+  // connection once the data is sent
+  std::clog << "[Cache] " << state.in_flight.size()
+            << " zerocopy sends still in flight, parking the socket"
+            << std::endl;
+  const int parked_fd = fcntl(socket_fd, F_DUPFD_CLOEXEC, 0);
+  if (parked_fd == -1) {
+    // Without a way to hear of the completions, the contents are kept
+    std::cerr << "[Cache] " << "Error: " << strerror(errno) << std::endl;
+  }
+  shutdown(socket_fd, SHUT_WR);
+  lock.lock();
+  parked_sockets_.emplace_back(parked_fd, std::move(state));
+}
+
+// Hit and miss counters
+uint64_t ftp::file_cache::hits() const { return hits_; }
+uint64_t ftp::file_cache::misses() const { return misses_; }
+
+// Bytes currently held by the cache
+size_t ftp::file_cache::size_bytes() const { return entries_.weight(); }
+
+// State of a socket, SO_ZEROCOPY being set on its first send
+ftp::file_cache::zero_copy_socket &
+ftp::file_cache::zero_copy_state(int socket_fd) {
+  std::lock_guard<std::mutex> lock(zero_copy_mutex_);
+  const auto [it, inserted] = zero_copy_sockets_.try_emplace(socket_fd);
+  if (inserted) {
+    const int one = 1;
+    it->second.enabled = setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+                                    sizeof(one)) == 0;
+  }
+  return it->second;
+}
+
+// Drop the sends of a socket whose completions are queued
+void ftp::file_cache::reap(int socket_fd, zero_copy_socket &state) {
+  while (socket_fd != -1 && !state.in_flight.empty()) {
+    char control[128];
+    struct msghdr msg = {};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(socket_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break; // None queued
+    }
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      const auto err =
+          reinterpret_cast<const struct sock_extended_err *>(CMSG_DATA(cmsg));
+      if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      // Completions cover the ids [ee_info, ee_data], which wrap around
+      // after 2^32 sends
+      const uint32_t count = err->ee_data - err->ee_info;
+      for (auto &sent : state.in_flight) {
+        if (sent.id - err->ee_info <= count) {
+          sent.done = true;
+        }
+      }
+    }
+  }
+  while (!state.in_flight.empty() && state.in_flight.front().done) {
+    state.in_flight.pop_front();
+  }
+}
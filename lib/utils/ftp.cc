@@ -1,5 +1,7 @@
 #include <algorithm>
+#include <cctype>
 #include <iostream>
+#include <iterator>
 #include <regex>
 #include <sstream>
 #include <string>
@@ -8,6 +10,18 @@
 
 #include "utils/ftp.h"
 
+// Upper case name of an operation
+const char *ftp::operation_name(operation op) {
+  static const char *const names[] = {
+      "USER", "PASS", "QUIT", "PORT", "PASV", "RETR", "STOR", "LIST",
+      "CWD",  "CDUP", "PWD",  "MKD",  "RMD",  "DELE", "RNFR", "RNTO",
+      "HELP", "NOOP", "MPUT", "MGET", "MLSD", "SIZE", "MDTM", "XCRC",
+      "MIRROR",
+  };
+  static_assert(std::size(names) == operation_count);
+  return op < operation_count ? names[op] : "UNKNOWN";
+}
+
 // Trim the leading and trailing whitespace from a string
 std::string ftp::trim(const std::string &str) {
   auto string_copy = str;
@@ -127,10 +141,90 @@ std::pair<ftp::operation, std::string> ftp::parse_command(std::string command) {
   if (tokens[0] == "rnto" && tokens.size() == 2) {
     return {ftp::RNTO, tokens[1]};
   }
+  // mput [-r] [-j <sessions>] <filename>... (filenames separated by spaces)
+  if (tokens[0] == "mput" && tokens.size() >= 2) {
+    std::string filenames = tokens[1];
+    for (size_t i = 2; i < tokens.size(); ++i) {
+      filenames += " " + tokens[i];
+    }
+    return {ftp::MPUT, filenames};
+  }
+  // mget [-r] [-j <sessions>] <path>... (paths separated by spaces)
+  if (tokens[0] == "mget" && tokens.size() >= 2) {
+    std::string paths = tokens[1];
+    for (size_t i = 2; i < tokens.size(); ++i) {
+      paths += " " + tokens[i];
+    }
+    return {ftp::MGET, paths};
+  }
+  // mlsd [<directory>]
+  if (tokens[0] == "mlsd" && (tokens.size() == 1 || tokens.size() == 2)) {
+    return {ftp::MLSD, tokens.size() == 2 ? tokens[1] : ""};
+  }
+  // size <filename>
+  if (tokens[0] == "size" && tokens.size() == 2) {
+    return {ftp::SIZE, tokens[1]};
+  }
+  // mdtm <filename>
+  if (tokens[0] == "mdtm" && tokens.size() == 2) {
+    return {ftp::MDTM, tokens[1]};
+  }
+  // xcrc <filename>
+  if (tokens[0] == "xcrc" && tokens.size() == 2) {
+    return {ftp::XCRC, tokens[1]};
+  }
+  // mirror [-n] [-j <sessions>] [--delete] [--hash] up|down <local> <remote>
+  if (tokens[0] == "mirror" && tokens.size() >= 2) {
+    std::string arguments = tokens[1];
+    for (size_t i = 2; i < tokens.size(); ++i) {
+      arguments += " " + tokens[i];
+    }
+    return {ftp::MIRROR, arguments};
+  }
   // help
   if ((tokens[0] == "help" || tokens[0] == "?") && tokens.size() == 1) {
     return {ftp::HELP, ""};
   }
   // noop (invalid command)
   return {ftp::NOOP, ""};
-}
\ No newline at end of file
+}
+
+// Does a reply carry an error code, 4xx or 5xx?
+bool ftp::is_error_reply(const std::string &reply) {
+  // A code is 3 digits followed by a space (or '-' for multiline replies)
+  if (reply.size() < 4 || (reply[3] != ' ' && reply[3] != '-') ||
+      !isdigit(reply[1]) || !isdigit(reply[2])) {
+    return false;
+  }
+  return reply[0] == '4' || reply[0] == '5';
+}
+
+// Is a reply to RETR that of a directory, sent as a tar archive?
+bool ftp::is_archive_reply(const std::string &reply) {
+  return reply.size() >= 4 && reply.compare(0, 3, archive_reply_code) == 0 &&
+         reply[3] == ' ';
+}
+
+// Size of the first complete reply at the start of received
+size_t ftp::reply_size(const std::string &received) {
+  size_t line_end = received.find('\n');
+  if (line_end == std::string::npos) {
+    return 0;
+  }
+  if (received.size() < 4 || received[3] != '-' || !isdigit(received[0]) ||
+      !isdigit(received[1]) || !isdigit(received[2])) {
+    return line_end + 1;
+  }
+  // The last line repeats the code, followed by a space
+  const std::string last = received.substr(0, 3) + " ";
+  while (true) {
+    const size_t line_start = line_end + 1;
+    line_end = received.find('\n', line_start);
+    if (line_end == std::string::npos) {
+      return 0;
+    }
+    if (received.compare(line_start, last.size(), last) == 0) {
+      return line_end + 1;
+    }
+  }
+}
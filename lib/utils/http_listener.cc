@@ -0,0 +1,117 @@
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "utils/http_listener.h"
+
+namespace {
+
+// Requests are a line and a few headers, anything larger is refused
+constexpr size_t max_request_size = 8 * 1024;
+
+// A complete response, the connection is closed after it
+std::string http_response(const std::string &status,
+                          const std::string &content_type,
+                          const std::string &body) {
+  return "HTTP/1.0 " + status + "\r\n" + "Content-Type: " + content_type +
+         "\r\n" + "Content-Length: " + std::to_string(body.size()) + "\r\n" +
+         "Connection: close\r\n\r\n" + body;
+}
+
+} // namespace
+
+// Constructor
+ftp::http_listener::http_listener(std::string address, uint16_t port)
+    : address_(std::move(address)), port_(port) {}
+
+// Destructor
+ftp::http_listener::~http_listener() { stop(); }
+
+// Serve GET requests for path
+void ftp::http_listener::route(const std::string &path,
+                               const std::string &content_type,
+                               handler body) {
+  routes_[path] = route_entry{content_type, std::move(body)};
+}
+
+// Start listening
+bool ftp::http_listener::start() {
+  if (!acceptor_.open(sockpp::inet_address(address_, port_))) {
+    std::cerr << "[HTTP] " << "Cannot listen on " << address_ << ":" << port_
+              << ": " << acceptor_.last_error_str() << std::endl;
+    return false;
+  }
+  running_ = true;
+  thread_ = std::thread([this]() { serve(); });
+  std::clog << "[HTTP] " << "Listening on " << address_ << ":" << port_
+            << std::endl;
+  return true;
+}
+
+// Stop listening and wait for the thread
+void ftp::http_listener::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  // Wakes up accept()
+  acceptor_.shutdown();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  acceptor_.close();
+}
+
+// Accept connections until stopped
+void ftp::http_listener::serve() {
+  while (running_) {
+    sockpp::tcp_socket sock = acceptor_.accept();
+    if (!sock) {
+      if (running_) {
+        std::cerr << "[HTTP] " << "Error: " << acceptor_.last_error_str()
+                  << std::endl;
+      }
+      continue;
+    }
+    answer(sock);
+  }
+}
+
+// Read one request and answer it
+void ftp::http_listener::answer(sockpp::tcp_socket &sock) {
+  // A slow or silent client must not hold the listener for long
+  sock.read_timeout(std::chrono::seconds(2));
+
+  std::string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < max_request_size) {
+    const ssize_t n = sock.read(buf, sizeof(buf));
+    if (n <= 0) {
+      return;
+    }
+    request.append(buf, size_t(n));
+  }
+
+  // Request line: GET <path> HTTP/1.x
+  const auto line = request.substr(0, request.find("\r\n"));
+  const auto path_start = line.find(' ');
+  const auto path_end = line.find(' ', path_start + 1);
+  if (path_start == std::string::npos || path_end == std::string::npos) {
+    sock.write(http_response("400 Bad Request", "text/plain", ""));
+    return;
+  }
+  if (line.substr(0, path_start) != "GET") {
+    sock.write(http_response("405 Method Not Allowed", "text/plain", ""));
+    return;
+  }
+  auto path = line.substr(path_start + 1, path_end - path_start - 1);
+  path = path.substr(0, path.find('?'));
+
+  const auto it = routes_.find(path);
+  if (it == routes_.end()) {
+    sock.write(http_response("404 Not Found", "text/plain", "Not found\n"));
+    return;
+  }
+  sock.write(http_response("200 OK", it->second.content_type,
+                           it->second.body()));
+}
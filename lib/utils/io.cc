@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <utility>
+
+#include <sys/socket.h>
+
 #include "utils/io.h"
 
 // Send (using connector)
@@ -52,19 +57,18 @@ void ftp::send_message(sockpp::tcp_socket *socket, const std::string &data) {
             << " bytes]" << std::endl;
 }
 
-// Receive (using connector)
-std::string ftp::receive_message(sockpp::tcp_connector *connector,
+// Receive (using socket)
+std::string ftp::receive_message(sockpp::tcp_socket *socket,
                                  std::shared_ptr<char> buffer,
                                  size_t buffer_size) {
-  if (!connector) {
-    std::cerr << "[IO] " << "Error: connector is null" << std::endl;
+  if (!socket) {
+    std::cerr << "[IO] " << "Error: socket is null" << std::endl;
     return "";
   }
 
-  ssize_t response_size = connector->read(buffer.get(), buffer_size);
+  ssize_t response_size = socket->read(buffer.get(), buffer_size);
   if (response_size <= 0) {
-    std::cerr << "[IO] " << "Error: " << connector->last_error_str()
-              << std::endl;
+    std::cerr << "[IO] " << "Error: " << socket->last_error_str() << std::endl;
     return "";
   }
 
@@ -79,25 +83,65 @@ std::string ftp::receive_message(sockpp::tcp_connector *connector,
   std::clog << "[IO] " << "Received data: " << first_line
             << (line_end == response.size() - 1 ? "" : "...") << "["
             << response.size() << " bytes]" << std::endl;
+
   return response;
 }
 
-// Receive (using socket)
+// Message buffer
+ftp::message_buffer::message_buffer(size_t initial_size, size_t max_size) {
+  data_.resize(initial_size);
+  initial_size_ = initial_size;
+  max_size_ = std::max(initial_size, max_size);
+}
+
+// Double the size (up to the maximum), returns false if already at it
+bool ftp::message_buffer::grow() {
+  if (data_.size() >= max_size_) {
+    return false;
+  }
+  data_.resize(std::min(data_.size() * 2, max_size_));
+  return true;
+}
+
+// Back to the initial size, releasing the memory grown
+void ftp::message_buffer::shrink() {
+  if (data_.size() > initial_size_) {
+    std::vector<char>(initial_size_).swap(data_);
+  }
+}
+
+// Receive (using socket and a growable buffer)
 std::string ftp::receive_message(sockpp::tcp_socket *socket,
-                                 std::shared_ptr<char> buffer,
-                                 size_t buffer_size) {
+                                 message_buffer &buffer) {
   if (!socket) {
     std::cerr << "[IO] " << "Error: socket is null" << std::endl;
     return "";
   }
 
-  ssize_t response_size = socket->read(buffer.get(), buffer_size);
+  ssize_t response_size = socket->read(buffer.data(), buffer.size());
   if (response_size <= 0) {
     std::cerr << "[IO] " << "Error: " << socket->last_error_str() << std::endl;
     return "";
   }
 
-  std::string response(buffer.get(), response_size);
+  // A full buffer means that more of the message may be waiting: grow the
+  // buffer and take what is already there, without blocking
+  while (size_t(response_size) == buffer.size() && buffer.grow()) {
+    const ssize_t n =
+        recv(socket->handle(), buffer.data() + response_size,
+             buffer.size() - response_size, MSG_DONTWAIT);
+    if (n <= 0) {
+      break;
+    }
+    response_size += n;
+  }
+
+  std::string response(buffer.data(), response_size);
+  // Messages fit the initial size again: a long one was a one-off, do not
+  // keep its memory for the life of the session
+  if (size_t(response_size) < buffer.initial_size()) {
+    buffer.shrink();
+  }
   // Only log the first line of the response
   const size_t line_end = response.find('\n');
   std::string first_line = response.substr(0, line_end);
@@ -110,4 +154,64 @@ std::string ftp::receive_message(sockpp::tcp_socket *socket,
             << response.size() << " bytes]" << std::endl;
 
   return response;
-}
\ No newline at end of file
+}
+
+// Next message on the control connection
+std::string ftp::message_framer::next(sockpp::tcp_socket *socket,
+                                      message_buffer &buffer) {
+  overflowed_ = false;
+  while (true) {
+    // A complete line is waiting
+    const size_t line_end = pending_.find('\n');
+    if (line_end != std::string::npos) {
+      std::string message = pending_.substr(0, line_end);
+      pending_.erase(0, line_end + 1);
+      // Do not keep the memory of a long batch once it was taken
+      if (pending_.empty() && pending_.capacity() > 4096) {
+        std::string().swap(pending_);
+      }
+      if (!message.empty() && message.back() == '\r') {
+        message.pop_back();
+      }
+      if (message.empty()) {
+        continue;
+      }
+      return message;
+    }
+
+    std::string received = receive_message(socket, buffer);
+    if (received.empty()) {
+      return "";
+    }
+    // The end of a line too long, the messages after it are kept
+    if (skipping_) {
+      const size_t end = received.find('\n');
+      if (end == std::string::npos) {
+        continue;
+      }
+      received.erase(0, end + 1);
+      skipping_ = false;
+    }
+    // One whole line, as sent without pipelining: no copy
+    if (pending_.empty() && !received.empty() &&
+        received.find('\n') == received.size() - 1) {
+      received.pop_back();
+      if (!received.empty() && received.back() == '\r') {
+        received.pop_back();
+      }
+      if (received.empty()) {
+        continue;
+      }
+      return received;
+    }
+    // The rest of a line, which is given up on past the limit
+    pending_ += received;
+    if (pending_.size() > max_line_size &&
+        pending_.find('\n') == std::string::npos) {
+      std::string().swap(pending_);
+      skipping_ = true;
+      overflowed_ = true;
+      return "";
+    }
+  }
+}
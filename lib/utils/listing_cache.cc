@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "utils/config.h"
+#include "utils/listing_cache.h"
+
+namespace {
+
+// Events that change the names or types shown by LIST
+constexpr uint32_t watch_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                IN_ONLYDIR;
+
+// Without inotify, a directory changed within this window may change again
+// without its mtime moving (coarse timestamps), so it is not cached yet
+constexpr int64_t racy_window_ns = 1000000000;
+
+// Key of a directory: normalized, without trailing separator
+std::string cache_key(const std::filesystem::path &directory) {
+  std::string key = directory.lexically_normal().string();
+  while (key.size() > 1 && key.back() == '/') {
+    key.pop_back();
+  }
+  return key;
+}
+
+// mtime of a directory in nanoseconds, -1 if it cannot be read
+int64_t mtime_ns(ftp::vfs &storage, const std::string &directory) {
+  const auto status = storage.stat(directory);
+  return status.is_directory ? status.mtime_ns : -1;
+}
+
+} // namespace
+
+// Render the LIST response of a directory of the storage
+std::string ftp::render_listing(vfs &storage, const std::string &directory) {
+  // List files in the directory
+  std::string response = "200 Directory listing:\r\n\n";
+  // Array of file name for further alphabetical sorting
+  std::vector<std::string> file_list;
+  // Only the types are needed, symbolic links are followed
+  const bool listed =
+      storage.list(directory, true, [&](const ftp::vfs_entry &entry) {
+        // Check if the entry is a file or directory
+        if (entry.status.is_regular) {
+          // Add the file name to the list
+          file_list.push_back(entry.name);
+        } else if (entry.status.is_directory) {
+          // Add the directory name to the list
+          file_list.push_back(entry.name + "/");
+        }
+        return true;
+      });
+  if (!listed) {
+    std::cerr << "[Listing] " << "Error: " << strerror(errno) << std::endl;
+    return response;
+  }
+  // Sort the file list (With alphabetical order, and directories first)
+  auto str_comp = [](const std::string &a, const std::string &b) {
+    // Check for empty strings
+    if (a.empty() && b.empty()) {
+      return false;
+    }
+    if (a.empty()) {
+      return false;
+    }
+    if (b.empty()) {
+      return true;
+    }
+
+    // Sort directories first, then files
+    bool a_is_dir = a.back() == '/';
+    bool b_is_dir = b.back() == '/';
+    if (a_is_dir != b_is_dir) {
+      return a_is_dir;
+    }
+
+    // Finally sort alphabetically
+    return a < b;
+  };
+  std::sort(file_list.begin(), file_list.end(), str_comp);
+  // Add the file names to the response string, note that directories are in
+  // blue color
+  for (const auto &file : file_list) {
+    if (file.back() == '/') {
+      // Remove the trailing slash
+      std::string file_no_slash = file.substr(0, file.size() - 1);
+      response += "    \e[1m\033[34m" + file_no_slash + "\033[0m\e[m\r\n";
+      continue;
+    }
+    response += "    " + file + "\r\n";
+  }
+  return response;
+}
+
+// Constructor
+ftp::listing_cache::listing_cache(bool enabled, size_t max_directories,
+                                  bool use_inotify) {
+  enabled_ = enabled;
+  max_directories_ = std::max<size_t>(max_directories, 1);
+  if (!enabled_ || !use_inotify) {
+    return;
+  }
+
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  wakeup_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (inotify_fd_ == -1 || wakeup_fd_ == -1) {
+    std::cerr << "[Listing] " << "inotify unavailable (" << strerror(errno)
+              << "), validating by mtime" << std::endl;
+    if (inotify_fd_ != -1) {
+      close(inotify_fd_);
+      inotify_fd_ = -1;
+    }
+    return;
+  }
+  watcher_ = std::thread([this]() { run_watcher(); });
+}
+
+// Destructor
+ftp::listing_cache::~listing_cache() {
+  if (watcher_.joinable()) {
+    const uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) == sizeof(one)) {
+      watcher_.join();
+    } else {
+      watcher_.detach();
+    }
+  }
+  if (inotify_fd_ != -1) {
+    close(inotify_fd_);
+  }
+  if (wakeup_fd_ != -1) {
+    close(wakeup_fd_);
+  }
+}
+
+// Server-wide instance, configured by "listingCache" in config.json
+ftp::listing_cache &ftp::listing_cache::instance() {
+  static listing_cache cache = []() {
+    const auto config = ftp::read_config()["listingCache"];
+    const bool enabled = config.get("enabled", true).asBool();
+    const size_t max_directories =
+        config.get("maxDirectories", 1024).asUInt64();
+    const bool use_inotify = config.get("inotify", true).asBool();
+
+    std::clog << "[Listing] " << "Listing cache "
+              << (enabled ? "enabled" : "disabled") << ", up to "
+              << max_directories << " directories"
+              << (use_inotify ? ", inotify" : ", mtime checks") << std::endl;
+    return listing_cache(enabled, max_directories, use_inotify);
+  }();
+  return cache;
+}
+
+// Rendered listing of a directory, from the cache or rebuilt
+std::shared_ptr<const std::string>
+ftp::listing_cache::listing(vfs &storage, const std::string &directory) {
+  if (!enabled_) {
+    return std::make_shared<const std::string>(
+        render_listing(storage, directory));
+  }
+
+  const std::string key = cache_key(storage.location(directory));
+  uint64_t generation = 0;
+  bool watched = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto [it, inserted] = entries_.try_emplace(key);
+    auto &e = it->second;
+    if (inserted) {
+      lru_.push_front(key);
+      e.lru = lru_.begin();
+    } else {
+      lru_.splice(lru_.begin(), lru_, e.lru);
+    }
+    if (e.listing != nullptr &&
+        (e.watch != -1 || mtime_ns(storage, directory) == e.mtime_ns)) {
+      hits_++;
+      return e.listing;
+    }
+    e.listing.reset();
+
+    // Watch before rendering, so that no change after this point is missed
+    // Only directories on a local disk (absolute paths) can be watched
+    if (e.watch == -1 && inotify_fd_ != -1 && key.front() == '/') {
+      e.watch = add_watch(key);
+    }
+    watched = e.watch != -1;
+    generation = e.generation;
+    evict();
+  }
+  misses_++;
+
+  // Rebuild outside of the lock, other directories stay available
+  const int64_t mtime = watched ? 0 : mtime_ns(storage, directory);
+  const auto start = std::chrono::steady_clock::now();
+  auto listing = std::make_shared<const std::string>(
+      render_listing(storage, directory));
+  const uint64_t micros =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  rebuild_micros_total_ += micros;
+  uint64_t max = rebuild_micros_max_;
+  while (micros > max &&
+         !rebuild_micros_max_.compare_exchange_weak(max, micros)) {
+  }
+  std::clog << "[Listing] " << "Rebuilt listing of " << key << " in "
+            << micros << " us" << std::endl;
+
+  // Store it unless the directory changed in the meantime
+  const int64_t now_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  if (!watched && (mtime == -1 || now_ns - mtime < racy_window_ns)) {
+    return listing;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = entries_.find(key);
+  if (it != entries_.end() && it->second.generation == generation) {
+    it->second.listing = listing;
+    it->second.mtime_ns = mtime;
+  }
+  return listing;
+}
+
+// Drop the entry of a directory whose contents the server just changed
+void ftp::listing_cache::invalidate(const std::filesystem::path &directory) {
+  if (!enabled_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = entries_.find(cache_key(directory));
+  if (it != entries_.end()) {
+    it->second.listing.reset();
+    it->second.generation++;
+  }
+}
+
+// Statistics
+uint64_t ftp::listing_cache::hits() const { return hits_; }
+uint64_t ftp::listing_cache::misses() const { return misses_; }
+uint64_t ftp::listing_cache::rebuild_micros_total() const {
+  return rebuild_micros_total_;
+}
+uint64_t ftp::listing_cache::rebuild_micros_max() const {
+  return rebuild_micros_max_;
+}
+size_t ftp::listing_cache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+// Watch a directory, returns -1 on failure
+int ftp::listing_cache::add_watch(const std::string &directory) {
+  const int watch = inotify_add_watch(inotify_fd_, directory.c_str(),
+                                      watch_mask);
+  if (watch == -1) {
+    // Typically out of watches (fs.inotify.max_user_watches)
+    std::clog << "[Listing] " << "Cannot watch " << directory << " ("
+              << strerror(errno) << "), validating by mtime" << std::endl;
+    return -1;
+  }
+  // The same directory under another name already has this watch; its
+  // events would only reach the other entry
+  const auto [it, inserted] = watches_.emplace(watch, directory);
+  if (!inserted && it->second != directory) {
+    return -1;
+  }
+  return watch;
+}
+
+// Drop least recently used entries while the cache is full, mutex_ held
+void ftp::listing_cache::evict() {
+  while (entries_.size() > max_directories_) {
+    const auto oldest = entries_.find(lru_.back());
+    if (oldest->second.watch != -1) {
+      inotify_rm_watch(inotify_fd_, oldest->second.watch);
+      watches_.erase(oldest->second.watch);
+    }
+    entries_.erase(oldest);
+    lru_.pop_back();
+  }
+}
+
+// inotify thread
+void ftp::listing_cache::run_watcher() {
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  while (true) {
+    struct pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {wakeup_fd_, POLLIN, 0}};
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "[Listing] " << "Error: " << strerror(errno) << std::endl;
+      return;
+    }
+    if (fds[1].revents != 0) {
+      return; // Stopping
+    }
+
+    const ssize_t n = read(inotify_fd_, buffer, sizeof(buffer));
+    if (n <= 0) {
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (ssize_t pos = 0; pos < n;) {
+      const auto event = reinterpret_cast<const struct inotify_event *>(
+          buffer + pos);
+      pos += sizeof(struct inotify_event) + event->len;
+
+      // Events were lost, nothing can be trusted
+      if (event->mask & IN_Q_OVERFLOW) {
+        for (auto &[key, e] : entries_) {
+          e.listing.reset();
+          e.generation++;
+        }
+        continue;
+      }
+
+      const auto watch = watches_.find(event->wd);
+      if (watch == watches_.end()) {
+        continue;
+      }
+      const auto it = entries_.find(watch->second);
+      if (event->mask & IN_IGNORED) {
+        // The watch is gone (directory deleted or unmounted)
+        watches_.erase(watch);
+        if (it != entries_.end()) {
+          it->second.watch = -1;
+        }
+      }
+      if (it != entries_.end()) {
+        it->second.listing.reset();
+        it->second.generation++;
+      }
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#include <atomic>
+#include <iostream>
+#include <streambuf>
+
+#include "utils/log_level.h"
+
+namespace {
+
+std::atomic<ftp::log_level> level = ftp::log_level::info;
+
+// Passes writes to the buffer it replaced, or drops them below the info
+// level; it holds no state, so threads may share it like the one it wraps
+class filtering_buffer : public std::streambuf {
+public:
+  explicit filtering_buffer(std::streambuf *target) : target_(target) {}
+
+protected:
+  int overflow(int c) override {
+    if (!shown() || traits_type::eq_int_type(c, traits_type::eof())) {
+      return traits_type::not_eof(c);
+    }
+    return target_->sputc(traits_type::to_char_type(c));
+  }
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    return shown() ? target_->sputn(s, n) : n;
+  }
+  int sync() override { return target_ == nullptr ? 0 : target_->pubsync(); }
+
+private:
+  // A stream without a buffer (silenced) stays silent
+  bool shown() const {
+    return target_ != nullptr &&
+           level.load(std::memory_order_relaxed) >= ftp::log_level::info;
+  }
+
+  std::streambuf *target_;
+};
+
+} // namespace
+
+// Parse "error" or "info"
+bool ftp::parse_log_level(const std::string &name, log_level &parsed) {
+  for (const auto l : {log_level::error, log_level::info}) {
+    if (name == log_level_name(l)) {
+      parsed = l;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *ftp::log_level_name(log_level l) {
+  return l == log_level::error ? "error" : "info";
+}
+
+// Put a filter in front of std::clog
+void ftp::install_log_filter() {
+  // Never destroyed: threads may still log while the program exits
+  static auto *const filter = new filtering_buffer(std::clog.rdbuf());
+  if (std::clog.rdbuf() != filter) {
+    std::clog.rdbuf(filter);
+  }
+}
+
+void ftp::set_log_level(log_level l) {
+  level.store(l, std::memory_order_relaxed);
+}
+
+ftp::log_level ftp::current_log_level() {
+  return level.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+#include "utils/buffer_pool.h"
+#include "utils/config.h"
+#include "utils/file_cache.h"
+#include "utils/listing_cache.h"
+#include "utils/metrics.h"
+#include "utils/stat_cache.h"
+
+namespace {
+
+// Bounds of the exported buckets: powers of two from about 1 us to about
+// 68 s, every one of them is the end of a histogram bucket
+constexpr unsigned first_exported_bit = 10;
+constexpr unsigned last_exported_bit = 36;
+
+// Nanoseconds as seconds, the unit of Prometheus
+std::string seconds(uint64_t nanoseconds) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.9g", double(nanoseconds) / 1e9);
+  return text;
+}
+
+// Comment lines describing a metric
+void describe(std::string &out, const std::string &name,
+              const std::string &type, const std::string &help) {
+  out += "# HELP " + name + " " + help + "\n";
+  out += "# TYPE " + name + " " + type + "\n";
+}
+
+// A single sample
+void sample(std::string &out, const std::string &name,
+            const std::string &labels, uint64_t value) {
+  out += name;
+  if (!labels.empty()) {
+    out += "{" + labels + "}";
+  }
+  out += " " + std::to_string(value) + "\n";
+}
+
+// Cumulative buckets, sum and count of a histogram
+void histogram(std::string &out, const std::string &name,
+               const std::string &labels,
+               const ftp::histogram_snapshot &snapshot) {
+  const std::string separator = labels.empty() ? "" : ",";
+  // Buckets are read while threads record: the total is taken from them
+  // rather than from the count, so that the buckets stay cumulative
+  const uint64_t total =
+      snapshot.count_below(std::numeric_limits<uint64_t>::max());
+  for (unsigned bit = first_exported_bit; bit <= last_exported_bit; ++bit) {
+    const uint64_t bound = uint64_t(1) << bit;
+    out += name + "_bucket{" + labels + separator + "le=\"" + seconds(bound) +
+           "\"} " + std::to_string(snapshot.count_below(bound)) + "\n";
+  }
+  out += name + "_bucket{" + labels + separator + "le=\"+Inf\"} " +
+         std::to_string(total) + "\n";
+  const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+  out += name + "_sum" + braces + " " + seconds(snapshot.sum) + "\n";
+  out += name + "_count" + braces + " " + std::to_string(total) + "\n";
+}
+
+} // namespace
+
+// Smallest value above a bucket
+uint64_t ftp::latency_histogram::bucket_end(size_t bucket) {
+  if (bucket + 1 >= bucket_count) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  if (bucket < sub_buckets) {
+    return bucket + 1;
+  }
+  const unsigned shift = unsigned(bucket / sub_buckets) - 1;
+  return (uint64_t(sub_buckets + bucket % sub_buckets) + 1) << shift;
+}
+
+// Add the counts of a histogram
+void ftp::histogram_snapshot::add(const latency_histogram &histogram) {
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+  }
+  count += histogram.count.load(std::memory_order_relaxed);
+  sum += histogram.sum.load(std::memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the q-th quantile
+uint64_t ftp::histogram_snapshot::quantile(double q) const {
+  // The buckets are read one by one while threads record, count may be
+  // slightly off from their total
+  uint64_t total = 0;
+  for (const auto value : buckets) {
+    total += value;
+  }
+  if (total == 0) {
+    return 0;
+  }
+  const auto rank = std::max<uint64_t>(uint64_t(std::ceil(q * total)), 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return latency_histogram::bucket_end(i);
+    }
+  }
+  return latency_histogram::bucket_end(buckets.size() - 1);
+}
+
+// Number of values below a bound
+uint64_t ftp::histogram_snapshot::count_below(uint64_t nanoseconds) const {
+  uint64_t result = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    if (latency_histogram::bucket_end(i) > nanoseconds) {
+      break;
+    }
+    result += buckets[i];
+  }
+  return result;
+}
+
+// Server-wide settings, configured by "metrics" in config.json
+const ftp::metrics_settings &ftp::metrics_settings::instance() {
+  static const metrics_settings settings = []() {
+    const auto config = ftp::read_config()["metrics"];
+    metrics_settings s;
+    s.enabled = config.get("enabled", s.enabled).asBool();
+    s.address = config.get("address", s.address).asString();
+    s.port = uint16_t(config.get("port", s.port).asUInt());
+    return s;
+  }();
+  return settings;
+}
+
+// Server-wide instance
+ftp::metrics &ftp::metrics::instance() {
+  static metrics instance;
+  return instance;
+}
+
+// Block of the calling thread, attached on first use
+ftp::metrics::thread_block &ftp::metrics::local() {
+  thread_local thread_block *block = nullptr;
+  if (block == nullptr) [[unlikely]] {
+    block = instance().attach();
+    // Hand the block back when the thread exits
+    thread_local const std::unique_ptr<thread_block, void (*)(thread_block *)>
+        release(block, &metrics::detach);
+  }
+  return *block;
+}
+
+// Find a block left by an exited thread, or allocate one
+ftp::metrics::thread_block *ftp::metrics::attach() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &block : blocks_) {
+    if (!block->in_use.load(std::memory_order_acquire)) {
+      block->in_use.store(true, std::memory_order_relaxed);
+      return block.get();
+    }
+  }
+  blocks_.push_back(std::make_unique<thread_block>());
+  blocks_.back()->in_use.store(true, std::memory_order_relaxed);
+  return blocks_.back().get();
+}
+
+// Hand a block back, its counts stay in the totals
+void ftp::metrics::detach(thread_block *block) {
+  block->in_use.store(false, std::memory_order_release);
+}
+
+// Hot path, recorded by the calling thread
+void ftp::metrics::record_command(operation op, uint64_t nanoseconds) {
+  if (op < operation_count) {
+    local().commands[op].record(nanoseconds);
+  }
+}
+
+void ftp::metrics::record_data_connection(uint64_t nanoseconds) {
+  local().data_connection.record(nanoseconds);
+}
+
+void ftp::metrics::add_bytes(transfer_direction direction, uint64_t bytes) {
+  auto &cell = local().bytes[size_t(direction)];
+  cell.store(cell.load(std::memory_order_relaxed) + bytes,
+             std::memory_order_relaxed);
+}
+
+// A session started or ended
+void ftp::metrics::session_started() {
+  active_sessions_++;
+  total_sessions_++;
+}
+
+void ftp::metrics::session_ended() { active_sessions_--; }
+
+// Totals over all threads
+ftp::histogram_snapshot ftp::metrics::command_latency(operation op) const {
+  histogram_snapshot snapshot;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &block : blocks_) {
+    snapshot.add(block->commands[op]);
+  }
+  return snapshot;
+}
+
+ftp::histogram_snapshot ftp::metrics::data_connection_latency() const {
+  histogram_snapshot snapshot;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &block : blocks_) {
+    snapshot.add(block->data_connection);
+  }
+  return snapshot;
+}
+
+uint64_t ftp::metrics::bytes(transfer_direction direction) const {
+  uint64_t total = 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &block : blocks_) {
+    total += block->bytes[size_t(direction)].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+uint64_t ftp::metrics::active_sessions() const { return active_sessions_; }
+uint64_t ftp::metrics::total_sessions() const { return total_sessions_; }
+
+// All metrics in the Prometheus text exposition format
+std::string ftp::metrics::render_prometheus() const {
+  std::string out;
+
+  describe(out, "ftp_command_duration_seconds", "histogram",
+           "Time to handle a command, data transfer included");
+  for (size_t op = 0; op < operation_count; ++op) {
+    const auto snapshot = command_latency(operation(op));
+    // Commands never received are left out
+    if (snapshot.count == 0) {
+      continue;
+    }
+    histogram(out, "ftp_command_duration_seconds",
+              std::string("command=\"") + operation_name(operation(op)) + "\"",
+              snapshot);
+  }
+
+  describe(out, "ftp_data_connection_setup_seconds", "histogram",
+           "Time to establish a data connection");
+  histogram(out, "ftp_data_connection_setup_seconds", "",
+            data_connection_latency());
+
+  describe(out, "ftp_transferred_bytes_total", "counter",
+           "Bytes of file data sent and received");
+  sample(out, "ftp_transferred_bytes_total", "direction=\"download\"",
+         bytes(transfer_direction::download));
+  sample(out, "ftp_transferred_bytes_total", "direction=\"upload\"",
+         bytes(transfer_direction::upload));
+
+  describe(out, "ftp_sessions_active", "gauge", "Sessions in progress");
+  sample(out, "ftp_sessions_active", "", active_sessions());
+  describe(out, "ftp_sessions_total", "counter", "Sessions accepted");
+  sample(out, "ftp_sessions_total", "", total_sessions());
+
+  // Server-wide caches and the buffer pool keep counters of their own
+  const auto &files = ftp::file_cache::instance();
+  const auto &listings = ftp::listing_cache::instance();
+  const auto &stats = ftp::stat_cache::instance();
+  describe(out, "ftp_cache_hits_total", "counter", "Cache hits");
+  sample(out, "ftp_cache_hits_total", "cache=\"file\"", files.hits());
+  sample(out, "ftp_cache_hits_total", "cache=\"listing\"", listings.hits());
+  sample(out, "ftp_cache_hits_total", "cache=\"stat\"", stats.hits());
+  describe(out, "ftp_cache_misses_total", "counter", "Cache misses");
+  sample(out, "ftp_cache_misses_total", "cache=\"file\"", files.misses());
+  sample(out, "ftp_cache_misses_total", "cache=\"listing\"",
+         listings.misses());
+  sample(out, "ftp_cache_misses_total", "cache=\"stat\"", stats.misses());
+  describe(out, "ftp_file_cache_bytes", "gauge",
+           "Bytes held by the file cache");
+  sample(out, "ftp_file_cache_bytes", "", files.size_bytes());
+
+  const auto &pool = ftp::buffer_pool::instance();
+  describe(out, "ftp_buffer_pool_leased", "gauge", "Buffers leased");
+  sample(out, "ftp_buffer_pool_leased", "", pool.leased());
+  describe(out, "ftp_buffer_pool_allocated", "gauge",
+           "Buffers backed by memory");
+  sample(out, "ftp_buffer_pool_allocated", "", pool.allocated());
+  describe(out, "ftp_buffer_pool_resident", "gauge",
+           "Buffers whose pages are in use");
+  sample(out, "ftp_buffer_pool_resident", "", pool.resident());
+  return out;
+}
@@ -0,0 +1,65 @@
+#include <charconv>
+
+#include "utils/mlsd.h"
+#include "utils/stat_cache.h"
+
+// Append the line of an entry to a machine readable listing
+void ftp::append_mlsd_line(const vfs_entry &entry, std::string &out) {
+  out += entry.status.is_directory ? "type=dir;" : "type=file;";
+  if (!entry.status.is_directory) {
+    out += "size=" + std::to_string(entry.status.size) + ";";
+  }
+  // Directories of object stores have no modification time
+  if (entry.status.mtime_ns != -1) {
+    out += "modify=" + ftp::format_timestamp(entry.status.mtime) + ";";
+  }
+  out += " ";
+  out += entry.name;
+  out += "\r\n";
+}
+
+// Append the entries of a listing received by a client to entries
+void ftp::parse_listing(const std::string &listing,
+                        std::vector<remote_entry> &entries) {
+  size_t start = 0;
+  while (start < listing.size()) {
+    size_t end = listing.find('\n', start);
+    if (end == std::string::npos) {
+      end = listing.size();
+    }
+    std::string line = listing.substr(start, end - start);
+    start = end + 1;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    // Facts hold no spaces, the name may
+    const auto space = line.find(' ');
+    if (space == std::string::npos) {
+      continue;
+    }
+    remote_entry entry;
+    entry.name = line.substr(space + 1);
+    size_t fact = 0;
+    while (fact < space) {
+      size_t fact_end = line.find(';', fact);
+      if (fact_end == std::string::npos || fact_end > space) {
+        fact_end = space;
+      }
+      const auto equals = line.find('=', fact);
+      if (equals < fact_end) {
+        const auto key = line.substr(fact, equals - fact);
+        const auto value = line.substr(equals + 1, fact_end - equals - 1);
+        if (key == "type") {
+          entry.is_directory = value == "dir";
+        } else if (key == "size") {
+          std::from_chars(value.data(), value.data() + value.size(),
+                          entry.size);
+        } else if (key == "modify") {
+          entry.modify = value;
+        }
+      }
+      fact = fact_end + 1;
+    }
+    entries.push_back(std::move(entry));
+  }
+}
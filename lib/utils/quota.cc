@@ -0,0 +1,606 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <json/json.h>
+#include <unistd.h>
+
+#include "utils/config.h"
+#include "utils/quota.h"
+
+// The journal holds one record per line, fields separated by tabs:
+//   F <user> <bytes> <path>   the user stored a file
+//   D <user> <path>           the user made a directory
+//   X <path>                  the path was removed
+//   R <from> <to>             the path was renamed, with what is below it
+// Users and paths escape '%', tabs and line ends as %XX
+
+namespace {
+
+// Escape a field of a record
+std::string escape(const std::string &field) {
+  std::string escaped;
+  escaped.reserve(field.size());
+  for (const char c : field) {
+    if (c == '%' || c == '\t' || c == '\n' || c == '\r') {
+      char code[4];
+      snprintf(code, sizeof(code), "%%%02X", static_cast<unsigned char>(c));
+      escaped += code;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+// Undo escape()
+std::string unescape(const std::string &field) {
+  std::string unescaped;
+  unescaped.reserve(field.size());
+  for (size_t i = 0; i < field.size(); ++i) {
+    if (field[i] == '%' && i + 2 < field.size() &&
+        isxdigit(static_cast<unsigned char>(field[i + 1])) &&
+        isxdigit(static_cast<unsigned char>(field[i + 2]))) {
+      unescaped += char(std::stoi(field.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      unescaped += field[i];
+    }
+  }
+  return unescaped;
+}
+
+// Split a record into its fields
+std::vector<std::string> split_record(const std::string &line) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (true) {
+    const size_t end = line.find('\t', start);
+    fields.push_back(line.substr(start, end - start));
+    if (end == std::string::npos) {
+      return fields;
+    }
+    start = end + 1;
+  }
+}
+
+// Write all of data to fd
+bool write_all(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    written += size_t(n);
+  }
+  return true;
+}
+
+// Take from a counter, never below 0
+void take(uint64_t &counter, uint64_t amount) {
+  counter -= std::min(counter, amount);
+}
+
+// Is path below directory?
+bool is_below(const std::string &path, const std::string &directory) {
+  return path.size() > directory.size() &&
+         path.compare(0, directory.size(), directory) == 0 &&
+         path[directory.size()] == '/';
+}
+
+} // namespace
+
+// Constructor, replays the journal when enabled
+ftp::quota_ledger::quota_ledger(const quota_settings &settings)
+    : settings_(settings) {
+  if (!settings_.enabled) {
+    return;
+  }
+  replay();
+  // Start from a journal holding only what is owned now
+  if (!write_snapshot(snapshot())) {
+    std::cerr << "[Quota] " << "Cannot write " << settings_.journal << ": "
+              << strerror(errno) << ", quotas disabled" << std::endl;
+    settings_.enabled = false;
+  }
+}
+
+// Destructor
+ftp::quota_ledger::~quota_ledger() {
+  stopping_ = true;
+  if (scan_thread_.joinable()) {
+    scan_thread_.join();
+  }
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+// Server-wide instance, configured by "quota" in config.json
+ftp::quota_ledger &ftp::quota_ledger::instance() {
+  static quota_ledger ledger = []() {
+    const auto root = ftp::read_config();
+    const auto config = root["quota"];
+    quota_settings s;
+    s.enabled = config.get("enabled", s.enabled).asBool();
+    s.journal = config.get("journal", s.journal).asString();
+    s.defaults.bytes = config.get("defaultBytes", 0).asUInt64();
+    s.defaults.files = config.get("defaultFiles", 0).asUInt64();
+    s.compact_records =
+        config.get("compactRecords", Json::UInt64(s.compact_records))
+            .asUInt64();
+    // Limits of a user, from their entry in "users"
+    for (const auto &user : root["users"]) {
+      if (!user.isMember("quotaBytes") && !user.isMember("quotaFiles")) {
+        continue;
+      }
+      auto &limits = s.users[user["username"].asString()];
+      limits.bytes =
+          user.get("quotaBytes", Json::UInt64(s.defaults.bytes)).asUInt64();
+      limits.files =
+          user.get("quotaFiles", Json::UInt64(s.defaults.files)).asUInt64();
+    }
+
+    if (s.enabled) {
+      std::clog << "[Quota] " << "Quotas on, journal " << s.journal << ", "
+                << s.users.size() << " users with limits of their own"
+                << std::endl;
+    }
+    return quota_ledger(s);
+  }();
+  return ledger;
+}
+
+bool ftp::quota_ledger::enabled() const { return settings_.enabled; }
+
+// Can the user store one more file?
+bool ftp::quota_ledger::has_room(const std::string &user) {
+  if (!settings_.enabled) {
+    return true;
+  }
+  const auto limit = limits(user);
+  std::lock_guard<std::mutex> lock(mutex_);
+  quota_usage used = reserved_[user];
+  const auto owned = usage_.find(user);
+  if (owned != usage_.end()) {
+    used.bytes += owned->second.bytes;
+    used.files += owned->second.files;
+  }
+  return (limit.bytes == 0 || used.bytes < limit.bytes) &&
+         (limit.files == 0 || used.files < limit.files);
+}
+
+// Reserve room for an upload of size bytes to path
+bool ftp::quota_ledger::reserve(const std::string &user,
+                                const std::string &path, uint64_t size) {
+  if (!settings_.enabled) {
+    return true;
+  }
+  const auto limit = limits(user);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &reserved = reserved_[user];
+  uint64_t bytes = reserved.bytes + size;
+  uint64_t files = reserved.files + 1;
+  const auto owned = usage_.find(user);
+  if (owned != usage_.end()) {
+    bytes += owned->second.bytes;
+    files += owned->second.files;
+  }
+  // A file of the user being replaced gives its room back
+  const auto it = paths_.find(path);
+  if (it != paths_.end() && it->second.owner == user &&
+      !it->second.is_directory) {
+    take(bytes, it->second.bytes);
+    take(files, 1);
+  }
+  if ((limit.bytes != 0 && bytes > limit.bytes) ||
+      (limit.files != 0 && files > limit.files)) {
+    errno = EDQUOT;
+    return false;
+  }
+  reserved.bytes += size;
+  reserved.files++;
+  return true;
+}
+
+// Release the room of an upload that is not committed
+void ftp::quota_ledger::release(const std::string &user, uint64_t reserved) {
+  if (!settings_.enabled) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &room = reserved_[user];
+  take(room.bytes, reserved);
+  take(room.files, 1);
+}
+
+// Account for a committed upload, releasing its reservation
+void ftp::quota_ledger::commit_file(const std::string &user,
+                                    const std::string &path,
+                                    uint64_t reserved, uint64_t size) {
+  if (!settings_.enabled) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &room = reserved_[user];
+    take(room.bytes, reserved);
+    take(room.files, 1);
+    put(path, {user, size, false, ++sequence_});
+    append("F\t" + escape(user) + "\t" + std::to_string(size) + "\t" +
+           escape(path));
+  }
+  flush_journal();
+}
+
+// Account for a directory made by the user
+void ftp::quota_ledger::add_directory(const std::string &user,
+                                      const std::string &path) {
+  if (!settings_.enabled) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    put(path, {user, 0, true, ++sequence_});
+    append("D\t" + escape(user) + "\t" + escape(path));
+  }
+  flush_journal();
+}
+
+// Forget a file or an (empty) directory removed
+void ftp::quota_ledger::remove(const std::string &path) {
+  if (!settings_.enabled) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = paths_.find(path);
+    if (it == paths_.end()) {
+      return;
+    }
+    erase(it);
+    append("X\t" + escape(path));
+  }
+  flush_journal();
+}
+
+// Move a path, and everything below it, keeping their owners
+void ftp::quota_ledger::rename(const std::string &from,
+                               const std::string &to) {
+  if (!settings_.enabled || from == to) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!move(from, to)) {
+      return;
+    }
+    append("R\t" + escape(from) + "\t" + escape(to));
+  }
+  flush_journal();
+}
+
+ftp::quota_usage ftp::quota_ledger::usage(const std::string &user) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = usage_.find(user);
+  return it == usage_.end() ? quota_usage() : it->second;
+}
+
+ftp::quota_limits ftp::quota_ledger::limits(const std::string &user) const {
+  const auto it = settings_.users.find(user);
+  return it == settings_.users.end() ? settings_.defaults : it->second;
+}
+
+// Usage of every user owning something, sorted by name
+std::map<std::string, ftp::quota_usage> ftp::quota_ledger::all_usage() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::map<std::string, quota_usage>(usage_.begin(), usage_.end());
+}
+
+// Check the journal against the storage on a thread of its own
+void ftp::quota_ledger::start_scan(vfs &storage) {
+  if (!settings_.enabled || scanning_.exchange(true)) {
+    return;
+  }
+  if (scan_thread_.joinable()) {
+    scan_thread_.join();
+  }
+  scan_thread_ = std::thread([this, &storage]() {
+    scan(storage);
+    scanning_ = false;
+  });
+}
+
+bool ftp::quota_ledger::scanning() const { return scanning_; }
+
+// Own a path, replacing its previous owner
+void ftp::quota_ledger::put(const std::string &path, owned_path entry) {
+  auto &used = usage_[entry.owner];
+  used.bytes += entry.bytes;
+  used.files++;
+  const auto it = paths_.find(path);
+  if (it == paths_.end()) {
+    paths_.emplace(path, std::move(entry));
+    return;
+  }
+  const auto previous = usage_.find(it->second.owner);
+  take(previous->second.bytes, it->second.bytes);
+  take(previous->second.files, 1);
+  if (previous->second.bytes == 0 && previous->second.files == 0) {
+    usage_.erase(previous);
+  }
+  it->second = std::move(entry);
+}
+
+// Forget a path
+ftp::quota_ledger::path_map::iterator
+ftp::quota_ledger::erase(path_map::iterator it) {
+  const auto owner = usage_.find(it->second.owner);
+  if (owner != usage_.end()) {
+    take(owner->second.bytes, it->second.bytes);
+    take(owner->second.files, 1);
+    if (owner->second.bytes == 0 && owner->second.files == 0) {
+      usage_.erase(owner);
+    }
+  }
+  return paths_.erase(it);
+}
+
+// Move a path and the paths below it
+bool ftp::quota_ledger::move(const std::string &from, const std::string &to) {
+  // The paths below from do not follow it in order ("a-b" sorts between
+  // "a" and "a/b"), so they are looked up on their own
+  std::vector<path_map::node_type> moved;
+  const auto exact = paths_.find(from);
+  if (exact != paths_.end()) {
+    moved.push_back(paths_.extract(exact));
+  }
+  auto it = paths_.lower_bound(from + "/");
+  while (it != paths_.end() && is_below(it->first, from)) {
+    moved.push_back(paths_.extract(it++));
+  }
+  for (auto &node : moved) {
+    node.key() = to + node.key().substr(from.size());
+    node.mapped().changed = ++sequence_;
+    // A stale path where the renamed one lands is dropped
+    const auto stale = paths_.find(node.key());
+    if (stale != paths_.end()) {
+      erase(stale);
+    }
+    paths_.insert(std::move(node));
+  }
+  return !moved.empty();
+}
+
+// Replay the journal into paths_
+void ftp::quota_ledger::replay() {
+  std::ifstream journal(settings_.journal);
+  std::string line;
+  uint64_t records = 0;
+  uint64_t malformed = 0;
+  while (std::getline(journal, line)) {
+    const auto fields = split_record(line);
+    records++;
+    if (fields[0] == "F" && fields.size() == 4) {
+      put(unescape(fields[3]), {unescape(fields[1]),
+                                std::strtoull(fields[2].c_str(), nullptr, 10),
+                                false, ++sequence_});
+    } else if (fields[0] == "D" && fields.size() == 3) {
+      put(unescape(fields[2]), {unescape(fields[1]), 0, true, ++sequence_});
+    } else if (fields[0] == "X" && fields.size() == 2) {
+      const auto it = paths_.find(unescape(fields[1]));
+      if (it != paths_.end()) {
+        erase(it);
+      }
+    } else if (fields[0] == "R" && fields.size() == 3) {
+      move(unescape(fields[1]), unescape(fields[2]));
+    } else {
+      // A record cut short by a crash
+      malformed++;
+    }
+  }
+  std::clog << "[Quota] " << "Replayed " << records << " journal records, "
+            << paths_.size() << " paths owned by " << usage_.size()
+            << " users";
+  if (malformed != 0) {
+    std::clog << " (" << malformed << " malformed records skipped)";
+  }
+  std::clog << std::endl;
+}
+
+// Queue a record for the journal, mutex_ held
+void ftp::quota_ledger::append(const std::string &record) {
+  pending_ += record;
+  pending_ += '\n';
+  records_++;
+}
+
+// Write the queued records to the journal and sync it, or replace it by a
+// snapshot once it grew too long; mutex_ not held
+// Records queued by concurrent sessions while a sync runs go together in
+// the next one, and a caller returns once its record is durable: whoever
+// took it held journal_mutex_ until the sync was done
+void ftp::quota_ledger::flush_journal() {
+  std::lock_guard<std::mutex> journal_lock(journal_mutex_);
+  std::string records;
+  std::string compacted;
+  bool compacting = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records.swap(pending_);
+    // The snapshot holds the queued records as well
+    if (records_ > std::max<uint64_t>(settings_.compact_records,
+                                      paths_.size())) {
+      compacted = snapshot();
+      compacting = true;
+      records_ = 0;
+    }
+  }
+
+  if (compacting) {
+    if (!write_snapshot(compacted)) {
+      std::cerr << "[Quota] " << "Cannot compact " << settings_.journal
+                << ": " << strerror(errno) << std::endl;
+    }
+    return;
+  }
+  if (records.empty() || fd_ == -1) {
+    return;
+  }
+  if (!write_all(fd_, records) || fdatasync(fd_) == -1) {
+    std::cerr << "[Quota] " << "Cannot write " << settings_.journal << ": "
+              << strerror(errno) << std::endl;
+  }
+}
+
+// One record per path owned, mutex_ held
+std::string ftp::quota_ledger::snapshot() const {
+  std::string snapshot;
+  for (const auto &[path, entry] : paths_) {
+    if (entry.is_directory) {
+      snapshot += "D\t" + escape(entry.owner) + "\t" + escape(path) + "\n";
+    } else {
+      snapshot += "F\t" + escape(entry.owner) + "\t" +
+                  std::to_string(entry.bytes) + "\t" + escape(path) + "\n";
+    }
+  }
+  return snapshot;
+}
+
+// Replace the journal by a snapshot, journal_mutex_ held
+// The snapshot replaces the journal by a rename, so that a crash leaves
+// either of them whole
+bool ftp::quota_ledger::write_snapshot(const std::string &snapshot) {
+  const std::string temporary = settings_.journal + ".tmp";
+  const int fd =
+      open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  if (!write_all(fd, snapshot) || fsync(fd) == -1) {
+    const int error = errno;
+    close(fd);
+    unlink(temporary.c_str());
+    errno = error;
+    return false;
+  }
+  close(fd);
+  if (std::rename(temporary.c_str(), settings_.journal.c_str()) == -1) {
+    const int error = errno;
+    unlink(temporary.c_str());
+    errno = error;
+    return false;
+  }
+  // Make the rename itself durable
+  auto directory = std::filesystem::path(settings_.journal).parent_path();
+  if (directory.empty()) {
+    directory = ".";
+  }
+  const int directory_fd =
+      open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directory_fd != -1) {
+    fsync(directory_fd);
+    close(directory_fd);
+  }
+
+  const int journal_fd = open(settings_.journal.c_str(),
+                              O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (journal_fd == -1) {
+    return false;
+  }
+  if (fd_ != -1) {
+    close(fd_);
+  }
+  fd_ = journal_fd;
+  return true;
+}
+
+// Walk the storage and reconcile paths_ with it
+// Paths changed by sessions while the walk runs are left alone: the walk may
+// have passed them before they changed
+void ftp::quota_ledger::scan(vfs &storage) {
+  uint64_t started = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    started = sequence_;
+  }
+  std::clog << "[Quota] " << "Scanning the storage" << std::endl;
+
+  // Sizes of the owned paths found, 0 for directories
+  std::unordered_map<std::string, uint64_t> found;
+  uint64_t directories = 0;
+  std::vector<std::string> pending = {"/"};
+  std::vector<vfs_entry> entries;
+  while (!pending.empty() && !stopping_) {
+    const std::string directory = std::move(pending.back());
+    pending.pop_back();
+    directories++;
+    // Read the directory without holding the lock, sessions go on
+    entries.clear();
+    storage.list(directory, false, [&](const vfs_entry &entry) {
+      if (!entry.is_link) {
+        entries.push_back(entry);
+      }
+      return !stopping_;
+    });
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &entry : entries) {
+      const auto path = ftp::join_path(directory, entry.name);
+      if (entry.status.is_directory) {
+        pending.push_back(path);
+      }
+      if (paths_.count(path) != 0) {
+        found[path] = entry.status.is_directory ? 0 : entry.status.size;
+      }
+    }
+  }
+  if (stopping_) {
+    return;
+  }
+
+  // Drop what is gone, resize what changed
+  uint64_t gone = 0;
+  uint64_t resized = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (auto it = paths_.begin(); it != paths_.end();) {
+    auto &entry = it->second;
+    if (entry.changed > started) {
+      ++it;
+      continue;
+    }
+    const auto size = found.find(it->first);
+    if (size == found.end()) {
+      append("X\t" + escape(it->first));
+      it = erase(it);
+      gone++;
+      continue;
+    }
+    if (!entry.is_directory && entry.bytes != size->second) {
+      auto &used = usage_[entry.owner];
+      take(used.bytes, entry.bytes);
+      used.bytes += size->second;
+      entry.bytes = size->second;
+      entry.changed = ++sequence_;
+      append("F\t" + escape(entry.owner) + "\t" +
+             std::to_string(entry.bytes) + "\t" + escape(it->first));
+      resized++;
+    }
+    ++it;
+  }
+  std::clog << "[Quota] " << "Scanned " << directories << " directories: "
+            << paths_.size() << " paths owned, " << gone << " gone, "
+            << resized << " resized" << std::endl;
+  lock.unlock();
+  flush_journal();
+}
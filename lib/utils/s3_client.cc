@@ -0,0 +1,476 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "utils/s3_client.h"
+#include "utils/sha256.h"
+
+namespace {
+
+// Heads of responses are a status line and a few headers
+constexpr size_t max_head_size = 64 * 1024;
+// Bytes read from the connection at a time
+constexpr size_t read_size = 64 * 1024;
+// Bytes moved by one splice() into a pipe
+constexpr size_t splice_size = 1024 * 1024;
+// A store not answering for this long fails the request
+constexpr auto store_timeout = std::chrono::seconds(30);
+
+// Append what the connection has to pending, false once closed or failed
+bool fill(sockpp::tcp_connector &conn, std::string &pending) {
+  const size_t size = pending.size();
+  pending.resize(size + read_size);
+  const ssize_t n = conn.read(pending.data() + size, read_size);
+  pending.resize(size + size_t(std::max<ssize_t>(n, 0)));
+  return n > 0;
+}
+
+// Lowercase copy of a header name
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return text;
+}
+
+// Copy without leading and trailing spaces
+std::string trim_spaces(const std::string &text) {
+  const auto start = text.find_first_not_of(" \t");
+  if (start == std::string::npos) {
+    return "";
+  }
+  return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+// First and last byte of the Range header of a request, false without one
+bool requested_range(const ftp::s3_request &request, uint64_t &first,
+                     uint64_t &last) {
+  for (const auto &[name, value] : request.headers) {
+    if (lowercase(name) != "range" || value.rfind("bytes=", 0) != 0) {
+      continue;
+    }
+    char *end = nullptr;
+    first = std::strtoull(value.c_str() + 6, &end, 10);
+    if (*end != '-') {
+      return false;
+    }
+    last = std::strtoull(end + 1, nullptr, 10);
+    return last >= first;
+  }
+  return false;
+}
+
+// Send a whole buffer to a socket, false on failure
+bool send_all(int socket_fd, const char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = ::send(socket_fd, data, size, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+} // namespace
+
+// Percent-encoding of URIs as signed by Signature Version 4
+std::string ftp::uri_encode(const std::string &text, bool encode_slash) {
+  static constexpr char digits[] = "0123456789ABCDEF";
+  std::string encoded;
+  encoded.reserve(text.size());
+  for (const unsigned char c : text) {
+    if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' ||
+        (c == '/' && !encode_slash)) {
+      encoded += char(c);
+      continue;
+    }
+    encoded += '%';
+    encoded += digits[c >> 4];
+    encoded += digits[c & 0x0F];
+  }
+  return encoded;
+}
+
+// Constructor, the endpoint is host:port
+ftp::s3_client::s3_client(object_store_settings settings)
+    : settings_(std::move(settings)) {
+  std::string endpoint = settings_.endpoint;
+  if (endpoint.rfind("http://", 0) == 0) {
+    endpoint = endpoint.substr(7);
+  } else if (endpoint.rfind("https://", 0) == 0) {
+    std::cerr << "[S3] " << "HTTPS is not supported, use a plain HTTP "
+              << "endpoint" << std::endl;
+    endpoint = endpoint.substr(8);
+  }
+  while (!endpoint.empty() && endpoint.back() == '/') {
+    endpoint.pop_back();
+  }
+  host_ = endpoint;
+  address_ = endpoint;
+  const auto colon = endpoint.find_last_of(':');
+  if (colon != std::string::npos) {
+    address_ = endpoint.substr(0, colon);
+    port_ = uint16_t(std::strtoul(endpoint.c_str() + colon + 1, nullptr, 10));
+  }
+}
+
+// Send a request and read the whole response
+ftp::s3_response ftp::s3_client::send(const s3_request &request) {
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    bool reused = false;
+    auto conn = acquire(reused);
+    if (conn == nullptr) {
+      break;
+    }
+    s3_response response;
+    std::string pending;
+    if (!exchange(*conn, request, response, pending)) {
+      // The store may have closed an idle connection
+      if (reused) {
+        continue;
+      }
+      break;
+    }
+    if (read_body(*conn, request, response, pending)) {
+      release(std::move(conn));
+    }
+    return response;
+  }
+  return {};
+}
+
+// Send a GET request and pass the body of the response on to socket_fd
+ssize_t ftp::s3_client::forward(const s3_request &request, int socket_fd) {
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    bool reused = false;
+    auto conn = acquire(reused);
+    if (conn == nullptr) {
+      break;
+    }
+    s3_response response;
+    std::string pending;
+    if (!exchange(*conn, request, response, pending)) {
+      if (reused) {
+        continue;
+      }
+      break;
+    }
+
+    const auto length = response.headers.find("content-length");
+    if ((response.status != 200 && response.status != 206) ||
+        length == response.headers.end() ||
+        response.headers.count("transfer-encoding") != 0) {
+      if (read_body(*conn, request, response, pending)) {
+        release(std::move(conn));
+      }
+      errno = response.status == 404 ? ENOENT : EIO;
+      return -1;
+    }
+
+    // Of the body left on the connection, the bytes wanted
+    uint64_t remaining = std::strtoull(length->second.c_str(), nullptr, 10);
+    uint64_t wanted = remaining;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    if (response.status == 200 && requested_range(request, first, last)) {
+      // A store ignoring the range sends the whole object: skip to the
+      // start of the range, and stop at its end
+      uint64_t skip = std::min(first, remaining);
+      remaining -= skip;
+      while (skip > 0) {
+        if (pending.empty() && !fill(*conn, pending)) {
+          errno = EIO;
+          return -1;
+        }
+        const size_t n = size_t(std::min<uint64_t>(skip, pending.size()));
+        pending.erase(0, n);
+        skip -= n;
+      }
+      wanted = std::min(remaining, last - first + 1);
+    }
+
+    // The start of the body came with the head, the rest is spliced
+    const size_t head_part = size_t(std::min<uint64_t>(wanted,
+                                                       pending.size()));
+    if (!send_all(socket_fd, pending.data(), head_part)) {
+      return -1;
+    }
+    ssize_t forwarded = ssize_t(head_part);
+    remaining -= head_part;
+    wanted -= head_part;
+
+    int pipe_fds[2] = {-1, -1};
+    if (wanted > 0 && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+      return forwarded > 0 ? forwarded : -1;
+    }
+    bool successful = true;
+    while (wanted > 0 && successful) {
+      ssize_t n = splice(conn->handle(), nullptr, pipe_fds[1], nullptr,
+                         size_t(std::min<uint64_t>(wanted, splice_size)),
+                         SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (n <= 0) {
+        successful = n == -1 && errno == EINTR;
+        continue;
+      }
+      remaining -= uint64_t(n);
+      wanted -= uint64_t(n);
+      while (n > 0) {
+        const ssize_t m = splice(pipe_fds[0], nullptr, socket_fd, nullptr,
+                                 size_t(n), SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (m <= 0) {
+          if (m == -1 && errno == EINTR) {
+            continue;
+          }
+          successful = false;
+          break;
+        }
+        n -= m;
+        forwarded += m;
+      }
+    }
+    for (const int fd : pipe_fds) {
+      if (fd != -1) {
+        close(fd);
+      }
+    }
+    // A body left half read cannot be followed by another response
+    if (successful && remaining == 0 && pending.size() == head_part &&
+        response.headers["connection"] != "close") {
+      release(std::move(conn));
+    }
+    return forwarded > 0 || successful ? forwarded : -1;
+  }
+  errno = EIO;
+  return -1;
+}
+
+// An idle connection, or a new one
+ftp::s3_client::connection ftp::s3_client::acquire(bool &reused) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_.empty()) {
+      auto conn = std::move(idle_.back());
+      idle_.pop_back();
+      reused = true;
+      return conn;
+    }
+  }
+  reused = false;
+  auto conn = std::make_unique<sockpp::tcp_connector>();
+  if (!conn->connect(sockpp::inet_address(address_, port_))) {
+    std::cerr << "[S3] " << "Cannot connect to " << host_ << ": "
+              << conn->last_error_str() << std::endl;
+    errno = EIO;
+    return nullptr;
+  }
+  conn->read_timeout(store_timeout);
+  conn->write_timeout(store_timeout);
+  // The body follows the head in a second write, which must not wait for
+  // the store to acknowledge the head
+  conn->set_option(IPPROTO_TCP, TCP_NODELAY, 1);
+  return conn;
+}
+
+// Keep a connection for the next request
+void ftp::s3_client::release(connection conn) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (idle_.size() < settings_.connections) {
+    idle_.push_back(std::move(conn));
+  }
+}
+
+// Write a signed request, then read the head of its response
+bool ftp::s3_client::exchange(sockpp::tcp_connector &conn,
+                              const s3_request &request,
+                              s3_response &response, std::string &pending) {
+  const auto head = request_head(request);
+  if (conn.write(head) != ssize_t(head.size()) ||
+      (request.body_size > 0 &&
+       conn.write(request.body, request.body_size) !=
+           ssize_t(request.body_size))) {
+    return false;
+  }
+
+  size_t head_end = std::string::npos;
+  while ((head_end = pending.find("\r\n\r\n")) == std::string::npos) {
+    if (pending.size() > max_head_size || !fill(conn, pending)) {
+      return false;
+    }
+  }
+
+  // Status line: HTTP/1.1 200 OK
+  size_t line_end = pending.find("\r\n");
+  const auto space = pending.find(' ');
+  if (space == std::string::npos || space > line_end) {
+    return false;
+  }
+  response.status = std::atoi(pending.c_str() + space + 1);
+  while (line_end < head_end) {
+    const size_t start = line_end + 2;
+    line_end = pending.find("\r\n", start);
+    const auto colon = pending.find(':', start);
+    if (colon < line_end) {
+      response.headers[lowercase(pending.substr(start, colon - start))] =
+          trim_spaces(pending.substr(colon + 1, line_end - colon - 1));
+    }
+  }
+  pending.erase(0, head_end + 4);
+  return response.status != 0;
+}
+
+// Read the rest of the body
+bool ftp::s3_client::read_body(sockpp::tcp_connector &conn,
+                               const s3_request &request,
+                               s3_response &response, std::string &pending) {
+  const bool keep_alive = response.headers["connection"] != "close";
+  if (request.method == "HEAD" || response.status == 204 ||
+      response.status == 304 || response.status < 200) {
+    return keep_alive;
+  }
+
+  if (response.headers["transfer-encoding"] == "chunked") {
+    size_t position = 0;
+    while (true) {
+      size_t line_end;
+      while ((line_end = pending.find("\r\n", position)) ==
+             std::string::npos) {
+        if (!fill(conn, pending)) {
+          return false;
+        }
+      }
+      const uint64_t size =
+          std::strtoull(pending.c_str() + position, nullptr, 16);
+      position = line_end + 2;
+      if (size == 0) {
+        break;
+      }
+      while (pending.size() < position + size + 2) {
+        if (!fill(conn, pending)) {
+          return false;
+        }
+      }
+      response.body.append(pending, position, size);
+      position += size + 2;
+    }
+    // Trailers, up to an empty line
+    while (true) {
+      size_t line_end;
+      while ((line_end = pending.find("\r\n", position)) ==
+             std::string::npos) {
+        if (!fill(conn, pending)) {
+          return false;
+        }
+      }
+      if (line_end == position) {
+        return keep_alive;
+      }
+      position = line_end + 2;
+    }
+  }
+
+  const auto length = response.headers.find("content-length");
+  if (length == response.headers.end()) {
+    // Delimited by the end of the connection
+    while (fill(conn, pending)) {
+    }
+    response.body = std::move(pending);
+    return false;
+  }
+  const uint64_t size = std::strtoull(length->second.c_str(), nullptr, 10);
+  while (pending.size() < size) {
+    if (!fill(conn, pending)) {
+      return false;
+    }
+  }
+  pending.resize(size);
+  response.body = std::move(pending);
+  return keep_alive;
+}
+
+// Head of a request signed with Signature Version 4
+std::string ftp::s3_client::request_head(const s3_request &request) const {
+  const std::time_t now = std::time(nullptr);
+  std::tm utc;
+  gmtime_r(&now, &utc);
+  char amz_date[17];
+  char date[9];
+  std::strftime(amz_date, sizeof(amz_date), "%Y%m%dT%H%M%SZ", &utc);
+  std::strftime(date, sizeof(date), "%Y%m%d", &utc);
+
+  // Path-style URL: /bucket/key
+  std::string uri = "/" + uri_encode(settings_.bucket);
+  if (!request.key.empty()) {
+    uri += "/" + uri_encode(request.key, false);
+  }
+
+  std::vector<std::string> parameters;
+  for (const auto &[name, value] : request.query) {
+    parameters.push_back(uri_encode(name) + "=" + uri_encode(value));
+  }
+  std::sort(parameters.begin(), parameters.end());
+  std::string query;
+  for (const auto &parameter : parameters) {
+    query += (query.empty() ? "" : "&") + parameter;
+  }
+
+  std::map<std::string, std::string> headers;
+  for (const auto &[name, value] : request.headers) {
+    headers[lowercase(name)] = trim_spaces(value);
+  }
+  headers["host"] = host_;
+  headers["x-amz-date"] = amz_date;
+  headers["x-amz-content-sha256"] = "UNSIGNED-PAYLOAD";
+
+  std::string head = request.method + " " + uri +
+                     (query.empty() ? "" : "?" + query) + " HTTP/1.1\r\n";
+  std::string canonical_headers;
+  std::string signed_headers;
+  for (const auto &[name, value] : headers) {
+    head += name + ": " + value + "\r\n";
+    canonical_headers += name + ":" + value + "\n";
+    signed_headers += (signed_headers.empty() ? "" : ";") + name;
+  }
+  if (request.body_size > 0 || request.method == "PUT" ||
+      request.method == "POST") {
+    head += "content-length: " + std::to_string(request.body_size) + "\r\n";
+  }
+
+  if (!settings_.access_key.empty()) {
+    const std::string canonical_request =
+        request.method + "\n" + uri + "\n" + query + "\n" +
+        canonical_headers + "\n" + signed_headers + "\nUNSIGNED-PAYLOAD";
+    const std::string scope =
+        std::string(date) + "/" + settings_.region + "/s3/aws4_request";
+    const std::string string_to_sign =
+        "AWS4-HMAC-SHA256\n" + std::string(amz_date) + "\n" + scope + "\n" +
+        to_hex(sha256::of(canonical_request));
+
+    // Signing key: the secret chained through the scope
+    auto key = hmac_sha256("AWS4" + settings_.secret_key, date);
+    for (const auto &part :
+         {settings_.region, std::string("s3"), std::string("aws4_request")}) {
+      key = hmac_sha256(std::string(key.begin(), key.end()), part);
+    }
+    const auto signature = to_hex(hmac_sha256(
+        std::string(key.begin(), key.end()), string_to_sign));
+    head += "authorization: AWS4-HMAC-SHA256 Credential=" +
+            settings_.access_key + "/" + scope +
+            ", SignedHeaders=" + signed_headers + ", Signature=" + signature +
+            "\r\n";
+  }
+  return head + "\r\n";
+}
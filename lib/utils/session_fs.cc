@@ -0,0 +1,85 @@
+#include <cerrno>
+#include <sstream>
+#include <vector>
+
+#include "utils/session_fs.h"
+
+namespace {
+
+// Components of a client path, without empty ones and "."
+std::vector<std::string> components(const std::string &path) {
+  std::vector<std::string> result;
+  std::string component;
+  std::istringstream stream(path);
+  while (std::getline(stream, component, '/')) {
+    if (component.empty() || component == ".") {
+      continue;
+    }
+    result.push_back(component);
+  }
+  return result;
+}
+
+} // namespace
+
+// Constructor, the working directory starts at the root
+ftp::session_fs::session_fs(vfs &storage)
+    : storage_(&storage), cwd_(storage.open_directory("/")) {}
+
+// Storage the paths are resolved for
+ftp::vfs &ftp::session_fs::storage() const { return *storage_; }
+
+// Working directory as the client sees it, read back from the handle
+const std::string &ftp::session_fs::pwd() const {
+  if (cwd_ != nullptr) {
+    auto path = cwd_->path();
+    if (!path.empty()) {
+      pwd_ = std::move(path);
+    }
+  }
+  return pwd_;
+}
+
+// Is the working directory still there?
+bool ftp::session_fs::cwd_exists() const {
+  return cwd_ != nullptr && !cwd_->path().empty();
+}
+
+// Absolute client path of a client path, without "." or ".."
+std::string ftp::session_fs::resolve(const std::string &path) const {
+  std::vector<std::string> resolved;
+  if (path.empty() || path[0] != '/') {
+    resolved = components(pwd());
+  }
+  for (auto &component : components(path)) {
+    if (component != "..") {
+      resolved.push_back(std::move(component));
+    } else if (!resolved.empty()) {
+      resolved.pop_back();
+    }
+  }
+
+  std::string result;
+  for (const auto &component : resolved) {
+    result += "/" + component;
+  }
+  return result.empty() ? "/" : result;
+}
+
+// Where a client path is stored
+std::filesystem::path
+ftp::session_fs::host_path(const std::string &path) const {
+  return storage_->location(resolve(path));
+}
+
+// Change the working directory, opening the new one in a single step
+bool ftp::session_fs::change_directory(const std::string &path) {
+  const auto resolved = resolve(path);
+  auto directory = storage_->open_directory(resolved);
+  if (directory == nullptr) {
+    return false;
+  }
+  cwd_ = std::move(directory);
+  pwd_ = resolved;
+  return true;
+}
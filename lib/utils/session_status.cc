@@ -0,0 +1,48 @@
+#include <iostream>
+#include <utility>
+
+#include "utils/config.h"
+#include "utils/session_status.h"
+
+namespace {
+
+std::atomic<uint64_t> next_session_id = 1;
+
+} // namespace
+
+// Server-wide settings, read from config.json once
+ftp::rate_limit_settings &ftp::rate_limit_settings::instance() {
+  static rate_limit_settings settings;
+  static std::once_flag read;
+  std::call_once(read, []() {
+    const auto config = ftp::read_config()["rateLimit"];
+    const uint64_t limit = config.get("bytesPerSecond", 0).asUInt64();
+    settings.bytes_per_second.store(limit, std::memory_order_relaxed);
+    if (limit != 0) {
+      std::clog << "[Config] " << "Rate limit: " << limit
+                << " bytes/s per session" << std::endl;
+    }
+  });
+  return settings;
+}
+
+// Constructor
+ftp::session_status::session_status(std::string peer)
+    : id(next_session_id.fetch_add(1, std::memory_order_relaxed)),
+      peer(std::move(peer)), connected(std::chrono::steady_clock::now()) {
+  rate_limit.store(
+      rate_limit_settings::instance().bytes_per_second.load(
+          std::memory_order_relaxed),
+      std::memory_order_relaxed);
+}
+
+// Logged in user
+void ftp::session_status::set_user(const std::string &user) {
+  std::lock_guard<std::mutex> lock(user_mutex_);
+  user_ = user;
+}
+
+std::string ftp::session_status::user() const {
+  std::lock_guard<std::mutex> lock(user_mutex_);
+  return user_;
+}
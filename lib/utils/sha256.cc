@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cstring>
+
+#include "utils/sha256.h"
+
+namespace {
+
+// First 32 bits of the fractional parts of the cube roots of the first 64
+// primes
+constexpr uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+uint32_t rotate_right(uint32_t value, int bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+} // namespace
+
+// Initial state: fractional parts of the square roots of the first 8 primes
+ftp::sha256::sha256()
+    : state_{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+             0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+
+// Hash size more bytes
+void ftp::sha256::update(const void *data, size_t size) {
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  total_size_ += size;
+  while (size > 0) {
+    const size_t chunk = std::min(size, sizeof(block_) - block_size_);
+    memcpy(block_ + block_size_, bytes, chunk);
+    block_size_ += chunk;
+    bytes += chunk;
+    size -= chunk;
+    if (block_size_ == sizeof(block_)) {
+      compress(block_);
+      block_size_ = 0;
+    }
+  }
+}
+
+// Pad the message with its length in bits and output the state
+ftp::sha256_digest ftp::sha256::finish() {
+  const uint64_t bits = total_size_ * 8;
+  const uint8_t marker = 0x80;
+  update(&marker, 1);
+  const uint8_t zero = 0;
+  while (block_size_ != 56) {
+    update(&zero, 1);
+  }
+  uint8_t length[8];
+  for (int i = 0; i < 8; ++i) {
+    length[i] = uint8_t(bits >> (56 - 8 * i));
+  }
+  update(length, sizeof(length));
+
+  sha256_digest digest;
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      digest[4 * i + j] = uint8_t(state_[i] >> (24 - 8 * j));
+    }
+  }
+  return digest;
+}
+
+// Digest of a string
+ftp::sha256_digest ftp::sha256::of(const std::string &data) {
+  sha256 hash;
+  hash.update(data.data(), data.size());
+  return hash.finish();
+}
+
+// Hash one 64 byte block into state_
+void ftp::sha256::compress(const uint8_t *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16 |
+           uint32_t(block[4 * i + 2]) << 8 | uint32_t(block[4 * i + 3]);
+  }
+  for (int i = 16; i < 64; ++i) {
+    const uint32_t s0 = rotate_right(w[i - 15], 7) ^
+                        rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 = rotate_right(w[i - 2], 17) ^
+                        rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; ++i) {
+    const uint32_t s1 =
+        rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+    const uint32_t choice = (e & f) ^ (~e & g);
+    const uint32_t t1 = h + s1 + choice + round_constants[i] + w[i];
+    const uint32_t s0 =
+        rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+    const uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+    const uint32_t t2 = s0 + majority;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+
+// HMAC-SHA-256 of a message
+ftp::sha256_digest ftp::hmac_sha256(const std::string &key,
+                                    const std::string &message) {
+  // Keys longer than a block are hashed first
+  uint8_t block_key[64] = {};
+  if (key.size() > sizeof(block_key)) {
+    const auto hashed = sha256::of(key);
+    memcpy(block_key, hashed.data(), hashed.size());
+  } else {
+    memcpy(block_key, key.data(), key.size());
+  }
+
+  uint8_t pad[64];
+  for (size_t i = 0; i < sizeof(pad); ++i) {
+    pad[i] = block_key[i] ^ 0x36;
+  }
+  sha256 inner;
+  inner.update(pad, sizeof(pad));
+  inner.update(message.data(), message.size());
+  const auto inner_digest = inner.finish();
+
+  for (size_t i = 0; i < sizeof(pad); ++i) {
+    pad[i] = block_key[i] ^ 0x5c;
+  }
+  sha256 outer;
+  outer.update(pad, sizeof(pad));
+  outer.update(inner_digest.data(), inner_digest.size());
+  return outer.finish();
+}
+
+// Lowercase hexadecimal digits of bytes
+std::string ftp::to_hex(const uint8_t *data, size_t size) {
+  static constexpr char digits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(2 * size);
+  for (size_t i = 0; i < size; ++i) {
+    hex += digits[data[i] >> 4];
+    hex += digits[data[i] & 0x0F];
+  }
+  return hex;
+}
+
+std::string ftp::to_hex(const sha256_digest &digest) {
+  return to_hex(digest.data(), digest.size());
+}
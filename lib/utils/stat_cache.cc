@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include "utils/config.h"
+#include "utils/stat_cache.h"
+
+// Timestamp as YYYYMMDDHHMMSS (UTC), as used by MDTM and MLSD
+std::string ftp::format_timestamp(int64_t seconds) {
+  const time_t time = seconds;
+  struct tm utc;
+  gmtime_r(&time, &utc);
+  char text[16];
+  strftime(text, sizeof(text), "%Y%m%d%H%M%S", &utc);
+  return text;
+}
+
+// Seconds since epoch of a YYYYMMDDHHMMSS timestamp (UTC)
+int64_t ftp::parse_timestamp(const std::string &timestamp) {
+  struct tm utc = {};
+  const char *end = strptime(timestamp.c_str(), "%Y%m%d%H%M%S", &utc);
+  if (timestamp.size() != 14 || end == nullptr || *end != '\0') {
+    return -1;
+  }
+  return timegm(&utc);
+}
+
+// Status of the file open at fd
+ftp::file_status ftp::read_file_status(int fd) {
+  file_status status;
+  struct stat file_stat;
+  if (fd != -1 && fstat(fd, &file_stat) == 0) {
+    status.exists = true;
+    status.is_regular = S_ISREG(file_stat.st_mode);
+    status.size = file_stat.st_size;
+    status.mtime = file_stat.st_mtime;
+  }
+  return status;
+}
+
+// Constructor
+// A non-zero capacity keeps at least one entry per shard
+ftp::stat_cache::stat_cache(size_t max_entries, std::chrono::milliseconds ttl,
+                            size_t shard_count)
+    : enabled_(max_entries > 0), ttl_(ttl),
+      entries_(shard_count,
+               std::max<size_t>(max_entries / std::max<size_t>(shard_count, 1),
+                                1)) {}
+
+// Server-wide instance, configured by "statCache" in config.json
+ftp::stat_cache &ftp::stat_cache::instance() {
+  static stat_cache cache = []() {
+    const auto config = ftp::read_config()["statCache"];
+    const size_t max_entries = config.get("maxEntries", 65536).asUInt64();
+    const auto ttl =
+        std::chrono::milliseconds(config.get("ttlMillis", 1000).asUInt64());
+    const size_t shard_count = config.get("shards", 16).asUInt();
+
+    std::clog << "[Cache] " << "Stat cache entries: " << max_entries
+              << ", ttl: " << ttl.count() << " ms, shards: " << shard_count
+              << std::endl;
+    return stat_cache(max_entries, ttl, shard_count);
+  }();
+  return cache;
+}
+
+// Status of a path, from the cache or from load() on a miss
+ftp::file_status
+ftp::stat_cache::status(const std::string &path,
+                        const std::function<file_status()> &load) {
+  const auto now = std::chrono::steady_clock::now();
+  uint64_t generation = 0;
+  if (enabled_) {
+    const auto cached = entries_.find(
+        path, [&](const entry &e) { return e.expires > now; }, &generation);
+    if (cached) {
+      hits_++;
+      return cached->status;
+    }
+  }
+  misses_++;
+
+  // Missing paths are cached as well, clients poll for files to appear
+  // Nothing is stored if the server changed a path meanwhile
+  const file_status status = load();
+  if (enabled_) {
+    entries_.insert(path, entry{status, now + ttl_}, &generation);
+  }
+  return status;
+}
+
+// Drop the entry of a path
+void ftp::stat_cache::invalidate(const std::string &path) {
+  entries_.erase(path);
+}
+
+// Drop the entries of a directory and of every path below it
+void ftp::stat_cache::invalidate_tree(const std::string &directory) {
+  entries_.erase_tree(directory);
+}
+
+// Hit and miss counters
+uint64_t ftp::stat_cache::hits() const { return hits_; }
+uint64_t ftp::stat_cache::misses() const { return misses_; }
+
+// Number of cached paths
+size_t ftp::stat_cache::size() const { return entries_.size(); }
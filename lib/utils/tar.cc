@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/tar.h"
+#include "utils/vfs_local.h"
+
+namespace {
+
+// Offsets and sizes of the ustar header fields
+constexpr size_t name_offset = 0, name_size = 100;
+constexpr size_t mode_offset = 100, mode_size = 8;
+constexpr size_t uid_offset = 108, uid_size = 8;
+constexpr size_t gid_offset = 116, gid_size = 8;
+constexpr size_t size_offset = 124, size_size = 12;
+constexpr size_t mtime_offset = 136, mtime_size = 12;
+constexpr size_t checksum_offset = 148, checksum_size = 8;
+constexpr size_t type_offset = 156;
+constexpr size_t magic_offset = 257;
+constexpr size_t prefix_offset = 345, prefix_size = 155;
+
+// Write value as a zero padded octal number followed by NUL
+void write_octal(char *field, size_t field_size, uint64_t value) {
+  snprintf(field, field_size, "%0*llo", int(field_size - 1),
+           static_cast<unsigned long long>(value));
+}
+
+// Write a number, using the GNU base-256 encoding if it does not fit in octal
+void write_number(char *field, size_t field_size, uint64_t value) {
+  if (value < (uint64_t(1) << (3 * (field_size - 1)))) {
+    write_octal(field, field_size, value);
+    return;
+  }
+  memset(field, 0, field_size);
+  field[0] = char(0x80);
+  for (size_t i = field_size - 1; i > 0 && value > 0; --i) {
+    field[i] = char(value & 0xff);
+    value >>= 8;
+  }
+}
+
+// Read an octal or base-256 number
+uint64_t read_number(const char *field, size_t field_size) {
+  uint64_t value = 0;
+  if (static_cast<unsigned char>(field[0]) & 0x80) {
+    for (size_t i = 1; i < field_size; ++i) {
+      value = (value << 8) | static_cast<unsigned char>(field[i]);
+    }
+    return value;
+  }
+  for (size_t i = 0; i < field_size && field[i] != '\0'; ++i) {
+    if (field[i] == ' ') {
+      continue;
+    }
+    if (field[i] < '0' || field[i] > '7') {
+      break;
+    }
+    value = (value << 3) | uint64_t(field[i] - '0');
+  }
+  return value;
+}
+
+// Sum of the header bytes, with the checksum field counted as spaces
+uint64_t header_checksum(const char *block) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < ftp::tar_block_size; ++i) {
+    const bool in_checksum =
+        i >= checksum_offset && i < checksum_offset + checksum_size;
+    sum += in_checksum ? ' ' : static_cast<unsigned char>(block[i]);
+  }
+  return sum;
+}
+
+// Build a single header block
+std::string header_block(const std::string &name, char type, uint64_t size,
+                         mode_t mode, time_t mtime) {
+  std::string block(ftp::tar_block_size, '\0');
+  char *data = block.data();
+  memcpy(data + name_offset, name.data(), std::min(name.size(), name_size));
+  write_octal(data + mode_offset, mode_size, mode & 07777);
+  write_octal(data + uid_offset, uid_size, 0);
+  write_octal(data + gid_offset, gid_size, 0);
+  write_number(data + size_offset, size_size, size);
+  write_number(data + mtime_offset, mtime_size,
+               uint64_t(std::max<time_t>(mtime, 0)));
+  data[type_offset] = type;
+  memcpy(data + magic_offset, "ustar\0" "00", 8);
+
+  snprintf(data + checksum_offset, checksum_size, "%06llo",
+           static_cast<unsigned long long>(header_checksum(data)));
+  data[checksum_offset + 7] = ' ';
+  return block;
+}
+
+// Is the entry name safe to extract (relative and without "..")?
+bool is_safe_path(const std::filesystem::path &path) {
+  if (path.empty() || path.is_absolute()) {
+    return false;
+  }
+  return std::none_of(path.begin(), path.end(),
+                      [](const auto &part) { return part == ".."; });
+}
+
+// Write all of data to fd
+bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = write(fd, data, size);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+} // namespace
+
+// Build the header block(s) of an entry
+std::string ftp::tar_header(const std::string &name, char type,
+                            uint64_t size, mode_t mode, time_t mtime) {
+  if (name.size() <= name_size) {
+    return header_block(name, type, size, mode, mtime);
+  }
+
+  // GNU long name: the name travels as the contents of an 'L' entry
+  std::string long_name = name + '\0';
+  std::string header = header_block("././@LongLink", tar_type_long_name,
+                                    long_name.size(), 0644, 0);
+  header += long_name;
+  header.append(tar_padding(long_name.size()), '\0');
+  header += header_block(name.substr(0, name_size), type, size, mode, mtime);
+  return header;
+}
+
+// Number of zero bytes needed after size bytes of contents
+size_t ftp::tar_padding(uint64_t size) {
+  return (tar_block_size - size % tar_block_size) % tar_block_size;
+}
+
+// Two zero blocks mark the end of the archive
+std::string ftp::tar_end_of_archive() {
+  return std::string(2 * tar_block_size, '\0');
+}
+
+// Constructor
+ftp::tar_extractor::tar_extractor(std::filesystem::path destination) {
+  root_fd_ = open(destination.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd_ == -1) {
+    std::cerr << "[Tar] " << "Cannot open " << destination << ": "
+              << strerror(errno) << std::endl;
+  }
+}
+
+// Destructor
+ftp::tar_extractor::~tar_extractor() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+  if (root_fd_ != -1) {
+    close(root_fd_);
+  }
+}
+
+// Feed the next chunk of the stream
+bool ftp::tar_extractor::feed(const char *data, size_t size) {
+  size_t pos = 0;
+  while (pos < size && !finished_) {
+    switch (state_) {
+    case state::header: {
+      const size_t chunk =
+          std::min(tar_block_size - header_.size(), size - pos);
+      header_.append(data + pos, chunk);
+      pos += chunk;
+      if (header_.size() == tar_block_size) {
+        if (!parse_header()) {
+          return false;
+        }
+        header_.clear();
+      }
+      break;
+    }
+    case state::long_name: {
+      const size_t chunk = std::min<uint64_t>(remaining_, size - pos);
+      long_name_.append(data + pos, chunk);
+      pos += chunk;
+      remaining_ -= chunk;
+      if (remaining_ == 0) {
+        // Strip the trailing NUL(s)
+        long_name_.erase(long_name_.find_last_not_of('\0') + 1);
+        has_long_name_ = true;
+        state_ = padding_ > 0 ? state::padding : state::header;
+      }
+      break;
+    }
+    case state::body: {
+      const size_t chunk = std::min<uint64_t>(remaining_, size - pos);
+      if (fd_ != -1 && !write_all(fd_, data + pos, chunk)) {
+        std::cerr << "[Tar] " << "Error: " << strerror(errno) << std::endl;
+        close(fd_);
+        fd_ = -1;
+      }
+      pos += chunk;
+      remaining_ -= chunk;
+      if (remaining_ == 0) {
+        finish_file();
+        state_ = padding_ > 0 ? state::padding : state::header;
+      }
+      break;
+    }
+    case state::padding: {
+      const size_t chunk = std::min(padding_, size - pos);
+      pos += chunk;
+      padding_ -= chunk;
+      if (padding_ == 0) {
+        state_ = state::header;
+      }
+      break;
+    }
+    }
+  }
+  return true;
+}
+
+// Has the end of archive marker (two zero blocks) been seen?
+bool ftp::tar_extractor::finished() const { return finished_; }
+
+// Number of files and directories extracted so far
+uint64_t ftp::tar_extractor::files() const { return files_; }
+uint64_t ftp::tar_extractor::directories() const { return directories_; }
+
+// Handle a complete header block
+bool ftp::tar_extractor::parse_header() {
+  const char *block = header_.data();
+  if (root_fd_ == -1) {
+    return false;
+  }
+
+  // Two zero blocks in a row mark the end of the archive
+  if (std::all_of(header_.begin(), header_.end(),
+                  [](char c) { return c == '\0'; })) {
+    finished_ = ++zero_blocks_ == 2;
+    return true;
+  }
+  zero_blocks_ = 0;
+
+  if (read_number(block + checksum_offset, checksum_size) !=
+      header_checksum(block)) {
+    std::cerr << "[Tar] " << "Invalid header checksum" << std::endl;
+    return false;
+  }
+
+  const char type = block[type_offset];
+  const uint64_t size = read_number(block + size_offset, size_size);
+  remaining_ = size;
+  padding_ = tar_padding(size);
+
+  // The long name applies to the next entry
+  if (type == tar_type_long_name) {
+    long_name_.clear();
+    state_ = size > 0 ? state::long_name : state::header;
+    return true;
+  }
+
+  // Full name of the entry: long name, or ustar prefix + name
+  std::string name;
+  if (has_long_name_) {
+    name = long_name_;
+    has_long_name_ = false;
+  } else {
+    name.assign(block + name_offset,
+                strnlen(block + name_offset, name_size));
+    const std::string prefix(block + prefix_offset,
+                             strnlen(block + prefix_offset, prefix_size));
+    if (!prefix.empty()) {
+      name = prefix + "/" + name;
+    }
+  }
+  mode_ = mode_t(read_number(block + mode_offset, mode_size));
+  mtime_ = time_t(read_number(block + mtime_offset, mtime_size));
+
+  const std::filesystem::path relative_path =
+      std::filesystem::path(name).lexically_normal();
+  const bool safe = is_safe_path(relative_path);
+  if (!safe) {
+    std::cerr << "[Tar] " << "Skipping unsafe entry \"" << name << "\""
+              << std::endl;
+  }
+  // "dir/" names dir
+  path_ = relative_path.has_filename() ? relative_path
+                                       : relative_path.parent_path();
+
+  // Directory
+  if (type == tar_type_directory) {
+    if (safe && make_directories(path_)) {
+      directories_++;
+    }
+    state_ = size > 0 ? state::body : state::header;
+    return true;
+  }
+
+  // Regular file (old tars use NUL as type), replacing what is there
+  if ((type == tar_type_file || type == '\0') && safe) {
+    const int parent_fd = open_parent(path_);
+    if (parent_fd != -1) {
+      const auto name = path_.filename();
+      const int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+      fd_ = openat(parent_fd, name.c_str(), flags, 0600);
+      if (fd_ == -1 && errno == EEXIST &&
+          unlinkat(parent_fd, name.c_str(), 0) == 0) {
+        fd_ = openat(parent_fd, name.c_str(), flags, 0600);
+      }
+      const int error = errno;
+      close(parent_fd);
+      errno = error;
+    }
+    if (fd_ == -1) {
+      std::cerr << "[Tar] " << "Cannot extract " << path_ << ": "
+                << strerror(errno) << std::endl;
+    }
+    if (size == 0) {
+      finish_file();
+      return true;
+    }
+  }
+
+  // Other entry types (links, devices...) are skipped
+  state_ = size > 0 ? state::body : state::header;
+  return true;
+}
+
+// Close the file being extracted and restore its mode and mtime
+void ftp::tar_extractor::finish_file() {
+  if (fd_ == -1) {
+    return;
+  }
+
+  // Permission bits only: a stream must not make setuid, setgid or sticky
+  // files
+  fchmod(fd_, mode_ & 0777);
+  const struct timespec times[2] = {{0, UTIME_OMIT}, {mtime_, 0}};
+  futimens(fd_, times);
+  close(fd_);
+  fd_ = -1;
+  files_++;
+}
+
+// Make a directory and those above it, existing ones being fine
+bool ftp::tar_extractor::make_directories(
+    const std::filesystem::path &relative) {
+  const int parent_fd = open_parent(relative);
+  if (parent_fd == -1) {
+    return false;
+  }
+  const auto name = relative.filename();
+  const bool made =
+      mkdirat(parent_fd, name.c_str(), 0777) == 0 || errno == EEXIST;
+  close(parent_fd);
+  return made;
+}
+
+// Open the directory containing a relative path, making it if needed
+int ftp::tar_extractor::open_parent(const std::filesystem::path &relative) {
+  const auto parent = relative.parent_path();
+  if (parent.empty()) {
+    return fcntl(root_fd_, F_DUPFD_CLOEXEC, 0);
+  }
+  const int flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+  int fd = open_beneath(root_fd_, parent.string(), flags);
+  if (fd == -1 && errno == ENOENT && make_directories(parent)) {
+    fd = open_beneath(root_fd_, parent.string(), flags);
+  }
+  return fd;
+}
@@ -0,0 +1,144 @@
+#include "utils/trace.h"
+
+#ifdef FTP_ENABLE_TRACING
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+// Spans kept per thread, the oldest ones are overwritten
+constexpr size_t ring_size = 8192;
+
+// A finished span, written by the owning thread only and read by
+// render_trace() while it may be overwritten: every field is an atomic, a
+// span found overwritten after reading it is dropped
+struct span {
+  std::atomic<const char *> name = nullptr;
+  std::atomic<uint64_t> start = 0;
+  std::atomic<uint64_t> end = 0;
+  std::atomic<int> thread_id = 0;
+};
+
+struct span_ring {
+  span spans[ring_size];
+  std::atomic<uint64_t> written = 0; // Spans recorded so far
+  std::atomic<bool> in_use = false;
+};
+
+// Rings of all threads; those of exited threads are kept (their spans are
+// the ones of ended sessions) and handed to new threads
+std::mutex rings_mutex;
+std::vector<std::unique_ptr<span_ring>> rings;
+
+// Start of the trace, times are relative to it
+const uint64_t trace_start = ftp::trace_clock();
+
+span_ring *attach_ring() {
+  std::lock_guard<std::mutex> lock(rings_mutex);
+  for (const auto &ring : rings) {
+    if (!ring->in_use.load(std::memory_order_acquire)) {
+      ring->in_use.store(true, std::memory_order_relaxed);
+      return ring.get();
+    }
+  }
+  rings.push_back(std::make_unique<span_ring>());
+  rings.back()->in_use.store(true, std::memory_order_relaxed);
+  return rings.back().get();
+}
+
+void detach_ring(span_ring *ring) {
+  ring->in_use.store(false, std::memory_order_release);
+}
+
+// Ring of the calling thread, attached on first use
+span_ring &local_ring() {
+  thread_local span_ring *ring = nullptr;
+  if (ring == nullptr) [[unlikely]] {
+    ring = attach_ring();
+    thread_local const std::unique_ptr<span_ring, void (*)(span_ring *)>
+        release(ring, &detach_ring);
+  }
+  return *ring;
+}
+
+// Microseconds since the start of the trace, as Chrome expects them
+std::string microseconds(uint64_t nanoseconds) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.3f", double(nanoseconds) / 1e3);
+  return text;
+}
+
+} // namespace
+
+// Record a finished span in the ring of the calling thread
+void ftp::record_span(const char *name, uint64_t start, uint64_t end) {
+  thread_local const int thread_id = int(gettid());
+  auto &ring = local_ring();
+  const uint64_t index = ring.written.load(std::memory_order_relaxed);
+  auto &s = ring.spans[index % ring_size];
+  s.name.store(name, std::memory_order_relaxed);
+  s.start.store(start, std::memory_order_relaxed);
+  s.end.store(end, std::memory_order_relaxed);
+  s.thread_id.store(thread_id, std::memory_order_relaxed);
+  ring.written.store(index + 1, std::memory_order_release);
+}
+
+// Spans of all threads, as Chrome trace-event JSON
+std::string ftp::render_trace() {
+  struct copied_span {
+    uint64_t index;
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+    int thread_id;
+  };
+
+  const std::string pid = std::to_string(getpid());
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+
+  std::lock_guard<std::mutex> lock(rings_mutex);
+  for (const auto &ring : rings) {
+    const uint64_t written = ring->written.load(std::memory_order_acquire);
+    const uint64_t oldest = written > ring_size ? written - ring_size : 0;
+    std::vector<copied_span> copied;
+    copied.reserve(written - oldest);
+    for (uint64_t i = oldest; i < written; ++i) {
+      const auto &s = ring->spans[i % ring_size];
+      copied.push_back({i, s.name.load(std::memory_order_relaxed),
+                        s.start.load(std::memory_order_relaxed),
+                        s.end.load(std::memory_order_relaxed),
+                        s.thread_id.load(std::memory_order_relaxed)});
+    }
+
+    // The owning thread kept recording: spans it overwrote meanwhile, or is
+    // overwriting, may have been read half old, half new
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t now_written = ring->written.load(std::memory_order_relaxed);
+    const uint64_t valid_from =
+        now_written + 1 > ring_size ? now_written + 1 - ring_size : 0;
+
+    for (const auto &s : copied) {
+      if (s.index < valid_from || s.name == nullptr || s.end < s.start ||
+          s.start < trace_start) {
+        continue;
+      }
+      out += first ? "" : ",";
+      first = false;
+      out += std::string("{\"name\":\"") + s.name + "\",\"ph\":\"X\",\"ts\":" +
+             microseconds(s.start - trace_start) +
+             ",\"dur\":" + microseconds(s.end - s.start) + ",\"pid\":" + pid +
+             ",\"tid\":" + std::to_string(s.thread_id) + "}";
+    }
+  }
+  out += "]}\n";
+  return out;
+}
+
+#endif
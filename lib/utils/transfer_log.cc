@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <json/json.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/config.h"
+#include "utils/transfer_log.h"
+
+namespace {
+
+// Parse "xferlog" or "json" (defaults to xferlog)
+ftp::transfer_log_format parse_format(const std::string &name) {
+  return name == "json" ? ftp::transfer_log_format::json
+                        : ftp::transfer_log_format::xferlog;
+}
+
+// Write all of data to fd
+bool write_all(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    written += size_t(n);
+  }
+  return true;
+}
+
+} // namespace
+
+// Constructor, starts the writer when enabled
+ftp::transfer_log::transfer_log(const transfer_log_settings &settings)
+    : settings_(settings), ring_(settings.queue_size) {
+  if (!settings_.enabled) {
+    return;
+  }
+  if (!open_log()) {
+    settings_.enabled = false;
+    return;
+  }
+  writer_ = std::thread([this]() { run(); });
+}
+
+// Destructor
+ftp::transfer_log::~transfer_log() {
+  stop();
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+// Server-wide instance, configured by "transferLog" in config.json
+ftp::transfer_log &ftp::transfer_log::instance() {
+  static transfer_log log = []() {
+    const auto config = ftp::read_config()["transferLog"];
+    transfer_log_settings s;
+    s.enabled = config.get("enabled", s.enabled).asBool();
+    s.path = config.get("path", s.path).asString();
+    s.format = parse_format(config.get("format", "xferlog").asString());
+    s.max_bytes =
+        config.get("maxBytes", Json::UInt64(s.max_bytes)).asUInt64();
+    s.keep = config.get("keep", Json::UInt64(s.keep)).asUInt64();
+    s.queue_size =
+        config.get("queueSize", Json::UInt64(s.queue_size)).asUInt64();
+    s.flush_interval = std::chrono::milliseconds(
+        config.get("flushIntervalMillis", Json::UInt64(200)).asUInt64());
+
+    if (s.enabled) {
+      std::clog << "[TransferLog] " << "Logging transfers to " << s.path
+                << " ("
+                << (s.format == transfer_log_format::json ? "json" : "xferlog")
+                << ")" << std::endl;
+    }
+    return transfer_log(s);
+  }();
+  return log;
+}
+
+bool ftp::transfer_log::enabled() const { return settings_.enabled; }
+
+// Queue a record, never blocks
+void ftp::transfer_log::record(transfer_record record) {
+  if (!settings_.enabled) {
+    return;
+  }
+  if (!ring_.try_push(record)) {
+    dropped_++;
+  }
+}
+
+// Write what is queued and stop the writer
+void ftp::transfer_log::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+}
+
+// Records written and dropped
+uint64_t ftp::transfer_log::written() const { return written_; }
+uint64_t ftp::transfer_log::dropped() const { return dropped_; }
+
+// Writer thread
+void ftp::transfer_log::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    wake_.wait_for(lock, settings_.flush_interval, [this]() {
+      return stopping_;
+    });
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+  // Records queued while the last batch was written
+  drain();
+}
+
+// Write the queued records
+void ftp::transfer_log::drain() {
+  std::string batch;
+  transfer_record record;
+  uint64_t count = 0;
+  while (ring_.try_pop(record)) {
+    batch += format(record);
+    count++;
+  }
+  if (batch.empty()) {
+    return;
+  }
+
+  if (log_size_ > 0 && log_size_ + batch.size() > settings_.max_bytes) {
+    rotate();
+  }
+  if (fd_ == -1 || !write_all(fd_, batch)) {
+    std::cerr << "[TransferLog] " << "Cannot write to " << settings_.path
+              << ": " << strerror(errno) << std::endl;
+    dropped_ += count;
+    return;
+  }
+  log_size_ += batch.size();
+  written_ += count;
+}
+
+// Line of a record, in the configured format
+std::string
+ftp::transfer_log::format(const transfer_record &record) const {
+  const time_t finished =
+      std::chrono::system_clock::to_time_t(record.finished);
+  const bool download = record.direction == transfer_direction::download;
+
+  if (settings_.format == transfer_log_format::json) {
+    struct tm utc;
+    gmtime_r(&finished, &utc);
+    char time_text[32];
+    strftime(time_text, sizeof(time_text), "%Y-%m-%dT%H:%M:%SZ", &utc);
+    const double seconds = double(record.duration_nanoseconds) / 1e9;
+
+    Json::Value line;
+    line["time"] = time_text;
+    line["user"] = record.user;
+    line["remote"] = record.remote_host;
+    line["path"] = record.path;
+    line["direction"] = download ? "download" : "upload";
+    line["mode"] = record.passive ? "passive" : "active";
+    line["bytes"] = Json::UInt64(record.bytes);
+    line["durationMicros"] = Json::UInt64(record.duration_nanoseconds / 1000);
+    line["bytesPerSecond"] =
+        Json::UInt64(seconds > 0 ? double(record.bytes) / seconds : 0);
+    line["outcome"] = record.complete ? "complete" : "incomplete";
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return Json::writeString(builder, line) + "\n";
+  }
+
+  // current-time transfer-time remote-host file-size filename transfer-type
+  // special-action-flag direction access-mode username service-name
+  // authentication-method authenticated-user-id completion-status
+  struct tm local;
+  localtime_r(&finished, &local);
+  char time_text[32];
+  strftime(time_text, sizeof(time_text), "%a %b %e %H:%M:%S %Y", &local);
+  // Whole seconds, at least one
+  const uint64_t seconds = std::max<uint64_t>(
+      (record.duration_nanoseconds + 500000000) / 1000000000, 1);
+  // Fields are separated by spaces
+  std::string path = record.path;
+  std::replace_if(
+      path.begin(), path.end(), [](char c) { return isspace(c) != 0; }, '_');
+
+  return std::string(time_text) + " " + std::to_string(seconds) + " " +
+         record.remote_host + " " + std::to_string(record.bytes) + " " +
+         path + " b _ " + (download ? "o" : "i") + " r " + record.user +
+         " ftp 0 * " + (record.complete ? "c" : "i") + "\n";
+}
+
+// Open the log for appending
+bool ftp::transfer_log::open_log() {
+  fd_ = open(settings_.path.c_str(),
+             O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ == -1) {
+    std::cerr << "[TransferLog] " << "Cannot open " << settings_.path << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  struct stat log_stat;
+  log_size_ = fstat(fd_, &log_stat) == 0 ? uint64_t(log_stat.st_size) : 0;
+  return true;
+}
+
+// Move the log to <path>.1, shifting older ones, and start a new one
+void ftp::transfer_log::rotate() {
+  close(fd_);
+  fd_ = -1;
+  if (settings_.keep == 0) {
+    unlink(settings_.path.c_str());
+  } else {
+    // The oldest one is overwritten
+    for (size_t i = settings_.keep - 1; i >= 1; --i) {
+      const auto from = settings_.path + "." + std::to_string(i);
+      const auto to = settings_.path + "." + std::to_string(i + 1);
+      rename(from.c_str(), to.c_str());
+    }
+    rename(settings_.path.c_str(), (settings_.path + ".1").c_str());
+  }
+  std::clog << "[TransferLog] " << "Rotated " << settings_.path << std::endl;
+  open_log();
+}
@@ -0,0 +1,241 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <unistd.h>
+
+#include "utils/buffer_pool.h"
+#include "utils/config.h"
+#include "utils/spsc_ring.h"
+#include "utils/trace.h"
+#include "utils/upload_pipeline.h"
+
+namespace {
+
+// A block of the pool on its way from the network to the disk
+struct block {
+  char *data = nullptr;
+  size_t size = 0; // 0 marks the end of the stream
+  uint64_t offset = 0;
+};
+
+// Slow disk emulation: take as long as the emulated disk would
+class disk_emulator {
+public:
+  explicit disk_emulator(const ftp::upload_pipeline_settings &settings)
+      : settings_(settings) {}
+
+  void wrote(size_t bytes) {
+    if (settings_.emulated_disk_rate != 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(
+          bytes * 1000000 / settings_.emulated_disk_rate));
+    }
+    if (settings_.emulated_stall_millis == 0) {
+      return;
+    }
+    since_stall_ += bytes;
+    if (since_stall_ >= settings_.emulated_stall_every_bytes) {
+      since_stall_ = 0;
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(settings_.emulated_stall_millis));
+    }
+  }
+
+private:
+  const ftp::upload_pipeline_settings &settings_;
+  uint64_t since_stall_ = 0;
+};
+
+// Write a whole block at its offset
+bool write_block(int fd, const block &b, disk_emulator &disk) {
+  FTP_TRACE_SCOPE("write block");
+  size_t written = 0;
+  while (written < b.size) {
+    const ssize_t n = pwrite(fd, b.data + written, b.size - written,
+                             off_t(b.offset + written));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "[Upload] " << "Error: " << strerror(errno) << std::endl;
+      return false;
+    }
+    written += n;
+  }
+  disk.wrote(b.size);
+  return true;
+}
+
+// Read from sock until the block is full or the stream ends
+// Returns false if the connection failed before that
+bool fill_block(sockpp::tcp_socket &sock, block &b, size_t capacity,
+                uint64_t remaining) {
+  const size_t wanted = size_t(std::min<uint64_t>(capacity, remaining));
+  b.size = 0;
+  while (b.size < wanted) {
+    const ssize_t n = sock.read(b.data + b.size, wanted - b.size);
+    if (n <= 0) {
+      std::cerr << "[Upload] " << "Error: " << sock.last_error_str()
+                << std::endl;
+      return false;
+    }
+    b.size += n;
+  }
+  return true;
+}
+
+// Receive size bytes from sock and pass them to write() block by block, in
+// order, on the writer stage
+bool receive_blocks(sockpp::tcp_socket &sock, uint64_t size,
+                    const ftp::upload_pipeline_settings &settings,
+                    const std::function<bool(uint64_t)> &progress,
+                    const std::function<bool(const block &)> &write) {
+  auto &pool = ftp::buffer_pool::instance();
+
+  // Without the pipeline, the session thread reads and writes in turn
+  if (!settings.enabled) {
+    const auto buffer = pool.lease();
+    if (!buffer) {
+      return false;
+    }
+    block b{buffer.data()};
+    uint64_t received = 0;
+    while (received < size) {
+      const bool filled = fill_block(sock, b, buffer.size(), size - received);
+      b.offset = received;
+      if (!write(b) || !filled) {
+        return false;
+      }
+      received += b.size;
+      if (!progress(received)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Blocks circulate between the two stages through two rings: filled
+  // blocks go to the disk writer, written ones come back to be refilled
+  // Fewer blocks than wanted when the pool runs short, but at least one
+  const auto buffers = pool.lease(settings.blocks);
+  if (buffers.empty()) {
+    return false;
+  }
+  ftp::spsc_ring<block> filled_blocks(buffers.size() + 1);
+  ftp::spsc_ring<block> free_blocks(buffers.size());
+  for (const auto &buffer : buffers) {
+    free_blocks.push(block{buffer.data()});
+  }
+
+  // Disk stage
+  std::atomic<bool> disk_failed = false;
+  std::thread disk_writer([&]() {
+    while (true) {
+      const block b = filled_blocks.pop();
+      if (b.size == 0) {
+        return;
+      }
+      // After a failure, keep draining so that the network stage never
+      // waits for a block forever
+      if (!disk_failed.load(std::memory_order_relaxed) && !write(b)) {
+        disk_failed.store(true, std::memory_order_relaxed);
+      }
+      free_blocks.push(b);
+    }
+  });
+
+  // Network stage, waits for a free block when the disk falls behind
+  bool network_failed = false;
+  bool stopped = false;
+  uint64_t received = 0;
+  while (received < size && !disk_failed.load(std::memory_order_relaxed)) {
+    block b = free_blocks.pop();
+    b.offset = received;
+    network_failed =
+        !fill_block(sock, b, pool.buffer_size(), size - received);
+    if (b.size > 0) {
+      filled_blocks.push(b);
+    }
+    received += b.size;
+    if (network_failed) {
+      break;
+    }
+    if (!progress(received)) {
+      stopped = true;
+      break;
+    }
+  }
+
+  // Tell the disk writer that the stream ended, wait for it to finish
+  filled_blocks.push(block{});
+  disk_writer.join();
+  return !network_failed && !stopped && !disk_failed && received == size;
+}
+
+} // namespace
+
+// Server-wide settings, configured by "uploadPipeline" in config.json
+const ftp::upload_pipeline_settings &
+ftp::upload_pipeline_settings::instance() {
+  static const upload_pipeline_settings settings = []() {
+    const auto config = ftp::read_config()["uploadPipeline"];
+    upload_pipeline_settings s;
+    s.enabled = config.get("enabled", s.enabled).asBool();
+    s.blocks = std::max<size_t>(
+        config.get("blocks", Json::UInt64(s.blocks)).asUInt64(), 2);
+    const auto emulated_disk = config["emulatedDisk"];
+    s.emulated_disk_rate = emulated_disk.get("bytesPerSecond", 0).asUInt64();
+    s.emulated_stall_millis = emulated_disk.get("stallMillis", 0).asUInt64();
+    s.emulated_stall_every_bytes = std::max<uint64_t>(
+        emulated_disk
+            .get("stallEveryBytes", Json::UInt64(s.emulated_stall_every_bytes))
+            .asUInt64(),
+        1);
+
+    std::clog << "[Upload] " << "Pipeline "
+              << (s.enabled ? "enabled" : "disabled") << ", " << s.blocks
+              << " blocks" << std::endl;
+    if (s.emulated_disk_rate != 0 || s.emulated_stall_millis != 0) {
+      std::clog << "[Upload] " << "Emulating a slow disk: "
+                << s.emulated_disk_rate << " bytes/s, "
+                << s.emulated_stall_millis << " ms stall every "
+                << s.emulated_stall_every_bytes << " bytes" << std::endl;
+    }
+    return s;
+  }();
+  return settings;
+}
+
+// Receive size bytes from sock and write them to fd, starting at offset 0
+bool ftp::receive_to_file(sockpp::tcp_socket &sock, int fd, uint64_t size,
+                          const upload_pipeline_settings &settings,
+                          const std::function<bool(uint64_t)> &progress) {
+  FTP_TRACE_SCOPE("receive to file");
+  disk_emulator disk(settings);
+  return receive_blocks(sock, size, settings, progress, [&](const block &b) {
+    return write_block(fd, b, disk);
+  });
+}
+
+// Receive size bytes from sock into an upload of the storage
+bool ftp::receive_to_upload(sockpp::tcp_socket &sock, vfs_upload &upload,
+                            uint64_t size,
+                            const upload_pipeline_settings &settings,
+                            const std::function<bool(uint64_t)> &progress) {
+  // Local files are written at their offsets
+  if (upload.fd() != -1) {
+    return receive_to_file(sock, upload.fd(), size, settings, progress);
+  }
+  FTP_TRACE_SCOPE("receive to upload");
+  return receive_blocks(sock, size, settings, progress, [&](const block &b) {
+    FTP_TRACE_SCOPE("write block");
+    if (!upload.write(b.data, b.size)) {
+      std::cerr << "[Upload] " << "Error: " << strerror(errno) << std::endl;
+      return false;
+    }
+    return true;
+  });
+}
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/socket.h>
+
+#include "utils/buffer_pool.h"
+#include "utils/config.h"
+#include "utils/vfs.h"
+#include "utils/vfs_local.h"
+#include "utils/vfs_memory.h"
+#include "utils/vfs_object_store.h"
+#include "utils/vfs_sharded.h"
+
+namespace {
+
+// Directory of a backend without descriptors, known by its path
+class path_directory : public ftp::vfs_directory {
+public:
+  path_directory(ftp::vfs &storage, std::string path)
+      : storage_(&storage), path_(std::move(path)) {}
+
+  std::string path() const override {
+    return storage_->stat(path_).is_directory ? path_ : "";
+  }
+
+private:
+  ftp::vfs *storage_;
+  std::string path_;
+};
+
+} // namespace
+
+// Send bytes of the file through a pool buffer
+ssize_t ftp::vfs_file::send(int socket_fd, uint64_t offset, size_t count) {
+  const auto buffer = ftp::buffer_pool::instance().lease();
+  if (!buffer) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  const ssize_t n = read(buffer.data(), std::min(count, buffer.size()), offset);
+  if (n <= 0) {
+    return n;
+  }
+  ssize_t sent = 0;
+  while (sent < n) {
+    const ssize_t written =
+        ::send(socket_fd, buffer.data() + sent, size_t(n - sent), MSG_NOSIGNAL);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return sent > 0 ? sent : -1;
+    }
+    sent += written;
+  }
+  return sent;
+}
+
+// Server-wide instance, configured by "storage" in config.json
+ftp::vfs &ftp::vfs::instance() {
+  static const std::unique_ptr<vfs> storage = []() -> std::unique_ptr<vfs> {
+    const auto root = ftp::read_config();
+    const auto config = root["storage"];
+    const auto backend = config.get("backend", "local").asString();
+
+    if (backend == "memory") {
+      const uint64_t capacity =
+          config["memory"].get("capacityBytes", 1073741824).asUInt64();
+      std::clog << "[VFS] " << "Memory storage, up to " << capacity
+                << " bytes" << std::endl;
+      return std::make_unique<memory_vfs>(capacity);
+    }
+
+    if (backend == "s3") {
+      const auto store = config["objectStore"];
+      object_store_settings settings;
+      settings.endpoint = store.get("endpoint", "127.0.0.1:9000").asString();
+      settings.bucket = store.get("bucket", "simple-ftp").asString();
+      settings.region = store.get("region", "us-east-1").asString();
+      settings.access_key = store.get("accessKey", "").asString();
+      settings.secret_key = store.get("secretKey", "").asString();
+      settings.part_bytes = std::max<uint64_t>(
+          store.get("partBytes", 8388608).asUInt64(), 5 * 1024 * 1024);
+      settings.connections = store.get("connections", 16).asUInt64();
+      std::clog << "[VFS] " << "Object storage: bucket " << settings.bucket
+                << " at " << settings.endpoint << ", parts of "
+                << settings.part_bytes << " bytes" << std::endl;
+      return std::make_unique<object_store_vfs>(settings);
+    }
+
+    if (backend == "sharded") {
+      const auto sharded = config["sharded"];
+      std::vector<std::filesystem::path> roots;
+      for (const auto &root : sharded["roots"]) {
+        roots.emplace_back(root.asString());
+      }
+      if (!roots.empty()) {
+        auto storage = std::make_unique<sharded_vfs>(
+            roots, sharded.get("virtualNodes", 128).asUInt64());
+        std::clog << "[VFS] " << "Sharded storage over " << roots.size()
+                  << " roots" << std::endl;
+        if (sharded.get("rebalanceOnStart", false).asBool()) {
+          storage->start_rebalance();
+        }
+        return storage;
+      }
+      std::cerr << "[VFS] " << "No roots for the sharded storage, using "
+                << "local" << std::endl;
+    } else if (backend != "local") {
+      std::cerr << "[VFS] " << "Unknown storage backend " << backend
+                << ", using local" << std::endl;
+    }
+    // The shared directory, or the home directory if not set
+    std::filesystem::path directory = root["workingDirectory"].asString();
+    if (directory.empty()) {
+      const char *home = getenv("HOME");
+      directory = home != nullptr ? home : "/";
+    }
+    std::clog << "[VFS] " << "Local storage in " << directory.string()
+              << std::endl;
+    return std::make_unique<local_vfs>(directory);
+  }();
+  return *storage;
+}
+
+// Remember the path of a directory
+std::unique_ptr<ftp::vfs_directory>
+ftp::vfs::open_directory(const std::string &path) {
+  const auto status = stat(path);
+  if (!status.exists) {
+    return nullptr;
+  }
+  if (!status.is_directory) {
+    errno = ENOTDIR;
+    return nullptr;
+  }
+  return std::make_unique<path_directory>(*this, path);
+}
+
+// Parent and last component of an absolute client path
+std::pair<std::string, std::string>
+ftp::split_path(const std::string &path) {
+  const auto separator = path.find_last_of('/');
+  if (separator == std::string::npos) {
+    return {"/", path};
+  }
+  return {separator == 0 ? "/" : path.substr(0, separator),
+          path.substr(separator + 1)};
+}
+
+// Client path of an entry of a directory
+std::string ftp::join_path(const std::string &directory,
+                           const std::string &name) {
+  if (directory.empty() || directory.back() == '/') {
+    return directory + name;
+  }
+  return directory + "/" + name;
+}
@@ -0,0 +1,594 @@
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "utils/durability.h"
+#include "utils/vfs_local.h"
+
+namespace {
+
+// Kernels older than 5.6 have no openat2()
+std::atomic<bool> has_openat2 = true;
+
+// Record returned by getdents64(), which glibc does not declare
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// Path relative to the root of an absolute client path
+std::string relative(const std::string &path) {
+  const auto start = path.find_first_not_of('/');
+  return start == std::string::npos ? "." : path.substr(start);
+}
+
+// Status of a file
+ftp::vfs_status to_status(const struct stat &file_stat) {
+  ftp::vfs_status status;
+  status.exists = true;
+  status.is_directory = S_ISDIR(file_stat.st_mode);
+  status.is_regular = S_ISREG(file_stat.st_mode);
+  status.size = uint64_t(file_stat.st_size);
+  status.mtime = file_stat.st_mtim.tv_sec;
+  status.mtime_ns = int64_t(file_stat.st_mtim.tv_sec) * 1000000000 +
+                    file_stat.st_mtim.tv_nsec;
+  status.mode = file_stat.st_mode & 07777;
+  return status;
+}
+
+// A local file, sent straight from the page cache
+class local_file : public ftp::vfs_file {
+public:
+  local_file(int fd, const ftp::vfs_status &status)
+      : fd_(fd), status_(status) {}
+  ~local_file() override { close(fd_); }
+
+  const ftp::vfs_status &status() const override { return status_; }
+
+  ssize_t read(char *buffer, size_t count, uint64_t offset) override {
+    while (true) {
+      const ssize_t n = pread(fd_, buffer, count, off_t(offset));
+      if (n != -1 || errno != EINTR) {
+        return n;
+      }
+    }
+  }
+
+  ssize_t send(int socket_fd, uint64_t offset, size_t count) override {
+    off_t position = off_t(offset);
+    return sendfile(socket_fd, fd_, &position, count);
+  }
+
+  int fd() const override { return fd_; }
+
+private:
+  int fd_;
+  ftp::vfs_status status_;
+};
+
+// An upload written to a hidden temporary file in the directory of its
+// destination, so that rename() is atomic
+class local_upload : public ftp::vfs_upload {
+public:
+  // Takes ownership of directory_fd and fd
+  local_upload(int directory_fd, std::string temp_name,
+               std::string final_name, int fd)
+      : directory_fd_(directory_fd), temp_name_(std::move(temp_name)),
+        final_name_(std::move(final_name)), fd_(fd) {}
+
+  ~local_upload() override {
+    if (fd_ != -1) {
+      close(fd_);
+    }
+    if (!committed_) {
+      unlinkat(directory_fd_, temp_name_.c_str(), 0);
+    }
+    close(directory_fd_);
+  }
+
+  bool write(const char *data, size_t size) override {
+    while (size > 0) {
+      const ssize_t n = ::write(fd_, data, size);
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data += n;
+      size -= size_t(n);
+    }
+    return true;
+  }
+
+  int fd() const override { return fd_; }
+
+  bool commit() override {
+    // Make the contents durable before they become visible
+    auto &durability = ftp::durability_manager::instance();
+    if (fd_ == -1 || !durability.sync(fd_)) {
+      return false;
+    }
+    close(fd_);
+    fd_ = -1;
+
+    // Atomically replace the destination
+    if (renameat(directory_fd_, temp_name_.c_str(), directory_fd_,
+                 final_name_.c_str()) == -1) {
+      return false;
+    }
+    committed_ = true;
+
+    // Make the rename itself durable
+    if (durability.policy() != ftp::durability_policy::none &&
+        !durability.sync(directory_fd_)) {
+      std::cerr << "[FS] " << "Failed to sync the directory of "
+                << final_name_ << std::endl;
+    }
+    return true;
+  }
+
+private:
+  int directory_fd_;
+  std::string temp_name_;
+  std::string final_name_;
+  int fd_;
+  bool committed_ = false;
+};
+
+// Where a descriptor leads, as /proc tells it; empty if it cannot
+std::string fd_path(int fd) {
+  char target[PATH_MAX];
+  const auto link = "/proc/self/fd/" + std::to_string(fd);
+  const ssize_t length = readlink(link.c_str(), target, sizeof(target));
+  if (length <= 0 || size_t(length) == sizeof(target)) {
+    return "";
+  }
+  return std::string(target, size_t(length));
+}
+
+// Working directory held open: its path is read back from the descriptor,
+// so that it follows the directory when it is renamed
+class local_directory : public ftp::vfs_directory {
+public:
+  local_directory(int fd, std::string path, std::string root_real)
+      : fd_(fd), path_(std::move(path)), root_real_(std::move(root_real)) {}
+  ~local_directory() override { close(fd_); }
+  local_directory(const local_directory &) = delete;
+  local_directory &operator=(const local_directory &) = delete;
+
+  std::string path() const override {
+    struct stat directory_stat;
+    if (fstat(fd_, &directory_stat) == -1 || directory_stat.st_nlink == 0) {
+      return "";
+    }
+    const auto host = fd_path(fd_);
+    if (host.empty()) {
+      return path_; // No /proc: where it was opened
+    }
+    if (host == root_real_) {
+      return "/";
+    }
+    // Moved out of the root on the host, if not beneath it
+    if (host.compare(0, root_real_.size(), root_real_) != 0 ||
+        host[root_real_.size()] != '/') {
+      return "";
+    }
+    return host.substr(root_real_.size());
+  }
+
+private:
+  int fd_;
+  std::string path_;
+  std::string root_real_;
+};
+
+// Open relative beneath dir_fd without openat2(): walk it one component at
+// a time with O_NOFOLLOW, refusing ".." (EXDEV) and symbolic links
+// (ELOOP), which could lead out of dir_fd
+int walk_beneath(int dir_fd, const std::string &relative, int flags,
+                 mode_t mode) {
+  int current = dir_fd;
+  auto fail = [&](int error) {
+    if (current != dir_fd) {
+      close(current);
+    }
+    errno = error;
+    return -1;
+  };
+  size_t start = 0;
+  while (true) {
+    const size_t end = relative.find('/', start);
+    std::string component = relative.substr(start, end - start);
+    if (component == "..") {
+      return fail(EXDEV);
+    }
+    if (end == std::string::npos) {
+      if (component.empty()) {
+        component = ".";
+      }
+      const int fd =
+          openat(current, component.c_str(), flags | O_NOFOLLOW, mode);
+      int error = errno;
+      // O_PATH opens a symbolic link itself
+      struct stat file_stat;
+      if (fd != -1 && fstat(fd, &file_stat) == 0 &&
+          S_ISLNK(file_stat.st_mode)) {
+        close(fd);
+        return fail(ELOOP);
+      }
+      if (fd == -1) {
+        return fail(error);
+      }
+      if (current != dir_fd) {
+        close(current);
+      }
+      return fd;
+    }
+    start = end + 1;
+    if (component.empty() || component == ".") {
+      continue;
+    }
+    const int next = openat(current, component.c_str(),
+                            O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (next == -1) {
+      return fail(errno);
+    }
+    if (current != dir_fd) {
+      close(current);
+    }
+    current = next;
+  }
+}
+
+} // namespace
+
+// Open relative beneath dir_fd
+int ftp::open_beneath(int dir_fd, const std::string &relative, int flags,
+                      mode_t mode) {
+  flags |= O_CLOEXEC;
+  if (has_openat2.load(std::memory_order_relaxed)) {
+    struct open_how how = {};
+    how.flags = uint64_t(flags);
+    // The mode may only be given along with O_CREAT or O_TMPFILE
+    if (flags & (O_CREAT | O_TMPFILE)) {
+      how.mode = mode;
+    }
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    const long fd = syscall(SYS_openat2, dir_fd, relative.c_str(), &how,
+                            sizeof(how));
+    if (fd != -1 || errno != ENOSYS) {
+      return int(fd);
+    }
+    // Paths are then walked one component at a time
+    has_openat2 = false;
+    std::cerr << "[FS] " << "openat2() is not available, symbolic links "
+              << "below the root are refused" << std::endl;
+  }
+  return walk_beneath(dir_fd, relative, flags, mode);
+}
+
+// Is name that of the temporary file of an upload in progress?
+bool ftp::is_upload_name(const std::string &name) {
+  const std::string suffix = ".part";
+  if (name.size() <= suffix.size() + 1 || name[0] != '.' ||
+      name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+    return false;
+  }
+  // "<pid>-<counter>" between the last "." before the suffix and the suffix
+  const auto end = name.size() - suffix.size();
+  const auto start = name.rfind('.', end - 1);
+  if (start == 0 || start == std::string::npos) {
+    return false;
+  }
+  const auto counter = name.substr(start + 1, end - start - 1);
+  const auto dash = counter.find('-');
+  return dash != std::string::npos && dash > 0 &&
+         dash + 1 < counter.size() &&
+         counter.find_first_not_of("0123456789-") == std::string::npos &&
+         counter.find('-', dash + 1) == std::string::npos;
+}
+
+// Open the root
+ftp::local_vfs::local_vfs(const std::filesystem::path &root) {
+  std::error_code error;
+  root_path_ = std::filesystem::absolute(root, error).lexically_normal();
+  // Without trailing separator, like the keys of the server-wide caches
+  if (!root_path_.has_filename() && root_path_ != "/") {
+    root_path_ = root_path_.parent_path();
+  }
+  root_fd_ = ::open(root_path_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd_ == -1) {
+    std::cerr << "[FS] " << "Cannot open " << root_path_ << ": "
+              << strerror(errno) << std::endl;
+    return;
+  }
+  root_real_ = fd_path(root_fd_);
+  if (root_real_ == "/") {
+    root_real_.clear();
+  }
+}
+
+// Close the root
+ftp::local_vfs::~local_vfs() {
+  if (root_fd_ != -1) {
+    close(root_fd_);
+  }
+}
+
+// Could the root be opened?
+bool ftp::local_vfs::is_open() const { return root_fd_ != -1; }
+
+// Path on the server of a client path
+std::string ftp::local_vfs::location(const std::string &path) const {
+  const auto path_relative = relative(path);
+  if (path_relative == ".") {
+    return root_path_.string();
+  }
+  return (root_path_ / path_relative).string();
+}
+
+// Status of a path, following symbolic links
+ftp::vfs_status ftp::local_vfs::stat(const std::string &path) {
+  const int fd = open(path, O_PATH);
+  struct stat file_stat;
+  if (fd == -1) {
+    return {};
+  }
+  const bool found = fstat(fd, &file_stat) == 0;
+  close(fd);
+  return found ? to_status(file_stat) : vfs_status();
+}
+
+// Read a directory with getdents64(), one batch of entries at a time, and
+// describe every entry with statx() unless its type is enough, symbolic
+// links by their target beneath the root
+bool ftp::local_vfs::list(
+    const std::string &path, bool types_only,
+    const std::function<bool(const vfs_entry &)> &visit) {
+  const int fd = open(path, O_RDONLY | O_DIRECTORY);
+  if (fd == -1) {
+    return false;
+  }
+
+  alignas(8) char buffer[32 * 1024];
+  vfs_entry entry;
+  while (true) {
+    const long length = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      const int error = errno;
+      close(fd);
+      errno = error;
+      return length == 0;
+    }
+    for (long position = 0; position < length;) {
+      const auto record =
+          reinterpret_cast<const linux_dirent64 *>(buffer + position);
+      position += record->d_reclen;
+      const char *name = record->d_name;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        continue;
+      }
+
+      entry.name = name;
+      entry.is_link = record->d_type == DT_LNK;
+      entry.status = vfs_status();
+      entry.status.exists = true;
+      if (types_only &&
+          (record->d_type == DT_REG || record->d_type == DT_DIR)) {
+        entry.status.is_directory = record->d_type == DT_DIR;
+        entry.status.is_regular = record->d_type == DT_REG;
+      } else {
+        // The entry itself: following a symbolic link here would tell the
+        // type, size and time of a target out of the root
+        struct statx entry_stat;
+        if (statx(fd, name, AT_SYMLINK_NOFOLLOW,
+                  STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME,
+                  &entry_stat) == -1) {
+          continue; // Removed since it was read
+        }
+        entry.is_link = S_ISLNK(entry_stat.stx_mode);
+        if (entry.is_link) {
+          // Its target, resolved beneath the root like RETR does; links
+          // leading out of it, or nowhere, are not listed
+          const auto target = stat(join_path(path, name));
+          if (!target.exists) {
+            continue;
+          }
+          entry.status = target;
+        } else {
+          entry.status.is_directory = S_ISDIR(entry_stat.stx_mode);
+          entry.status.is_regular = S_ISREG(entry_stat.stx_mode);
+          entry.status.size = entry_stat.stx_size;
+          entry.status.mtime = entry_stat.stx_mtime.tv_sec;
+          entry.status.mtime_ns =
+              entry_stat.stx_mtime.tv_sec * 1000000000 +
+              entry_stat.stx_mtime.tv_nsec;
+          entry.status.mode = entry_stat.stx_mode & 07777;
+        }
+      }
+      // Entries other than files and directories are skipped
+      if (!entry.status.is_directory && !entry.status.is_regular) {
+        continue;
+      }
+      if (!visit(entry)) {
+        close(fd);
+        return true;
+      }
+    }
+  }
+}
+
+// Open a regular file for reading
+std::unique_ptr<ftp::vfs_file>
+ftp::local_vfs::open_read(const std::string &path) {
+  // O_NONBLOCK keeps a FIFO from blocking the session
+  const int fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    const int error = errno;
+    close(fd);
+    errno = error;
+    return nullptr;
+  }
+  // Directories are sent as archives, special files not at all
+  if (!S_ISREG(file_stat.st_mode)) {
+    close(fd);
+    errno = S_ISDIR(file_stat.st_mode) ? EISDIR : EINVAL;
+    return nullptr;
+  }
+  return std::make_unique<local_file>(fd, to_status(file_stat));
+}
+
+// Create the temporary file of an upload next to its destination
+std::unique_ptr<ftp::vfs_upload>
+ftp::local_vfs::open_write(const std::string &path) {
+  std::string name;
+  const int directory_fd = open_parent(path, name);
+  if (directory_fd == -1) {
+    return nullptr;
+  }
+
+  // Hidden temporary file in the same directory, so that rename() is atomic
+  // The mode is the usual one, the umask applies
+  static std::atomic<uint64_t> upload_counter = 0;
+  std::string temp_name;
+  int fd = -1;
+  for (int attempt = 0; fd == -1 && attempt < 16; ++attempt) {
+    temp_name = "." + name + "." + std::to_string(getpid()) + "-" +
+                std::to_string(upload_counter++) + ".part";
+    fd = openat(directory_fd, temp_name.c_str(),
+                O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0666);
+    if (fd == -1 && errno != EEXIST) {
+      break;
+    }
+  }
+  if (fd == -1) {
+    const int error = errno;
+    close(directory_fd);
+    errno = error;
+    return nullptr;
+  }
+  return std::make_unique<local_upload>(directory_fd, temp_name, name, fd);
+}
+
+// Rename a file or a directory, renameat2() refuses to replace one
+bool ftp::local_vfs::rename(const std::string &from, const std::string &to) {
+  std::string old_name;
+  std::string new_name;
+  const int old_parent_fd = open_parent(from, old_name);
+  const int new_parent_fd = open_parent(to, new_name);
+  int result = -1;
+  if (old_parent_fd != -1 && new_parent_fd != -1) {
+    result = renameat2(old_parent_fd, old_name.c_str(), new_parent_fd,
+                       new_name.c_str(), RENAME_NOREPLACE);
+    // File systems without RENAME_NOREPLACE: check first
+    if (result == -1 && errno == EINVAL) {
+      struct stat new_stat;
+      if (fstatat(new_parent_fd, new_name.c_str(), &new_stat,
+                  AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+      } else {
+        result = renameat(old_parent_fd, old_name.c_str(), new_parent_fd,
+                          new_name.c_str());
+      }
+    }
+  }
+  const int error = errno;
+  for (const int fd : {old_parent_fd, new_parent_fd}) {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+  errno = error;
+  return result == 0;
+}
+
+// Remove a file, unlinkat() checks that it is not a directory
+bool ftp::local_vfs::remove(const std::string &path) {
+  std::string name;
+  const int parent_fd = open_parent(path, name);
+  if (parent_fd == -1) {
+    return false;
+  }
+  const int result = unlinkat(parent_fd, name.c_str(), 0);
+  const int error = errno;
+  close(parent_fd);
+  errno = error;
+  return result == 0;
+}
+
+// Remove an empty directory
+bool ftp::local_vfs::remove_directory(const std::string &path) {
+  std::string name;
+  const int parent_fd = open_parent(path, name);
+  if (parent_fd == -1) {
+    return false;
+  }
+  const int result = unlinkat(parent_fd, name.c_str(), AT_REMOVEDIR);
+  const int error = errno;
+  close(parent_fd);
+  errno = error;
+  return result == 0;
+}
+
+// Create a directory, mkdirat() fails if it already exists
+bool ftp::local_vfs::make_directory(const std::string &path) {
+  std::string name;
+  const int parent_fd = open_parent(path, name);
+  if (parent_fd == -1) {
+    return false;
+  }
+  const int result = mkdirat(parent_fd, name.c_str(), 0777);
+  const int error = errno;
+  close(parent_fd);
+  errno = error;
+  return result == 0;
+}
+
+// Hold a directory open
+std::unique_ptr<ftp::vfs_directory>
+ftp::local_vfs::open_directory(const std::string &path) {
+  const int fd = open(path, O_PATH | O_DIRECTORY);
+  if (fd == -1) {
+    return nullptr;
+  }
+  return std::make_unique<local_directory>(fd, path, root_real_);
+}
+
+// Open a client path
+int ftp::local_vfs::open(const std::string &path, int flags,
+                         mode_t mode) const {
+  return open_beneath(root_fd_, relative(path), flags, mode);
+}
+
+// Open the directory containing a client path
+int ftp::local_vfs::open_parent(const std::string &path,
+                                std::string &name) const {
+  const auto [parent, last] = split_path(path);
+  if (last.empty()) {
+    errno = EINVAL;
+    return -1;
+  }
+  name = last;
+  if (parent == "/") {
+    return fcntl(root_fd_, F_DUPFD_CLOEXEC, 0);
+  }
+  return open(parent, O_RDONLY | O_DIRECTORY);
+}
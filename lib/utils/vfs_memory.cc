@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "utils/vfs_memory.h"
+
+namespace {
+
+// Current time in nanoseconds since epoch
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Status of a file with these contents, or of a directory
+ftp::vfs_status make_status(bool is_directory, size_t size,
+                            int64_t mtime_ns) {
+  ftp::vfs_status status;
+  status.exists = true;
+  status.is_directory = is_directory;
+  status.is_regular = !is_directory;
+  status.size = is_directory ? 0 : size;
+  status.mtime = mtime_ns / 1000000000;
+  status.mtime_ns = mtime_ns;
+  status.mode = is_directory ? 0755 : 0644;
+  return status;
+}
+
+// A version of a file, sent straight from memory
+class memory_file : public ftp::vfs_file {
+public:
+  memory_file(std::shared_ptr<const std::string> contents,
+              const ftp::vfs_status &status)
+      : contents_(std::move(contents)), status_(status) {}
+
+  const ftp::vfs_status &status() const override { return status_; }
+
+  ssize_t read(char *buffer, size_t count, uint64_t offset) override {
+    if (offset >= contents_->size()) {
+      return 0;
+    }
+    count = std::min<uint64_t>(count, contents_->size() - offset);
+    memcpy(buffer, contents_->data() + offset, count);
+    return ssize_t(count);
+  }
+
+  ssize_t send(int socket_fd, uint64_t offset, size_t count) override {
+    if (offset >= contents_->size()) {
+      return 0;
+    }
+    count = std::min<uint64_t>(count, contents_->size() - offset);
+    while (true) {
+      const ssize_t n = ::send(socket_fd, contents_->data() + offset, count,
+                               MSG_NOSIGNAL);
+      if (n != -1 || errno != EINTR) {
+        return n;
+      }
+    }
+  }
+
+private:
+  std::shared_ptr<const std::string> contents_;
+  ftp::vfs_status status_;
+};
+
+} // namespace
+
+// A new version of a file, built in memory and swapped in by commit()
+class ftp::memory_vfs::upload : public ftp::vfs_upload {
+public:
+  upload(memory_vfs &storage, std::string path)
+      : storage_(storage), path_(std::move(path)) {}
+  ~upload() override { storage_.release(contents_.size()); }
+
+  bool write(const char *data, size_t size) override {
+    if (!storage_.reserve(size)) {
+      return false;
+    }
+    contents_.append(data, size);
+    return true;
+  }
+
+  bool commit() override {
+    const uint64_t size = contents_.size();
+    auto contents = std::make_shared<const std::string>(std::move(contents_));
+    contents_.clear();
+    if (!storage_.install(path_, std::move(contents))) {
+      storage_.release(size);
+      return false;
+    }
+    return true;
+  }
+
+private:
+  memory_vfs &storage_;
+  std::string path_;
+  std::string contents_;
+};
+
+// Constructor, with an empty root
+ftp::memory_vfs::memory_vfs(uint64_t capacity_bytes)
+    : root_(std::make_shared<node>()), capacity_(capacity_bytes) {
+  root_->is_directory = true;
+  root_->mtime_ns = now_ns();
+}
+
+// Paths are only in memory
+std::string ftp::memory_vfs::location(const std::string &path) const {
+  return "memory:" + path;
+}
+
+// Status of a path
+ftp::vfs_status ftp::memory_vfs::stat(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto found = find(path);
+  if (found == nullptr) {
+    return {};
+  }
+  return make_status(found->is_directory,
+                     found->contents ? found->contents->size() : 0,
+                     found->mtime_ns);
+}
+
+// Call visit for the entries of a directory, from a copy taken at once
+bool ftp::memory_vfs::list(
+    const std::string &path, bool types_only,
+    const std::function<bool(const vfs_entry &)> &visit) {
+  std::vector<vfs_entry> entries;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto directory = find(path);
+    if (directory == nullptr) {
+      return false;
+    }
+    if (!directory->is_directory) {
+      errno = ENOTDIR;
+      return false;
+    }
+    entries.reserve(directory->children.size());
+    for (const auto &[name, child] : directory->children) {
+      vfs_entry entry;
+      entry.name = name;
+      entry.status = make_status(
+          child->is_directory, child->contents ? child->contents->size() : 0,
+          child->mtime_ns);
+      entries.push_back(std::move(entry));
+    }
+  }
+  for (const auto &entry : entries) {
+    if (!visit(entry)) {
+      break;
+    }
+  }
+  return true;
+}
+
+// Open the current version of a file
+std::unique_ptr<ftp::vfs_file>
+ftp::memory_vfs::open_read(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto found = find(path);
+  if (found == nullptr) {
+    return nullptr;
+  }
+  if (found->is_directory) {
+    errno = EISDIR;
+    return nullptr;
+  }
+  return std::make_unique<memory_file>(
+      found->contents,
+      make_status(false, found->contents->size(), found->mtime_ns));
+}
+
+// Start a new version of a file
+std::unique_ptr<ftp::vfs_upload>
+ftp::memory_vfs::open_write(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string name;
+  const auto parent = find_parent(path, name);
+  if (parent == nullptr) {
+    return nullptr;
+  }
+  const auto existing = parent->children.find(name);
+  if (existing != parent->children.end() && existing->second->is_directory) {
+    errno = EISDIR;
+    return nullptr;
+  }
+  return std::make_unique<upload>(*this, path);
+}
+
+// Move a node to another directory or name
+bool ftp::memory_vfs::rename(const std::string &from, const std::string &to) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string old_name;
+  std::string new_name;
+  const auto old_parent = find_parent(from, old_name);
+  const auto new_parent = find_parent(to, new_name);
+  if (old_parent == nullptr || new_parent == nullptr) {
+    return false;
+  }
+  const auto moved = old_parent->children.find(old_name);
+  if (moved == old_parent->children.end()) {
+    errno = ENOENT;
+    return false;
+  }
+  if (new_parent->children.count(new_name) != 0) {
+    errno = EEXIST;
+    return false;
+  }
+  // A directory cannot move into itself
+  if (moved->second->is_directory && to.rfind(from + "/", 0) == 0) {
+    errno = EINVAL;
+    return false;
+  }
+  auto target = moved->second;
+  old_parent->children.erase(moved);
+  new_parent->children.emplace(new_name, std::move(target));
+  const int64_t now = now_ns();
+  old_parent->mtime_ns = now;
+  new_parent->mtime_ns = now;
+  return true;
+}
+
+// Remove a file
+bool ftp::memory_vfs::remove(const std::string &path) {
+  uint64_t size = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string name;
+    const auto parent = find_parent(path, name);
+    if (parent == nullptr) {
+      return false;
+    }
+    const auto it = parent->children.find(name);
+    if (it == parent->children.end()) {
+      errno = ENOENT;
+      return false;
+    }
+    if (it->second->is_directory) {
+      errno = EISDIR;
+      return false;
+    }
+    size = it->second->contents->size();
+    parent->children.erase(it);
+    parent->mtime_ns = now_ns();
+  }
+  release(size);
+  return true;
+}
+
+// Remove an empty directory
+bool ftp::memory_vfs::remove_directory(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string name;
+  const auto parent = find_parent(path, name);
+  if (parent == nullptr) {
+    return false;
+  }
+  const auto it = parent->children.find(name);
+  if (it == parent->children.end()) {
+    errno = ENOENT;
+    return false;
+  }
+  if (!it->second->is_directory) {
+    errno = ENOTDIR;
+    return false;
+  }
+  if (!it->second->children.empty()) {
+    errno = ENOTEMPTY;
+    return false;
+  }
+  parent->children.erase(it);
+  parent->mtime_ns = now_ns();
+  return true;
+}
+
+// Create a directory
+bool ftp::memory_vfs::make_directory(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string name;
+  const auto parent = find_parent(path, name);
+  if (parent == nullptr) {
+    return false;
+  }
+  auto directory = std::make_shared<node>();
+  directory->is_directory = true;
+  directory->mtime_ns = now_ns();
+  if (!parent->children.emplace(name, std::move(directory)).second) {
+    errno = EEXIST;
+    return false;
+  }
+  parent->mtime_ns = now_ns();
+  return true;
+}
+
+// Bytes of file contents held
+uint64_t ftp::memory_vfs::used_bytes() const { return used_; }
+
+// Node of a path, mutex_ held
+std::shared_ptr<ftp::memory_vfs::node>
+ftp::memory_vfs::find(const std::string &path) const {
+  auto current = root_;
+  size_t start = 0;
+  while (start < path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    if (end > start) {
+      if (!current->is_directory) {
+        errno = ENOTDIR;
+        return nullptr;
+      }
+      const auto child =
+          current->children.find(path.substr(start, end - start));
+      if (child == current->children.end()) {
+        errno = ENOENT;
+        return nullptr;
+      }
+      current = child->second;
+    }
+    start = end + 1;
+  }
+  return current;
+}
+
+// Directory containing a path, mutex_ held
+std::shared_ptr<ftp::memory_vfs::node>
+ftp::memory_vfs::find_parent(const std::string &path,
+                             std::string &name) const {
+  const auto [parent_path, last] = split_path(path);
+  if (last.empty()) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  auto parent = find(parent_path);
+  if (parent != nullptr && !parent->is_directory) {
+    errno = ENOTDIR;
+    return nullptr;
+  }
+  name = last;
+  return parent;
+}
+
+// Replace the file at path with a committed upload
+bool ftp::memory_vfs::install(const std::string &path,
+                              std::shared_ptr<const std::string> contents) {
+  uint64_t replaced = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string name;
+    // The directory may have been removed since the upload started
+    const auto parent = find_parent(path, name);
+    if (parent == nullptr) {
+      return false;
+    }
+    auto &file = parent->children[name];
+    if (file != nullptr && file->is_directory) {
+      errno = EISDIR;
+      return false;
+    }
+    if (file != nullptr) {
+      replaced = file->contents->size();
+    }
+    // A new node: renaming the old one away keeps it intact
+    file = std::make_shared<node>();
+    file->contents = std::move(contents);
+    file->mtime_ns = now_ns();
+    parent->mtime_ns = file->mtime_ns;
+  }
+  release(replaced);
+  return true;
+}
+
+// Account for bytes held
+bool ftp::memory_vfs::reserve(uint64_t bytes) {
+  uint64_t used = used_.load(std::memory_order_relaxed);
+  do {
+    if (used + bytes > capacity_) {
+      errno = ENOSPC;
+      return false;
+    }
+  } while (!used_.compare_exchange_weak(used, used + bytes));
+  return true;
+}
+
+void ftp::memory_vfs::release(uint64_t bytes) { used_ -= bytes; }
@@ -0,0 +1,643 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+#include "utils/vfs_object_store.h"
+
+namespace {
+
+// Key of the object of a client path
+std::string key_of(const std::string &path) {
+  const auto start = path.find_first_not_of('/');
+  return start == std::string::npos ? "" : path.substr(start);
+}
+
+// Text with the five predefined XML entities decoded
+std::string xml_decode(const std::string &text) {
+  static const std::pair<const char *, char> entities[] = {
+      {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'},
+      {"&apos;", '\''}};
+  std::string decoded;
+  decoded.reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    bool replaced = false;
+    if (text[i] == '&') {
+      for (const auto &[entity, c] : entities) {
+        if (text.compare(i, strlen(entity), entity) == 0) {
+          decoded += c;
+          i += strlen(entity) - 1;
+          replaced = true;
+          break;
+        }
+      }
+    }
+    if (!replaced) {
+      decoded += text[i];
+    }
+  }
+  return decoded;
+}
+
+// Contents of every <tag> element of a document, in order
+std::vector<std::string> elements(const std::string &xml,
+                                  const std::string &tag) {
+  std::vector<std::string> found;
+  const std::string open = "<" + tag + ">";
+  const std::string close = "</" + tag + ">";
+  size_t position = 0;
+  while ((position = xml.find(open, position)) != std::string::npos) {
+    position += open.size();
+    const auto end = xml.find(close, position);
+    if (end == std::string::npos) {
+      break;
+    }
+    found.push_back(xml.substr(position, end - position));
+    position = end + close.size();
+  }
+  return found;
+}
+
+// Decoded text of the first <tag> element, "" if there is none
+std::string element(const std::string &xml, const std::string &tag) {
+  const auto found = elements(xml, tag);
+  return found.empty() ? "" : xml_decode(found.front());
+}
+
+// Seconds since epoch of a time in a format of strptime(), 0 if invalid
+int64_t parse_time(const std::string &text, const char *format) {
+  std::tm utc = {};
+  if (strptime(text.c_str(), format, &utc) == nullptr) {
+    return 0;
+  }
+  return int64_t(timegm(&utc));
+}
+
+bool succeeded(const ftp::s3_response &response) {
+  // Some requests report errors in the body of a 200 response
+  return response.status >= 200 && response.status < 300 &&
+         response.body.find("<Error>") == std::string::npos;
+}
+
+// Log a failed request and set errno from its status
+void failed(const std::string &what, const std::string &key,
+            const ftp::s3_response &response) {
+  errno = response.status == 404   ? ENOENT
+          : response.status == 403 ? EACCES
+                                   : EIO;
+  if (response.status == 404) {
+    return;
+  }
+  std::cerr << "[S3] " << what << " " << key << " failed: "
+            << (response.status == 0 ? "no response"
+                                     : std::to_string(response.status) +
+                                           " " + element(response.body,
+                                                         "Code"))
+            << std::endl;
+}
+
+// Status of a directory, which has no modification time
+ftp::vfs_status directory_status() {
+  ftp::vfs_status status;
+  status.exists = true;
+  status.is_directory = true;
+  status.mode = 0755;
+  return status;
+}
+
+// Status of a file
+ftp::vfs_status file_status(uint64_t size, int64_t mtime) {
+  ftp::vfs_status status;
+  status.exists = true;
+  status.is_regular = true;
+  status.size = size;
+  status.mtime = mtime;
+  status.mtime_ns = mtime * 1000000000;
+  return status;
+}
+
+// Value of a Range header
+std::string byte_range(uint64_t offset, size_t count) {
+  return "bytes=" + std::to_string(offset) + "-" +
+         std::to_string(offset + count - 1);
+}
+
+// An object read with ranged GETs
+class object_file : public ftp::vfs_file {
+public:
+  object_file(ftp::s3_client &client, std::string key,
+              const ftp::vfs_status &status)
+      : client_(client), key_(std::move(key)), status_(status) {}
+
+  const ftp::vfs_status &status() const override { return status_; }
+
+  ssize_t read(char *buffer, size_t count, uint64_t offset) override {
+    if (offset >= status_.size || count == 0) {
+      return 0;
+    }
+    ftp::s3_request request;
+    request.key = key_;
+    request.headers = {{"Range", byte_range(offset, count)}};
+    const auto response = client_.send(request);
+    // The body is the contents, which may well hold "<Error>"
+    if (response.status != 200 && response.status != 206) {
+      failed("GET", key_, response);
+      return -1;
+    }
+    // A store ignoring the range sends the whole object
+    const size_t start = response.status == 206 ? 0 : size_t(offset);
+    if (start >= response.body.size()) {
+      return 0;
+    }
+    count = std::min(count, response.body.size() - start);
+    memcpy(buffer, response.body.data() + start, count);
+    return ssize_t(count);
+  }
+
+  ssize_t send(int socket_fd, uint64_t offset, size_t count) override {
+    if (offset >= status_.size || count == 0) {
+      return 0;
+    }
+    count = size_t(std::min<uint64_t>(count, status_.size - offset));
+    ftp::s3_request request;
+    request.key = key_;
+    request.headers = {{"Range", byte_range(offset, count)}};
+    return client_.forward(request, socket_fd);
+  }
+
+private:
+  ftp::s3_client &client_;
+  std::string key_;
+  ftp::vfs_status status_;
+};
+
+// An object uploaded in one PUT, or in parts once larger than a part
+class object_upload : public ftp::vfs_upload {
+public:
+  object_upload(ftp::s3_client &client, std::string key)
+      : client_(client), key_(std::move(key)) {}
+
+  // Parts already sent are dropped by the store
+  ~object_upload() override {
+    if (upload_id_.empty() || committed_) {
+      return;
+    }
+    ftp::s3_request request;
+    request.method = "DELETE";
+    request.key = key_;
+    request.query = {{"uploadId", upload_id_}};
+    client_.send(request);
+  }
+
+  bool write(const char *data, size_t size) override {
+    const size_t part_bytes = client_.settings().part_bytes;
+    while (size > 0) {
+      const size_t chunk = std::min(size, part_bytes - buffer_.size());
+      buffer_.append(data, chunk);
+      data += chunk;
+      size -= chunk;
+      if (buffer_.size() == part_bytes && !send_part()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool commit() override {
+    ftp::s3_request request;
+    request.key = key_;
+    if (upload_id_.empty()) {
+      request.method = "PUT";
+      request.body = buffer_.data();
+      request.body_size = buffer_.size();
+      const auto response = client_.send(request);
+      if (!succeeded(response)) {
+        failed("PUT", key_, response);
+        return false;
+      }
+      committed_ = true;
+      return true;
+    }
+
+    // The last part may be smaller than the others
+    if (!buffer_.empty() && !send_part()) {
+      return false;
+    }
+    std::string parts = "<CompleteMultipartUpload>";
+    for (size_t i = 0; i < etags_.size(); ++i) {
+      parts += "<Part><PartNumber>" + std::to_string(i + 1) +
+               "</PartNumber><ETag>" + etags_[i] + "</ETag></Part>";
+    }
+    parts += "</CompleteMultipartUpload>";
+    request.method = "POST";
+    request.query = {{"uploadId", upload_id_}};
+    request.body = parts.data();
+    request.body_size = parts.size();
+    const auto response = client_.send(request);
+    if (!succeeded(response)) {
+      failed("CompleteMultipartUpload", key_, response);
+      return false;
+    }
+    committed_ = true;
+    return true;
+  }
+
+private:
+  // Send the buffer as the next part, starting the upload on the first one
+  bool send_part() {
+    ftp::s3_request request;
+    request.key = key_;
+    if (upload_id_.empty()) {
+      request.method = "POST";
+      request.query = {{"uploads", ""}};
+      const auto response = client_.send(request);
+      upload_id_ = succeeded(response) ? element(response.body, "UploadId")
+                                       : "";
+      if (upload_id_.empty()) {
+        failed("CreateMultipartUpload", key_, response);
+        return false;
+      }
+    }
+    request.method = "PUT";
+    request.query = {{"partNumber", std::to_string(etags_.size() + 1)},
+                     {"uploadId", upload_id_}};
+    request.body = buffer_.data();
+    request.body_size = buffer_.size();
+    const auto response = client_.send(request);
+    const auto etag = response.headers.find("etag");
+    if (!succeeded(response) || etag == response.headers.end()) {
+      failed("UploadPart", key_, response);
+      return false;
+    }
+    etags_.push_back(etag->second);
+    buffer_.clear();
+    return true;
+  }
+
+  ftp::s3_client &client_;
+  std::string key_;
+  std::string buffer_; // Data of the next part
+  std::string upload_id_;
+  std::vector<std::string> etags_; // Of the parts sent
+  bool committed_ = false;
+};
+
+} // namespace
+
+// Constructor
+ftp::object_store_vfs::object_store_vfs(object_store_settings settings)
+    : client_(std::move(settings)) {}
+
+// URL of the object of a path
+std::string ftp::object_store_vfs::location(const std::string &path) const {
+  return "s3://" + client_.settings().bucket + "/" + key_of(path);
+}
+
+// Status of a path: an object, or a prefix of objects
+ftp::vfs_status ftp::object_store_vfs::stat(const std::string &path) {
+  const auto key = key_of(path);
+  if (key.empty()) {
+    return directory_status();
+  }
+  const auto status = stat_object(key);
+  if (status.exists || errno != ENOENT) {
+    return status;
+  }
+  if (has_prefix(key + "/")) {
+    return directory_status();
+  }
+  errno = ENOENT;
+  return {};
+}
+
+// Call visit for the objects and prefixes directly below a prefix
+bool ftp::object_store_vfs::list(
+    const std::string &path, bool types_only,
+    const std::function<bool(const vfs_entry &)> &visit) {
+  const auto key = key_of(path);
+  const std::string prefix = key.empty() ? "" : key + "/";
+  bool found = key.empty();
+  vfs_entry entry;
+  const bool listed = list_keys(
+      prefix, true, [&](const std::string &child, const vfs_status &status) {
+        found = true;
+        entry.name = child.substr(prefix.size());
+        if (!entry.name.empty() && entry.name.back() == '/') {
+          entry.name.pop_back();
+        }
+        // The marker of the directory itself
+        if (entry.name.empty()) {
+          return true;
+        }
+        entry.status = status;
+        return visit(entry);
+      });
+  if (!listed || found) {
+    return listed;
+  }
+  // Nothing below the prefix: a file, or nothing at all
+  const auto status = stat_object(key);
+  errno = status.exists ? ENOTDIR : ENOENT;
+  return false;
+}
+
+// Open an object for ranged reads
+std::unique_ptr<ftp::vfs_file>
+ftp::object_store_vfs::open_read(const std::string &path) {
+  const auto key = key_of(path);
+  if (key.empty()) {
+    errno = EISDIR;
+    return nullptr;
+  }
+  const auto status = stat_object(key);
+  if (status.exists) {
+    return std::make_unique<object_file>(client_, key, status);
+  }
+  if (errno == ENOENT && has_prefix(key + "/")) {
+    errno = EISDIR;
+  }
+  return nullptr;
+}
+
+// Start an upload, in a directory that exists
+std::unique_ptr<ftp::vfs_upload>
+ftp::object_store_vfs::open_write(const std::string &path) {
+  const auto key = key_of(path);
+  const auto parent = split_path(path).first;
+  if (key.empty()) {
+    errno = EISDIR;
+    return nullptr;
+  }
+  if (parent != "/") {
+    const auto parent_status = stat(parent);
+    if (!parent_status.exists || !parent_status.is_directory) {
+      errno = parent_status.exists ? ENOTDIR : errno;
+      return nullptr;
+    }
+  }
+  if (has_prefix(key + "/")) {
+    errno = EISDIR;
+    return nullptr;
+  }
+  return std::make_unique<object_upload>(client_, key);
+}
+
+// Copy, then delete, every object of the path
+bool ftp::object_store_vfs::rename(const std::string &from,
+                                   const std::string &to) {
+  const auto from_key = key_of(from);
+  const auto to_key = key_of(to);
+  if (from_key.empty() || to_key.empty()) {
+    errno = EINVAL;
+    return false;
+  }
+  const auto source = stat(from);
+  if (!source.exists) {
+    return false;
+  }
+  const auto target = stat(to);
+  if (target.exists || errno != ENOENT) {
+    errno = target.exists ? EEXIST : errno;
+    return false;
+  }
+  const auto parent = split_path(to).first;
+  if (parent != "/") {
+    const auto parent_status = stat(parent);
+    if (!parent_status.is_directory) {
+      errno = parent_status.exists ? ENOTDIR : ENOENT;
+      return false;
+    }
+  }
+
+  if (!source.is_directory) {
+    if (!copy_object(from_key, to_key)) {
+      return false;
+    }
+    s3_request request;
+    request.method = "DELETE";
+    request.key = from_key;
+    const auto response = client_.send(request);
+    if (!succeeded(response)) {
+      failed("DELETE", from_key, response);
+      return false;
+    }
+    return true;
+  }
+
+  // A directory cannot move into itself
+  if (to_key.rfind(from_key + "/", 0) == 0) {
+    errno = EINVAL;
+    return false;
+  }
+  // Collect the keys first, the listing would see the copies otherwise
+  std::vector<std::string> keys;
+  if (!list_keys(from_key + "/", false,
+                 [&](const std::string &key, const vfs_status &) {
+                   keys.push_back(key);
+                   return true;
+                 })) {
+    return false;
+  }
+  for (const auto &key : keys) {
+    const auto moved = to_key + key.substr(from_key.size());
+    if (!copy_object(key, moved)) {
+      return false;
+    }
+    s3_request request;
+    request.method = "DELETE";
+    request.key = key;
+    const auto response = client_.send(request);
+    if (!succeeded(response)) {
+      failed("DELETE", key, response);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Delete the object of a file
+bool ftp::object_store_vfs::remove(const std::string &path) {
+  const auto key = key_of(path);
+  if (key.empty()) {
+    errno = EISDIR;
+    return false;
+  }
+  const auto status = stat_object(key);
+  if (!status.exists) {
+    if (errno == ENOENT && has_prefix(key + "/")) {
+      errno = EISDIR;
+    }
+    return false;
+  }
+  s3_request request;
+  request.method = "DELETE";
+  request.key = key;
+  const auto response = client_.send(request);
+  if (!succeeded(response)) {
+    failed("DELETE", key, response);
+    return false;
+  }
+  return true;
+}
+
+// Delete the marker of an empty directory
+bool ftp::object_store_vfs::remove_directory(const std::string &path) {
+  const auto key = key_of(path);
+  if (key.empty()) {
+    errno = EBUSY;
+    return false;
+  }
+  const auto status = stat(path);
+  if (!status.exists) {
+    return false;
+  }
+  if (!status.is_directory) {
+    errno = ENOTDIR;
+    return false;
+  }
+  const std::string marker = key + "/";
+  bool empty = true;
+  if (!list_keys(marker, true,
+                 [&](const std::string &child, const vfs_status &) {
+                   empty = child == marker;
+                   return empty;
+                 })) {
+    return false;
+  }
+  if (!empty) {
+    errno = ENOTEMPTY;
+    return false;
+  }
+  s3_request request;
+  request.method = "DELETE";
+  request.key = marker;
+  const auto response = client_.send(request);
+  if (!succeeded(response)) {
+    failed("DELETE", marker, response);
+    return false;
+  }
+  return true;
+}
+
+// Create the marker of a directory
+bool ftp::object_store_vfs::make_directory(const std::string &path) {
+  const auto key = key_of(path);
+  const auto status = stat(path);
+  if (status.exists || errno != ENOENT) {
+    errno = status.exists ? EEXIST : errno;
+    return false;
+  }
+  const auto parent = split_path(path).first;
+  if (parent != "/") {
+    const auto parent_status = stat(parent);
+    if (!parent_status.is_directory) {
+      errno = parent_status.exists ? ENOTDIR : ENOENT;
+      return false;
+    }
+  }
+  s3_request request;
+  request.method = "PUT";
+  request.key = key + "/";
+  const auto response = client_.send(request);
+  if (!succeeded(response)) {
+    failed("PUT", request.key, response);
+    return false;
+  }
+  return true;
+}
+
+// Status of the object of a file
+ftp::vfs_status ftp::object_store_vfs::stat_object(const std::string &key) {
+  s3_request request;
+  request.method = "HEAD";
+  request.key = key;
+  const auto response = client_.send(request);
+  if (!succeeded(response)) {
+    failed("HEAD", key, response);
+    return {};
+  }
+  const auto length = response.headers.find("content-length");
+  const auto modified = response.headers.find("last-modified");
+  return file_status(
+      length == response.headers.end()
+          ? 0
+          : std::strtoull(length->second.c_str(), nullptr, 10),
+      modified == response.headers.end()
+          ? 0
+          : parse_time(modified->second, "%a, %d %b %Y %H:%M:%S"));
+}
+
+// Is there a marker or any object below a prefix?
+bool ftp::object_store_vfs::has_prefix(const std::string &prefix) {
+  s3_request request;
+  request.query = {{"list-type", "2"}, {"prefix", prefix}, {"max-keys", "1"}};
+  const auto response = client_.send(request);
+  if (!succeeded(response)) {
+    failed("ListObjectsV2", prefix, response);
+    return false;
+  }
+  errno = ENOENT;
+  return !elements(response.body, "Contents").empty();
+}
+
+// Call visit for the keys below a prefix
+bool ftp::object_store_vfs::list_keys(
+    const std::string &prefix, bool delimited,
+    const std::function<bool(const std::string &, const vfs_status &)>
+        &visit) {
+  std::string token;
+  while (true) {
+    s3_request request;
+    request.query = {{"list-type", "2"}, {"prefix", prefix}};
+    if (delimited) {
+      request.query.emplace_back("delimiter", "/");
+    }
+    if (!token.empty()) {
+      request.query.emplace_back("continuation-token", token);
+    }
+    const auto response = client_.send(request);
+    if (!succeeded(response)) {
+      failed("ListObjectsV2", prefix, response);
+      return false;
+    }
+
+    for (const auto &contents : elements(response.body, "Contents")) {
+      const auto status = file_status(
+          std::strtoull(element(contents, "Size").c_str(), nullptr, 10),
+          parse_time(element(contents, "LastModified"), "%Y-%m-%dT%H:%M:%S"));
+      if (!visit(element(contents, "Key"), status)) {
+        return true;
+      }
+    }
+    for (const auto &common : elements(response.body, "CommonPrefixes")) {
+      if (!visit(element(common, "Prefix"), directory_status())) {
+        return true;
+      }
+    }
+
+    token = element(response.body, "NextContinuationToken");
+    if (element(response.body, "IsTruncated") != "true" || token.empty()) {
+      return true;
+    }
+  }
+}
+
+// Server-side copy of an object
+bool ftp::object_store_vfs::copy_object(const std::string &from,
+                                        const std::string &to) {
+  s3_request request;
+  request.method = "PUT";
+  request.key = to;
+  request.headers = {
+      {"x-amz-copy-source",
+       "/" + client_.settings().bucket + "/" + uri_encode(from, false)}};
+  const auto response = client_.send(request);
+  if (!succeeded(response)) {
+    failed("CopyObject", from, response);
+    return false;
+  }
+  return true;
+}
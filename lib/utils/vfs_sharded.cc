@@ -0,0 +1,560 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/vfs_sharded.h"
+
+namespace {
+
+// FNV-1a, then the finalizer of splitmix64 so that nearby paths spread over
+// the whole ring; stable across builds, unlike std::hash
+uint64_t ring_hash(const std::string &text) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const unsigned char c : text) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ull;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebull;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+// Copy the contents of a file to an upload
+bool copy_contents(ftp::vfs_file &source, ftp::vfs_upload &target) {
+  const uint64_t size = source.status().size;
+  uint64_t offset = 0;
+  // Between local files, the kernel copies without going through user
+  // space; it may refuse across file systems, then the data is read
+  if (source.fd() != -1 && target.fd() != -1) {
+    while (offset < size) {
+      loff_t source_offset = loff_t(offset);
+      const ssize_t n = copy_file_range(source.fd(), &source_offset,
+                                        target.fd(), nullptr,
+                                        size_t(size - offset), 0);
+      if (n <= 0) {
+        break;
+      }
+      offset += uint64_t(n);
+    }
+  }
+  std::vector<char> buffer(1024 * 1024);
+  while (offset < size) {
+    const size_t count =
+        size_t(std::min<uint64_t>(size - offset, buffer.size()));
+    const ssize_t n = source.read(buffer.data(), count, offset);
+    if (n < 0) {
+      return false;
+    }
+    if (n == 0) {
+      break; // The file shrank
+    }
+    if (!target.write(buffer.data(), size_t(n))) {
+      return false;
+    }
+    offset += uint64_t(n);
+  }
+  return true;
+}
+
+} // namespace
+
+// An upload to the owning root, which replaces the copies of the file left
+// on the other roots once committed
+class ftp::sharded_vfs::upload : public ftp::vfs_upload {
+public:
+  upload(sharded_vfs &storage, size_t shard, std::string path,
+         std::unique_ptr<vfs_upload> file)
+      : storage_(storage), shard_(shard), path_(std::move(path)),
+        file_(std::move(file)) {}
+
+  bool write(const char *data, size_t size) override {
+    return file_->write(data, size);
+  }
+
+  int fd() const override { return file_->fd(); }
+
+  bool commit() override {
+    if (!file_->commit()) {
+      return false;
+    }
+    storage_.remove_copies(shard_, path_);
+    return true;
+  }
+
+private:
+  sharded_vfs &storage_;
+  size_t shard_;
+  std::string path_;
+  std::unique_ptr<vfs_upload> file_;
+};
+
+// Open the roots and place them on the ring
+ftp::sharded_vfs::sharded_vfs(const std::vector<std::filesystem::path> &roots,
+                              size_t virtual_nodes) {
+  virtual_nodes = std::max<size_t>(virtual_nodes, 1);
+  for (const auto &root : roots) {
+    // Points are named after the root, so that its files stay on it when
+    // roots are added or listed in another order ("/mnt/d1/" is "/mnt/d1")
+    auto name = root.lexically_normal().string();
+    while (name.size() > 1 && name.back() == '/') {
+      name.pop_back();
+    }
+    for (size_t i = 0; i < virtual_nodes; ++i) {
+      ring_.emplace_back(ring_hash(name + "#" + std::to_string(i)),
+                         shards_.size());
+    }
+    shards_.push_back(std::make_unique<local_vfs>(root));
+  }
+  std::sort(ring_.begin(), ring_.end());
+}
+
+// Stop rebalancing
+ftp::sharded_vfs::~sharded_vfs() {
+  stopping_ = true;
+  if (rebalance_thread_.joinable()) {
+    rebalance_thread_.join();
+  }
+}
+
+// Could every root be opened?
+bool ftp::sharded_vfs::is_open() const {
+  return !shards_.empty() &&
+         std::all_of(shards_.begin(), shards_.end(),
+                     [](const auto &shard) { return shard->is_open(); });
+}
+
+size_t ftp::sharded_vfs::shard_count() const { return shards_.size(); }
+
+// Index of the root owning a path: the first point at or after the hash of
+// its first component, so that renames below a top-level directory keep the
+// files on their owner
+size_t ftp::sharded_vfs::owner(const std::string &path) const {
+  const size_t start = path.find_first_not_of('/');
+  const auto top = start == std::string::npos
+                       ? std::string()
+                       : path.substr(start, path.find('/', start) - start);
+  const uint64_t hash = ring_hash(top);
+  auto point = std::lower_bound(ring_.begin(), ring_.end(),
+                                std::make_pair(hash, size_t(0)));
+  if (point == ring_.end()) {
+    point = ring_.begin();
+  }
+  return point->second;
+}
+
+// Move the misplaced files on a thread of its own
+bool ftp::sharded_vfs::start_rebalance() {
+  bool expected = false;
+  if (!rebalancing_.compare_exchange_strong(expected, true)) {
+    return false;
+  }
+  if (rebalance_thread_.joinable()) {
+    rebalance_thread_.join();
+  }
+  moved_ = 0;
+  failed_ = 0;
+  rebalance_thread_ = std::thread([this]() {
+    const auto started = std::chrono::steady_clock::now();
+    std::clog << "[VFS] " << "Rebalancing " << shards_.size() << " roots"
+              << std::endl;
+    for (size_t shard = 0; shard < shards_.size() && !stopping_; ++shard) {
+      rebalance(shard, "/");
+    }
+    std::clog << "[VFS] " << "Rebalance " << (stopping_ ? "stopped" : "done")
+              << ": " << moved_ << " files moved, " << failed_
+              << " failed in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - started)
+                     .count()
+              << " ms" << std::endl;
+    rebalancing_ = false;
+  });
+  return true;
+}
+
+bool ftp::sharded_vfs::rebalancing() const { return rebalancing_; }
+
+uint64_t ftp::sharded_vfs::moved_files() const { return moved_; }
+
+uint64_t ftp::sharded_vfs::failed_files() const { return failed_; }
+
+// A path of the virtual namespace, not of one root
+std::string ftp::sharded_vfs::location(const std::string &path) const {
+  return "shards:" + path;
+}
+
+// Status of a path: a file from the first root holding it, the owner first;
+// a directory merged from every root
+ftp::vfs_status ftp::sharded_vfs::stat(const std::string &path) {
+  if (path == "/" && !is_open()) {
+    errno = ENOENT;
+    return {};
+  }
+  const size_t first = owner(path);
+  vfs_status merged;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    const auto status = shards_[(first + i) % shards_.size()]->stat(path);
+    if (!status.exists) {
+      continue;
+    }
+    if (!status.is_directory) {
+      if (!merged.exists) {
+        return status;
+      }
+      continue;
+    }
+    if (!merged.exists) {
+      merged = status;
+    } else if (status.mtime_ns > merged.mtime_ns) {
+      merged.mtime = status.mtime;
+      merged.mtime_ns = status.mtime_ns;
+    }
+  }
+  if (!merged.exists) {
+    errno = ENOENT;
+  }
+  return merged;
+}
+
+// Merge the directory of every root, sorted by name
+// A file found on two roots (while it is being moved) is taken from the
+// owner of its path
+bool ftp::sharded_vfs::list(
+    const std::string &path, bool types_only,
+    const std::function<bool(const vfs_entry &)> &visit) {
+  std::map<std::string, vfs_entry> entries;
+  bool found = false;
+  int error = ENOENT;
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    const bool listed =
+        shards_[shard]->list(path, types_only, [&](const vfs_entry &entry) {
+          const auto [existing, inserted] =
+              entries.try_emplace(entry.name, entry);
+          if (inserted) {
+            return true;
+          }
+          auto &merged = existing->second;
+          if (merged.status.is_directory && entry.status.is_directory) {
+            merged.status.mtime = std::max(merged.status.mtime,
+                                           entry.status.mtime);
+            merged.status.mtime_ns = std::max(merged.status.mtime_ns,
+                                              entry.status.mtime_ns);
+          } else if (!entry.status.is_directory &&
+                     shard == owner(join_path(path, entry.name))) {
+            merged = entry;
+          }
+          return true;
+        });
+    if (listed) {
+      found = true;
+    } else if (errno != ENOENT) {
+      error = errno;
+    }
+  }
+  if (!found) {
+    errno = error;
+    return false;
+  }
+  for (const auto &[name, entry] : entries) {
+    if (!visit(entry)) {
+      break;
+    }
+  }
+  return true;
+}
+
+// Open a file from the owner of its path, or from the root it was left on
+std::unique_ptr<ftp::vfs_file>
+ftp::sharded_vfs::open_read(const std::string &path) {
+  const size_t first = owner(path);
+  int error = ENOENT;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    auto file = shards_[(first + i) % shards_.size()]->open_read(path);
+    if (file != nullptr) {
+      return file;
+    }
+    if (errno == EISDIR) {
+      return nullptr;
+    }
+    if (errno != ENOENT) {
+      error = errno;
+    }
+  }
+  errno = error;
+  return nullptr;
+}
+
+// Write a file to the owner of its path
+std::unique_ptr<ftp::vfs_upload>
+ftp::sharded_vfs::open_write(const std::string &path) {
+  const auto status = stat(path);
+  if (status.is_directory) {
+    errno = EISDIR;
+    return nullptr;
+  }
+  const size_t shard = owner(path);
+  auto file = shards_[shard]->open_write(path);
+  // The directory exists on another root only (added since it was made)
+  if (file == nullptr && errno == ENOENT) {
+    const auto directory = split_path(path).first;
+    if (!stat(directory).is_directory) {
+      errno = ENOENT;
+      return nullptr;
+    }
+    if (!make_directories(shard, directory)) {
+      return nullptr;
+    }
+    file = shards_[shard]->open_write(path);
+  }
+  if (file == nullptr) {
+    return nullptr;
+  }
+  return std::make_unique<upload>(*this, shard, path, std::move(file));
+}
+
+// Rename on every root holding the path, in one step for a directory
+// A file stays on its root until the next rebalance, so that the rename
+// stays atomic; a directory is renamed only if it lies on one root, as
+// rebalance leaves it, since renames on several roots could not be undone
+// all together after a crash
+bool ftp::sharded_vfs::rename(const std::string &from, const std::string &to) {
+  const auto source = stat(from);
+  if (!source.exists) {
+    return false;
+  }
+  if (stat(to).exists) {
+    errno = EEXIST;
+    return false;
+  }
+  const auto directory = split_path(to).first;
+  if (!stat(directory).is_directory) {
+    errno = ENOENT;
+    return false;
+  }
+  // Roots lacking the parent of to would otherwise get it created below
+  // from
+  if (source.is_directory && to.rfind(from + "/", 0) == 0) {
+    errno = EINVAL;
+    return false;
+  }
+  std::vector<size_t> holders;
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    if (shards_[shard]->stat(from).exists) {
+      holders.push_back(shard);
+    }
+  }
+  if (source.is_directory && holders.size() > 1) {
+    std::cerr << "[VFS] " << "Cannot rename " << from << ": it lies on "
+              << holders.size() << " roots, rebalance first" << std::endl;
+    errno = EXDEV;
+    return false;
+  }
+  // A file being moved by rebalance has two copies: put back the ones
+  // renamed if another cannot be
+  for (size_t i = 0; i < holders.size(); ++i) {
+    const size_t shard = holders[i];
+    if (!make_directories(shard, directory) ||
+        !shards_[shard]->rename(from, to)) {
+      const int error = errno;
+      while (i-- > 0) {
+        shards_[holders[i]]->rename(to, from);
+      }
+      errno = error;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Remove every copy of a file
+bool ftp::sharded_vfs::remove(const std::string &path) {
+  bool removed = false;
+  for (const auto &shard : shards_) {
+    const auto status = shard->stat(path);
+    if (!status.exists) {
+      continue;
+    }
+    if (status.is_directory) {
+      errno = EISDIR;
+      return false;
+    }
+    if (!shard->remove(path)) {
+      return false;
+    }
+    removed = true;
+  }
+  if (!removed) {
+    errno = ENOENT;
+  }
+  return removed;
+}
+
+// Remove a directory from every root, once it is empty on all of them
+// It exists as long as one of its copies does, so that failing halfway
+// leaves it in place rather than half removed
+bool ftp::sharded_vfs::remove_directory(const std::string &path) {
+  const auto status = stat(path);
+  if (!status.exists) {
+    return false;
+  }
+  if (!status.is_directory) {
+    errno = ENOTDIR;
+    return false;
+  }
+  for (const auto &shard : shards_) {
+    bool empty = true;
+    shard->list(path, true, [&](const vfs_entry &) {
+      empty = false;
+      return false;
+    });
+    if (!empty) {
+      errno = ENOTEMPTY;
+      return false;
+    }
+  }
+  for (const auto &shard : shards_) {
+    if (!shard->remove_directory(path) && errno != ENOENT) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Create a directory on the root owning the files below it, in one step;
+// another root gets a copy when a file of its own is stored in it
+bool ftp::sharded_vfs::make_directory(const std::string &path) {
+  if (stat(path).exists) {
+    errno = EEXIST;
+    return false;
+  }
+  const auto parent = split_path(path).first;
+  if (!stat(parent).is_directory) {
+    errno = ENOENT;
+    return false;
+  }
+  const size_t shard = owner(path);
+  return make_directories(shard, parent) &&
+         shards_[shard]->make_directory(path);
+}
+
+// Create a directory and its parents on a root, if missing
+bool ftp::sharded_vfs::make_directories(size_t shard,
+                                        const std::string &directory) {
+  size_t end = 0;
+  while (end != std::string::npos) {
+    end = directory.find('/', end + 1);
+    const auto parent = directory.substr(0, end);
+    if (parent.empty() || parent == "/") {
+      continue;
+    }
+    if (!shards_[shard]->make_directory(parent) && errno != EEXIST) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Remove the copies of a file from the roots other than shard
+void ftp::sharded_vfs::remove_copies(size_t shard, const std::string &path) {
+  for (size_t other = 0; other < shards_.size(); ++other) {
+    if (other != shard && shards_[other]->stat(path).is_regular) {
+      shards_[other]->remove(path);
+    }
+  }
+}
+
+// Walk a directory of a root, moving the misplaced files below it
+void ftp::sharded_vfs::rebalance(size_t shard, const std::string &directory) {
+  // Read the whole directory first, it changes as files are moved out
+  std::vector<std::pair<std::string, bool>> children;
+  shards_[shard]->list(directory, true, [&](const vfs_entry &entry) {
+    // Symbolic links stay where they are
+    if (!entry.is_link) {
+      children.emplace_back(entry.name, entry.status.is_directory);
+    }
+    return true;
+  });
+  for (const auto &[name, is_directory] : children) {
+    if (stopping_) {
+      return;
+    }
+    const auto path = join_path(directory, name);
+    if (is_directory) {
+      // A copy on another root than the owner goes once emptied, so that
+      // the directory can be renamed again; the owner keeps it, even empty
+      const size_t target = owner(path);
+      if (target != shard && !make_directories(target, path)) {
+        failed_++;
+        continue;
+      }
+      rebalance(shard, path);
+      if (target != shard && !stopping_) {
+        shards_[shard]->remove_directory(path);
+      }
+      continue;
+    }
+    const size_t target = owner(path);
+    if (target == shard || is_upload_name(name)) {
+      continue;
+    }
+    if (move_file(shard, target, path)) {
+      moved_++;
+    } else {
+      failed_++;
+      std::cerr << "[VFS] " << "Cannot move " << path << " to "
+                << shards_[target]->location(path) << ": " << strerror(errno)
+                << std::endl;
+    }
+  }
+}
+
+// Copy a file to its owner then remove it, keeping its modification time
+bool ftp::sharded_vfs::move_file(size_t from, size_t to,
+                                 const std::string &path) {
+  auto &source_root = *shards_[from];
+  auto &target_root = *shards_[to];
+  // A version stored on the owner since wins over the misplaced one
+  if (target_root.stat(path).exists) {
+    return source_root.remove(path);
+  }
+  const auto source = source_root.open_read(path);
+  if (source == nullptr) {
+    return errno == ENOENT; // Removed meanwhile
+  }
+  if (!make_directories(to, split_path(path).first)) {
+    return false;
+  }
+  auto target = target_root.open_write(path);
+  if (target == nullptr || !copy_contents(*source, *target)) {
+    return false;
+  }
+  // Mirrors compare modification times, keep it
+  const int64_t mtime_ns = source->status().mtime_ns;
+  if (target->fd() != -1 && mtime_ns >= 0) {
+    const struct timespec times[2] = {
+        {0, UTIME_OMIT},
+        {time_t(mtime_ns / 1000000000), long(mtime_ns % 1000000000)}};
+    futimens(target->fd(), times);
+  }
+
+  // A session may have stored or removed the file while it was copied
+  // (the window left is that of the two calls below)
+  if (target_root.stat(path).exists) {
+    return source_root.remove(path);
+  }
+  if (!source_root.stat(path).exists) {
+    return true;
+  }
+  return target->commit() && source_root.remove(path);
+}
@@ -0,0 +1,183 @@
+// Load generator: concurrent sessions running a scripted workload
+
+#include <iostream>
+#include <string>
+
+#include <argparse/argparse.hpp>
+#include <sockpp/tcp_connector.h>
+
+#include "load_generator.h"
+#include "regression.h"
+
+int main(int argc, char const *argv[]) {
+  // Init argparse
+  argparse::ArgumentParser program("simple-ftp-bench");
+  program.add_argument("--host")
+      .help("Host to connect to")
+      .default_value("localhost");
+  program.add_argument("-p", "--port")
+      .help("Port to connect to")
+      .default_value(21)
+      .scan<'i', int>();
+  program.add_argument("-u", "--user")
+      .help("Username to log in with")
+      .default_value("");
+  program.add_argument("--password")
+      .help("Password to log in with")
+      .default_value("");
+
+  program.add_argument("-w", "--workload")
+      .help("login, list, retr (small files), stor (large files) or "
+            "pipeline (long commands)")
+      .default_value("list");
+  program.add_argument("-s", "--sessions")
+      .help("Number of concurrent sessions")
+      .default_value(8)
+      .scan<'i', int>();
+  program.add_argument("-d", "--duration")
+      .help("Seconds to run for")
+      .default_value(10.0)
+      .scan<'g', double>();
+  program.add_argument("-n", "--operations")
+      .help("Operations per session, instead of a duration")
+      .default_value(0)
+      .scan<'i', int>();
+  program.add_argument("--size")
+      .help("Bytes of the file of retr (4096) and stor (67108864)")
+      .default_value("");
+  program.add_argument("--directory")
+      .help("Directory on the server for the files of the benchmark")
+      .default_value("/");
+  program.add_argument("--active")
+      .help("Use active mode (PORT) instead of passive mode (PASV)")
+      .flag();
+  program.add_argument("--active-port")
+      .help("Data port of the first session in active mode")
+      .default_value(30000)
+      .scan<'i', int>();
+
+  program.add_argument("-f", "--format")
+      .help("Report format: text or json")
+      .default_value("text");
+  program.add_argument("--regression")
+      .help("Run the regression suite against a server of this process")
+      .flag();
+  program.add_argument("--baseline")
+      .help("Baseline of the regression suite, recorded on this host")
+      .default_value("bench/baselines/loopback.json");
+  program.add_argument("--tolerance")
+      .help("Slowdown failing a regression case (0.25: 25%)")
+      .default_value(0.25)
+      .scan<'g', double>();
+  program.add_argument("--relative-tolerance")
+      .help("Lower throughput of a regression case than in the other mode "
+            "failing it (0.5: 50%)")
+      .default_value(0.5)
+      .scan<'g', double>();
+  program.add_argument("--update-baseline")
+      .help("Write the results of the regression suite as its baseline")
+      .flag();
+  program.add_argument("--filter")
+      .help("Only run the regression cases whose name contains it")
+      .default_value("");
+  program.add_argument("--storage")
+      .help("Storage of the regression server: local, memory or s3")
+      .default_value("local");
+
+  program.add_argument("-v", "--verbose")
+      .help("Show the log of the sessions")
+      .flag();
+
+  // Receive arguments
+  ftp::bench_options options;
+  std::string format;
+  try {
+    program.parse_args(argc, argv);
+
+    options.host = program.get<std::string>("--host");
+    options.port = uint16_t(program.get<int>("--port"));
+    options.username = program.get<std::string>("--user");
+    options.password = program.get<std::string>("--password");
+    if (options.username.empty() && !program.get<bool>("--regression")) {
+      throw std::runtime_error("--user is required");
+    }
+    if (!ftp::parse_workload(program.get<std::string>("--workload"),
+                             options.workload)) {
+      throw std::runtime_error("Unknown workload " +
+                               program.get<std::string>("--workload"));
+    }
+    const int sessions = program.get<int>("--sessions");
+    const int operations = program.get<int>("--operations");
+    if (sessions < 1 || operations < 0) {
+      throw std::runtime_error("Invalid number of sessions or operations");
+    }
+    options.sessions = size_t(sessions);
+    options.operations = uint64_t(operations);
+    options.duration_seconds = program.get<double>("--duration");
+    const auto size = program.get<std::string>("--size");
+    options.file_size = size.empty() ? 0 : std::stoull(size);
+    options.remote_directory = program.get<std::string>("--directory");
+    options.passive = !program.get<bool>("--active");
+    options.active_port_base = uint16_t(program.get<int>("--active-port"));
+
+    const auto storage = program.get<std::string>("--storage");
+    if (storage != "local" && storage != "memory" && storage != "s3") {
+      throw std::runtime_error("Unknown storage " + storage);
+    }
+
+    format = program.get<std::string>("--format");
+    if (format != "text" && format != "json") {
+      throw std::runtime_error("Unknown format " + format);
+    }
+  } catch (const std::exception &err) {
+    std::cerr << err.what() << std::endl;
+    std::cerr << program;
+    return 1;
+  }
+
+  // The sessions log every command and transfer, too much under load
+  if (!program.get<bool>("--verbose")) {
+    std::clog.rdbuf(nullptr);
+  }
+
+  // Initialize sockpp
+  sockpp::initialize();
+
+  // Regression suite: fails on slowdowns beyond the tolerance
+  if (program.get<bool>("--regression")) {
+    ftp::regression_options regression;
+    regression.baseline = program.get<std::string>("--baseline");
+    regression.tolerance = program.get<double>("--tolerance");
+    regression.relative_tolerance =
+        program.get<double>("--relative-tolerance");
+    regression.update_baseline = program.get<bool>("--update-baseline");
+    regression.filter = program.get<std::string>("--filter");
+    regression.storage = program.get<std::string>("--storage");
+
+    std::vector<ftp::regression_result> results;
+    std::string error;
+    if (!ftp::run_regression(regression, results, error)) {
+      std::cerr << "[Bench] " << error << std::endl;
+      return 1;
+    }
+    std::cout << (format == "json" ? ftp::format_json(results)
+                                   : ftp::format_text(results));
+    for (const auto &r : results) {
+      if (r.regressed) {
+        return 2;
+      }
+    }
+    return 0;
+  }
+
+  ftp::bench_result result;
+  std::string error;
+  if (!ftp::run_bench(options, result, error)) {
+    std::cerr << "[Bench] " << error << std::endl;
+    return 1;
+  }
+
+  std::cout << (format == "json" ? ftp::format_json(result)
+                                 : ftp::format_text(result));
+  return result.errors == 0 ? 0 : 2;
+}
@@ -1,10 +1,13 @@
 // Simple echo client using sockpp
 
+#include <fstream>
 #include <string>
+#include <vector>
 
 #include <argparse/argparse.hpp>
 
 #include "ftp_client.h"
+#include "utils/ftp.h"
 #include "utils/sighandler.h"
 
 // ftp client pointer for the signal handler
@@ -22,9 +25,47 @@ int main(int argc, char const *argv[]) {
       .help("Host to connect to")
       .default_value("localhost");
 
+  program.add_argument("-b", "--batch")
+      .help("Run the commands of a file (one per line, - for standard input) "
+            "without a prompt, exit with 1 if any fails")
+      .default_value("");
+
+  program.add_argument("-c", "--command")
+      .help("Run commands separated by ';' without a prompt, exit with 1 if "
+            "any fails")
+      .default_value("");
+
   // Receive arguments
+  std::vector<std::string> commands;
+  bool batch = false;
   try {
     program.parse_args(argc, argv);
+
+    // Lines starting with '#' are comments
+    const auto batch_file = program.get<std::string>("--batch");
+    if (!batch_file.empty()) {
+      std::ifstream file;
+      if (batch_file != "-") {
+        file.open(batch_file);
+        if (!file) {
+          throw std::runtime_error("Cannot open " + batch_file);
+        }
+      }
+      std::istream &in = batch_file == "-" ? std::cin : file;
+      for (std::string line; std::getline(in, line);) {
+        if (ftp::trim(line).rfind('#', 0) != 0) {
+          commands.push_back(line);
+        }
+      }
+      batch = true;
+    }
+    const auto command_line = program.get<std::string>("--command");
+    if (!command_line.empty()) {
+      const auto split_commands = ftp::split(command_line, {}, ';');
+      commands.insert(commands.end(), split_commands.begin(),
+                      split_commands.end());
+      batch = true;
+    }
   } catch (const std::runtime_error &err) {
     std::cerr << err.what() << std::endl;
     std::cerr << program;
@@ -47,6 +88,21 @@ int main(int argc, char const *argv[]) {
   // Init signal handler
   init_sigint_handler_client();
 
+  // Without a prompt, for scripts
+  if (batch) {
+    // A file streamed to standard output (get <file> -) has it to itself,
+    // the output of the other commands goes to standard error
+    for (const auto &command : commands) {
+      const auto [operation, argument] = ftp::parse_command(command);
+      if (operation == ftp::RETR && argument.size() > 2 &&
+          argument.compare(argument.size() - 2, 2, " -") == 0) {
+        std::cout.rdbuf(std::cerr.rdbuf());
+        break;
+      }
+    }
+    return client.run_batch(commands) ? 0 : 1;
+  }
+
   // Connect to the server
   client.connect();
 
@@ -0,0 +1,111 @@
+// Microbenchmarks of the parser, string utilities and message I/O
+
+#include <fstream>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <argparse/argparse.hpp>
+#include <sockpp/tcp_socket.h>
+
+#include "microbench.h"
+
+namespace {
+
+// Formats everything written to it and throws it away, so that the cost of
+// logging is measured without that of a terminal
+class discarding_buffer : public std::streambuf {
+protected:
+  int overflow(int c) override { return traits_type::not_eof(c); }
+  std::streamsize xsputn(const char *, std::streamsize n) override {
+    return n;
+  }
+};
+
+} // namespace
+
+int main(int argc, char const *argv[]) {
+  // Init argparse
+  argparse::ArgumentParser program("simple-ftp-microbench");
+  program.add_argument("--filter")
+      .help("Only run the benchmarks whose name contains it")
+      .default_value("");
+  program.add_argument("--min-time")
+      .help("Seconds every repetition lasts at least")
+      .default_value(0.1)
+      .scan<'g', double>();
+  program.add_argument("-r", "--repetitions")
+      .help("Repetitions, the median is reported")
+      .default_value(5)
+      .scan<'i', int>();
+  program.add_argument("--corpus")
+      .help("File of commands, one per line, instead of the built-in ones")
+      .default_value("");
+  program.add_argument("-f", "--format")
+      .help("Report format: text or json")
+      .default_value("text");
+
+  ftp::microbench_options options;
+  std::vector<std::string> commands;
+  std::string format;
+  try {
+    program.parse_args(argc, argv);
+
+    options.filter = program.get<std::string>("--filter");
+    options.min_seconds = program.get<double>("--min-time");
+    const int repetitions = program.get<int>("--repetitions");
+    if (repetitions < 1) {
+      throw std::runtime_error("Invalid number of repetitions");
+    }
+    options.repetitions = size_t(repetitions);
+
+    const auto corpus = program.get<std::string>("--corpus");
+    if (!corpus.empty()) {
+      std::ifstream file(corpus);
+      if (!file) {
+        throw std::runtime_error("Cannot open " + corpus);
+      }
+      for (std::string line; std::getline(file, line);) {
+        commands.push_back(line);
+      }
+    }
+
+    format = program.get<std::string>("--format");
+    if (format != "text" && format != "json") {
+      throw std::runtime_error("Unknown format " + format);
+    }
+  } catch (const std::exception &err) {
+    std::cerr << err.what() << std::endl;
+    std::cerr << program;
+    return 1;
+  }
+
+  discarding_buffer discard;
+  auto *const log = std::clog.rdbuf(&discard);
+
+  std::vector<ftp::microbench_result> results;
+  bool over_budget = false;
+  try {
+    for (const auto &bench : ftp::utility_microbenches(commands)) {
+      if (bench.name.find(options.filter) == std::string::npos) {
+        continue;
+      }
+      results.push_back(ftp::run_microbench(bench, options));
+      // Budgets are set for the built-in corpus
+      over_budget = over_budget ||
+                    (commands.empty() && results.back().over_budget());
+    }
+  } catch (const std::exception &err) {
+    // A benchmark found the code under test broken
+    std::clog.rdbuf(log);
+    std::cerr << err.what() << std::endl;
+    return 1;
+  }
+  std::clog.rdbuf(log);
+
+  std::cout << (format == "json" ? ftp::format_json(results)
+                                 : ftp::format_text(results));
+  // Allocation regressions fail the run
+  return over_budget ? 2 : 0;
+}
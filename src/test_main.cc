@@ -0,0 +1,59 @@
+// Tests of the library, see tests/test.h
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <argparse/argparse.hpp>
+
+#include "test.h"
+
+int main(int argc, char const *argv[]) {
+  // Init argparse
+  argparse::ArgumentParser program("simple-ftp-test");
+  program.add_argument("--filter")
+      .help("Only run the tests whose name contains it")
+      .default_value("");
+  program.add_argument("-v", "--verbose")
+      .help("Print the log of the code under test")
+      .default_value(false)
+      .implicit_value(true);
+
+  std::string filter;
+  try {
+    program.parse_args(argc, argv);
+    filter = program.get<std::string>("--filter");
+  } catch (const std::exception &err) {
+    std::cerr << err.what() << std::endl;
+    std::cerr << program;
+    return 1;
+  }
+  if (!program.get<bool>("--verbose")) {
+    std::clog.rdbuf(nullptr);
+  }
+
+  std::vector<ftp::test_case> tests;
+  for (auto &&group : {ftp::cache_tests(), ftp::io_tests(),
+                       ftp::storage_tests()}) {
+    tests.insert(tests.end(), group.begin(), group.end());
+  }
+
+  size_t run = 0;
+  size_t failed = 0;
+  for (const auto &test : tests) {
+    if (test.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    run++;
+    try {
+      test.body();
+      std::cout << "ok      " << test.name << std::endl;
+    } catch (const std::exception &err) {
+      failed++;
+      std::cout << "FAILED  " << test.name << ": " << err.what()
+                << std::endl;
+    }
+  }
+  std::cout << run - failed << " of " << run << " tests passed" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "utils/file_cache.h"
+#include "utils/listing_cache.h"
+#include "utils/sharded_lru.h"
+#include "utils/stat_cache.h"
+#include "utils/vfs_local.h"
+
+namespace {
+
+// A connected pair of TCP sockets over the loopback, which MSG_ZEROCOPY
+// needs (Unix sockets copy)
+struct tcp_pair {
+  tcp_pair() {
+    const int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    ftp::expect(listener != -1 &&
+                    bind(listener, reinterpret_cast<sockaddr *>(&address),
+                         sizeof(address)) == 0 &&
+                    listen(listener, 1) == 0 &&
+                    getsockname(listener, reinterpret_cast<sockaddr *>(&address),
+                                &length) == 0,
+                "Cannot listen on the loopback");
+    sender = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ftp::expect(connect(sender, reinterpret_cast<sockaddr *>(&address),
+                        sizeof(address)) == 0,
+                "Cannot connect over the loopback");
+    receiver = accept(listener, nullptr, nullptr);
+    close(listener);
+  }
+  ~tcp_pair() {
+    close(sender);
+    close(receiver);
+  }
+  int sender = -1;
+  int receiver = -1;
+};
+
+} // namespace
+
+std::vector<ftp::test_case> ftp::cache_tests() {
+  std::vector<test_case> tests;
+
+  // Paths naming the same file share an entry, so invalidating one of
+  // them drops what was loaded under the other
+  tests.push_back({"file-cache/keys", [] {
+    ftp::file_cache cache(1 << 20, 1 << 16, 4, false, 16384);
+    const auto file = tmpfile();
+    fputs("contents", file);
+    fflush(file);
+    struct stat file_stat;
+    expect(fstat(fileno(file), &file_stat) == 0, "fstat() failed");
+    expect(cache.load("/srv/ftp//a/./b.txt", fileno(file), file_stat) !=
+                   nullptr &&
+               cache.lookup("/srv/ftp/a/b.txt", file_stat) != nullptr,
+           "/srv/ftp/a/b.txt is not found under another spelling");
+    cache.invalidate("/srv/ftp/a/../a/b.txt");
+    expect(cache.lookup("/srv/ftp/a/b.txt", file_stat) == nullptr,
+           "/srv/ftp/a/b.txt was not invalidated");
+    fclose(file);
+  }});
+
+  // Shards evict their least recently used values by weight
+  tests.push_back({"sharded-lru/eviction", [] {
+    ftp::sharded_lru<size_t> lru(1, 10, [](const size_t &v) { return v; });
+    const auto fresh = [](const size_t &) { return true; };
+    lru.insert("a", 4);
+    lru.insert("b", 4);
+    expect(lru.find("a", fresh).has_value(), "a was evicted early");
+    lru.insert("c", 4);
+    expect(lru.find("a", fresh) && !lru.find("b", fresh) &&
+               lru.find("c", fresh),
+           "b was not the one evicted");
+    expect(lru.size() == 2 && lru.weight() == 8, "Wrong size or weight");
+    expect(!lru.find("a", [](const size_t &) { return false; }) &&
+               lru.size() == 1,
+           "A stale value was not dropped");
+  }});
+
+  // Renaming or removing a directory drops what is cached below it, and
+  // nothing else
+  tests.push_back({"stat-cache/tree", [] {
+    ftp::stat_cache cache(1024, std::chrono::seconds(60), 4);
+    int loads = 0;
+    const auto load = [&loads]() {
+      loads++;
+      return ftp::file_status{true, true, 1, 0};
+    };
+    for (const char *path : {"/srv/d", "/srv/d/a", "/srv/d/e/f", "/srv/dx"}) {
+      cache.status(path, load);
+    }
+    cache.invalidate_tree("/srv/d");
+    for (const char *path : {"/srv/d", "/srv/d/a", "/srv/d/e/f", "/srv/dx"}) {
+      cache.status(path, load);
+    }
+    expect(loads == 7, "Expected 3 paths reloaded, got " +
+                           std::to_string(loads - 4));
+  }});
+
+  // A full listing cache drops the directory listed least recently
+  tests.push_back({"listing-cache/lru", [] {
+    namespace fs = std::filesystem;
+    const auto base = fs::temp_directory_path() /
+                      ("ftp-listing-" + std::to_string(getpid()));
+    fs::remove_all(base);
+    for (const char *name : {"a", "b", "c"}) {
+      fs::create_directories(base / name);
+      // Old enough to be cached without inotify
+      fs::last_write_time(base / name, fs::last_write_time(base / name) -
+                                           std::chrono::hours(1));
+    }
+    {
+      ftp::local_vfs storage(base);
+      ftp::listing_cache cache(true, 2, false);
+      for (const char *path : {"/a", "/b", "/a", "/c", "/a", "/b"}) {
+        cache.listing(storage, path);
+      }
+      expect(cache.hits() == 2 && cache.misses() == 4 && cache.size() == 2,
+             "Expected /b evicted, got " + std::to_string(cache.hits()) +
+                 " hits and " + std::to_string(cache.misses()) + " misses");
+    }
+    fs::remove_all(base);
+  }});
+
+  // Contents sent with MSG_ZEROCOPY arrive whole, and their completions
+  // are collected by finish() rather than waited out
+  tests.push_back({"file-cache/zero-copy", [] {
+    ftp::file_cache cache(1 << 20, 1 << 20, 1, true, 16384);
+    auto contents = std::make_shared<std::string>();
+    for (size_t i = 0; contents->size() < 600000; ++i) {
+      *contents += std::to_string(i) + ",";
+    }
+    const std::shared_ptr<const std::string> data = contents;
+
+    tcp_pair sockets;
+    std::string received;
+    std::thread reader([&] {
+      char buffer[65536];
+      while (received.size() < 3 * data->size()) {
+        const ssize_t n = read(sockets.receiver, buffer, sizeof(buffer));
+        if (n <= 0) {
+          break;
+        }
+        received.append(buffer, size_t(n));
+      }
+    });
+    size_t sent = 0;
+    for (int i = 0; i < 3; ++i) {
+      sent += cache.send(sockets.sender, data, 0, 100000);
+      sent += cache.send(sockets.sender, data, 100000, data->size());
+    }
+    reader.join();
+    const auto started = std::chrono::steady_clock::now();
+    cache.finish(sockets.sender);
+    expect(sent == 3 * data->size() && received == *data + *data + *data,
+           "The contents did not arrive whole");
+    expect(std::chrono::steady_clock::now() - started <
+               std::chrono::milliseconds(500),
+           "The completions were not collected");
+  }});
+
+  return tests;
+}
@@ -0,0 +1,148 @@
+#include <chrono>
+#include <thread>
+
+#include <sys/socket.h>
+
+#include "test.h"
+#include "utils/buffer_pool.h"
+#include "utils/ftp.h"
+#include "utils/io.h"
+
+namespace {
+
+// A connected pair of stream sockets, without a network
+struct socket_pair {
+  socket_pair() {
+    int fds[2];
+    ftp::expect(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+                "socketpair() failed");
+    sender = sockpp::tcp_socket(fds[0]);
+    receiver = sockpp::tcp_socket(fds[1]);
+  }
+  sockpp::tcp_socket sender;
+  sockpp::tcp_socket receiver;
+};
+
+} // namespace
+
+std::vector<ftp::test_case> ftp::io_tests() {
+  std::vector<test_case> tests;
+
+  // A pipelined batch read in pieces of a fixed size: the first read ends
+  // on a line end, the next ones in the middle of a line, which must be
+  // waited for rather than taken as a command
+  tests.push_back({"framer/split-reads", [] {
+    const std::vector<std::string> batch = {
+        "MKD incoming", "DELE incoming/partial.bin",
+        "RNTO reports/2024/quarterly-results-final.pdf"};
+    std::string message;
+    for (const auto &command : batch) {
+      message += command + "\r\n";
+    }
+    socket_pair sockets;
+    // Reads never take more than the first line
+    ftp::message_buffer buffer(batch[0].size() + 2, batch[0].size() + 2);
+    ftp::message_framer framer;
+    for (int round = 0; round < 3; ++round) {
+      ftp::send_message(&sockets.sender, message);
+      for (const auto &command : batch) {
+        const auto received = framer.next(&sockets.receiver, buffer);
+        expect(received == command, "message_framer returned \"" + received +
+                                        "\" instead of \"" + command + "\"");
+      }
+    }
+  }});
+
+  // A read holding no line end is the start of a command, not one, even
+  // before the first line end of the connection
+  tests.push_back({"framer/partial-read", [] {
+    socket_pair sockets;
+    ftp::message_buffer buffer;
+    ftp::message_framer framer;
+    ftp::send_message(&sockets.sender, "PW");
+    std::string received;
+    std::thread reader(
+        [&] { received = framer.next(&sockets.receiver, buffer); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ftp::send_message(&sockets.sender, "D\r\n");
+    reader.join();
+    expect(received == "PWD",
+           "message_framer returned \"" + received + "\" instead of \"PWD\"");
+  }});
+
+  // A line past the limit is dropped up to its end, and reported, rather
+  // than taken as a command; the commands after it are kept
+  tests.push_back({"framer/line-too-long", [] {
+    socket_pair sockets;
+    ftp::message_buffer buffer;
+    ftp::message_framer framer;
+    const std::string line(ftp::message_framer::max_line_size + 4096, 'a');
+    std::thread writer([&] {
+      ftp::send_message(&sockets.sender, "CWD " + line);
+      ftp::send_message(&sockets.sender, line + "\r\nPWD\r\n");
+    });
+    const auto dropped = framer.next(&sockets.receiver, buffer);
+    expect(dropped.empty() && framer.overflowed(),
+           "The long line was not reported");
+    const auto received = framer.next(&sockets.receiver, buffer);
+    writer.join();
+    expect(received == "PWD" && !framer.overflowed(),
+           "message_framer returned \"" + received.substr(0, 20) +
+               "\" instead of \"PWD\"");
+  }});
+
+  // Replies end with their line, or with the last line of several
+  tests.push_back({"replies/size", [] {
+    const std::vector<std::pair<std::string, size_t>> cases = {
+        {"", 0},
+        {"200 Directory chan", 0},
+        {"200 Directory changed to /\r\n213 3\r\n", 28},
+        {"451-Batch: 1 stored, 1 failed\r\n    failed a\r\n", 0},
+        {"451-Batch: 1 stored, 1 failed\r\n    failed a\r\n"
+         "451 End of batch\r\n200 OK\r\n",
+         63},
+    };
+    for (const auto &[received, size] : cases) {
+      expect(ftp::reply_size(received) == size,
+             "reply_size(\"" + received + "\") is " +
+                 std::to_string(ftp::reply_size(received)));
+    }
+  }});
+
+  // Leases take what is free rather than waiting for all they want, give
+  // up after the timeout, and idle buffers beyond the limit lose their pages
+  tests.push_back({"buffer-pool/leases", [] {
+    ftp::buffer_pool pool(4096, 4, 4, ftp::huge_page_mode::none, 1,
+                          std::chrono::milliseconds(50));
+    auto first = pool.lease(3);
+    auto second = pool.lease(3);
+    expect(first.size() == 3 && second.size() == 1,
+           "Leased " + std::to_string(first.size()) + " then " +
+               std::to_string(second.size()) + " buffers");
+    expect(!pool.lease(), "A lease of an exhausted pool did not time out");
+    std::thread returner([&first]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      first.pop_back();
+    });
+    expect(bool(pool.lease()), "A returned buffer was not leased");
+    returner.join();
+    first.clear();
+    second.clear();
+    expect(pool.resident() == 1,
+           std::to_string(pool.resident()) + " idle buffers kept");
+  }});
+
+  // A long message grows the buffer, the next short one shrinks it back
+  tests.push_back({"message-buffer/shrink", [] {
+    socket_pair sockets;
+    ftp::message_buffer buffer(16, 1024);
+    ftp::send_message(&sockets.sender, std::string(100, 'a') + "\r\n");
+    ftp::receive_message(&sockets.receiver, buffer);
+    expect(buffer.size() > 16, "The buffer did not grow");
+    ftp::send_message(&sockets.sender, "NOOP\r\n");
+    ftp::receive_message(&sockets.receiver, buffer);
+    expect(buffer.size() == 16, "The buffer did not shrink");
+  }});
+
+  return tests;
+}
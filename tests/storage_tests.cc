@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include <sys/socket.h>
+
+#include "s3_stand_in.h"
+#include "test.h"
+#include "utils/session_fs.h"
+#include "utils/tar.h"
+#include "utils/vfs_local.h"
+#include "utils/vfs_object_store.h"
+
+namespace {
+
+// Names listed in a directory of a storage, sorted
+std::vector<std::string> listed(ftp::vfs &storage, const std::string &path) {
+  std::vector<std::string> names;
+  storage.list(path, false, [&](const ftp::vfs_entry &entry) {
+    names.push_back(entry.name);
+    return true;
+  });
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+// Store a file, false on failure
+bool store(ftp::vfs &storage, const std::string &path,
+           const std::string &data) {
+  auto upload = storage.open_write(path);
+  return upload != nullptr && upload->write(data.data(), data.size()) &&
+         upload->commit();
+}
+
+// Contents of a file, read in ranges of at most count bytes
+std::string load(ftp::vfs &storage, const std::string &path, size_t count) {
+  auto file = storage.open_read(path);
+  if (file == nullptr) {
+    return "";
+  }
+  std::string data(file->status().size, '\0');
+  for (size_t offset = 0; offset < data.size();) {
+    const ssize_t n = file->read(data.data() + offset,
+                                 std::min(count, data.size() - offset), offset);
+    if (n <= 0) {
+      return "";
+    }
+    offset += size_t(n);
+  }
+  return data;
+}
+
+// Bytes count to count + size of a file, as sent to a socket
+std::string sent(ftp::vfs &storage, const std::string &path, uint64_t offset,
+                 size_t count) {
+  int fds[2];
+  ftp::expect(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+              "socketpair() failed");
+  sockpp::tcp_socket sender(fds[0]);
+  sockpp::tcp_socket receiver(fds[1]);
+  auto file = storage.open_read(path);
+  const ssize_t n =
+      file == nullptr ? -1 : file->send(sender.handle(), offset, count);
+  if (n <= 0) {
+    return "";
+  }
+  std::string data(size_t(n), '\0');
+  receiver.read_n(data.data(), data.size());
+  return data;
+}
+
+} // namespace
+
+std::vector<ftp::test_case> ftp::storage_tests() {
+  std::vector<test_case> tests;
+
+  // Against a stand-in listing two keys a page: stores files (one of them
+  // in three parts), lists, reads and sends them, renames a file and a
+  // directory, and removes everything
+  tests.push_back({"object-store/round", [] {
+    ftp::s3_stand_in stand_in(2);
+    std::string error;
+    expect(stand_in.start(error), error);
+    auto settings = stand_in.settings();
+    settings.part_bytes = 4096;
+    ftp::object_store_vfs storage(settings);
+
+    const std::string small = "simple-ftp\n";
+    std::string large;
+    for (size_t i = 0; large.size() < 3 * settings.part_bytes - 100; ++i) {
+      large += std::to_string(i) + ",";
+    }
+    const std::vector<std::string> files = {"a.txt", "b.txt", "c.txt",
+                                            "d.txt", "large.csv"};
+    expect(storage.make_directory("/data"), "MKD /data failed");
+    expect(storage.make_directory("/data/sub"), "MKD /data/sub failed");
+    for (const auto &name : files) {
+      expect(store(storage, "/data/" + name,
+                   name == "large.csv" ? large : small),
+             "STOR /data/" + name + " failed");
+    }
+    const std::vector<std::string> expected = {"a.txt", "b.txt",     "c.txt",
+                                               "d.txt", "large.csv", "sub"};
+    expect(listed(storage, "/data") == expected,
+           "LIST /data misses entries past the first page");
+
+    expect(load(storage, "/data/large.csv", 5000) == large,
+           "RETR /data/large.csv returned other contents");
+    expect(sent(storage, "/data/a.txt", 0, small.size()) == small,
+           "/data/a.txt was sent with other contents");
+    expect(sent(storage, "/data/large.csv", 5000, 3000) ==
+               large.substr(5000, 3000),
+           "A range of /data/large.csv was sent with other contents");
+
+    expect(storage.rename("/data/a.txt", "/data/sub/e.txt") &&
+               !storage.stat("/data/a.txt").exists &&
+               load(storage, "/data/sub/e.txt", 4096) == small,
+           "RNFR /data/a.txt, RNTO /data/sub/e.txt failed");
+    expect(storage.rename("/data", "/moved") &&
+               !storage.stat("/data").exists &&
+               listed(storage, "/moved/sub") ==
+                   std::vector<std::string>{"e.txt"},
+           "RNFR /data, RNTO /moved failed");
+
+    expect(!storage.remove_directory("/moved/sub"),
+           "RMD /moved/sub removed a directory that is not empty");
+    expect(storage.remove("/moved/sub/e.txt") &&
+               storage.remove_directory("/moved/sub"),
+           "Removing /moved/sub failed");
+    for (const auto &name : files) {
+      if (name != "a.txt") {
+        expect(storage.remove("/moved/" + name),
+               "DELE /moved/" + name + " failed");
+      }
+    }
+    expect(storage.remove_directory("/moved") && stand_in.keys().empty(),
+           "Objects are left in the bucket");
+  }});
+
+  // A store ignoring Range headers sends the whole object: reads and sends
+  // of a range must still get the bytes of that range
+  tests.push_back({"object-store/range-ignored", [] {
+    ftp::s3_stand_in stand_in;
+    std::string error;
+    expect(stand_in.start(error), error);
+    ftp::object_store_vfs storage(stand_in.settings());
+    std::string data;
+    for (size_t i = 0; data.size() < 100000; ++i) {
+      data += std::to_string(i) + ",";
+    }
+    expect(store(storage, "/data.csv", data), "STOR /data.csv failed");
+    stand_in.ignore_ranges(true);
+
+    expect(load(storage, "/data.csv", 7000) == data,
+           "RETR /data.csv returned other contents");
+    for (const uint64_t offset : {uint64_t(0), uint64_t(1), uint64_t(70000)}) {
+      expect(sent(storage, "/data.csv", offset, 20000) ==
+                 data.substr(offset, 20000),
+             "The range at " + std::to_string(offset) +
+                 " of /data.csv was sent with other contents");
+    }
+  }});
+
+  // Symbolic links in a local root: those leading out of it must neither be
+  // listed nor opened, those beneath it are listed as their targets
+  tests.push_back({"local/links", [] {
+    namespace fs = std::filesystem;
+    const auto base =
+        fs::temp_directory_path() / ("ftp-links-" + std::to_string(getpid()));
+    fs::remove_all(base);
+    fs::create_directories(base / "root" / "dir");
+    std::ofstream(base / "secret.txt") << "secret";
+    std::ofstream(base / "root" / "dir" / "file.txt") << "contents";
+    fs::create_symlink(base / "secret.txt", base / "root" / "out.txt");
+    fs::create_symlink(base, base / "root" / "out");
+    fs::create_symlink("dir/file.txt", base / "root" / "in.txt");
+
+    {
+      ftp::local_vfs storage(base / "root");
+      expect(storage.is_open(), "The root could not be opened");
+      std::vector<std::string> names;
+      storage.list("/", false, [&](const ftp::vfs_entry &entry) {
+        names.push_back(entry.name);
+        expect(entry.name != "in.txt" ||
+                   (entry.is_link && entry.status.size == 8),
+               "in.txt is not listed as a link to dir/file.txt");
+        return true;
+      });
+      std::sort(names.begin(), names.end());
+      expect(names == std::vector<std::string>{"dir", "in.txt"},
+             "Links out of the root are listed");
+      expect(storage.open_read("/out.txt") == nullptr &&
+                 !storage.stat("/out/secret.txt").exists,
+             "Links out of the root are followed");
+      expect(load(storage, "/in.txt", 4096) == "contents",
+             "RETR /in.txt returned other contents");
+    }
+    fs::remove_all(base);
+  }});
+
+  // A session's working directory is held open: it follows the directory
+  // when another session renames it, and is gone once it is removed
+  tests.push_back({"local/working-directory", [] {
+    namespace fs = std::filesystem;
+    const auto base =
+        fs::temp_directory_path() / ("ftp-cwd-" + std::to_string(getpid()));
+    fs::remove_all(base);
+    fs::create_directories(base / "a" / "b");
+    {
+      ftp::local_vfs storage(base);
+      ftp::session_fs session(storage);
+      expect(session.change_directory("a/b") && session.pwd() == "/a/b",
+             "CWD a/b failed");
+      expect(!session.change_directory("/missing") && session.pwd() == "/a/b",
+             "CWD /missing changed the working directory");
+      expect(storage.rename("/a", "/z"), "RNTO /z failed");
+      expect(session.pwd() == "/z/b" &&
+                 session.resolve("f.txt") == "/z/b/f.txt",
+             "The working directory did not follow RNTO: " + session.pwd());
+      expect(session.cwd_exists(), "The renamed directory is missing");
+      expect(storage.remove_directory("/z/b") && !session.cwd_exists(),
+             "The removed working directory still exists");
+    }
+    fs::remove_all(base);
+  }});
+
+  // Extracting an archive writes neither through a link already in the
+  // destination nor out of it, and goes on past a lone zero block
+  tests.push_back({"tar/extract", [] {
+    namespace fs = std::filesystem;
+    const auto base =
+        fs::temp_directory_path() / ("ftp-tar-" + std::to_string(getpid()));
+    fs::remove_all(base);
+    fs::create_directories(base / "root");
+    std::ofstream(base / "secret.txt") << "secret";
+    fs::create_symlink(base / "secret.txt", base / "root" / "a.txt");
+    fs::create_symlink(base, base / "root" / "out");
+
+    std::string archive;
+    for (const std::string name : {"a.txt", "out/b.txt", "dir/c.txt"}) {
+      archive += ftp::tar_header(name, ftp::tar_type_file, 4, 0644, 0);
+      archive += "data";
+      archive.append(ftp::tar_padding(4), '\0');
+      if (name == "a.txt") {
+        archive.append(ftp::tar_block_size, '\0');
+      }
+    }
+    archive += ftp::tar_end_of_archive();
+    {
+      ftp::tar_extractor extractor(base / "root");
+      expect(extractor.feed(archive.data(), archive.size() - 1) &&
+                 !extractor.finished(),
+             "The archive ended early");
+      expect(extractor.feed(archive.data() + archive.size() - 1, 1) &&
+                 extractor.finished(),
+             "The archive did not end");
+      expect(extractor.files() == 2, std::to_string(extractor.files()) +
+                                         " files extracted instead of 2");
+    }
+    std::ifstream secret(base / "secret.txt");
+    std::string contents;
+    secret >> contents;
+    expect(contents == "secret", "A link in the destination was followed");
+    expect(!fs::is_symlink(base / "root" / "a.txt") &&
+               fs::file_size(base / "root" / "a.txt") == 4 &&
+               fs::exists(base / "root" / "dir" / "c.txt") &&
+               !fs::exists(base / "b.txt"),
+           "Wrong files extracted");
+    fs::remove_all(base);
+  }});
+
+  return tests;
+}
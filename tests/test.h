@@ -0,0 +1,33 @@
+#pragma once
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ftp {
+
+// A test, whose body throws std::runtime_error (see expect()) when the code
+// under test is broken
+struct test_case {
+  std::string name;
+  std::function<void()> body;
+};
+
+// Throw what unless condition holds
+inline void expect(bool condition, const std::string &what) {
+  if (!condition) {
+    throw std::runtime_error(what);
+  }
+}
+
+// File cache: keys and zerocopy sends
+std::vector<test_case> cache_tests();
+// Message I/O: control messages framed from reads split anywhere, and
+// where replies end
+std::vector<test_case> io_tests();
+// Storage backends: the object storage against an S3 stand-in, symbolic
+// links and working directories of the local storage
+std::vector<test_case> storage_tests();
+
+} // namespace ftp
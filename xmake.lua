@@ -7,6 +7,26 @@ add_requires("argparse")
 add_requires("indicators")
 add_requires("jsoncpp")
 
+-- Record trace spans of the server (xmake f --tracing=y), see utils/trace.h
+option("tracing")
+  set_default(false)
+  set_showmenu(true)
+  set_description("Enable FTP_TRACE_SCOPE trace spans")
+  add_defines("FTP_ENABLE_TRACING")
+option_end()
+
+-- Client and server code for programs embedding them (libsimpleftp.a), see
+-- proto/async_client.h for the non-blocking client
+target("simpleftp")
+  set_kind("static")
+  add_includedirs("include", {public = true})
+  add_files("lib/*.cc")
+  add_files("lib/*/*.cc")
+  add_packages("sockpp", {public = true})
+  add_packages("indicators")
+  add_packages("jsoncpp", {public = true})
+  add_options("tracing")
+
 target("simple-ftp-server")
   set_kind("binary")
   add_includedirs("include")
@@ -17,6 +37,7 @@ target("simple-ftp-server")
   add_packages("argparse")
   add_packages("indicators")
   add_packages("jsoncpp")
+  add_options("tracing")
   add_defines("FTP_SERVER")
   
 target("simple-ftp-client")
@@ -29,4 +50,59 @@ target("simple-ftp-client")
   add_packages("argparse")
   add_packages("indicators")
   add_packages("jsoncpp")
+  add_options("tracing")
   add_defines("FTP_CLIENT")
+
+-- Load generator and regression suite, see bench/load_generator.h and
+-- bench/regression.h
+target("simple-ftp-bench")
+  set_kind("binary")
+  add_includedirs("include")
+  add_includedirs("bench")
+  add_files("lib/*.cc")
+  add_files("lib/*/*.cc")
+  add_files("bench/load_generator.cc")
+  add_files("bench/regression.cc")
+  add_files("bench/s3_stand_in.cc")
+  add_files("src/bench_main.cc")
+  add_packages("sockpp")
+  add_packages("argparse")
+  add_packages("indicators")
+  add_packages("jsoncpp")
+  add_options("tracing")
+
+-- Microbenchmarks of the parser, string utilities and message I/O, see
+-- bench/microbench.h
+target("simple-ftp-microbench")
+  set_kind("binary")
+  add_includedirs("include")
+  add_includedirs("bench")
+  add_files("lib/*.cc")
+  add_files("lib/*/*.cc")
+  add_files("bench/microbench.cc")
+  add_files("bench/utility_microbenches.cc")
+  add_files("src/microbench_main.cc")
+  add_packages("sockpp")
+  add_packages("argparse")
+  add_packages("indicators")
+  add_packages("jsoncpp")
+  add_options("tracing")
+
+-- Tests of the library (xmake test), see tests/test.h; the object storage
+-- is tested against the S3 stand-in of the benchmark
+target("simple-ftp-test")
+  set_kind("binary")
+  add_includedirs("include")
+  add_includedirs("bench")
+  add_includedirs("tests")
+  add_files("lib/*.cc")
+  add_files("lib/*/*.cc")
+  add_files("bench/s3_stand_in.cc")
+  add_files("tests/*.cc")
+  add_files("src/test_main.cc")
+  add_packages("sockpp")
+  add_packages("argparse")
+  add_packages("indicators")
+  add_packages("jsoncpp")
+  add_options("tracing")
+  add_tests("default")